@@ -12,9 +12,189 @@
 #include <stdio.h>
 #include <windows.h>
 #include <iostream>
+#include <vector>
+#include <algorithm>
+#include <memory>
+
+#include "concrt_extras.h"
+#include "SampleUtilities.h"
 
 using namespace ::Concurrency;
 using namespace ::std;
+using namespace ::SampleUtilities;
+
+#pragma region Task spawn benchmark
+
+// Runs a heap allocated functor and deletes it, as schedule_task did for every functor before 
+// small functors were stored in task slots.
+
+template<class Func>
+void __cdecl HeapTaskProc(void* data)
+{
+    Func* pFunc = static_cast<Func*>(data);
+    (*pFunc)();
+    delete pFunc;
+}
+
+// Spawns empty tasks into a schedule group and waits until the last one has run.
+
+// The counter and event are shared with the tasks, as wait can return while the last task is still inside set,
+// and the event must outlive that call.
+
+struct SpawnState
+{
+    volatile long remaining;
+    event done;
+
+    explicit SpawnState(long count) : remaining(count) {}
+};
+
+void SpawnEmptyTasks(int taskCount, bool useTaskSlots)
+{
+    shared_ptr<SpawnState> pState = make_shared<SpawnState>(taskCount);
+    samples::schedule_group group;
+
+    auto task = [pState]()
+    {
+        if (InterlockedDecrement(&pState->remaining) == 0)
+            pState->done.set();
+    };
+
+    for (int i = 0; i < taskCount; ++i)
+    {
+        if (useTaskSlots)
+            group.schedule_task(task);
+        else
+            group.native_handle->ScheduleTask(HeapTaskProc<decltype(task)>, new decltype(task)(task));
+    }
+    pState->done.wait();
+}
+
+#pragma endregion
+
+#pragma region Interference benchmark
+
+// Keeps the processor busy for the given number of microseconds.
+
+void SpinFor(double microseconds)
+{
+    LARGE_INTEGER begin, now, freq;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&begin);
+    do
+    {
+        QueryPerformanceCounter(&now);
+    }
+    while ((now.QuadPart - begin.QuadPart) * 1000000.0 / freq.QuadPart < microseconds);
+}
+
+// A batch workload that keeps a fixed number of long tasks queued on a scheduler until stopped.
+
+struct BatchLoad
+{
+    samples::task_scheduler& scheduler;
+    volatile long stop;
+    volatile long running;
+    event drained;
+
+    BatchLoad(samples::task_scheduler& s) : scheduler(s), stop(0), running(0) {}
+
+private:
+    BatchLoad const & operator=(BatchLoad const&);
+};
+
+void RunBatchTask(BatchLoad* load)
+{
+    SpinFor(1000);
+    if (load->stop == 0)
+        samples::schedule_task(load->scheduler.native_handle, [load]() { RunBatchTask(load); });
+    else if (InterlockedDecrement(&load->running) == 0)
+        load->drained.set();
+}
+
+// Sends short requests to the latency scheduler one at a time, optionally while the batch scheduler is 
+// saturated, and prints the mean and 99th percentile response time.
+
+void MeasureLatency(samples::task_scheduler& latencyScheduler, samples::task_scheduler& batchScheduler, 
+                    bool withBatchLoad, const char* label)
+{
+    const int requestCount = 2000;
+    const long batchTaskCount = 4 * GetProcessorCount();
+
+    BatchLoad load(batchScheduler);
+    if (withBatchLoad)
+    {
+        load.running = batchTaskCount;
+        for (long i = 0; i < batchTaskCount; ++i)
+            samples::schedule_task(batchScheduler.native_handle, [&load]() { RunBatchTask(&load); });
+    }
+
+    vector<double> latencies;
+    latencies.reserve(requestCount);
+    for (int i = 0; i < requestCount; ++i)
+    {
+        event done;
+        latencies.push_back(TimedRun([&latencyScheduler, &done]()
+        {
+            samples::schedule_task(latencyScheduler.native_handle, [&done]()
+            {
+                SpinFor(50);
+                done.set();
+            });
+            done.wait();
+        }));
+    }
+
+    if (withBatchLoad)
+    {
+        load.stop = 1;
+        load.drained.wait();
+    }
+
+    sort(latencies.begin(), latencies.end());
+    double total = 0.0;
+    for_each(latencies.begin(), latencies.end(), [&total](double latency) { total += latency; });
+    printf("  %-32s: mean %8.1f us, 99th percentile %8.1f us\n", label, 
+        1e6 * total / requestCount, 1e6 * latencies[requestCount * 99 / 100]);
+}
+
+// Compares a latency sensitive workload sharing one scheduler with a batch workload against the same 
+// workloads on two isolated schedulers, one core for the latency work and the rest for batch work.
+
+void RunInterferenceBenchmark()
+{
+    unsigned int processorCount = GetProcessorCount();
+    printf("\nLatency of 50 us requests with a concurrent batch workload\n");
+    if (processorCount < 2)
+    {
+        printf("  Requires at least two processors.\n");
+        return;
+    }
+
+    {
+        samples::task_scheduler shared;
+        MeasureLatency(shared, shared, false, "Idle");
+        MeasureLatency(shared, shared, true, "Shared scheduler");
+    }
+
+    samples::scheduler_policy latencyPolicy;
+    latencyPolicy.SetConcurrencyLimits(1, 1);
+    samples::scheduler_policy batchPolicy;
+    batchPolicy.SetConcurrencyLimits(processorCount - 1, processorCount - 1);
+#if defined(SAMPLES_PORTABLE_RUNTIME)
+    // The portable scheduler can also pin each pool to its own processors.
+    vector<unsigned int> batchProcessors;
+    for (unsigned int i = 1; i < processorCount; ++i)
+        batchProcessors.push_back(i);
+    latencyPolicy.SetProcessorAffinity(vector<unsigned int>(1, 0));
+    batchPolicy.SetProcessorAffinity(batchProcessors);
+#endif
+    samples::task_scheduler latencyScheduler(latencyPolicy);
+    samples::task_scheduler batchScheduler(batchPolicy);
+    MeasureLatency(latencyScheduler, batchScheduler, true, "Isolated schedulers");
+}
+
+#pragma endregion
 
 int main()
 {
@@ -43,6 +223,33 @@ int main()
     myScheduler->Release();
     WaitForSingleObject(schedulerShutdownEvent, INFINITE);
 
+    const int taskCount = 1000000;
+    printf("\nSpawning %d empty tasks\n", taskCount);
+
+#if defined(SAMPLES_TASK_SLOTS)
+    // Warm up the scheduler and the task slot caches
+    SpawnEmptyTasks(taskCount / 10, false);
+    SpawnEmptyTasks(taskCount / 10, true);
+
+    double heapTime = TimedRun([taskCount]() { SpawnEmptyTasks(taskCount, false); });
+    double slotTime = TimedRun([taskCount]() { SpawnEmptyTasks(taskCount, true); });
+    printf("  Heap allocated functors : %10.0f tasks/s\n", taskCount / heapTime);
+    printf("  Task slot functors      : %10.0f tasks/s (%.2fx)\n", taskCount / slotTime, heapTime / slotTime);
+#else
+    // This compiler has no task slots, so schedule_task heap allocates every functor.
+    SpawnEmptyTasks(taskCount / 10, false);
+
+    double heapTime = TimedRun([taskCount]() { SpawnEmptyTasks(taskCount, false); });
+    printf("  Heap allocated functors : %10.0f tasks/s\n", taskCount / heapTime);
+    printf("  Task slot functors      : n/a (needs Visual C++ 2015 or later)\n");
+#endif
+#if defined(SAMPLES_PORTABLE_RUNTIME)
+    // Define SAMPLES_NO_SCHEDULER_STATISTICS to measure the cost of the counters.
+    printf("  Scheduler statistics    : %s\n", samples::current_scheduler_statistics().to_json().c_str());
+#endif
+
+    RunInterferenceBenchmark();
+
     printf("\nRun complete... press enter to finish.");
     getchar();
 }
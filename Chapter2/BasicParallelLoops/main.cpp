@@ -16,6 +16,7 @@
 #include <math.h>
 #include <vector>
 #include <algorithm>
+#include <ppl_extras.h>
 
 #include "SampleUtilities.h"
 
@@ -111,8 +112,7 @@ void Example04(size_t size, int workLoad)
 {
     // Create input values
     vector<size_t> inputs(size);
-    for (size_t i = 0; i < size; ++i) 
-        inputs[i] = i;
+    samples::parallel_iota(inputs.begin(), inputs.end(), static_cast<size_t>(0));
 
     parallel_for_each(inputs.cbegin(), inputs.cend(), [workLoad](size_t i){
         DoWork(i, workLoad);
@@ -128,7 +128,7 @@ void Example05(vector<double>& results, int workLoad)
 {
     task_group tg;
     size_t fillTo = results.size() - 5 ;
-    fill(results.begin(), results.end(), -1.0);
+    samples::parallel_fill(results.begin(), results.end(), -1.0);
 
     task_group_status status = tg.run_and_wait([&]{
         parallel_for(0u, results.size(), [&](size_t i){
@@ -11,12 +11,17 @@
 
 #include <unordered_map>
 #include <algorithm>
+#include <random>
+#include <ppl.h>
 
+#include "random_extras.h"
 #include "account.h"
 
 namespace CreditReview
 {
     using namespace ::std;
+    using namespace ::Concurrency;
+    using namespace ::Concurrency::samples;
 
     typedef int Customer;
 
@@ -53,13 +58,18 @@ namespace CreditReview
         AccountRepository(const AccountRepository&);
     };
 
-    // Assign every account with monthly balances that fit randomly assigned trend
+    // Assign every account with monthly balances that fit randomly assigned trend.
+    // Each account draws from its own stream of the counter-based engine, selected by customer number, so 
+    // accounts can be generated in parallel and still get the same balances whatever the number of threads.
 
-    template<typename Trend, typename Random>
-    inline void AssignRandomTrends(AccountRepository& accounts,  const Trend& goodBalance,  const Trend& badBalance, double variation, Random& random)
+    template<typename Trend>
+    inline void AssignRandomTrends(AccountRepository& accounts,  const Trend& goodBalance,  const Trend& badBalance, double variation, const philox4x32& engine)
     {
-        for_each(accounts.begin(), accounts.end(), [&random, goodBalance, badBalance, variation](AccountRepository::value_type& record)
+        parallel_for_each(accounts.begin(), accounts.end(), [&engine, goodBalance, badBalance, variation](AccountRepository::value_type& record)
         {
+            philox4x32 accountEngine = engine.substream(record.first);
+            uniform_real_distribution<double> distribution(0.0, 1.0);
+            auto random = [&accountEngine, &distribution]() { return distribution(accountEngine); };
             AssignRandomTrend(record.second, goodBalance, badBalance, variation, random);
         });
     }
@@ -14,11 +14,13 @@
 #include <ppl.h>
 
 #include "SampleUtilities.h"
+#include "random_extras.h"
 #include "Account.h"
 #include "AccountRepository.h"
 #include "Trend.h"
 
 using namespace ::Concurrency;
+using namespace ::Concurrency::samples;
 using namespace ::std;
 
 using namespace ::SampleUtilities;
@@ -59,10 +61,7 @@ int main(int argc, char* argv[])
     printf("For most accurate timing results, use Release build.\n\n");
 #endif
 
-    default_random_engine engine;
-    engine.seed(42);
-    uniform_real_distribution<double> distribution(0.0, 1.0);
-    auto random = std::bind(distribution, engine);
+    philox4x32 engine(42);
 
     // Defaults for data generation, may override some on command line
     int months = 36;
@@ -89,14 +88,14 @@ int main(int argc, char* argv[])
 
     AccountRepository smallAccounts(fewCustomers, fewMonths, overdraft);
 
-    AssignRandomTrends(smallAccounts, goodBalance, badBalance, variation, random);
+    AssignRandomTrends(smallAccounts, goodBalance, badBalance, variation, engine);
 
     UpdatePredictionsSequential(smallAccounts);
     UpdatePredictionsParallel(smallAccounts);
 
     // Create accounts for timing tests
     AccountRepository accounts(customerCount, months, overdraft);
-    AssignRandomTrends(accounts, goodBalance, badBalance, variation, random);
+    AssignRandomTrends(accounts, goodBalance, badBalance, variation, engine);
 
     // Print summary of accounts  
     printf("\n%d customers, %d months in each account\n\n", customerCount, months);
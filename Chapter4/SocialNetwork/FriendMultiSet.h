@@ -2,15 +2,17 @@
 
 #include <set>
 #include <hash_map>
+#include <memory_extras.h>
 
 using namespace ::std;
 
 typedef int                                                     SubscriberID;
 typedef int                                                     FriendID;
 
-// A set of unique friendIDs.
+// A set of unique friendIDs. The sets are built and merged by many threads at once, so their 
+// nodes come from the thread-caching suballocator.
 
-typedef set<FriendID>                                           FriendsSet;
+typedef set<FriendID, less<FriendID>, Concurrency::samples::suballocator<FriendID>> FriendsSet;
 typedef pair<SubscriberID, FriendID>                            FriendsSetPair;
 
 typedef shared_ptr<FriendsSet>                                  FriendsSetPtr;
@@ -44,7 +46,10 @@ class FriendMultiSet;
 typedef shared_ptr<FriendMultiSet>                              FriendMultiSetPtr;
 typedef pair<FriendID, int>                                     FriendMultiSetPair;
 
-class FriendMultiSet : public hash_map<FriendID, int>
+typedef stdext::hash_compare<FriendID, less<FriendID>>          FriendHashCompare;
+typedef Concurrency::samples::suballocator<pair<const FriendID, int>> FriendMultiSetAllocator;
+
+class FriendMultiSet : public hash_map<FriendID, int, FriendHashCompare, FriendMultiSetAllocator>
 {
 public:
     FriendMultiSet() {}
@@ -9,8 +9,14 @@
 
 #include <random>
 #include <algorithm>
+#include <vector>
 #include <ppl.h>
 #include <ppl_extras.h>
+#include <random_extras.h>
+#include <memory_extras.h>
+#if defined(USE_TBB_MALLOC)
+#include <tbb/scalable_allocator.h>
+#endif
 
 #include "SampleUtilities.h"
 #include "FriendMultiSet.h"
@@ -41,36 +47,57 @@ void Print(const SubscriberMap& subscribers, int maxFriends)
     printf("\n");
 }
 
+// Friends are assigned in parallel. Each subscriber draws its friends from its own stream of a 
+// counter-based random engine so the network is the same for a given seed whatever the number of 
+// threads. Friend sets are updated under a small array of striped locks; as sets are unordered the 
+// order in which friends arrive does not change the result.
+
 bool AssignRandomFriends(SubscriberMap& m_subscribers, int maxSubscribers, int maxFriends, unsigned long seed)
 {
-    for (SubscriberID i = 0; i < maxSubscribers; i++)
-        m_subscribers.insert(SubscriberMapPair(i, make_shared<FriendsSet>()));
+    static const int lockCount = 256;
 
-    default_random_engine engine;
-    engine.seed(seed);
-    uniform_int_distribution<int> distribution_subscribers(0, maxSubscribers - 1);
-    uniform_int_distribution<int> distribution_maxfriends(0, maxFriends);
-    auto random_subscriber = bind(distribution_subscribers, engine);
-    auto random_maxfriends = bind(distribution_maxfriends, engine);
+    vector<FriendsSetPtr> friendSets(maxSubscribers);
+    try
+    {
+        for (SubscriberID i = 0; i < maxSubscribers; i++)
+        {
+            friendSets[i] = make_shared<FriendsSet>();
+            m_subscribers.insert(SubscriberMapPair(i, friendSets[i]));
+        }
+    }
+    catch (bad_alloc e)
+    {
+        return false;
+    }
 
-    SubscriberMap::iterator itr;
+    philox4x32 engine(seed);
+    critical_section locks[lockCount];
 
     try
     {
-        for(itr = m_subscribers.begin(); itr != m_subscribers.end(); ++itr)
+        parallel_for(0, maxSubscribers, [&](SubscriberID id)
         {
-            auto nFriends = random_maxfriends();
+            philox4x32 subscriberEngine = engine.substream(id);
+            uniform_int_distribution<int> distribution_subscribers(0, maxSubscribers - 1);
+            uniform_int_distribution<int> distribution_maxfriends(0, maxFriends);
+
+            auto nFriends = distribution_maxfriends(subscriberEngine);
             for (int i = 0; i < nFriends; ++i)
             {
-                int friendID = random_subscriber();
-                if (friendID == itr->first)                                             // Self is never in friends
+                int friendID = distribution_subscribers(subscriberEngine);
+                if (friendID == id)                                                     // Self is never in friends
                     continue;
 
-                itr->second->insert(friendID);                                          // Add new friend, set ensures no duplicates
-                SubscriberMap::iterator myFriend = m_subscribers.find(friendID);        // Add this subscriber to new friend's friends
-                myFriend->second->insert(itr->first); 
+                {
+                    critical_section::scoped_lock lock(locks[id % lockCount]);          // Add new friend, set ensures no duplicates
+                    friendSets[id]->insert(friendID);
+                }
+                {
+                    critical_section::scoped_lock lock(locks[friendID % lockCount]);    // Add this subscriber to new friend's friends
+                    friendSets[friendID]->insert(id);
+                }
             }
-        }
+        });
     }
     catch (bad_alloc e)
     {
@@ -205,6 +232,33 @@ FriendOrderedMultiSet PotentialFriendsParallel(const SubscriberMap& subscribers,
     return candidates.MostNumerous(maxCandidates);
 }
 
+// Allocator benchmark: builds one friend set per subscriber in parallel, then frees them in parallel. Sets are 
+// usually freed on a different thread from the one that allocated them.
+
+template<typename Allocator>
+void AllocateFriendSets(int subscriberCount, int maxFriends)
+{
+    typedef set<FriendID, less<FriendID>, Allocator> Set;
+
+    vector<Set> sets(subscriberCount);
+    philox4x32 engine(42);
+
+    parallel_for(0, subscriberCount, [&](int id)
+    {
+        philox4x32 subscriberEngine = engine.substream(id);
+        uniform_int_distribution<int> distribution_subscribers(0, subscriberCount - 1);
+        uniform_int_distribution<int> distribution_maxfriends(0, maxFriends);
+
+        for (int n = distribution_maxfriends(subscriberEngine); n > 0; --n)
+            sets[id].insert(distribution_subscribers(subscriberEngine));
+    });
+
+    parallel_for(0, subscriberCount, [&sets](int id)
+    {
+        Set().swap(sets[id]);
+    });
+}
+
 /// Usage: CreditReview n m, optional. n is number of customers, use 25,000+ for meaningful timings, m is the number of friends.
 
 int main(int argc, char* argv[])
@@ -280,6 +334,19 @@ int main(int argc, char* argv[])
     Print(potentialFriends);
     printf("\n");
 
+    // Allocators
+    printf("Allocator comparison, building and freeing %d friend sets\n", subscriberCount);
+    TimedRun([subscriberCount, maxFriends]() { AllocateFriendSets<allocator<FriendID>>(subscriberCount, maxFriends); }, 
+        "  std::allocator");
+    TimedRun([subscriberCount, maxFriends]() { AllocateFriendSets<suballocator<FriendID>>(subscriberCount, maxFriends); }, 
+        "  suballocator");
+#if defined(USE_TBB_MALLOC)
+    TimedRun([subscriberCount, maxFriends]() { AllocateFriendSets<tbb::scalable_allocator<FriendID>>(subscriberCount, maxFriends); }, 
+        "  tbb::scalable_allocator");
+#else
+    printf("  (define USE_TBB_MALLOC to compare with tbb::scalable_allocator)\n");
+#endif
+
     printf("\nRun complete... press enter to finish.");
     getchar();
 }
@@ -21,7 +21,8 @@
 ADashDlg::ADashDlg(CWnd* pParent /*=nullptr*/) : 
     CDialogEx(ADashDlg::IDD, pParent),
     m_engineState(),
-    m_isParallelWorkflow(false)
+    m_isParallelWorkflow(false),
+    m_compensateForIO(true)
 {
     m_hIcon = AfxGetApp()->LoadIcon(IDR_MAINFRAME);
 }
@@ -51,9 +52,11 @@ void ADashDlg::DoDataExchange(CDataExchange* pDX)
     // Application control buttons:
 
     GetDlgItem(IDC_CHECK_PARALLEL)->EnableWindow(!m_engineState.GetIsRunning());
+    GetDlgItem(IDC_CHECK_COMPENSATE)->EnableWindow(!m_engineState.GetIsRunning());
     GetDlgItem(IDC_BUTTON_CALCULATE)->EnableWindow(!m_engineState.GetIsRunning());
     GetDlgItem(IDC_BUTTON_CANCEL)->EnableWindow(m_engineState.GetIsRunning());
     DDX_Check(pDX, IDC_CHECK_PARALLEL, (int&)m_isParallelWorkflow);
+    DDX_Check(pDX, IDC_CHECK_COMPENSATE, (int&)m_compensateForIO);
     CDialogEx::DoDataExchange(pDX);
 }
 
@@ -116,18 +119,33 @@ void ADashDlg::OnBnClickedButtonCalculate()
     {
         m_backgroundWorker->run([this](){
             AnalysisEngine engine(m_backgroundWorker.get());
-            engine.DoAnalysisSequential(m_engineState);
+            double elapsed = TimedRun([this, &engine](){ engine.DoAnalysisSequential(m_engineState); });
+            ReportElapsedTime(elapsed);
         });
     }
     else
     {
-        m_backgroundWorker->run([this](){
-            AnalysisEngine engine(m_backgroundWorker.get());
-            engine.DoAnalysisParallel(m_engineState);
+        bool compensateForIO = m_compensateForIO;
+        m_backgroundWorker->run([this, compensateForIO](){
+            AnalysisEngine engine(m_backgroundWorker.get(), 1.0, compensateForIO);
+            double elapsed = TimedRun([this, &engine](){ engine.DoAnalysisParallel(m_engineState); });
+            ReportElapsedTime(elapsed);
         });
     }
 }
 
+// Appends the elapsed time to the recommendation, so that runs with and without
+// compensation for the blocking loads can be compared.
+
+void ADashDlg::ReportElapsedTime(double seconds)
+{
+    if (m_backgroundWorker->is_canceling())
+        return;
+    wostringstream oss;
+    oss << m_engineState.GetMarketRecommendation() << L" (" << fixed << setprecision(2) << seconds << L" s)";
+    m_engineState.SetMarketRecommendation(oss.str());
+}
+
 void ADashDlg::OnBnClickedCancel()
 {
     CancelAnalysis();
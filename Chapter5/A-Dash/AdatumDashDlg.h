@@ -28,6 +28,7 @@ public:
     ADashDlg(CWnd* pParent = nullptr);	
     enum { IDD = IDD_ADATUMDASH_DIALOG };
     bool m_isParallelWorkflow;
+    bool m_compensateForIO;
 
 private:
     virtual void DoDataExchange(CDataExchange* pDX);
@@ -59,4 +60,7 @@ public:
     afx_msg void OnBnClickedButtonCompareResult();
 
     void CancelAnalysis();
+
+private:
+    void ReportElapsedTime(double seconds);
 };
@@ -37,6 +37,10 @@ private:
 
     task_group* m_tasks;
 
+    // When false the I/O bound loads block their worker without oversubscribing,
+    // which shows how much the compensation for blocking contributes.
+    bool m_compensateForIO;
+
 #pragma region Create Sample Data
 
     StockDataCollection GenerateSecurities(const string& exchange, int size) const
@@ -161,9 +165,10 @@ private:
 
 public:
 
-    AnalysisEngine(task_group* tasks, double speed = 1.0)
+    AnalysisEngine(task_group* tasks, double speed = 1.0, bool compensateForIO = true)
         : m_speedFactor(speed),
-        m_tasks(tasks)
+        m_tasks(tasks),
+        m_compensateForIO(compensateForIO)
     {
     }
 
@@ -227,7 +232,7 @@ public:
         // Current market data tasks
 
         Future<StockDataCollection> future1([this, &engineState]()->StockDataCollection{ 
-            scoped_oversubcription_token oversubscribeForIO;
+            scoped_oversubcription_token oversubscribeForIO(m_compensateForIO);
             auto result = LoadNyseData();
             if (!m_tasks->is_canceling()) 
                 engineState.SetNyseCompleted();
@@ -235,7 +240,7 @@ public:
         });
 
         Future<StockDataCollection> future2([this, &engineState]()->StockDataCollection{ 
-            scoped_oversubcription_token oversubscribeForIO;
+            scoped_oversubcription_token oversubscribeForIO(m_compensateForIO);
             auto result = LoadNasdaqData();
             if (!m_tasks->is_canceling()) 
                 engineState.SetNasdaqCompleted();
@@ -278,7 +283,7 @@ public:
         // Historical data tasks
 
         Future<StockDataCollection> future7 = Future<StockDataCollection>([this, &engineState]()->StockDataCollection{ 
-            scoped_oversubcription_token oversubscribeForIO;
+            scoped_oversubcription_token oversubscribeForIO(m_compensateForIO);
             auto result = LoadFedHistoricalData();
             if (!m_tasks->is_canceling()) 
                 engineState.SetLoadFedHistoricalDataCompleted();
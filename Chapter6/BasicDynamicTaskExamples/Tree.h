@@ -10,6 +10,9 @@
 #pragma once
 
 #include <random>
+#include <ppl.h>
+
+#include "random_extras.h"
 
 using namespace ::std;
 
@@ -48,12 +51,7 @@ public:
 
     static Tree<int> MakeTree(int nodeCount, double density, unsigned long seed)
     {
-        default_random_engine engine;
-        engine.seed(seed);
-        uniform_int_distribution<double> distribution(0.0, 1.0);
-        auto random = bind(distribution, engine);
-
-        return Tree<int>(MakeTreeNode(nodeCount, density, 0, random));
+        return Tree<int>(MakeTreeNode(nodeCount, density, 0, ::Concurrency::samples::philox4x32(seed)));
     }
 
     template<typename Func>
@@ -69,21 +67,40 @@ public:
     }
 
 private:
-    template <typename Random>
+    static const int ParallelBuildThreshold = 1024;
 
-    static shared_ptr<TreeNode<int>> MakeTreeNode(int nodeCount, double density, int offset, Random& random)
+    // Each node draws from the engine stream selected by its offset, which is unique within the tree. 
+    // Subtrees can therefore be built in parallel and the tree's shape depends only on the seed.
+
+    static shared_ptr<TreeNode<int>> MakeTreeNode(int nodeCount, double density, int offset, 
+                                                  const ::Concurrency::samples::philox4x32& engine)
     {
-        bool addNodeLeft = random() > density;
-        bool addNodeRight = random() > density;
+        ::Concurrency::samples::philox4x32 nodeEngine = engine.substream(offset);
+        uniform_real_distribution<double> distribution(0.0, 1.0);
+
+        bool addNodeLeft = distribution(nodeEngine) > density;
+        bool addNodeRight = distribution(nodeEngine) > density;
         int newCount = nodeCount - 1;
         int countLeft = (addNodeLeft && addNodeRight) ? (newCount / 2) : addNodeLeft ? newCount : 0;
         int countRight = newCount - countLeft;
-        if (random() > 0.5)
+        if (distribution(nodeEngine) > 0.5)
             swap(countLeft, countRight);
 
-        return shared_ptr<TreeNode<int>>(new TreeNode<int>(offset,
-                         (countLeft > 0) ? MakeTreeNode(countLeft, density, offset + 1, random) : nullptr,
-                         (countRight > 0) ? MakeTreeNode(countRight, density, offset + 1 + countLeft, random) : nullptr));
+        shared_ptr<TreeNode<int>> left;
+        shared_ptr<TreeNode<int>> right;
+        auto makeLeft = [&] { if (countLeft > 0) left = MakeTreeNode(countLeft, density, offset + 1, engine); };
+        auto makeRight = [&] { if (countRight > 0) right = MakeTreeNode(countRight, density, offset + 1 + countLeft, engine); };
+
+        if (nodeCount > ParallelBuildThreshold)
+        {
+            ::Concurrency::parallel_invoke(makeLeft, makeRight);
+        }
+        else
+        {
+            makeLeft();
+            makeRight();
+        }
+        return shared_ptr<TreeNode<int>>(new TreeNode<int>(offset, left, right));
     }
 
     template<typename Func>
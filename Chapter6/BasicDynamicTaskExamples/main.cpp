@@ -14,10 +14,21 @@
 #include <ppl.h>
 #include <concrt.h>
 #include <concurrent_vector.h>
-#include <concurrent_queue.h>
 #include <assert.h>
 #include "Tree.h"
 #include "SampleUtilities.h"
+#include "concrt_extras.h"
+
+// The bounded work list and the queue benchmark need the C++11 thread library. Visual C++ 2010 
+// builds keep the unbounded concurrent_queue.
+#if defined(SAMPLES_STD_THREADS)
+#include <deque>
+#include <mutex>
+#include <thread>
+#include "queue_extras.h"
+#else
+#include <concurrent_queue.h>
+#endif
 
 using namespace ::std;
 using namespace ::Concurrency;
@@ -115,6 +126,28 @@ void Example03(const Tree<int>& tree)
 
 // Parallel while not empty 2
 
+#if defined(SAMPLES_STD_THREADS)
+
+// The work list is bounded. When it is full, the task that found the new item processes it 
+// immediately instead, so adding an item never blocks.
+
+const size_t WorkListCapacity = 1024;
+
+template<typename T, typename Func>
+void ParallelWhileNotEmpty2(vector<shared_ptr<TreeNode<T>>> initialValues, Func body)
+{
+    samples::bounded_queue<shared_ptr<TreeNode<T>>> items((initialValues.size() > WorkListCapacity) ? initialValues.size() : WorkListCapacity);
+    items.try_push_batch(initialValues.cbegin(), initialValues.cend());
+    const int maxTasks = 
+        CurrentScheduler::Get()->GetNumberOfVirtualProcessors();
+    int taskCount = 0;
+    function<void (shared_ptr<TreeNode<T>>)> addMethod;
+    addMethod = [&items, &body, &addMethod](shared_ptr<TreeNode<T>> n) 
+    { 
+        if (!items.try_push(n))
+            body(n, addMethod);
+    };
+#else
 template<typename T, typename Func>
 void ParallelWhileNotEmpty2(vector<shared_ptr<TreeNode<T>>> initialValues, Func body)
 {
@@ -123,6 +156,7 @@ void ParallelWhileNotEmpty2(vector<shared_ptr<TreeNode<T>>> initialValues, Func
         CurrentScheduler::Get()->GetNumberOfVirtualProcessors();
     int taskCount = 0;
     function<void (shared_ptr<TreeNode<T>>)> addMethod = [&items](shared_ptr<TreeNode<T>> n) { items.push(n); };
+#endif
 
     task_group tasks;
     while (true)
@@ -232,6 +266,115 @@ static void Example05(const Tree<int>& tree)
     printf("\n");
 }
 
+#if defined(SAMPLES_STD_THREADS)
+#pragma region Work list queue benchmark
+
+// A bounded queue protected by a mutex, for comparison with samples::bounded_queue.
+
+template<typename T>
+class MutexQueue
+{
+private:
+    mutex m_lock;
+    deque<T> m_items;
+    size_t m_capacity;
+
+public:
+    MutexQueue(size_t capacity) : m_capacity(capacity) {}
+
+    bool try_push(const T& item)
+    {
+        lock_guard<mutex> lock(m_lock);
+        if (m_items.size() == m_capacity)
+            return false;
+        m_items.push_back(item);
+        return true;
+    }
+
+    bool try_pop(T& item)
+    {
+        lock_guard<mutex> lock(m_lock);
+        if (m_items.empty())
+            return false;
+        item = m_items.front();
+        m_items.pop_front();
+        return true;
+    }
+};
+
+// Passes timestamps from producer threads to consumer threads through the queue and prints the 
+// throughput and the mean time an item spent in the queue. Threads yield when the queue is full or empty.
+
+template<typename Queue>
+void RunQueueBenchmark(int producers, int consumers, const char* label)
+{
+    const long long itemCount = 1000000;
+    const size_t capacity = 1024;
+    Queue queue(capacity);
+    volatile long long consumed = 0;
+    volatile long long totalLatency = 0;
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+
+    double elapsed = TimedRun([&]()
+    {
+        vector<thread> threads;
+        for (int p = 0; p < producers; ++p)
+        {
+            threads.push_back(thread([&, p]()
+            {
+                for (long long i = p; i < itemCount; i += producers)
+                {
+                    LARGE_INTEGER now;
+                    QueryPerformanceCounter(&now);
+                    while (!queue.try_push(now.QuadPart))
+                        this_thread::yield();
+                }
+            }));
+        }
+        for (int c = 0; c < consumers; ++c)
+        {
+            threads.push_back(thread([&]()
+            {
+                long long latency = 0;
+                long long timestamp;
+                while (consumed < itemCount)
+                {
+                    if (queue.try_pop(timestamp))
+                    {
+                        LARGE_INTEGER now;
+                        QueryPerformanceCounter(&now);
+                        latency += now.QuadPart - timestamp;
+                        InterlockedIncrement64(&consumed);
+                    }
+                    else
+                        this_thread::yield();
+                }
+                InterlockedExchangeAdd64(&totalLatency, latency);
+            }));
+        }
+        for_each(threads.begin(), threads.end(), [](thread& t) { t.join(); });
+    });
+
+    printf("    %-24s: %7.2f million items/s, mean latency %8.2f us\n", label, 
+        itemCount / elapsed / 1e6, 1e6 * totalLatency / freq.QuadPart / itemCount);
+}
+
+void RunQueueBenchmarks()
+{
+    printf("\nWork list queue, 1,000,000 items, capacity 1024\n");
+    const int processorCount = static_cast<int>(GetProcessorCount());
+    for (int n = 1; n <= processorCount; n = (n * 2 > processorCount && n != processorCount) ? processorCount : n * 2)
+    {
+        printf("  %d producer(s), %d consumer(s)\n", n, n);
+        RunQueueBenchmark<samples::bounded_queue<long long>>(n, n, "Lock-free bounded queue");
+        RunQueueBenchmark<MutexQueue<long long>>(n, n, "Mutex protected deque");
+    }
+}
+
+#pragma endregion
+#endif
+
 int main()
 {
     printf("Basic Dynamic Task Samples\n\n");
@@ -257,6 +400,10 @@ int main()
 
     TimedRun([&tree]() { Example05(tree); }, "Tree traversal, parallel task groups");
 
+#if defined(SAMPLES_STD_THREADS)
+    RunQueueBenchmarks();
+#endif
+
     printf("\nRun complete... press enter to finish.");
     getchar();
 }
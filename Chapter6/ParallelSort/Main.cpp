@@ -11,6 +11,7 @@
 #include <vector>
 #include <algorithm>
 #include <ppl.h>
+#include <ppl_extras.h>
 
 #include "Sort.h"
 #include "SampleUtilities.h"
@@ -22,13 +23,15 @@ using namespace ::ParallelSort;
 
 #pragma region Helper methods
 
+// Both the fill and the shuffle run in parallel. The shuffle uses a counter-based engine so the 
+// same seed always gives the same array, whatever the number of threads.
+
 vector<int> MakeArray(int length, unsigned long seed)
 {
     vector<int> a;
     a.resize(length);
-    int i = 1;
-    generate(a.begin(), a.end(), [&i] { return i++; } );
-    random_shuffle(a.begin(), a.end());
+    samples::parallel_iota(a.begin(), a.end(), 1);
+    samples::parallel_shuffle(a.begin(), a.end(), samples::philox4x32(seed));
     return a;
 }
 
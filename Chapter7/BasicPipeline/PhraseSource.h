@@ -12,6 +12,7 @@
 #include <string>
 #include <array>
 #include <random>
+#include <assert.h>
 
 #include "SampleUtilities.h"
 
@@ -33,13 +34,84 @@ namespace Pipeline
 
     const wstring g_finishedToken = L"FINISHED!";
 
+    // Every phrase is interned in g_phraseTable, which does not change once it is constructed, so the stages of a 
+    // pipeline can pass a PhraseToken, the index of a phrase in the table, in place of a copy of its text and can 
+    // compare phrases by comparing integers.
+
+    typedef unsigned char PhraseToken;
+
+    enum PhraseTokens
+    {
+        kTheToken,
+        kJumpedOverTheToken,
+        kPeriodToken,
+        kFoxToken,
+        kDogToken,
+        kQuickToken,
+        kBrownToken,
+        kLazyToken,
+        kAdjectiveToken,
+        kNounToken,
+        kFinishedToken,
+        kPhraseTokenCount
+    };
+
+    // Set on the token of the first phrase of a sentence once its first letter is to be written as a capital.
+    const PhraseToken kCapitalizedToken = 0x80;
+
+    const array<wstring, kPhraseTokenCount> g_phraseTable = 
+    { 
+        L"the", L"jumped over the", L".", L"fox", L"dog", L"quick", L"brown", L"lazy", L"<Adjective>", L"<Noun>", g_finishedToken 
+    };
+
+    inline const wstring& PhraseText(PhraseToken token) { return g_phraseTable[token & ~kCapitalizedToken]; }
+
+    // A sentence held as the tokens of its phrases. The tokens are stored in place, in a buffer sized for the 
+    // longest sentence the source creates, so sentences move from stage to stage without any allocation. 
+    // The text is only materialized by AppendText, when the sentence is written.
+
+    class PhraseSentence
+    {
+    public:
+        static const size_t kMaxPhrases = 8;
+
+    private:
+        array<PhraseToken, kMaxPhrases> m_tokens;
+        size_t m_count;
+
+    public:
+        PhraseSentence() : m_count(0) {}
+
+        void Add(PhraseToken token)
+        {
+            assert(m_count < kMaxPhrases);
+            m_tokens[m_count++] = token;
+        }
+
+        void Clear() { m_count = 0; }
+
+        void AppendText(wstring& text) const
+        {
+            for (size_t i = 0; i < m_count; ++i)
+            {
+                const PhraseToken token = m_tokens[i];
+                if (i > 0 && token != kPeriodToken)
+                    text.push_back(L' ');
+                const size_t start = text.size();
+                text.append(PhraseText(token));
+                if (0 != (token & kCapitalizedToken))
+                    text[start] = towupper(text[start]);
+            }
+        }
+    };
+
     class PhraseSource
     {
     private:
-        array<wstring, 8> m_phrases;
-        array<wstring, 8>::const_iterator m_phraseIt;
-        array<wstring, 2> m_nouns;
-        array<wstring, 3> m_adjectives;
+        array<PhraseToken, PhraseSentence::kMaxPhrases> m_phrases;
+        array<PhraseToken, PhraseSentence::kMaxPhrases>::const_iterator m_phraseIt;
+        array<PhraseToken, 2> m_nouns;
+        array<PhraseToken, 3> m_adjectives;
 
         int m_numberOfSentences;
         int m_sentence;
@@ -52,14 +124,14 @@ namespace Pipeline
             m_numberOfSentences(numberOfSentences),
             m_sentence(0)
         {
-            array<wstring, 8> phrases = { L"the", L"<Adjective>", L"<Adjective>", L"<Noun>", L"jumped over the", L"<Adjective>", L"<Noun>", L"." };
+            array<PhraseToken, PhraseSentence::kMaxPhrases> phrases = { kTheToken, kAdjectiveToken, kAdjectiveToken, kNounToken, kJumpedOverTheToken, kAdjectiveToken, kNounToken, kPeriodToken };
             m_phrases.swap(phrases);
             m_phraseIt = m_phrases.cbegin();
 
-            array<wstring, 2> nouns = { L"fox", L"dog" };
+            array<PhraseToken, 2> nouns = { kFoxToken, kDogToken };
             m_nouns.swap(nouns);
 
-            array<wstring, 3> adjectives = { L"quick", L"brown", L"lazy" };
+            array<PhraseToken, 3> adjectives = { kQuickToken, kBrownToken, kLazyToken };
             m_adjectives.swap(adjectives);
 
             m_randomEngine = default_random_engine(42);
@@ -68,23 +140,26 @@ namespace Pipeline
             m_distributionAdjectives = uniform_int_distribution<int>(0, m_adjectives.size() - 1);
         }
 
-        const wstring& Next()
+        // Returns the token of the next phrase, or kFinishedToken once all the sentences have been created.
+        PhraseToken NextToken()
         {
             if (m_sentence >= m_numberOfSentences)
-                return FinishedSentinel();
+                return kFinishedToken;
 
-            const wstring* pPhrase = &m_phraseIt[0];
-            if (*pPhrase == L"<Adjective>")
-                pPhrase = &m_adjectives[m_distributionAdjectives(m_randomEngine)];
-            if (*pPhrase == L"<Noun>")
-                pPhrase = &m_nouns[m_distributionNouns(m_randomEngine)];
+            PhraseToken token = *m_phraseIt;
+            if (token == kAdjectiveToken)
+                token = m_adjectives[m_distributionAdjectives(m_randomEngine)];
+            else if (token == kNounToken)
+                token = m_nouns[m_distributionNouns(m_randomEngine)];
             ++m_phraseIt;
             if (m_phraseIt == m_phrases.cend())
                 m_phraseIt = m_phrases.cbegin();
-            if (*pPhrase == L".")
+            if (token == kPeriodToken)
                 ++m_sentence;
-            return *pPhrase;
+            return token;
         }
+
+        const wstring& Next() { return PhraseText(NextToken()); }
         
         static const wstring& FinishedSentinel() { return g_finishedToken; }
     };
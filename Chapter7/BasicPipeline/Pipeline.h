@@ -26,17 +26,21 @@ namespace Pipeline
     using namespace ::Concurrency;
     using namespace ::PipelineUtilities;
 
+    // The first and last agents are templates on the governor, so that the pipeline can be throttled by either 
+    // PipelineGovernor or SemaphorePipelineGovernor.
+
+    template<typename Governor>
     class ReadStringsAgent : public agent
     {
     private:
         int m_seed;
         int m_numberOfSentences;
         int m_sentencePipelineLimit;
-        PipelineGovernor& m_governor;
+        Governor& m_governor;
         ITarget<wstring>& m_phraseOutput;
 
     public:
-        ReadStringsAgent(int seed, int numberOfSentences, PipelineGovernor& governor, ITarget<wstring>& phraseOutput) :
+        ReadStringsAgent(int seed, int numberOfSentences, Governor& governor, ITarget<wstring>& phraseOutput) :
             m_seed(seed),
             m_numberOfSentences(numberOfSentences),
             m_governor(governor), 
@@ -150,17 +154,18 @@ namespace Pipeline
         }
     };
 
+    template<typename Governor>
     class WriteSentencesAgent : public agent
     {
     private:
         wstring m_targetSentence;
-        PipelineGovernor& m_governor;
+        Governor& m_governor;
         ISource<wstring>& m_sentenceInput;
         wstring m_outputPath;
         int m_currentSentenceCount;
 
     public:
-        WriteSentencesAgent(wstring targetSentence, wstring outputPath, PipelineGovernor& governor, ISource<wstring>& sentenceInput) :
+        WriteSentencesAgent(wstring targetSentence, wstring outputPath, Governor& governor, ISource<wstring>& sentenceInput) :
             m_targetSentence(targetSentence),
             m_governor(governor),
             m_sentenceInput(sentenceInput),
@@ -11,12 +11,19 @@
 #include <random>
 #include <iostream>
 #include <fstream>
+#include <vector>
+#include <algorithm>
 
 #include "Pipeline.h"
 #include "PhraseSource.h"
+#if defined(SAMPLES_STD_THREADS)
+#include "pipeline_extras.h"
+#include "output_extras.h"
+#endif
 
 using namespace ::std;
 using namespace ::Pipeline;
+using namespace ::Concurrency::samples;
 
 const wstring g_targetSentence = L"The quick brown fox jumped over the lazy dog.";
 const wstring g_sequentialResults = L"Chapter7_sequential.txt";
@@ -24,6 +31,24 @@ const wstring g_pipelineResults = L"Chapter7_pipeline.txt";
 const wstring g_successFlag = L"Success!!!";
 const int g_sentenceMax = 200;
 const int g_sentencePipelineLimit = 10;
+const int g_governorBenchmarkSentences = 100000;
+const int g_phraseConnectionCapacity = 32;
+const int g_messageBenchmarkCount = 1000000;
+const int g_phraseRateSentences = 100000;
+const int g_tokenRateSentences = 2000000;
+const int g_outputRateSentences = 1000000;
+const wstring g_outputRateResults = L"Chapter7_output_rate.txt";
+
+#if defined(SAMPLES_STD_THREADS)
+// Writes a numbered sentence as one line of a results file.
+void WriteSentence(async_output_file& fout, int sentenceNumber, const wstring& sentence)
+{
+    fout.write(sentenceNumber);
+    fout.write(L' ');
+    fout.write(sentence);
+    fout.end_line();
+}
+#endif
 
 void SequentialExample(const int seed)
 {
@@ -72,17 +97,17 @@ void SequentialExample(const int seed)
     fout.close();
 }
 
-void ParallelPipelineExample(const int seed)
+template<typename Governor>
+void ParallelPipelineExample(const int seed, Governor& governor)
 {
     unbounded_buffer<wstring> buffer1;
     unbounded_buffer<wstring> buffer2;
     unbounded_buffer<wstring> buffer3;
-    PipelineGovernor governor(g_sentencePipelineLimit);
 
-    ReadStringsAgent agent1(seed, g_sentenceMax, governor, buffer1);
+    ReadStringsAgent<Governor> agent1(seed, g_sentenceMax, governor, buffer1);
     CorrectCaseAgent agent2(buffer1, buffer2);
     CreateSentencesAgent agent3(buffer2, buffer3);
-    WriteSentencesAgent agent4(g_targetSentence, g_pipelineResults, governor, buffer3);
+    WriteSentencesAgent<Governor> agent4(g_targetSentence, g_pipelineResults, governor, buffer3);
 
     agent1.start();
     agent2.start();
@@ -93,6 +118,399 @@ void ParallelPipelineExample(const int seed)
     agent::wait_for_all(4, agents);
 }
 
+#if defined(SAMPLES_STD_THREADS)
+// The same four stages as ParallelPipelineExample, written as typed stage functions. The stages are connected 
+// by bounded rings of g_phraseConnectionCapacity elements, which hold back the source in place of a governor, 
+// and the pipeline ends when the source runs dry rather than when a sentinel phrase reaches the last stage. 
+// Every stage records its service time, queue wait and queue length for each phrase into the telemetry.
+
+// Phrases pass from stage to stage as PhraseTokens rather than as strings, and the sentence stage adds them to 
+// a PhraseSentence, so no stage allocates. Only the last stage turns a sentence into text, in a string it reuses.
+
+void TypedPipelineExample(const int seed, pipeline_telemetry& telemetry)
+{
+    PhraseSource source(seed, g_sentenceMax);
+    async_output_file fout(g_pipelineResults);
+    int sentenceCount = 1;
+
+    // Each stage function is only called by one thread, so stages keep their state in mutable captures.
+    bool isFirstPhrase = true;
+    PhraseSentence sentence;
+    wstring text;
+
+    pipeline sentencePipeline = 
+        pipeline_source<PhraseToken>([&source](PhraseToken& phrase) -> bool
+        {
+            Stage1AdditionalWork();
+            phrase = source.NextToken();
+            return phrase != kFinishedToken;
+        }, g_phraseConnectionCapacity)
+        | pipeline_stage([isFirstPhrase](PhraseToken phrase) mutable -> PhraseToken
+        {
+            // Transform phrase by possibly capitalizing it
+            Stage2AdditionalWork();
+            if (phrase == kPeriodToken)
+            {
+                isFirstPhrase = true;
+                return phrase;
+            }
+            if (isFirstPhrase)
+            {
+                phrase |= kCapitalizedToken;
+                isFirstPhrase = false;
+            }
+            return phrase;
+        })
+        | pipeline_flat_stage<PhraseSentence>([sentence](PhraseToken phrase, pipeline_output<PhraseSentence>& sentenceOutput) mutable
+        {
+            // Create sentences from input phrases
+            sentence.Add(phrase);
+            if (phrase == kPeriodToken)
+            {
+                Stage3AdditionalWork();
+                sentenceOutput.push(sentence);
+                sentence.Clear();
+            }
+        })
+        | pipeline_sink([&fout, &sentenceCount, text](const PhraseSentence& sentence) mutable
+        {
+            Stage4AdditionalWork();
+            text.clear();
+            sentence.AppendText(text);
+            if (text == g_targetSentence)
+                text.append(L"       Success!");
+            WriteSentence(fout, sentenceCount++, text);
+            OutputProgress(sentenceCount);
+        });
+
+    sentencePipeline.set_telemetry(telemetry);
+    telemetry.start();
+    sentencePipeline.run();
+    fout.close();
+}
+
+void PrintTelemetry(const pipeline_telemetry& telemetry)
+{
+    pipeline_telemetry_snapshot snapshot = telemetry.snapshot();
+    printf("\n  %-16s %8s %5s  %27s  %27s  %11s\n", "Stage", "Count", "Util", "Service p50/p99/p99.9 (us)", "Wait p50/p99/p99.9 (us)", "Queue p50/99");
+    for (size_t i = 0; i < snapshot.stages.size(); ++i)
+    {
+        const pipeline_stage_statistics& stage = snapshot.stages[i];
+        printf("  %-16s %8.0f %4.0f%%  %8.1f %8.1f %9.1f  %8.1f %8.1f %9.1f  %5d %5d%s\n", stage.name.c_str(), static_cast<double>(stage.count), 
+            100.0 * stage.utilization, 1e-3 * stage.service_p50, 1e-3 * stage.service_p99, 1e-3 * stage.service_p999, 
+            1e-3 * stage.wait_p50, 1e-3 * stage.wait_p99, 1e-3 * stage.wait_p999, static_cast<int>(stage.depth_p50), static_cast<int>(stage.depth_p99),
+            (i == snapshot.bottleneck) ? "  <- bottleneck" : "");
+    }
+}
+
+void PrintGovernorDecisions(SemaphorePipelineGovernor& governor)
+{
+    vector<PipelineGovernorDecision> decisions = governor.GetDecisions();
+    printf("\n  Final capacity %d after %d changes\n", governor.GetCapacity(), static_cast<int>(decisions.size()));
+    for_each(decisions.begin(), decisions.end(), [](const PipelineGovernorDecision& d)
+    {
+        printf("    %7.3f s: %3d -> %3d sentences, %6.1f sentences/s, latency %6.1f ms\n", 
+            d.elapsedTime, d.previousCapacity, d.newCapacity, d.throughput, 1e3 * d.latency);
+    });
+}
+#endif
+
+// Measures the cost of throttling alone: the first stage takes a pipeline slot for each sentence 
+// and the last stage frees it, with no other work in between.
+
+template<typename Governor>
+void GovernorOverheadExample(int sentenceCount, const char* label)
+{
+    Governor governor(g_sentencePipelineLimit);
+    call<int> lastStage([&governor](int) { governor.FreePipelineSlot(); });
+
+    double elapsed = TimedRun([&governor, &lastStage, sentenceCount]()
+    {
+        for (int i = 0; i < sentenceCount; ++i)
+        {
+            governor.WaitForAvailablePipelineSlot();
+            asend(lastStage, i);
+        }
+        governor.WaitForEmptyPipeline();
+    });
+    printf("  %-26s: %6.2f us per sentence\n", label, 1e6 * elapsed / sentenceCount);
+}
+
+// Measures the cost of moving messages alone: the middle stages pass integers on without doing any work. 
+// The first version uses the message blocks of the agent pipeline, the second the rings of TypedPipelineExample.
+
+void AgentMessageOverheadExample(int messageCount)
+{
+    unbounded_buffer<int> source;
+    transformer<int, int> stage2([](int i) { return i; });
+    transformer<int, int> stage3([](int i) { return i; });
+    int received = 0;
+    event finished;
+    call<int> sink([&received, &finished, messageCount](int)
+    {
+        if (++received == messageCount)
+            finished.set();
+    });
+    source.link_target(&stage2);
+    stage2.link_target(&stage3);
+    stage3.link_target(&sink);
+
+    double elapsed = TimedRun([&source, &finished, messageCount]()
+    {
+        for (int i = 0; i < messageCount; ++i)
+            asend(source, i);
+        finished.wait();
+    });
+    printf("  %-26s: %6.3f us per message, %10.0f messages/s\n", "Message blocks", 1e6 * elapsed / messageCount, messageCount / elapsed);
+}
+
+#if defined(SAMPLES_STD_THREADS)
+void TypedMessageOverheadExample(int messageCount)
+{
+    int sent = 0;
+    int received = 0;
+    pipeline messagePipeline = 
+        pipeline_source<int>([&sent, messageCount](int& i) -> bool
+        {
+            i = sent++;
+            return i < messageCount;
+        }, g_phraseConnectionCapacity)
+        | pipeline_stage([](int i) { return i; })
+        | pipeline_stage([](int i) { return i; })
+        | pipeline_sink([&received](int) { ++received; });
+
+    double elapsed = TimedRun([&messagePipeline]() { messagePipeline.run(); });
+    printf("  %-26s: %6.3f us per message, %10.0f messages/s\n", "Typed pipeline rings", 1e6 * elapsed / messageCount, messageCount / elapsed);
+}
+
+// Measures the rate at which phrases pass through the stages of TypedPipelineExample when the stages do no 
+// additional work, so that the cost of handing phrases from stage to stage dominates. With a maximum batch 
+// size above one, each stage hands its phrases on in batches that grow while the next stage has a backlog. 
+// With fusion, the stages find that they are cheaper than the hand-over and run on the source's thread.
+
+void PhraseRateExample(const int seed, int sentenceCount, size_t maxBatch, bool fusion)
+{
+    PhraseSource source(seed, sentenceCount);
+    int phraseCount = 0;
+    bool isFirstPhrase = true;
+    wstring sentence;
+
+    pipeline ratePipeline = 
+        pipeline_source<wstring>([&source, &phraseCount](wstring& phrase) -> bool
+        {
+            phrase = source.Next();
+            if (phrase == PhraseSource::FinishedSentinel())
+                return false;
+            ++phraseCount;
+            return true;
+        }, g_phraseConnectionCapacity, maxBatch)
+        | pipeline_stage([isFirstPhrase](wstring phrase) mutable -> wstring
+        {
+            if (isFirstPhrase)
+            {
+                phrase[0] = towupper(phrase[0]);
+                isFirstPhrase = false;
+            }
+            if (phrase == L".")
+                isFirstPhrase = true;
+            return phrase;
+        })
+        | pipeline_flat_stage<wstring>([sentence](wstring phrase, pipeline_output<wstring>& sentenceOutput) mutable
+        {
+            if (!sentence.empty() && phrase != L".")
+                sentence.append(L" ");
+            sentence.append(phrase);
+            if (phrase == L".")
+            {
+                sentenceOutput.push(move(sentence));
+                sentence.clear();
+            }
+        })
+        | pipeline_sink([](wstring) {});
+
+    if (!fusion)
+        ratePipeline.set_fusion_threshold(0);
+    double elapsed = TimedRun([&ratePipeline]() { ratePipeline.run(); });
+    printf("  Batch %2d, fusion %-3s     : %6.3f us per phrase, %10.0f phrases/s, %d fusions\n", static_cast<int>(maxBatch), fusion ? "on" : "off", 
+        1e6 * elapsed / phraseCount, phraseCount / elapsed, static_cast<int>(ratePipeline.fusion_count()));
+}
+
+// The same phrase rate measured with the stages of TypedPipelineExample, which pass phrase tokens and sentences 
+// of tokens. Unlike PhraseRateExample, the last stage turns each sentence into text, as a writer would have to.
+
+void TokenPhraseRateExample(const int seed, int sentenceCount, size_t maxBatch, bool fusion)
+{
+    PhraseSource source(seed, sentenceCount);
+    int phraseCount = 0;
+    bool isFirstPhrase = true;
+    PhraseSentence sentence;
+    wstring text;
+
+    pipeline ratePipeline = 
+        pipeline_source<PhraseToken>([&source, &phraseCount](PhraseToken& phrase) -> bool
+        {
+            phrase = source.NextToken();
+            if (phrase == kFinishedToken)
+                return false;
+            ++phraseCount;
+            return true;
+        }, g_phraseConnectionCapacity, maxBatch)
+        | pipeline_stage([isFirstPhrase](PhraseToken phrase) mutable -> PhraseToken
+        {
+            if (phrase == kPeriodToken)
+            {
+                isFirstPhrase = true;
+                return phrase;
+            }
+            if (isFirstPhrase)
+            {
+                phrase |= kCapitalizedToken;
+                isFirstPhrase = false;
+            }
+            return phrase;
+        })
+        | pipeline_flat_stage<PhraseSentence>([sentence](PhraseToken phrase, pipeline_output<PhraseSentence>& sentenceOutput) mutable
+        {
+            sentence.Add(phrase);
+            if (phrase == kPeriodToken)
+            {
+                sentenceOutput.push(sentence);
+                sentence.Clear();
+            }
+        })
+        | pipeline_sink([text](const PhraseSentence& sentence) mutable
+        {
+            text.clear();
+            sentence.AppendText(text);
+        });
+
+    if (!fusion)
+        ratePipeline.set_fusion_threshold(0);
+    double elapsed = TimedRun([&ratePipeline]() { ratePipeline.run(); });
+    printf("  Tokens, batch %2d, fusion %-3s: %6.3f us per phrase, %10.0f phrases/s, %10.0f sentences/s\n", static_cast<int>(maxBatch), fusion ? "on" : "off", 
+        1e6 * elapsed / phraseCount, phraseCount / elapsed, sentenceCount / elapsed);
+}
+#endif
+
+// Measures the rate at which the sequential example and the typed pipeline write sentences when the stages do 
+// no additional work. The sentences are written once through a wofstream that is flushed at the end of every 
+// line, as the sequential and agent examples write them, and then through an async_output_file, with and without waiting 
+// for the storage device when the file is closed.
+
+class StreamSentenceWriter
+{
+private:
+    wofstream m_fout;
+
+public:
+    StreamSentenceWriter(const wstring& path) { m_fout.open(path); }
+
+    void Write(int sentenceNumber, const wstring& sentence) { m_fout << sentenceNumber << L" " << sentence.c_str() << endl; }
+
+    void Close() { m_fout.close(); }
+};
+
+#if defined(SAMPLES_STD_THREADS)
+class AsyncSentenceWriter
+{
+private:
+    async_output_file m_fout;
+    bool m_durable;
+
+public:
+    AsyncSentenceWriter(const wstring& path, bool durable) : m_fout(path), m_durable(durable) {}
+
+    void Write(int sentenceNumber, const wstring& sentence) { WriteSentence(m_fout, sentenceNumber, sentence); }
+
+    void Close() { m_fout.close(m_durable); }
+};
+#endif
+
+template<typename Writer>
+void SequentialOutputRateExample(const int seed, int sentenceCount, Writer& writer, const char* label)
+{
+    PhraseSource source(seed, sentenceCount);
+    double elapsed = TimedRun([&source, &writer]()
+    {
+        bool isFirstPhrase = true;
+        wstring sentence;
+        int sentenceNumber = 1;
+        wstring phrase;
+        while ((phrase = source.Next()) != PhraseSource::FinishedSentinel())
+        {
+            if (isFirstPhrase)
+                phrase[0] = towupper(phrase[0]);
+            if (!isFirstPhrase && (phrase != L"."))
+                sentence.append(L" ");
+            sentence.append(phrase);
+            isFirstPhrase = false;
+            if (phrase == L".")
+            {
+                writer.Write(sentenceNumber++, sentence);
+                sentence.clear();
+                isFirstPhrase = true;
+            }
+        }
+        writer.Close();
+    });
+    printf("  %-30s: %10.0f sentences/s\n", label, sentenceCount / elapsed);
+}
+
+#if defined(SAMPLES_STD_THREADS)
+template<typename Writer>
+void PipelineOutputRateExample(const int seed, int sentenceCount, Writer& writer, const char* label)
+{
+    PhraseSource source(seed, sentenceCount);
+    bool isFirstPhrase = true;
+    PhraseSentence sentence;
+    wstring text;
+    int sentenceNumber = 1;
+
+    pipeline outputPipeline = 
+        pipeline_source<PhraseToken>([&source](PhraseToken& phrase) -> bool
+        {
+            phrase = source.NextToken();
+            return phrase != kFinishedToken;
+        }, g_phraseConnectionCapacity, g_phraseConnectionCapacity / 2)
+        | pipeline_stage([isFirstPhrase](PhraseToken phrase) mutable -> PhraseToken
+        {
+            if (phrase == kPeriodToken)
+            {
+                isFirstPhrase = true;
+                return phrase;
+            }
+            if (isFirstPhrase)
+            {
+                phrase |= kCapitalizedToken;
+                isFirstPhrase = false;
+            }
+            return phrase;
+        })
+        | pipeline_flat_stage<PhraseSentence>([sentence](PhraseToken phrase, pipeline_output<PhraseSentence>& sentenceOutput) mutable
+        {
+            sentence.Add(phrase);
+            if (phrase == kPeriodToken)
+            {
+                sentenceOutput.push(sentence);
+                sentence.Clear();
+            }
+        })
+        | pipeline_sink([&writer, &sentenceNumber, text](const PhraseSentence& sentence) mutable
+        {
+            text.clear();
+            sentence.AppendText(text);
+            writer.Write(sentenceNumber++, text);
+        });
+
+    double elapsed = TimedRun([&outputPipeline, &writer]()
+    {
+        outputPipeline.run();
+        writer.Close();
+    });
+    printf("  %-30s: %10.0f sentences/s\n", label, sentenceCount / elapsed);
+}
+#endif
+
 void CompareFiles(const wstring& file1, const wstring& file2) 
 {
     wifstream fin1(file1);
@@ -127,9 +545,80 @@ int main()
 
     const int seed = 42;
     TimedRun([seed]() { SequentialExample(seed); }, "Write sentences, sequential");
-    TimedRun([seed]() { ParallelPipelineExample(seed); }, "Write sentences, pipeline  ");
+    PipelineGovernor governor(g_sentencePipelineLimit);
+    TimedRun([seed, &governor]() { ParallelPipelineExample(seed, governor); }, "Write sentences, pipeline  ");
     CompareFiles(g_sequentialResults, g_pipelineResults);
 
+#if defined(SAMPLES_STD_THREADS)
+    // Starts from the same capacity and lets the governor find the capacity with the best throughput.
+    SemaphorePipelineGovernor adaptiveGovernor(AdaptiveCapacitySettings(g_sentencePipelineLimit, 1, 10 * g_sentencePipelineLimit));
+    TimedRun([seed, &adaptiveGovernor]() { ParallelPipelineExample(seed, adaptiveGovernor); }, "Write sentences, adaptive pipeline");
+    CompareFiles(g_sequentialResults, g_pipelineResults);
+    PrintGovernorDecisions(adaptiveGovernor);
+
+    pipeline_telemetry telemetry(4);
+    telemetry.set_stage_name(0, "Read phrase");
+    telemetry.set_stage_name(1, "Correct case");
+    telemetry.set_stage_name(2, "Create sentences");
+    telemetry.set_stage_name(3, "Write sentences");
+    TimedRun([seed, &telemetry]() { TypedPipelineExample(seed, telemetry); }, "Write sentences, typed pipeline");
+    CompareFiles(g_sequentialResults, g_pipelineResults);
+    PrintTelemetry(telemetry);
+#endif
+
+    printf("\n\nPipeline message overhead, %d messages through four stages\n", g_messageBenchmarkCount);
+    AgentMessageOverheadExample(g_messageBenchmarkCount);
+#if defined(SAMPLES_STD_THREADS)
+    TypedMessageOverheadExample(g_messageBenchmarkCount);
+
+    printf("\n\nTyped pipeline phrase rate, %d sentences without additional work\n", g_phraseRateSentences);
+    PhraseRateExample(seed, g_phraseRateSentences, 1, false);
+    PhraseRateExample(seed, g_phraseRateSentences, 8, false);
+    PhraseRateExample(seed, g_phraseRateSentences, g_phraseConnectionCapacity / 2, false);
+    PhraseRateExample(seed, g_phraseRateSentences, 1, true);
+    PhraseRateExample(seed, g_phraseRateSentences, g_phraseConnectionCapacity / 2, true);
+
+    printf("\n\nPhrase strings against phrase tokens, %d sentences without additional work\n", g_tokenRateSentences);
+    PhraseRateExample(seed, g_tokenRateSentences, 1, false);
+    TokenPhraseRateExample(seed, g_tokenRateSentences, 1, false);
+    PhraseRateExample(seed, g_tokenRateSentences, g_phraseConnectionCapacity / 2, true);
+    TokenPhraseRateExample(seed, g_tokenRateSentences, g_phraseConnectionCapacity / 2, true);
+#endif
+
+    printf("\n\nSentence output rate, %d sentences without additional work\n", g_outputRateSentences);
+    {
+        StreamSentenceWriter writer(g_outputRateResults);
+        SequentialOutputRateExample(seed, g_outputRateSentences, writer, "Sequential, wofstream");
+    }
+#if defined(SAMPLES_STD_THREADS)
+    {
+        AsyncSentenceWriter writer(g_outputRateResults, false);
+        SequentialOutputRateExample(seed, g_outputRateSentences, writer, "Sequential, async file");
+    }
+    {
+        AsyncSentenceWriter writer(g_outputRateResults, true);
+        SequentialOutputRateExample(seed, g_outputRateSentences, writer, "Sequential, durable async file");
+    }
+    {
+        StreamSentenceWriter writer(g_outputRateResults);
+        PipelineOutputRateExample(seed, g_outputRateSentences, writer, "Pipeline, wofstream");
+    }
+    {
+        AsyncSentenceWriter writer(g_outputRateResults, false);
+        PipelineOutputRateExample(seed, g_outputRateSentences, writer, "Pipeline, async file");
+    }
+    {
+        AsyncSentenceWriter writer(g_outputRateResults, true);
+        PipelineOutputRateExample(seed, g_outputRateSentences, writer, "Pipeline, durable async file");
+    }
+#endif
+
+    printf("\n\nPipeline governor overhead, %d sentences\n", g_governorBenchmarkSentences);
+    GovernorOverheadExample<PipelineGovernor>(g_governorBenchmarkSentences, "Message based governor");
+#if defined(SAMPLES_STD_THREADS)
+    GovernorOverheadExample<SemaphorePipelineGovernor>(g_governorBenchmarkSentences, "Semaphore based governor");
+#endif
+
     printf("\nRun complete... press enter to finish.");
     getchar();
 }
@@ -0,0 +1,126 @@
+//===============================================================================
+// Microsoft patterns & practices
+// Parallel Programming Guide
+//===============================================================================
+// Copyright  Microsoft Corporation.  All rights reserved.
+// This code released under the terms of the
+// Microsoft patterns & practices license (http://parallelpatterns.codeplex.com/license).
+//===============================================================================
+
+#pragma once
+
+#include <memory>
+#include <queue>
+#include <vector>
+
+#include "sync_extras.h"
+#include "MessageBlock.h"
+#include "PipelineBase.h"
+
+// The BalancedPipeline is the DataflowPipeline with settings.filterCount filter blocks, like
+// ImageAgentPipelineBalanced. The scaler hands the images to the filterers in turn, where the sample lets
+// the filterers accept them at random, and a multiplexer block puts the filtered images back into sequence
+// order before they reach the displayer.
+
+namespace HeadlessImagePipeline
+{
+    using namespace ::std;
+    using namespace ::Concurrency::samples;
+
+    // Functor for ordering ImageFramePtr. Used by the multiplexer's priority queue.
+
+    struct CompareImageFramePtr
+    {
+        bool operator()(const ImageFramePtr& lhs, const ImageFramePtr& rhs) const
+        {
+            return (lhs->GetSequence() > rhs->GetSequence());
+        }
+    };
+
+    class BalancedPipeline : public PipelineBase
+    {
+    private:
+        counting_semaphore m_governor;
+        int m_multiplexSequence;
+        priority_queue<ImageFramePtr, vector<ImageFramePtr>, CompareImageFramePtr> m_multiplexQueue;
+        int m_nextFilter;
+        MessageBlock<ImageFramePtr> m_displayer;
+        MessageBlock<ImageFramePtr> m_multiplexer;
+        vector<unique_ptr<MessageBlock<ImageFramePtr>>> m_filterers;
+        unique_ptr<MessageBlock<ImageFramePtr>> m_scaler;
+
+    public:
+        BalancedPipeline(const ImageSource& source, const PipelineSettings& settings, IImageSink& sink, PipelinePerformance& performance) :
+            PipelineBase(source, settings, sink, performance),
+            m_governor(GetPipelineCapacity() * 3),
+            m_multiplexSequence(kFirstImage),
+            m_nextFilter(0),
+            m_displayer([this](ImageFramePtr pFrame)
+            {
+                this->DisplayImage(pFrame);
+                m_governor.release();
+            }),
+            m_multiplexer([this](ImageFramePtr pFrame)
+            {
+                m_multiplexQueue.push(pFrame);
+                while ((m_multiplexQueue.size() > 0) && (m_multiplexQueue.top()->GetSequence() == m_multiplexSequence))
+                {
+                    m_displayer.Send(m_multiplexQueue.top());
+                    m_multiplexQueue.pop();
+                    ++m_multiplexSequence;
+                }
+            })
+        {
+            for (int i = 0; i < m_settings.filterCount; ++i)
+            {
+                m_filterers.push_back(unique_ptr<MessageBlock<ImageFramePtr>>(new MessageBlock<ImageFramePtr>([this](ImageFramePtr pFrame)
+                {
+                    this->FilterImage(pFrame);
+                    m_multiplexer.Send(pFrame);
+                })));
+            }
+            m_scaler.reset(new MessageBlock<ImageFramePtr>([this](ImageFramePtr pFrame)
+            {
+                this->ScaleImage(pFrame);
+                m_filterers[m_nextFilter]->Send(pFrame);
+                m_nextFilter = (m_nextFilter + 1) % m_settings.filterCount;
+            }));
+        }
+
+        ~BalancedPipeline()
+        {
+            // The scaler sends to the filterers, so it has to go first.
+            m_scaler.reset();
+            m_filterers.clear();
+        }
+
+        int GetQueueSize(int queue) const
+        {
+            if (queue == kLoaderToScaler)
+                return m_scaler->GetQueueSize();
+            if (queue == kFiltererToDisplayer)
+                return m_multiplexer.GetQueueSize() + m_displayer.GetQueueSize();
+            int size = 0;
+            for (size_t i = 0; i < m_filterers.size(); ++i)
+                size += m_filterers[i]->GetQueueSize();
+            return size;
+        }
+
+        void Run()
+        {
+            for (int sequence = kFirstImage; sequence <= GetLastSequence() && !IsCancellationPending(); ++sequence)
+            {
+                ImageFramePtr pFrame = LoadImage(sequence);
+                if (nullptr == pFrame)
+                    break;
+                // Don't push more data into the pipeline if it is already full to capacity.
+                m_governor.acquire();
+                m_scaler->Send(pFrame);
+            }
+
+            // Wait for pipeline to empty before returning.
+            m_governor.acquire(GetPipelineCapacity() * 3);
+            m_governor.release(GetPipelineCapacity() * 3);
+        }
+    };
+};
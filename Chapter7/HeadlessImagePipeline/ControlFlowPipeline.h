@@ -0,0 +1,109 @@
+//===============================================================================
+// Microsoft patterns & practices
+// Parallel Programming Guide
+//===============================================================================
+// Copyright  Microsoft Corporation.  All rights reserved.
+// This code released under the terms of the
+// Microsoft patterns & practices license (http://parallelpatterns.codeplex.com/license).
+//===============================================================================
+
+#pragma once
+
+#include <thread>
+
+#include "queue_extras.h"
+#include "sync_extras.h"
+#include "PipelineBase.h"
+
+// The ControlFlowPipeline runs the scale, filter and display phases each on a thread of its own, which loops
+// taking images from a queue, like the control flow agents of ImageAgentPipelineControlFlow. The calling thread
+// loads the images.
+
+// The loader takes a slot of the m_governor semaphore for each image and the displayer frees it, so that at
+// most GetPipelineCapacity images are in flight, as with the PipelineGovernor of the ImagePipeline sample. The
+// queues therefore never fill up. Once the last image is loaded the loader sends a nullptr sentinel, which
+// each stage passes on before its thread exits.
+
+namespace HeadlessImagePipeline
+{
+    using namespace ::std;
+    using namespace ::Concurrency::samples;
+
+    class ControlFlowPipeline : public PipelineBase
+    {
+    private:
+        counting_semaphore m_governor;
+        bounded_queue<ImageFramePtr> m_scaleQueue;
+        bounded_queue<ImageFramePtr> m_filterQueue;
+        bounded_queue<ImageFramePtr> m_displayQueue;
+
+    public:
+        ControlFlowPipeline(const ImageSource& source, const PipelineSettings& settings, IImageSink& sink, PipelinePerformance& performance) :
+            PipelineBase(source, settings, sink, performance),
+            m_governor(GetPipelineCapacity()),
+            m_scaleQueue(GetPipelineCapacity() + 1),
+            m_filterQueue(GetPipelineCapacity() + 1),
+            m_displayQueue(GetPipelineCapacity() + 1)
+        {
+        }
+
+        int GetQueueSize(int queue) const
+        {
+            const bounded_queue<ImageFramePtr>* queues[] = { &m_scaleQueue, &m_filterQueue, &m_displayQueue };
+            return static_cast<int>(queues[queue]->unsafe_size());
+        }
+
+        void Run()
+        {
+            thread scaler([this]()
+            {
+                ImageFramePtr pFrame = nullptr;
+                do
+                {
+                    m_scaleQueue.pop(pFrame);
+                    this->ScaleImage(pFrame);
+                    m_filterQueue.push(pFrame);
+                }
+                while (nullptr != pFrame);
+            });
+            thread filterer([this]()
+            {
+                ImageFramePtr pFrame = nullptr;
+                do
+                {
+                    m_filterQueue.pop(pFrame);
+                    this->FilterImage(pFrame);
+                    m_displayQueue.push(pFrame);
+                }
+                while (nullptr != pFrame);
+            });
+            thread displayer([this]()
+            {
+                ImageFramePtr pFrame = nullptr;
+                do
+                {
+                    m_displayQueue.pop(pFrame);
+                    this->DisplayImage(pFrame);
+                    if (nullptr != pFrame)
+                        m_governor.release();
+                }
+                while (nullptr != pFrame);
+            });
+
+            for (int sequence = kFirstImage; sequence <= GetLastSequence() && !IsCancellationPending(); ++sequence)
+            {
+                ImageFramePtr pFrame = LoadImage(sequence);
+                if (nullptr == pFrame)
+                    break;
+                // Don't push more data into the pipeline if it is already full to capacity.
+                m_governor.acquire();
+                m_scaleQueue.push(pFrame);
+            }
+            m_scaleQueue.push(ImageFramePtr());
+
+            scaler.join();
+            filterer.join();
+            displayer.join();
+        }
+    };
+};
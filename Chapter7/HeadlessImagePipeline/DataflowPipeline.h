@@ -0,0 +1,81 @@
+//===============================================================================
+// Microsoft patterns & practices
+// Parallel Programming Guide
+//===============================================================================
+// Copyright  Microsoft Corporation.  All rights reserved.
+// This code released under the terms of the
+// Microsoft patterns & practices license (http://parallelpatterns.codeplex.com/license).
+//===============================================================================
+
+#pragma once
+
+#include "sync_extras.h"
+#include "MessageBlock.h"
+#include "PipelineBase.h"
+
+// The DataflowPipeline connects message blocks for the scale, filter and display phases, like the transformer
+// and call blocks of ImageAgentPipelineDataFlow. No thread is dedicated to a phase: each block processes its
+// messages on a task of the scheduler while it has any. The calling thread loads the images.
+
+// The loader takes a slot of the m_governor semaphore for each image and the displayer frees it. Once the last
+// image is loaded the loader waits until it holds all the slots, which means that the pipeline is empty.
+
+namespace HeadlessImagePipeline
+{
+    using namespace ::std;
+    using namespace ::Concurrency::samples;
+
+    class DataflowPipeline : public PipelineBase
+    {
+    private:
+        counting_semaphore m_governor;
+        MessageBlock<ImageFramePtr> m_displayer;
+        MessageBlock<ImageFramePtr> m_filterer;
+        MessageBlock<ImageFramePtr> m_scaler;
+
+    public:
+        DataflowPipeline(const ImageSource& source, const PipelineSettings& settings, IImageSink& sink, PipelinePerformance& performance) :
+            PipelineBase(source, settings, sink, performance),
+            m_governor(GetPipelineCapacity()),
+            m_displayer([this](ImageFramePtr pFrame)
+            {
+                this->DisplayImage(pFrame);
+                m_governor.release();
+            }),
+            m_filterer([this](ImageFramePtr pFrame)
+            {
+                this->FilterImage(pFrame);
+                m_displayer.Send(pFrame);
+            }),
+            m_scaler([this](ImageFramePtr pFrame)
+            {
+                this->ScaleImage(pFrame);
+                m_filterer.Send(pFrame);
+            })
+        {
+        }
+
+        int GetQueueSize(int queue) const
+        {
+            const MessageBlock<ImageFramePtr>* blocks[] = { &m_scaler, &m_filterer, &m_displayer };
+            return blocks[queue]->GetQueueSize();
+        }
+
+        void Run()
+        {
+            for (int sequence = kFirstImage; sequence <= GetLastSequence() && !IsCancellationPending(); ++sequence)
+            {
+                ImageFramePtr pFrame = LoadImage(sequence);
+                if (nullptr == pFrame)
+                    break;
+                // Don't push more data into the pipeline if it is already full to capacity.
+                m_governor.acquire();
+                m_scaler.Send(pFrame);
+            }
+
+            // Wait for pipeline to empty before returning.
+            m_governor.acquire(GetPipelineCapacity());
+            m_governor.release(GetPipelineCapacity());
+        }
+    };
+};
@@ -0,0 +1,117 @@
+//===============================================================================
+// Microsoft patterns & practices
+// Parallel Programming Guide
+//===============================================================================
+// Copyright  Microsoft Corporation.  All rights reserved.
+// This code released under the terms of the
+// Microsoft patterns & practices license (http://parallelpatterns.codeplex.com/license).
+//===============================================================================
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+
+#include "image_extras.h"
+
+namespace HeadlessImagePipeline
+{
+    using namespace ::std;
+    using namespace ::Concurrency::samples;
+
+    // An image with four bytes per pixel, in the blue, green, red, unused order of GDI+'s PixelFormat32bppRGB.
+    // Each row starts on a kAlignment byte boundary and is padded to a multiple of kAlignment bytes, so that
+    // vector code can process whole rows with aligned loads and stores and never reads into the next allocation.
+    // The pixels come from an image_buffer_pool, if one is given, and go back to it when the image is destroyed.
+
+    class ImageBuffer
+    {
+    private:
+        int m_width;
+        int m_height;
+        size_t m_stride;
+        shared_ptr<image_buffer_pool> m_pPool;
+        unsigned char* m_allocation;
+        size_t m_allocationSize;
+        unsigned char* m_pPixels;
+
+    public:
+        static const size_t kAlignment = 64;
+        static const int kBytesPerPixel = 4;
+
+        ImageBuffer(int width, int height, const shared_ptr<image_buffer_pool>& pPool = nullptr) :
+            m_width(width),
+            m_height(height),
+            m_stride(0),
+            m_pPool(pPool),
+            m_allocation(nullptr),
+            m_allocationSize(0),
+            m_pPixels(nullptr)
+        {
+            if (width <= 0 || height <= 0)
+                throw invalid_argument("ImageBuffer");
+            m_stride = (static_cast<size_t>(width) * kBytesPerPixel + kAlignment - 1) & ~(kAlignment - 1);
+            m_allocationSize = m_stride * height + kAlignment - 1;
+            m_allocation = (nullptr == m_pPool) ? new unsigned char[m_allocationSize] : m_pPool->allocate(m_allocationSize);
+            uintptr_t address = reinterpret_cast<uintptr_t>(m_allocation);
+            m_pPixels = reinterpret_cast<unsigned char*>((address + kAlignment - 1) & ~static_cast<uintptr_t>(kAlignment - 1));
+        }
+
+        ~ImageBuffer()
+        {
+            if (nullptr == m_pPool)
+                delete[] m_allocation;
+            else
+                m_pPool->deallocate(m_allocation, m_allocationSize);
+        }
+
+        int GetWidth() const { return m_width; }
+
+        int GetHeight() const { return m_height; }
+
+        // The distance in bytes from the start of one row to the start of the next.
+
+        size_t GetStride() const { return m_stride; }
+
+        size_t GetSize() const { return m_stride * m_height; }
+
+        // The pool the pixels came from, which images derived from this one can use too, or null.
+
+        const shared_ptr<image_buffer_pool>& GetPool() const { return m_pPool; }
+
+        unsigned char* GetRow(int y) { return m_pPixels + y * m_stride; }
+
+        const unsigned char* GetRow(int y) const { return m_pPixels + y * m_stride; }
+
+        // Sets the pixels of a rectangle, clipped to the image, to one color.
+
+        void FillRectangle(int left, int top, int width, int height, unsigned char red, unsigned char green, unsigned char blue)
+        {
+            int right = min(left + width, m_width);
+            int bottom = min(top + height, m_height);
+            left = max(left, 0);
+            top = max(top, 0);
+            for (int y = top; y < bottom; ++y)
+            {
+                unsigned char* pixel = GetRow(y) + left * kBytesPerPixel;
+                for (int x = left; x < right; ++x, pixel += kBytesPerPixel)
+                {
+                    pixel[0] = blue;
+                    pixel[1] = green;
+                    pixel[2] = red;
+                    pixel[3] = 0xFF;
+                }
+            }
+        }
+
+    private:
+        // Disable copy constructor and assignment.
+        ImageBuffer(const ImageBuffer&);
+        ImageBuffer const & operator=(ImageBuffer const&);
+    };
+
+    typedef unique_ptr<ImageBuffer> ImageBufferPtr;
+};
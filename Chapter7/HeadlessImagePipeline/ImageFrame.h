@@ -0,0 +1,105 @@
+//===============================================================================
+// Microsoft patterns & practices
+// Parallel Programming Guide
+//===============================================================================
+// Copyright  Microsoft Corporation.  All rights reserved.
+// This code released under the terms of the
+// Microsoft patterns & practices license (http://parallelpatterns.codeplex.com/license).
+//===============================================================================
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "telemetry_extras.h"
+#include "ImageBuffer.h"
+
+namespace HeadlessImagePipeline
+{
+    using namespace ::std;
+    using namespace ::Concurrency::samples;
+
+    enum Phases
+    {
+        kLoad = 0,
+        kScale,
+        kFilter,
+        kDisplay,
+        kPhaseCount
+    };
+
+    enum Queues
+    {
+        kLoaderToScaler = 0,
+        kScalerToFilterer,
+        kFiltererToDisplayer,
+        kQueueCount
+    };
+
+    enum Sequence
+    {
+        kFirstImage = 1
+    };
+
+    // The headless counterpart of ImagePipeline::ImageInfo: an image on its way through the pipeline, with the
+    // time each phase started and ended. Times are pipeline_telemetry::timestamp nanoseconds.
+
+    class ImageFrame
+    {
+    private:
+        int m_sequenceNumber;
+        string m_name;
+        ImageBufferPtr m_pImage;
+        unsigned long long m_startTimes[kPhaseCount];
+        unsigned long long m_endTimes[kPhaseCount];
+
+    public:
+        ImageFrame(int sequenceNumber, const string& name, ImageBufferPtr pImage) :
+            m_sequenceNumber(sequenceNumber),
+            m_name(name),
+            m_pImage(move(pImage))
+        {
+            for (int i = 0; i < kPhaseCount; ++i)
+                m_startTimes[i] = m_endTimes[i] = 0;
+        }
+
+        int GetSequence() const { return m_sequenceNumber; }
+
+        const string& GetName() const { return m_name; }
+
+        ImageBuffer& GetImage() { return *m_pImage; }
+
+        const ImageBuffer& GetImage() const { return *m_pImage; }
+
+        void SetImage(ImageBufferPtr pImage) { m_pImage = move(pImage); }
+
+        void PhaseStart(int phase) { m_startTimes[phase] = pipeline_telemetry::timestamp(); }
+
+        void PhaseEnd(int phase) { m_endTimes[phase] = pipeline_telemetry::timestamp(); }
+
+        // Special case for first phase which creates ImageFrame after starting.
+        void PhaseEnd(int phase, unsigned long long start)
+        {
+            m_startTimes[phase] = start;
+            PhaseEnd(phase);
+        }
+
+        unsigned long long GetPhaseDuration(int phase) const { return Elapsed(m_startTimes[phase], m_endTimes[phase]); }
+
+        // The time between the end of the phase before the queue and the start of the phase after it.
+        unsigned long long GetQueueDuration(int queue) const { return Elapsed(m_endTimes[queue], m_startTimes[queue + 1]); }
+
+        // The time from the start of the load to the end of the display.
+        unsigned long long GetLatency() const { return Elapsed(m_startTimes[kLoad], m_endTimes[kDisplay]); }
+
+    private:
+        static unsigned long long Elapsed(unsigned long long start, unsigned long long end) { return (end < start) ? 0 : end - start; }
+
+        // Disable copy constructor and assignment.
+        ImageFrame(const ImageFrame&);
+        ImageFrame const & operator=(ImageFrame const&);
+    };
+
+    typedef shared_ptr<ImageFrame> ImageFramePtr;
+};
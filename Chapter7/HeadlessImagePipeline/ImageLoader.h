@@ -0,0 +1,381 @@
+//===============================================================================
+// Microsoft patterns & practices
+// Parallel Programming Guide
+//===============================================================================
+// Copyright  Microsoft Corporation.  All rights reserved.
+// This code released under the terms of the
+// Microsoft patterns & practices license (http://parallelpatterns.codeplex.com/license).
+//===============================================================================
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ImageBuffer.h"
+#include "ImageSource.h"
+
+// The load phase of the ImagePipeline sample cycles through the same few JPEG files and reads and decodes each
+// of them again on every lap. An ImageLoader keeps the decoded images in an ImageCache, so that loading an
+// image it has seen before costs a copy of its pixels, and decodes the images the pipeline asks for next on
+// I/O threads of its own, so that the load phase finds them ready instead of waiting for the file system and
+// the decoder. Synthetic images are cached like files, with drawing in place of decoding.
+
+namespace HeadlessImagePipeline
+{
+    using namespace ::std;
+
+    // A least recently used cache of decoded images, bounded by the size of their pixels. Entries are keyed by
+    // path and carry the modification time of the file they were decoded from, so that an image whose file has
+    // been written since is decoded again. The cache is not thread safe; the ImageLoader guards it.
+
+    class ImageCache
+    {
+    private:
+        struct Entry
+        {
+            string path;
+            long long modificationTime;
+            shared_ptr<const ImageBuffer> pImage;
+        };
+
+        typedef list<Entry> EntryList;
+
+        const size_t m_capacity;
+        size_t m_size;
+        // The most recently used entry is at the front.
+        EntryList m_entries;
+        map<string, EntryList::iterator> m_index;
+
+    public:
+        explicit ImageCache(size_t capacity) : m_capacity(capacity), m_size(0) {}
+
+        size_t GetCapacity() const { return m_capacity; }
+
+        // The bytes of pixels the cache holds, and the number of images.
+
+        size_t GetSize() const { return m_size; }
+
+        size_t GetImageCount() const { return m_entries.size(); }
+
+        bool Contains(const string& path) const { return m_index.find(path) != m_index.end(); }
+
+        // Returns the image of the file and makes it the most recently used, or null if there is none for this
+        // modification time. The image of an older version of the file is removed.
+        shared_ptr<const ImageBuffer> Find(const string& path, long long modificationTime)
+        {
+            auto i = m_index.find(path);
+            if (i == m_index.end())
+                return nullptr;
+            if (i->second->modificationTime != modificationTime)
+            {
+                Remove(i);
+                return nullptr;
+            }
+            m_entries.splice(m_entries.begin(), m_entries, i->second);
+            return i->second->pImage;
+        }
+
+        // Adds the image as the most recently used, in place of any other version of the file, and removes the
+        // least recently used ones until the cache fits its capacity. An image larger than that is not added.
+        void Insert(const string& path, long long modificationTime, const shared_ptr<const ImageBuffer>& pImage)
+        {
+            auto i = m_index.find(path);
+            if (i != m_index.end())
+                Remove(i);
+            if (pImage->GetSize() > m_capacity)
+                return;
+
+            Entry entry = { path, modificationTime, pImage };
+            m_entries.push_front(entry);
+            m_index[path] = m_entries.begin();
+            m_size += pImage->GetSize();
+            while (m_size > m_capacity)
+                Remove(m_index.find(m_entries.back().path));
+        }
+
+    private:
+        void Remove(map<string, EntryList::iterator>::iterator i)
+        {
+            m_size -= i->second->pImage->GetSize();
+            m_entries.erase(i->second);
+            m_index.erase(i);
+        }
+
+        // Disable copy constructor and assignment.
+        ImageCache(const ImageCache&);
+        ImageCache const & operator=(ImageCache const&);
+    };
+
+    // Loads the images of a source through an ImageCache. Load returns a copy of the cached image with pixels
+    // from the pool, as the later phases of the pipeline work on the image they are given.
+
+    // Prefetch queues an image for the I/O threads, which skip those that are cached or being decoded already.
+    // The images they decode are kept apart from the cache until they are loaded, so that prefetching also
+    // works when the cache is too small for the images the pipeline cycles through, or has no capacity at all.
+    // A Load of an image an I/O thread is decoding waits for it rather than decoding it a second time. With
+    // neither a cache nor prefetching every load decodes, as in the sample.
+
+    // Whether a cached or prefetched image is current is checked by Load, which reads the modification time of
+    // the file, so an image whose file has changed is decoded again. All methods may be called from any thread.
+
+    class ImageLoader
+    {
+    private:
+        // Reading a file is mostly waiting for the disk, so a couple of threads keep ahead of one load phase.
+        static const int kPrefetchThreads = 2;
+
+        struct PrefetchedImage
+        {
+            long long modificationTime;
+            shared_ptr<const ImageBuffer> pImage;
+        };
+
+        const ImageSource& m_source;
+        const shared_ptr<image_buffer_pool> m_pPool;
+        mutable mutex m_lock;
+        condition_variable m_workAvailable;
+        condition_variable m_decoded;
+        ImageCache m_cache;
+        deque<size_t> m_prefetchQueue;
+        map<size_t, PrefetchedImage> m_prefetchedImages;
+        // The images a thread is reading and decoding.
+        set<size_t> m_decoding;
+        bool m_shutdown;
+        unsigned long long m_loadCount;
+        unsigned long long m_cacheHitCount;
+        unsigned long long m_prefetchHitCount;
+        unsigned long long m_waitCount;
+        unsigned long long m_prefetchCount;
+        vector<thread> m_threads;
+
+    public:
+        ImageLoader(const ImageSource& source, const shared_ptr<image_buffer_pool>& pPool, size_t cacheCapacity, bool prefetch) :
+            m_source(source),
+            m_pPool(pPool),
+            m_cache(cacheCapacity),
+            m_shutdown(false),
+            m_loadCount(0),
+            m_cacheHitCount(0),
+            m_prefetchHitCount(0),
+            m_waitCount(0),
+            m_prefetchCount(0)
+        {
+            if (prefetch)
+            {
+                for (int i = 0; i < kPrefetchThreads; ++i)
+                    m_threads.push_back(thread([this]() { PrefetchImages(); }));
+            }
+        }
+
+        ~ImageLoader()
+        {
+            {
+                lock_guard<mutex> lock(m_lock);
+                m_shutdown = true;
+                m_prefetchQueue.clear();
+            }
+            m_workAvailable.notify_all();
+            for (size_t i = 0; i < m_threads.size(); ++i)
+                m_threads[i].join();
+        }
+
+        const ImageSource& GetSource() const { return m_source; }
+
+        ImageBufferPtr Load(size_t index)
+        {
+            const string path = m_source.GetPath(index);
+            const long long modificationTime = m_source.GetModificationTime(index);
+            shared_ptr<const ImageBuffer> pImage;
+            {
+                unique_lock<mutex> lock(m_lock);
+                ++m_loadCount;
+                if (m_decoding.count(index) != 0)
+                {
+                    ++m_waitCount;
+                    while (m_decoding.count(index) != 0)
+                        m_decoded.wait(lock);
+                }
+
+                pImage = m_cache.Find(path, modificationTime);
+                if (nullptr != pImage)
+                    ++m_cacheHitCount;
+                else
+                {
+                    auto i = m_prefetchedImages.find(index);
+                    if (i != m_prefetchedImages.end())
+                    {
+                        if (i->second.modificationTime == modificationTime)
+                        {
+                            pImage = i->second.pImage;
+                            m_cache.Insert(path, modificationTime, pImage);
+                            ++m_prefetchHitCount;
+                        }
+                        m_prefetchedImages.erase(i);
+                    }
+                }
+                if (nullptr == pImage)
+                    m_decoding.insert(index);
+            }
+            if (nullptr != pImage)
+                return Copy(*pImage, m_pPool);
+
+            ImageBufferPtr pLoaded;
+            try
+            {
+                pLoaded = m_source.Load(index, m_pPool);
+            }
+            catch (...)
+            {
+                FinishDecoding(index);
+                throw;
+            }
+            if (pLoaded->GetSize() <= m_cache.GetCapacity())
+                FinishDecoding(index, path, modificationTime, shared_ptr<const ImageBuffer>(Copy(*pLoaded, nullptr)));
+            else
+                FinishDecoding(index);
+            return pLoaded;
+        }
+
+        void Prefetch(size_t index)
+        {
+            if (m_threads.empty())
+                return;
+            {
+                lock_guard<mutex> lock(m_lock);
+                if (IsLoadedOrQueued(index, m_source.GetPath(index)) ||
+                    find(m_prefetchQueue.begin(), m_prefetchQueue.end(), index) != m_prefetchQueue.end())
+                    return;
+                m_prefetchQueue.push_back(index);
+            }
+            m_workAvailable.notify_one();
+        }
+
+        // The loads so far, those that found their image in the cache and those that found it prefetched, and
+        // those that waited for an I/O thread to finish their image. Prefetches are the images the I/O threads
+        // decoded, whether the load phase used them or not.
+
+        unsigned long long GetLoadCount() const
+        {
+            lock_guard<mutex> lock(m_lock);
+            return m_loadCount;
+        }
+
+        unsigned long long GetCacheHitCount() const
+        {
+            lock_guard<mutex> lock(m_lock);
+            return m_cacheHitCount;
+        }
+
+        unsigned long long GetPrefetchHitCount() const
+        {
+            lock_guard<mutex> lock(m_lock);
+            return m_prefetchHitCount;
+        }
+
+        unsigned long long GetWaitCount() const
+        {
+            lock_guard<mutex> lock(m_lock);
+            return m_waitCount;
+        }
+
+        unsigned long long GetPrefetchCount() const
+        {
+            lock_guard<mutex> lock(m_lock);
+            return m_prefetchCount;
+        }
+
+        // The images the cache holds, and the bytes of their pixels.
+
+        size_t GetCachedImageCount() const
+        {
+            lock_guard<mutex> lock(m_lock);
+            return m_cache.GetImageCount();
+        }
+
+        size_t GetCachedBytes() const
+        {
+            lock_guard<mutex> lock(m_lock);
+            return m_cache.GetSize();
+        }
+
+    private:
+        static ImageBufferPtr Copy(const ImageBuffer& image, const shared_ptr<image_buffer_pool>& pPool)
+        {
+            ImageBufferPtr pCopy(new ImageBuffer(image.GetWidth(), image.GetHeight(), pPool));
+            memcpy(pCopy->GetRow(0), image.GetRow(0), image.GetSize());
+            return pCopy;
+        }
+
+        // Call with m_lock held.
+        bool IsLoadedOrQueued(size_t index, const string& path) const
+        {
+            return m_decoding.count(index) != 0 || m_prefetchedImages.count(index) != 0 || m_cache.Contains(path);
+        }
+
+        void FinishDecoding(size_t index, const string& path = string(), long long modificationTime = 0,
+            const shared_ptr<const ImageBuffer>& pImage = nullptr)
+        {
+            {
+                lock_guard<mutex> lock(m_lock);
+                if (nullptr != pImage)
+                    m_cache.Insert(path, modificationTime, pImage);
+                m_decoding.erase(index);
+            }
+            m_decoded.notify_all();
+        }
+
+        void PrefetchImages()
+        {
+            unique_lock<mutex> lock(m_lock);
+            for (;;)
+            {
+                while (!m_shutdown && m_prefetchQueue.empty())
+                    m_workAvailable.wait(lock);
+                if (m_shutdown)
+                    return;
+                const size_t index = m_prefetchQueue.front();
+                m_prefetchQueue.pop_front();
+                if (IsLoadedOrQueued(index, m_source.GetPath(index)))
+                    continue;
+                m_decoding.insert(index);
+                lock.unlock();
+
+                PrefetchedImage image;
+                image.modificationTime = m_source.GetModificationTime(index);
+                try
+                {
+                    image.pImage = shared_ptr<const ImageBuffer>(m_source.Load(index));
+                }
+                catch (exception&)
+                {
+                    // The load phase reads the file again and reports the error.
+                }
+
+                lock.lock();
+                if (nullptr != image.pImage)
+                {
+                    m_prefetchedImages[index] = image;
+                    ++m_prefetchCount;
+                }
+                m_decoding.erase(index);
+                m_decoded.notify_all();
+            }
+        }
+
+        // Disable copy constructor and assignment.
+        ImageLoader(const ImageLoader&);
+        ImageLoader const & operator=(ImageLoader const&);
+    };
+};
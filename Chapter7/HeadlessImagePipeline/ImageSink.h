@@ -0,0 +1,64 @@
+//===============================================================================
+// Microsoft patterns & practices
+// Parallel Programming Guide
+//===============================================================================
+// Copyright  Microsoft Corporation.  All rights reserved.
+// This code released under the terms of the
+// Microsoft patterns & practices license (http://parallelpatterns.codeplex.com/license).
+//===============================================================================
+
+#pragma once
+
+#include <cstdio>
+#include <string>
+
+#include "ImageFrame.h"
+#include "ImageSource.h"
+
+namespace HeadlessImagePipeline
+{
+    using namespace ::std;
+
+    // Where the display phase puts the finished images, in place of the dialog of the ImagePipeline sample.
+    // Display is only called from one thread at a time, in the order of the image sequence numbers.
+
+    class IImageSink
+    {
+    public:
+        virtual ~IImageSink() {}
+
+        virtual void Display(const ImageFrame& frame) = 0;
+    };
+
+    // Drops the images, so that the throughput of the pipeline is that of the load, scale and filter phases.
+
+    class DropImageSink : public IImageSink
+    {
+    public:
+        void Display(const ImageFrame& /*frame*/)
+        {
+        }
+    };
+
+    // Writes each image to a PPM file, named after its sequence number, in a directory that must exist.
+
+    class FileImageSink : public IImageSink
+    {
+    private:
+        string m_directory;
+
+    public:
+        explicit FileImageSink(const string& directory) : m_directory(directory)
+        {
+            if (!m_directory.empty() && m_directory[m_directory.size() - 1] != '/' && m_directory[m_directory.size() - 1] != '\\')
+                m_directory.push_back('/');
+        }
+
+        void Display(const ImageFrame& frame)
+        {
+            char name[32];
+            sprintf(name, "image%05d.ppm", frame.GetSequence());
+            WritePixmap(m_directory + name, frame.GetImage());
+        }
+    };
+};
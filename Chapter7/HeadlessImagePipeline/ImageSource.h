@@ -0,0 +1,232 @@
+//===============================================================================
+// Microsoft patterns & practices
+// Parallel Programming Guide
+//===============================================================================
+// Copyright  Microsoft Corporation.  All rights reserved.
+// This code released under the terms of the
+// Microsoft patterns & practices license (http://parallelpatterns.codeplex.com/license).
+//===============================================================================
+
+#pragma once
+
+#include <cctype>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+#include "ImageBuffer.h"
+
+namespace HeadlessImagePipeline
+{
+    using namespace ::std;
+
+    // Binary portable pixmaps (PPM, "P6" with a maximum value of 255) take the place of the JPEG files and GDI+
+    // decoder of the ImagePipeline sample, as they can be read and written without a library on any platform.
+    // Errors throw a runtime_error whose message is the path of the file.
+
+    namespace details
+    {
+        // Reads the next number of a PPM header, skipping white space and comments.
+        inline bool ReadHeaderNumber(FILE* file, int& value)
+        {
+            int c = fgetc(file);
+            while (c != EOF && (isspace(c) || c == '#'))
+            {
+                if (c == '#')
+                {
+                    while (c != EOF && c != '\n')
+                        c = fgetc(file);
+                }
+                c = fgetc(file);
+            }
+            if (c == EOF || !isdigit(c))
+                return false;
+            value = 0;
+            while (c != EOF && isdigit(c))
+            {
+                if (value > 100000)
+                    return false;
+                value = value * 10 + (c - '0');
+                c = fgetc(file);
+            }
+            // The single white space character after the maximum value ends the header.
+            return c != EOF && isspace(c);
+        }
+
+        class FileCloser
+        {
+        private:
+            FILE* m_file;
+
+        public:
+            explicit FileCloser(FILE* file) : m_file(file) {}
+
+            ~FileCloser()
+            {
+                if (nullptr != m_file)
+                    fclose(m_file);
+            }
+
+            // Closes the file and returns false if any buffered data could not be written.
+            bool Close()
+            {
+                FILE* file = m_file;
+                m_file = nullptr;
+                return fclose(file) == 0;
+            }
+        };
+    };
+
+    inline ImageBufferPtr ReadPixmap(const string& path, const shared_ptr<image_buffer_pool>& pPool = nullptr)
+    {
+        FILE* file = fopen(path.c_str(), "rb");
+        if (nullptr == file)
+            throw runtime_error(path);
+        details::FileCloser closer(file);
+
+        int width = 0;
+        int height = 0;
+        int maximum = 0;
+        if (fgetc(file) != 'P' || fgetc(file) != '6' || !details::ReadHeaderNumber(file, width) ||
+            !details::ReadHeaderNumber(file, height) || !details::ReadHeaderNumber(file, maximum) ||
+            width == 0 || height == 0 || maximum != 255)
+            throw runtime_error(path);
+
+        ImageBufferPtr pImage(new ImageBuffer(width, height, pPool));
+        vector<unsigned char> row(width * 3);
+        for (int y = 0; y < height; ++y)
+        {
+            if (fread(&row[0], 1, row.size(), file) != row.size())
+                throw runtime_error(path);
+            const unsigned char* rgb = &row[0];
+            unsigned char* pixel = pImage->GetRow(y);
+            for (int x = 0; x < width; ++x, rgb += 3, pixel += ImageBuffer::kBytesPerPixel)
+            {
+                pixel[0] = rgb[2];
+                pixel[1] = rgb[1];
+                pixel[2] = rgb[0];
+                pixel[3] = 0xFF;
+            }
+        }
+        return pImage;
+    }
+
+    inline void WritePixmap(const string& path, const ImageBuffer& image)
+    {
+        FILE* file = fopen(path.c_str(), "wb");
+        if (nullptr == file)
+            throw runtime_error(path);
+        details::FileCloser closer(file);
+
+        if (fprintf(file, "P6\n%d %d\n255\n", image.GetWidth(), image.GetHeight()) < 0)
+            throw runtime_error(path);
+        vector<unsigned char> row(image.GetWidth() * 3);
+        for (int y = 0; y < image.GetHeight(); ++y)
+        {
+            const unsigned char* pixel = image.GetRow(y);
+            unsigned char* rgb = &row[0];
+            for (int x = 0; x < image.GetWidth(); ++x, rgb += 3, pixel += ImageBuffer::kBytesPerPixel)
+            {
+                rgb[0] = pixel[2];
+                rgb[1] = pixel[1];
+                rgb[2] = pixel[0];
+            }
+            if (fwrite(&row[0], 1, row.size(), file) != row.size())
+                throw runtime_error(path);
+        }
+        if (!closer.Close())
+            throw runtime_error(path);
+    }
+
+    // The images the load phase cycles through, like the JPEG files of the application directory in the
+    // ImagePipeline sample. Either a list of PPM files, which are read and decoded on every load, or a number
+    // of synthetic images, which are drawn on every load and need no files at all. The images get their pixels
+    // from the pool passed to Load, if any. Load may be called from several threads at once.
+
+    class ImageSource
+    {
+    private:
+        vector<string> m_paths;
+        int m_syntheticCount;
+        int m_syntheticWidth;
+        int m_syntheticHeight;
+
+    public:
+        explicit ImageSource(const vector<string>& paths) :
+            m_paths(paths),
+            m_syntheticCount(0),
+            m_syntheticWidth(0),
+            m_syntheticHeight(0)
+        {
+        }
+
+        ImageSource(int count, int width, int height) :
+            m_syntheticCount(count),
+            m_syntheticWidth(width),
+            m_syntheticHeight(height)
+        {
+        }
+
+        size_t GetImageCount() const { return m_paths.empty() ? m_syntheticCount : m_paths.size(); }
+
+        string GetName(size_t index) const
+        {
+            if (m_paths.empty())
+                return "synthetic" + to_string(static_cast<unsigned long long>(index + 1)) + ".ppm";
+            size_t i = m_paths[index].find_last_of("/\\");
+            return (i == string::npos) ? m_paths[index] : m_paths[index].substr(i + 1);
+        }
+
+        // The path of the file, or the name of a synthetic image, and the time the file was last written, in
+        // seconds. Synthetic images never change, and their time is zero, as is that of a file that is missing.
+
+        string GetPath(size_t index) const { return m_paths.empty() ? GetName(index) : m_paths[index]; }
+
+        long long GetModificationTime(size_t index) const
+        {
+            if (m_paths.empty())
+                return 0;
+#if defined(_WIN32)
+            struct _stat64 status;
+            return (_stat64(m_paths[index].c_str(), &status) == 0) ? status.st_mtime : 0;
+#else
+            struct stat status;
+            return (stat(m_paths[index].c_str(), &status) == 0) ? status.st_mtime : 0;
+#endif
+        }
+
+        ImageBufferPtr Load(size_t index, const shared_ptr<image_buffer_pool>& pPool = nullptr) const
+        {
+            if (m_paths.empty())
+                return DrawSyntheticImage(static_cast<int>(index), pPool);
+            return ReadPixmap(m_paths[index], pPool);
+        }
+
+    private:
+        // Draws a photograph sized image with smooth gradients and some detail, which is different for each index.
+        ImageBufferPtr DrawSyntheticImage(int index, const shared_ptr<image_buffer_pool>& pPool) const
+        {
+            ImageBufferPtr pImage(new ImageBuffer(m_syntheticWidth, m_syntheticHeight, pPool));
+            const int centerX = m_syntheticWidth * (index % 3 + 1) / 4;
+            const int centerY = m_syntheticHeight * (index % 2 + 1) / 3;
+            for (int y = 0; y < m_syntheticHeight; ++y)
+            {
+                unsigned char* pixel = pImage->GetRow(y);
+                const int dy = y - centerY;
+                for (int x = 0; x < m_syntheticWidth; ++x, pixel += ImageBuffer::kBytesPerPixel)
+                {
+                    const int dx = x - centerX;
+                    const unsigned int ring = static_cast<unsigned int>(dx * dx + dy * dy) >> (7 + index % 4);
+                    pixel[0] = static_cast<unsigned char>(255 * x / m_syntheticWidth);
+                    pixel[1] = static_cast<unsigned char>((ring & 1) ? 224 : 32 + 192 * y / m_syntheticHeight);
+                    pixel[2] = static_cast<unsigned char>((x ^ y) + 40 * index);
+                    pixel[3] = 0xFF;
+                }
+            }
+            return pImage;
+        }
+    };
+};
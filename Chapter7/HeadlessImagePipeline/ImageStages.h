@@ -0,0 +1,161 @@
+//===============================================================================
+// Microsoft patterns & practices
+// Parallel Programming Guide
+//===============================================================================
+// Copyright  Microsoft Corporation.  All rights reserved.
+// This code released under the terms of the
+// Microsoft patterns & practices license (http://parallelpatterns.codeplex.com/license).
+//===============================================================================
+
+#pragma once
+
+#include <algorithm>
+#include <assert.h>
+#include <memory>
+#include <vector>
+
+#include "image_extras.h"
+#include "ImageBuffer.h"
+#include "ImageFrame.h"
+#include "ImageLoader.h"
+#include "ImageSink.h"
+#include "ImageSource.h"
+
+// The load, scale, filter and display phases of the ImagePipeline sample, on an ImageBuffer instead of a GDI+
+// Bitmap. Scaling is bilinear like the default interpolation mode of Graphics::DrawImage, or an area average,
+// the border is the part of the sample's 15 pixel wide pen that falls inside the image, and the noise filter is
+// a noise_filter.
+// The scale and filter phases can split an image into row bands that are processed in parallel; the result
+// does not depend on the number of bands.
+
+namespace HeadlessImagePipeline
+{
+    using namespace ::std;
+    using namespace ::Concurrency::samples;
+
+    const int kBorderWidth = 8;
+
+    // How the scale phase resizes images: with the ResizeImage function below, one pixel at a time, or with an
+    // image_resampler.
+    enum ScaleMethods
+    {
+        kScalarBilinear = 0,
+        kResampledBilinear,
+        kResampledAreaAverage
+    };
+
+    // The image gets its pixels from the pool of the loader, as do the images the later phases make from it.
+
+    inline ImageFramePtr CreateImage(ImageLoader& loader, size_t index, int sequence)
+    {
+        unsigned long long start = pipeline_telemetry::timestamp();
+
+        ImageFramePtr pFrame = ImageFramePtr(new ImageFrame(sequence, loader.GetSource().GetName(index), loader.Load(index)));
+
+        pFrame->PhaseEnd(kLoad, start);
+        return pFrame;
+    }
+
+    // Bilinear resampling with 8 bit fixed point weights. The source position of each column and row is computed
+    // once per image rather than once per pixel.
+
+    inline void ResizeImage(const ImageBuffer& source, ImageBuffer& target, int bandCount = 1)
+    {
+        const int sourceWidth = source.GetWidth();
+        const int sourceHeight = source.GetHeight();
+        const int width = target.GetWidth();
+        const int height = target.GetHeight();
+
+        vector<int> columns(width);
+        vector<int> columnWeights(width);
+        for (int x = 0; x < width; ++x)
+        {
+            double position = max(0.0, (x + 0.5) * sourceWidth / width - 0.5);
+            columns[x] = min(static_cast<int>(position), sourceWidth - 1);
+            columnWeights[x] = (columns[x] == sourceWidth - 1) ? 0 : static_cast<int>((position - columns[x]) * 256);
+        }
+
+        parallel_for_row_bands(height, bandCount, [&](int firstRow, int lastRow)
+        {
+            for (int y = firstRow; y < lastRow; ++y)
+            {
+                double position = max(0.0, (y + 0.5) * sourceHeight / height - 0.5);
+                int row = min(static_cast<int>(position), sourceHeight - 1);
+                int rowWeight = (row == sourceHeight - 1) ? 0 : static_cast<int>((position - row) * 256);
+                const unsigned char* top = source.GetRow(row);
+                const unsigned char* bottom = source.GetRow(min(row + 1, sourceHeight - 1));
+                unsigned char* pixel = target.GetRow(y);
+
+                for (int x = 0; x < width; ++x, pixel += ImageBuffer::kBytesPerPixel)
+                {
+                    const int left = columns[x] * ImageBuffer::kBytesPerPixel;
+                    const int right = left + ((columnWeights[x] == 0) ? 0 : ImageBuffer::kBytesPerPixel);
+                    const int w = columnWeights[x];
+                    for (int c = 0; c < 3; ++c)
+                    {
+                        int upper = top[left + c] * (256 - w) + top[right + c] * w;
+                        int lower = bottom[left + c] * (256 - w) + bottom[right + c] * w;
+                        pixel[c] = static_cast<unsigned char>((upper * (256 - rowWeight) + lower * rowWeight + 32768) >> 16);
+                    }
+                    pixel[3] = 0xFF;
+                }
+            }
+        });
+    }
+
+    inline void ScaleImage(ImageFramePtr pFrame, int width, int height, image_resampler_cache& resamplers, ScaleMethods method = kResampledBilinear,
+        int bandCount = 1)
+    {
+        assert(nullptr != pFrame);
+
+        pFrame->PhaseStart(kScale);
+
+        const ImageBuffer& image = pFrame->GetImage();
+        ImageBufferPtr pScaled(new ImageBuffer(width, height, image.GetPool()));
+        if (method == kScalarBilinear)
+            ResizeImage(image, *pScaled, bandCount);
+        else
+        {
+            shared_ptr<const image_resampler> pResampler = resamplers.get(image.GetWidth(), image.GetHeight(), width, height,
+                (method == kResampledBilinear) ? resample_bilinear : resample_area_average);
+            pResampler->resample(image.GetRow(0), image.GetStride(), pScaled->GetRow(0), pScaled->GetStride(), ImageBuffer::kBytesPerPixel, bandCount);
+        }
+        pScaled->FillRectangle(0, 0, width, kBorderWidth, 0, 0, 0);
+        pScaled->FillRectangle(0, height - kBorderWidth, width, kBorderWidth, 0, 0, 0);
+        pScaled->FillRectangle(0, 0, kBorderWidth, height, 0, 0, 0);
+        pScaled->FillRectangle(width - kBorderWidth, 0, kBorderWidth, height, 0, 0, 0);
+        pFrame->SetImage(move(pScaled));
+
+        pFrame->PhaseEnd(kScale);
+    }
+
+    // Each row gets its own noise stream, so the bands can be filtered in any order.
+
+    inline void FilterImage(ImageFramePtr pFrame, const noise_filter& filter, int bandCount = 1)
+    {
+        assert(nullptr != pFrame);
+
+        pFrame->PhaseStart(kFilter);
+
+        ImageBuffer& image = pFrame->GetImage();
+        const unsigned long long stream = static_cast<unsigned long long>(pFrame->GetSequence()) << 32;
+        parallel_for_row_bands(image.GetHeight(), bandCount, [&](int firstRow, int lastRow)
+        {
+            for (int y = firstRow; y < lastRow; ++y)
+                filter.filter_row(image.GetRow(y), image.GetWidth(), ImageBuffer::kBytesPerPixel, stream + y);
+        });
+
+        pFrame->PhaseEnd(kFilter);
+    }
+
+    inline void DisplayImage(ImageFramePtr pFrame, IImageSink& sink)
+    {
+        assert(nullptr != pFrame);
+
+        pFrame->PhaseStart(kDisplay);
+
+        sink.Display(*pFrame);
+
+        pFrame->PhaseEnd(kDisplay);
+    }
+};
@@ -0,0 +1,98 @@
+//===============================================================================
+// Microsoft patterns & practices
+// Parallel Programming Guide
+//===============================================================================
+// Copyright  Microsoft Corporation.  All rights reserved.
+// This code released under the terms of the
+// Microsoft patterns & practices license (http://parallelpatterns.codeplex.com/license).
+//===============================================================================
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+#include "concrt_extras.h"
+
+namespace HeadlessImagePipeline
+{
+    using namespace ::std;
+    using namespace ::Concurrency::samples;
+
+    // A message block that calls a function for each message sent to it, one message at a time and in the order
+    // they were sent, like the transformer and call blocks of the Agents Library. The messages are processed by
+    // a task of the current scheduler, which is only scheduled while there are messages waiting, so an idle
+    // block holds no thread.
+
+    // The destructor waits for the task to finish, so a block can be destroyed as soon as the last message it
+    // was sent has been processed.
+
+    template <typename T>
+    class MessageBlock
+    {
+    private:
+        function<void (T)> m_action;
+        mutable mutex m_lock;
+        condition_variable m_idle;
+        deque<T> m_messages;
+        bool m_processing;
+
+    public:
+        explicit MessageBlock(function<void (T)> action) : m_action(action), m_processing(false)
+        {
+        }
+
+        ~MessageBlock()
+        {
+            unique_lock<mutex> lock(m_lock);
+            while (m_processing)
+                m_idle.wait(lock);
+        }
+
+        void Send(T message)
+        {
+            {
+                lock_guard<mutex> lock(m_lock);
+                m_messages.push_back(message);
+                if (m_processing)
+                    return;
+                m_processing = true;
+            }
+            schedule_task([this]() { this->ProcessMessages(); });
+        }
+
+        // The number of messages waiting, not counting the one being processed.
+        int GetQueueSize() const
+        {
+            lock_guard<mutex> lock(m_lock);
+            return static_cast<int>(m_messages.size());
+        }
+
+    private:
+        void ProcessMessages()
+        {
+            for (;;)
+            {
+                T message;
+                {
+                    lock_guard<mutex> lock(m_lock);
+                    if (m_messages.empty())
+                    {
+                        m_processing = false;
+                        m_idle.notify_all();
+                        return;
+                    }
+                    message = m_messages.front();
+                    m_messages.pop_front();
+                }
+                m_action(message);
+            }
+        }
+
+        // Disable copy constructor and assignment.
+        MessageBlock(const MessageBlock&);
+        MessageBlock const & operator=(MessageBlock const&);
+    };
+};
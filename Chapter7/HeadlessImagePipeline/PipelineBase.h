@@ -0,0 +1,361 @@
+//===============================================================================
+// Microsoft patterns & practices
+// Parallel Programming Guide
+//===============================================================================
+// Copyright  Microsoft Corporation.  All rights reserved.
+// This code released under the terms of the
+// Microsoft patterns & practices license (http://parallelpatterns.codeplex.com/license).
+//===============================================================================
+
+#pragma once
+
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "image_extras.h"
+#include "telemetry_extras.h"
+#include "ImageFrame.h"
+#include "ImageLoader.h"
+#include "ImageSink.h"
+#include "ImageSource.h"
+#include "ImageStages.h"
+
+namespace HeadlessImagePipeline
+{
+    using namespace ::std;
+    using namespace ::Concurrency::samples;
+
+    struct PipelineSettings
+    {
+        int imageCount;
+        int displayWidth;
+        int displayHeight;
+        double noiseLevel;
+        int filterCount;
+        // The row bands the scale and filter phases split each image into, or zero to choose from the number
+        // of images in and waiting for the phase.
+        int bandCount;
+        ScaleMethods scaleMethod;
+        bool recycleBuffers;
+        // The megabytes of decoded images the load phase keeps, and the images after the current one it has
+        // decoded ahead. With both zero every image is decoded on every load.
+        int cacheMegabytes;
+        int prefetchCount;
+
+        // The defaults are those of the ImagePipeline dialog: a 50.0 noise level and eight filterers in the
+        // balanced pipeline. Images are not split, as in the sample, scaling is bilinear, the pixel memory
+        // of displayed images is reused, and the cache holds a few dozen photograph sized images.
+        PipelineSettings() : imageCount(200), displayWidth(640), displayHeight(480), noiseLevel(50.0), filterCount(8), bandCount(1),
+            scaleMethod(kResampledBilinear), recycleBuffers(true), cacheMegabytes(64), prefetchCount(4) {}
+    };
+
+    // The headless counterpart of ImagePipeline::PipelinePerformanceData. The display phase calls Update for
+    // each image, so all methods but the getters are called from one thread at a time.
+
+    class PipelinePerformance
+    {
+    private:
+        int m_imageCount;
+        unsigned long long m_startTime;
+        unsigned long long m_currentTime;
+        unsigned long long m_firstImageTime;
+        // When each image was displayed, for the throughput of the second half of the run.
+        vector<unsigned long long> m_displayTimes;
+        unsigned long long m_totalPhaseTime[kPhaseCount];
+        unsigned long long m_totalQueueTime[kQueueCount];
+        vector<shared_ptr<log_histogram>> m_phaseTimes;
+        vector<shared_ptr<log_histogram>> m_queueTimes;
+        vector<shared_ptr<log_histogram>> m_queueSizes;
+        shared_ptr<log_histogram> m_latency;
+
+    public:
+        PipelinePerformance() : m_latency(make_shared<log_histogram>())
+        {
+            for (int i = 0; i < kPhaseCount; ++i)
+                m_phaseTimes.push_back(make_shared<log_histogram>());
+            for (int i = 0; i < kQueueCount; ++i)
+            {
+                m_queueTimes.push_back(make_shared<log_histogram>());
+                m_queueSizes.push_back(make_shared<log_histogram>());
+            }
+            Start();
+        }
+
+        void Start()
+        {
+            m_imageCount = 0;
+            m_startTime = m_currentTime = m_firstImageTime = pipeline_telemetry::timestamp();
+            m_displayTimes.clear();
+            for (int i = 0; i < kPhaseCount; ++i)
+            {
+                m_totalPhaseTime[i] = 0;
+                m_phaseTimes[i]->reset();
+            }
+            for (int i = 0; i < kQueueCount; ++i)
+            {
+                m_totalQueueTime[i] = 0;
+                m_queueTimes[i]->reset();
+                m_queueSizes[i]->reset();
+            }
+            m_latency->reset();
+        }
+
+        void Update(const ImageFrame& frame)
+        {
+            m_currentTime = pipeline_telemetry::timestamp();
+            for (int i = 0; i < kPhaseCount; ++i)
+            {
+                m_totalPhaseTime[i] += frame.GetPhaseDuration(i);
+                m_phaseTimes[i]->record(frame.GetPhaseDuration(i));
+            }
+            for (int i = 0; i < kQueueCount; ++i)
+            {
+                m_totalQueueTime[i] += frame.GetQueueDuration(i);
+                m_queueTimes[i]->record(frame.GetQueueDuration(i));
+            }
+            m_latency->record(frame.GetLatency());
+            if (m_imageCount++ == 0)
+                m_firstImageTime = m_currentTime;
+            m_displayTimes.push_back(m_currentTime);
+        }
+
+        void UpdateQueueSize(int queue, int size)
+        {
+            m_queueSizes[queue]->record((size < 0) ? 0 : size);
+        }
+
+        int GetImageCount() const { return m_imageCount; }
+
+        double GetElapsedTime() const { return 1e-9 * (m_currentTime - m_startTime); }
+
+        double GetImagesPerSecond() const { return (m_currentTime == m_startTime) ? 0.0 : m_imageCount / GetElapsedTime(); }
+
+        double GetTimePerImage() const { return (m_imageCount == 0) ? 0.0 : 1000.0 * GetElapsedTime() / m_imageCount; }
+
+        // How long the first image took to get through an empty pipeline, in milliseconds, and the throughput
+        // over the second half of the images, which is what a pipeline that runs for a long time achieves. A
+        // pipeline that fills up before it displays anything can display the rest in a burst, so the throughput
+        // is 0, for unknown, when the second half took less than a tenth of the run or there are too few images.
+
+        double GetTimeToFirstImage() const { return 1e-6 * (m_firstImageTime - m_startTime); }
+
+        double GetSteadyStateImagesPerSecond() const
+        {
+            if (m_imageCount < 4)
+                return 0.0;
+            const unsigned long long windowStart = m_displayTimes[m_imageCount / 2 - 1];
+            const unsigned long long window = m_currentTime - windowStart;
+            if (window == 0 || 10 * window < m_currentTime - m_startTime)
+                return 0.0;
+            return (m_imageCount - m_imageCount / 2) / (1e-9 * window);
+        }
+
+        // Times are in milliseconds; fraction is 0.5 for the median, 0.99 for the 99th percentile.
+
+        double GetAveragePhaseTime(int phase) const { return (m_imageCount == 0) ? 0.0 : 1e-6 * m_totalPhaseTime[phase] / m_imageCount; }
+
+        double GetAverageQueueTime(int queue) const { return (m_imageCount == 0) ? 0.0 : 1e-6 * m_totalQueueTime[queue] / m_imageCount; }
+
+        double GetPhaseTimePercentile(int phase, double fraction) const { return 1e-6 * m_phaseTimes[phase]->percentile(fraction); }
+
+        double GetQueueTimePercentile(int queue, double fraction) const { return 1e-6 * m_queueTimes[queue]->percentile(fraction); }
+
+        int GetQueueSizePercentile(int queue, double fraction) const { return static_cast<int>(m_queueSizes[queue]->percentile(fraction)); }
+
+        double GetLatencyPercentile(double fraction) const { return 1e-6 * m_latency->percentile(fraction); }
+
+        // The average number of images in the phase at once. Phases that run on several threads can exceed one.
+
+        double GetPhaseUtilization(int phase) const
+        {
+            unsigned long long elapsed = m_currentTime - m_startTime;
+            return (elapsed == 0) ? 0.0 : static_cast<double>(m_totalPhaseTime[phase]) / elapsed;
+        }
+
+    private:
+        // Disable copy constructor and assignment.
+        PipelinePerformance(const PipelinePerformance&);
+        PipelinePerformance const & operator=(PipelinePerformance const&);
+    };
+
+    // The headless counterpart of ImagePipeline::AgentBase. Each pipeline loads settings.imageCount images,
+    // cycling through those of the source, and its Run method returns once the last of them has been displayed.
+
+    // The stage work functions trap all exceptions. The first one records an error message and sets the shutdown
+    // flag, after which the load phase stops and the other phases pass the remaining images on without working on
+    // them, so that the pipeline drains as it does when the ImagePipeline dialog's Stop button is pressed.
+
+    class PipelineBase
+    {
+    private:
+        const ImageSource& m_source;
+        shared_ptr<image_buffer_pool> m_pBufferPool;
+        ImageLoader m_loader;
+        const noise_filter m_noiseFilter;
+        image_resampler_cache m_resamplers;
+        IImageSink& m_sink;
+        PipelinePerformance& m_performance;
+        atomic<bool> m_shutdownPending;
+        atomic<int> m_scalingCount;
+        atomic<int> m_filteringCount;
+        mutex m_errorLock;
+        string m_error;
+
+    protected:
+        const PipelineSettings m_settings;
+
+        int GetPipelineCapacity() const { return 20; }
+
+        // The most images any of the pipelines has in flight, which is the governor of the balanced pipeline, and
+        // so the most free buffers of a size the pool needs to keep.
+        int GetMaximumImagesInFlight() const { return 3 * GetPipelineCapacity(); }
+
+        int GetLastSequence() const { return kFirstImage + m_settings.imageCount - 1; }
+
+    public:
+        PipelineBase(const ImageSource& source, const PipelineSettings& settings, IImageSink& sink, PipelinePerformance& performance) :
+            m_source(source),
+            m_pBufferPool(make_shared<image_buffer_pool>(settings.recycleBuffers ? GetMaximumImagesInFlight() : 0)),
+            m_loader(source, m_pBufferPool, static_cast<size_t>(settings.cacheMegabytes) << 20, settings.prefetchCount > 0),
+            m_noiseFilter(settings.noiseLevel),
+            m_sink(sink),
+            m_performance(performance),
+            m_shutdownPending(false),
+            m_scalingCount(0),
+            m_filteringCount(0),
+            m_settings(settings)
+        {
+        }
+
+        virtual ~PipelineBase() {}
+
+        virtual void Run() = 0;
+
+        virtual int GetQueueSize(int queue) const = 0;
+
+        bool IsCancellationPending() const { return m_shutdownPending.load(); }
+
+        // The pool the images of the pipeline take their pixel memory from.
+        const image_buffer_pool& GetBufferPool() const { return *m_pBufferPool; }
+
+        // The loader of the load phase, with its cache statistics.
+        const ImageLoader& GetImageLoader() const { return m_loader; }
+
+        // The message of the first error, or an empty string if there was none.
+        string GetError()
+        {
+            lock_guard<mutex> lock(m_errorLock);
+            return m_error;
+        }
+
+        // Pipeline stage work functions.
+
+        ImageFramePtr LoadImage(int sequence)
+        {
+            ImageFramePtr pFrame = nullptr;
+            size_t index = (sequence - kFirstImage) % m_source.GetImageCount();
+            try
+            {
+                if (!IsCancellationPending())
+                {
+                    // The I/O threads decode the next images while this one is loaded.
+                    const int imageCount = static_cast<int>(m_source.GetImageCount());
+                    for (int i = 1; i <= m_settings.prefetchCount && i < imageCount && sequence + i <= GetLastSequence(); ++i)
+                        m_loader.Prefetch((index + i) % imageCount);
+                    pFrame = HeadlessImagePipeline::CreateImage(m_loader, index, sequence);
+                }
+            }
+            catch (exception& e)
+            {
+                ShutdownOnError(kLoad, m_source.GetName(index), e);
+            }
+            return pFrame;
+        }
+
+        void ScaleImage(ImageFramePtr pFrame)
+        {
+            ++m_scalingCount;
+            try
+            {
+                if (!IsCancellationPending() && (nullptr != pFrame))
+                    HeadlessImagePipeline::ScaleImage(pFrame, m_settings.displayWidth, m_settings.displayHeight, m_resamplers,
+                        m_settings.scaleMethod, GetBandCount(m_scalingCount.load(), kLoaderToScaler));
+            }
+            catch (exception& e)
+            {
+                ShutdownOnError(kScale, pFrame->GetName(), e);
+            }
+            --m_scalingCount;
+        }
+
+        void FilterImage(ImageFramePtr pFrame)
+        {
+            ++m_filteringCount;
+            try
+            {
+                if (!IsCancellationPending() && (nullptr != pFrame))
+                    HeadlessImagePipeline::FilterImage(pFrame, m_noiseFilter, GetBandCount(m_filteringCount.load(), kScalerToFilterer));
+            }
+            catch (exception& e)
+            {
+                ShutdownOnError(kFilter, pFrame->GetName(), e);
+            }
+            --m_filteringCount;
+        }
+
+        void DisplayImage(ImageFramePtr pFrame)
+        {
+            try
+            {
+                if (!IsCancellationPending() && (nullptr != pFrame))
+                {
+                    HeadlessImagePipeline::DisplayImage(pFrame, m_sink);
+                    m_performance.Update(*pFrame);
+                    for (int i = kLoaderToScaler; i < kQueueCount; ++i)
+                        m_performance.UpdateQueueSize(i, GetQueueSize(i));
+                }
+            }
+            catch (exception& e)
+            {
+                ShutdownOnError(kDisplay, pFrame->GetName(), e);
+            }
+        }
+
+    private:
+        static int GetProcessorCount()
+        {
+            const unsigned int count = thread::hardware_concurrency();
+            return (count == 0) ? 1 : static_cast<int>(count);
+        }
+
+        // With a fixed band count every image is split the same way. Otherwise the processors are shared among
+        // the images the phase is working on and those waiting in its input queue: while the pipeline fills up
+        // or runs dry an image gets all of them, which shortens its latency, and once the queue backs up each
+        // image gets one, which avoids the cost of splitting when there is enough work for all processors.
+        int GetBandCount(int imagesInPhase, Queues input) const
+        {
+            if (m_settings.bandCount > 0)
+                return m_settings.bandCount;
+            const int images = imagesInPhase + max(0, GetQueueSize(input));
+            return max(1, GetProcessorCount() / max(1, images));
+        }
+
+        void ShutdownOnError(Phases phase, const string& imageName, const exception& e)
+        {
+            const char* phaseNames[] = { "loading", "scaling", "filtering", "displaying" };
+            lock_guard<mutex> lock(m_errorLock);
+            if (m_error.empty())
+                m_error = string("Error while ") + phaseNames[phase] + " image \"" + imageName + "\": " + e.what();
+            m_shutdownPending.store(true);
+        }
+
+        // Disable copy constructor and assignment.
+        PipelineBase(const PipelineBase&);
+        PipelineBase const & operator=(PipelineBase const&);
+    };
+};
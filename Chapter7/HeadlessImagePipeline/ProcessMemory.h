@@ -0,0 +1,65 @@
+//===============================================================================
+// Microsoft patterns & practices
+// Parallel Programming Guide
+//===============================================================================
+// Copyright  Microsoft Corporation.  All rights reserved.
+// This code released under the terms of the
+// Microsoft patterns & practices license (http://parallelpatterns.codeplex.com/license).
+//===============================================================================
+
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#if defined(_WIN32)
+#if !defined(NOMINMAX)
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+namespace HeadlessImagePipeline
+{
+    // The memory of the process that is in physical memory, its working set on Windows and resident set on
+    // Linux, and the page faults it has taken so far. Zero where neither can be read.
+
+    struct ProcessMemoryUsage
+    {
+        size_t residentBytes;
+        unsigned long long pageFaults;
+
+        ProcessMemoryUsage() : residentBytes(0), pageFaults(0) {}
+    };
+
+    inline ProcessMemoryUsage GetProcessMemoryUsage()
+    {
+        ProcessMemoryUsage usage;
+#if defined(_WIN32)
+        PROCESS_MEMORY_COUNTERS counters;
+        if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        {
+            usage.residentBytes = counters.WorkingSetSize;
+            usage.pageFaults = counters.PageFaultCount;
+        }
+#else
+        FILE* file = fopen("/proc/self/statm", "r");
+        if (nullptr != file)
+        {
+            unsigned long size = 0;
+            unsigned long resident = 0;
+            if (fscanf(file, "%lu %lu", &size, &resident) == 2)
+                usage.residentBytes = static_cast<size_t>(resident) * sysconf(_SC_PAGESIZE);
+            fclose(file);
+        }
+        rusage resources;
+        if (getrusage(RUSAGE_SELF, &resources) == 0)
+            usage.pageFaults = resources.ru_minflt + resources.ru_majflt;
+#endif
+        return usage;
+    }
+};
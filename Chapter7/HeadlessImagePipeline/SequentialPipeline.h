@@ -0,0 +1,41 @@
+//===============================================================================
+// Microsoft patterns & practices
+// Parallel Programming Guide
+//===============================================================================
+// Copyright  Microsoft Corporation.  All rights reserved.
+// This code released under the terms of the
+// Microsoft patterns & practices license (http://parallelpatterns.codeplex.com/license).
+//===============================================================================
+
+#pragma once
+
+#include "PipelineBase.h"
+
+// The SequentialPipeline runs the four phases one image at a time on the calling thread, like the
+// ImageAgentSequential agent of the ImagePipeline sample.
+
+namespace HeadlessImagePipeline
+{
+    class SequentialPipeline : public PipelineBase
+    {
+    public:
+        SequentialPipeline(const ImageSource& source, const PipelineSettings& settings, IImageSink& sink, PipelinePerformance& performance) :
+            PipelineBase(source, settings, sink, performance)
+        {
+        }
+
+        // Queue size is meaningless in the sequential case.
+        int GetQueueSize(int /*queue*/) const { return 0; }
+
+        void Run()
+        {
+            for (int sequence = kFirstImage; sequence <= GetLastSequence() && !IsCancellationPending(); ++sequence)
+            {
+                ImageFramePtr pFrame = LoadImage(sequence);
+                ScaleImage(pFrame);
+                FilterImage(pFrame);
+                DisplayImage(pFrame);
+            }
+        }
+    };
+};
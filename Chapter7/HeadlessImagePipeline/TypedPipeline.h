@@ -0,0 +1,75 @@
+//===============================================================================
+// Microsoft patterns & practices
+// Parallel Programming Guide
+//===============================================================================
+// Copyright  Microsoft Corporation.  All rights reserved.
+// This code released under the terms of the
+// Microsoft patterns & practices license (http://parallelpatterns.codeplex.com/license).
+//===============================================================================
+
+#pragma once
+
+#include "pipeline_extras.h"
+#include "PipelineBase.h"
+
+// The TypedPipeline expresses the phases as typed stage functions of a samples::pipeline, like
+// ImageAgentPipelineTyped. The filter is a parallel stage and the display a serial in-order stage, and the
+// bounded rings between the stages take the place of a governor.
+
+namespace HeadlessImagePipeline
+{
+    using namespace ::std;
+    using namespace ::Concurrency::samples;
+
+    class TypedPipeline : public PipelineBase
+    {
+    private:
+        pipeline m_pipeline;
+
+    public:
+        TypedPipeline(const ImageSource& source, const PipelineSettings& settings, IImageSink& sink, PipelinePerformance& performance) :
+            PipelineBase(source, settings, sink, performance)
+        {
+            m_pipeline = CreatePipeline();
+        }
+
+        int GetQueueSize(int queue) const { return static_cast<int>(m_pipeline.unsafe_queue_size(queue)); }
+
+        void Run()
+        {
+            m_pipeline.run();
+        }
+
+    private:
+        pipeline CreatePipeline()
+        {
+            int sequence = kFirstImage;
+
+            // Each ring holds two images. With a parallel stage in the pipeline, at most two images per filter 
+            // thread are in flight at once.
+            const size_t connectionCapacity = 2;
+
+            return pipeline_source<ImageFramePtr>([this, sequence](ImageFramePtr& pFrame) mutable -> bool
+                {
+                    if (IsCancellationPending() || sequence > GetLastSequence())
+                        return false;
+                    pFrame = this->LoadImage(sequence++);
+                    return nullptr != pFrame;
+                }, connectionCapacity)
+                | pipeline_stage([this](ImageFramePtr pFrame) -> ImageFramePtr
+                {
+                    this->ScaleImage(pFrame);
+                    return pFrame;
+                })
+                | pipeline_stage([this](ImageFramePtr pFrame) -> ImageFramePtr
+                {
+                    this->FilterImage(pFrame);
+                    return pFrame;
+                }, pipeline_parallel)
+                | pipeline_sink([this](ImageFramePtr pFrame)
+                {
+                    this->DisplayImage(pFrame);
+                });
+        }
+    };
+};
@@ -0,0 +1,318 @@
+//===============================================================================
+// Microsoft patterns & practices
+// Parallel Programming Guide
+//===============================================================================
+// Copyright  Microsoft Corporation.  All rights reserved.
+// This code released under the terms of the
+// Microsoft patterns & practices license (http://parallelpatterns.codeplex.com/license).
+//===============================================================================
+
+// The load, scale, filter and display pipeline of the ImagePipeline sample without MFC or GDI+. Images are
+// ImageBuffers read from PPM files or drawn on the fly, the display phase hands them to an IImageSink that
+// drops them or writes them to files, and the sequential, control flow, dataflow, balanced and typed
+// pipelines of the sample run one after the other on the same images. For each of them the program prints
+// the throughput and the time images spend in each phase and queue, like the dialog of the sample.
+
+// The program only uses the portable parts of the Utilities folder, so it also builds and runs on Linux,
+// for example with
+//
+//     g++ -std=c++11 -O2 -pthread -I ../../Utilities main.cpp -o HeadlessImagePipeline
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ImageLoader.h"
+#include "ImageSink.h"
+#include "ImageSource.h"
+#include "PipelineBase.h"
+#include "ProcessMemory.h"
+#include "SequentialPipeline.h"
+#include "ControlFlowPipeline.h"
+#include "DataflowPipeline.h"
+#include "BalancedPipeline.h"
+#include "TypedPipeline.h"
+
+using namespace ::std;
+using namespace ::HeadlessImagePipeline;
+
+enum PipelineKinds
+{
+    kSequential = 0,
+    kControlFlow,
+    kDataflow,
+    kBalanced,
+    kTyped,
+    kPipelineKindCount
+};
+
+const char* g_pipelineNames[kPipelineKindCount] = { "sequential", "controlflow", "dataflow", "balanced", "typed" };
+
+const char* g_scaleMethodNames[] = { "scalar", "bilinear", "area" };
+
+struct ProgramOptions
+{
+    PipelineSettings settings;
+    vector<int> pipelines;
+    vector<string> inputPaths;
+    int sourceWidth;
+    int sourceHeight;
+    string outputDirectory;
+
+    // Three synthetic images the size of the photographs that come with the ImagePipeline sample.
+    ProgramOptions() : sourceWidth(1024), sourceHeight(768)
+    {
+        for (int i = 0; i < kPipelineKindCount; ++i)
+            pipelines.push_back(i);
+    }
+};
+
+unique_ptr<PipelineBase> CreatePipeline(int kind, const ImageSource& source, const PipelineSettings& settings, IImageSink& sink, PipelinePerformance& performance)
+{
+    switch (kind)
+    {
+    case kSequential:
+        return unique_ptr<PipelineBase>(new SequentialPipeline(source, settings, sink, performance));
+    case kControlFlow:
+        return unique_ptr<PipelineBase>(new ControlFlowPipeline(source, settings, sink, performance));
+    case kDataflow:
+        return unique_ptr<PipelineBase>(new DataflowPipeline(source, settings, sink, performance));
+    case kBalanced:
+        return unique_ptr<PipelineBase>(new BalancedPipeline(source, settings, sink, performance));
+    default:
+        return unique_ptr<PipelineBase>(new TypedPipeline(source, settings, sink, performance));
+    }
+}
+
+void PrintReport(const char* name, const PipelinePerformance& performance, double sequentialRate)
+{
+    const char* phaseNames[] = { "Load", "Scale", "Filter", "Display" };
+
+    printf("%s: %d images in %.2f s, %.1f images/s, %.1f ms per image", name, performance.GetImageCount(),
+        performance.GetElapsedTime(), performance.GetImagesPerSecond(), performance.GetTimePerImage());
+    if (sequentialRate > 0.0)
+        printf(", %.2fx sequential", performance.GetImagesPerSecond() / sequentialRate);
+    printf("\n  Latency : p50 %7.1f ms, p99 %7.1f ms, first image %7.1f ms, then ", performance.GetLatencyPercentile(0.5),
+        performance.GetLatencyPercentile(0.99), performance.GetTimeToFirstImage());
+    if (performance.GetSteadyStateImagesPerSecond() > 0.0)
+        printf("%.1f images/s\n", performance.GetSteadyStateImagesPerSecond());
+    else
+        printf("n/a\n");
+    for (int i = kLoad; i < kPhaseCount; ++i)
+    {
+        printf("  %-8s: avg %7.2f ms, p50 %7.2f ms, p99 %7.2f ms, utilization %4.2f\n", phaseNames[i], performance.GetAveragePhaseTime(i),
+            performance.GetPhaseTimePercentile(i, 0.5), performance.GetPhaseTimePercentile(i, 0.99), performance.GetPhaseUtilization(i));
+    }
+    for (int i = kLoaderToScaler; i < kQueueCount; ++i)
+    {
+        printf("  Queue %d : avg %7.2f ms, p99 %7.2f ms, size p50 %d, p99 %d\n", i + 1, performance.GetAverageQueueTime(i),
+            performance.GetQueueTimePercentile(i, 0.99), performance.GetQueueSizePercentile(i, 0.5), performance.GetQueueSizePercentile(i, 0.99));
+    }
+}
+
+// Allocations are those of pixel memory, which the buffer pool saves when it has a free buffer of the size.
+// The resident memory is measured once the last image has been displayed, while the pool still holds its
+// buffers, and page faults are those the process took while the pipeline ran.
+void PrintMemoryReport(const image_buffer_pool& pool, const ProcessMemoryUsage& start, const ProcessMemoryUsage& end, int imageCount)
+{
+    const double images = (imageCount == 0) ? 1.0 : imageCount;
+    printf("  Memory  : %.2f buffer allocations per image, %d buffers reused, %d free buffers of %.1f MB, resident %.1f MB, %.0f page faults per image\n",
+        pool.allocation_count() / images, static_cast<int>(pool.reuse_count()), static_cast<int>(pool.free_buffer_count()),
+        pool.free_bytes() / 1048576.0, end.residentBytes / 1048576.0, (end.pageFaults - start.pageFaults) / images);
+}
+
+// Hits are loads that found their image decoded, in the cache or prefetched by the I/O threads, some of them
+// after waiting for an I/O thread to finish it. Prefetches that were not used were decoded in vain.
+void PrintCacheReport(const ImageLoader& loader)
+{
+    const unsigned long long loads = loader.GetLoadCount();
+    const unsigned long long cacheHits = loader.GetCacheHitCount();
+    const unsigned long long prefetchHits = loader.GetPrefetchHitCount();
+    printf("  Cache   : hit rate %5.1f%%, %d cached and %d prefetched of %d loads, %d waited, %d of %d prefetches used, %d images of %.1f MB cached\n",
+        (loads == 0) ? 0.0 : 100.0 * (cacheHits + prefetchHits) / loads, static_cast<int>(cacheHits), static_cast<int>(prefetchHits),
+        static_cast<int>(loads), static_cast<int>(loader.GetWaitCount()), static_cast<int>(prefetchHits), static_cast<int>(loader.GetPrefetchCount()),
+        static_cast<int>(loader.GetCachedImageCount()), loader.GetCachedBytes() / 1048576.0);
+}
+
+void Help()
+{
+    printf("Usage: HeadlessImagePipeline [options]\n\n");
+    printf("  --pipelines NAME,... pipelines to run: sequential, controlflow, dataflow, balanced and typed (default all)\n");
+    printf("  --images N           images each pipeline processes (default 200)\n");
+    printf("  --input FILE,...     binary PPM files to load (default synthetic images)\n");
+    printf("  --source-size WxH    size of the synthetic images (default 1024x768)\n");
+    printf("  --display-size WxH   size the images are scaled to (default 640x480)\n");
+    printf("  --noise N            standard deviation of the noise filter (default 50)\n");
+    printf("  --filters N          filterers of the balanced pipeline (default 8)\n");
+    printf("  --scaling METHOD     scalar or bilinear interpolation, or area average (default bilinear); scalar is\n");
+    printf("                       the reference implementation, which works on one pixel at a time\n");
+    printf("  --bands N|auto       row bands the scale and filter phases split each image into, or auto to choose\n");
+    printf("                       from the images waiting for the phase (default 1)\n");
+    printf("  --buffer-pool on|off reuse the pixel memory of displayed images (default on)\n");
+    printf("  --cache-size MB      megabytes of decoded images the load phase keeps, or 0 to decode every load\n");
+    printf("                       (default 64)\n");
+    printf("  --prefetch N         images the load phase decodes ahead on I/O threads, or 0 for none (default 4)\n");
+    printf("  --output DIRECTORY   write the displayed images to DIRECTORY instead of dropping them\n");
+}
+
+bool ParseNumber(const char* text, int minimum, int& value)
+{
+    char* end = nullptr;
+    long number = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || number < minimum)
+        return false;
+    value = static_cast<int>(number);
+    return true;
+}
+
+bool ParseSize(const char* text, int& width, int& height)
+{
+    string size(text);
+    size_t x = size.find('x');
+    return (x != string::npos) && ParseNumber(size.substr(0, x).c_str(), 2 * kBorderWidth + 1, width) &&
+        ParseNumber(size.substr(x + 1).c_str(), 2 * kBorderWidth + 1, height);
+}
+
+vector<string> SplitList(const char* text)
+{
+    vector<string> items;
+    string list(text);
+    size_t first = 0;
+    while (first <= list.size())
+    {
+        size_t comma = list.find(',', first);
+        if (comma == string::npos)
+            comma = list.size();
+        if (comma > first)
+            items.push_back(list.substr(first, comma - first));
+        first = comma + 1;
+    }
+    return items;
+}
+
+bool ParseOptions(int argc, char* argv[], ProgramOptions& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        string option = argv[i];
+        if (i + 1 == argc)
+            return false;
+        const char* value = argv[++i];
+
+        if (option == "--pipelines")
+        {
+            vector<string> names = SplitList(value);
+            options.pipelines.clear();
+            for (size_t j = 0; j < names.size(); ++j)
+            {
+                int kind = 0;
+                while (kind < kPipelineKindCount && names[j] != g_pipelineNames[kind])
+                    ++kind;
+                if (kind == kPipelineKindCount)
+                    return false;
+                options.pipelines.push_back(kind);
+            }
+            if (options.pipelines.empty())
+                return false;
+        }
+        else if (option == "--images" && ParseNumber(value, 1, options.settings.imageCount))
+            continue;
+        else if (option == "--input")
+        {
+            options.inputPaths = SplitList(value);
+            if (options.inputPaths.empty())
+                return false;
+        }
+        else if (option == "--source-size" && ParseSize(value, options.sourceWidth, options.sourceHeight))
+            continue;
+        else if (option == "--display-size" && ParseSize(value, options.settings.displayWidth, options.settings.displayHeight))
+            continue;
+        else if (option == "--noise")
+        {
+            char* end = nullptr;
+            options.settings.noiseLevel = strtod(value, &end);
+            if (end == value || *end != '\0' || options.settings.noiseLevel < 0.0)
+                return false;
+        }
+        else if (option == "--filters" && ParseNumber(value, 1, options.settings.filterCount))
+            continue;
+        else if (option == "--scaling")
+        {
+            int method = kScalarBilinear;
+            while (method <= kResampledAreaAverage && string(value) != g_scaleMethodNames[method])
+                ++method;
+            if (method > kResampledAreaAverage)
+                return false;
+            options.settings.scaleMethod = static_cast<ScaleMethods>(method);
+        }
+        else if (option == "--bands")
+        {
+            if (string(value) == "auto")
+                options.settings.bandCount = 0;
+            else if (!ParseNumber(value, 1, options.settings.bandCount))
+                return false;
+        }
+        else if (option == "--buffer-pool")
+        {
+            if (string(value) != "on" && string(value) != "off")
+                return false;
+            options.settings.recycleBuffers = (string(value) == "on");
+        }
+        else if (option == "--cache-size" && ParseNumber(value, 0, options.settings.cacheMegabytes))
+            continue;
+        else if (option == "--prefetch" && ParseNumber(value, 0, options.settings.prefetchCount))
+            continue;
+        else if (option == "--output")
+            options.outputDirectory = value;
+        else
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    ProgramOptions options;
+    if (!ParseOptions(argc, argv, options))
+    {
+        Help();
+        return 1;
+    }
+
+    unique_ptr<ImageSource> source(options.inputPaths.empty() ? new ImageSource(3, options.sourceWidth, options.sourceHeight) : new ImageSource(options.inputPaths));
+    unique_ptr<IImageSink> sink(options.outputDirectory.empty() ? static_cast<IImageSink*>(new DropImageSink()) : new FileImageSink(options.outputDirectory));
+
+    string bands = (options.settings.bandCount == 0) ? string("auto") : to_string(static_cast<long long>(options.settings.bandCount));
+    printf("%d images of %d, %s scaled to %dx%d, noise %.1f, %s bands, %s\n\n", options.settings.imageCount, static_cast<int>(source->GetImageCount()),
+        g_scaleMethodNames[options.settings.scaleMethod], options.settings.displayWidth, options.settings.displayHeight, options.settings.noiseLevel, bands.c_str(),
+        options.outputDirectory.empty() ? "dropped after display" : ("written to " + options.outputDirectory).c_str());
+
+    double sequentialRate = 0.0;
+    for (size_t i = 0; i < options.pipelines.size(); ++i)
+    {
+        int kind = options.pipelines[i];
+        PipelinePerformance performance;
+        unique_ptr<PipelineBase> pipeline = CreatePipeline(kind, *source, options.settings, *sink, performance);
+        ProcessMemoryUsage startMemory = GetProcessMemoryUsage();
+        performance.Start();
+        pipeline->Run();
+        ProcessMemoryUsage endMemory = GetProcessMemoryUsage();
+        string error = pipeline->GetError();
+        if (!error.empty())
+        {
+            fprintf(stderr, "%s: %s\n", g_pipelineNames[kind], error.c_str());
+            return 1;
+        }
+
+        PrintReport(g_pipelineNames[kind], performance, (kind == kSequential) ? 0.0 : sequentialRate);
+        PrintCacheReport(pipeline->GetImageLoader());
+        PrintMemoryReport(pipeline->GetBufferPool(), startMemory, endMemory, performance.GetImageCount());
+        pipeline.reset();
+        if (kind == kSequential)
+            sequentialRate = performance.GetImagesPerSecond();
+        printf("\n");
+    }
+    return 0;
+}
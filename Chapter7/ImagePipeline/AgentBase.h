@@ -16,6 +16,7 @@
 #include <ppl.h>
 #include <tuple>
 
+#include "image_extras.h"
 #include "ImageInfo.h"
 
 #define WM_REPORTERROR (WM_USER + 1)
@@ -46,11 +47,19 @@ namespace ImagePipeline
         // Marked mutable as this is completely internal not public state.
         mutable critical_section m_latestImageLock; 
         ImageInfoPtr m_pLatestImage;
+        // Marked mutable as the scale phase keeps its resamplers here, for the run of this agent.
+        mutable image_resampler_cache m_resamplers;
     
     protected:
-        int GetPipelineCapacity() const { return 20; }
+        static const int kPipelineCapacity = 20;
+
+        int GetPipelineCapacity() const { return kPipelineCapacity; }
 
     public:
+        // The most images any of the pipelines has in flight, which is the governor of the balanced pipeline, and
+        // so the most free bitmaps of a size the pool of ImageInfo.cpp needs to keep.
+        static int GetMaximumImagesInFlight() { return 3 * kPipelineCapacity; }
+
         AgentBase(HWND dialog, ISource<bool>& cancellationSource, ITarget<ErrorInfo>& errorTarget) : 
             m_dialogWindow(dialog), 
             m_cancellationSource(cancellationSource),
@@ -113,7 +122,7 @@ namespace ImagePipeline
             try
             {
                 if (!IsCancellationPending() && (nullptr != pInfo))
-                    ImagePipeline::ScaleImage(pInfo, size);
+                    ImagePipeline::ScaleImage(pInfo, size, m_resamplers);
             }
             catch (CException* e)
             {
@@ -94,7 +94,7 @@ namespace ImagePipeline
         ImageAgentPipelineBalanced(IImagePipelineDialog* dialog, ISource<bool>& cancel, ITarget<ErrorInfo>& errorTarget, double noiseLevel, int filterTaskCount) : AgentBase(dialog->GetWindow(), cancel, errorTarget),
             m_multiplexSequence(kFirstImage),
             m_imageProcessedCount(0),
-            m_governor(GetPipelineCapacity() * 3),
+            m_governor(GetMaximumImagesInFlight()),
             m_scaler(nullptr),
             m_multiplexer(nullptr),
             m_displayer(nullptr),
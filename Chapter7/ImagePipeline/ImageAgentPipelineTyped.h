@@ -0,0 +1,135 @@
+//===============================================================================
+// Microsoft patterns & practices
+// Parallel Programming Guide
+//===============================================================================
+// Copyright  Microsoft Corporation.  All rights reserved.
+// This code released under the terms of the 
+// Microsoft patterns & practices license (http://parallelpatterns.codeplex.com/license).
+//===============================================================================
+
+#pragma once
+
+#include <vector>
+#include <agents.h>
+
+#include "AgentBase.h"
+#include "pipeline_extras.h"
+#include "ImageInfo.h"
+#include "ImagePipelineDlg.h"
+#include "utilities.h"
+
+#ifdef _DEBUG
+#define new DEBUG_NEW
+#endif
+
+// The ImageAgentPipelineTyped pipeline expresses the stages of ImageAgentPipelineControlFlow as typed stage
+// functions of a samples::pipeline. The stages are connected by bounded rings, so the loader waits when the
+// scaler falls behind without the need for a PipelineGovernor.
+
+// Like ImageAgentPipelineBalanced, it runs the filter stage, the most expensive one, on several threads. Here 
+// the filter is declared a parallel stage and the display a serial in-order stage, and the pipeline does the 
+// load balancing and the reordering that the balanced pipeline codes by hand.
+
+// To shutdown the pipeline the m_cancelMessage buffer is set to true. Once m_cancelMessage is true the
+// source stops loading images. Each stage then drains its input, skipping the work on any remaining images,
+// and the pipeline returns once the display stage has seen the last of them. No sentinel image is needed.
+
+// The pipeline records the service time, queue wait and queue size of every image in each stage in m_telemetry, 
+// and traces their percentiles and the utilization of each stage when it shuts down.
+
+// If one of the stages throws an exception then the AgentBase::ShutdownOnError method will notify the UI and
+// send a cancel message to shutdown the pipeline.
+
+namespace ImagePipeline
+{
+    using namespace ::std;
+    using namespace ::Concurrency;
+    using namespace ::Concurrency::samples;
+
+    class ImageAgentPipelineTyped : public AgentBase
+    {
+    private:
+        pipeline m_pipeline;
+        pipeline_telemetry m_telemetry;
+        SIZE m_imageDisplaySize;
+        double m_noiseLevel;
+
+    public:
+        ImageAgentPipelineTyped(IImagePipelineDialog* dialog, ISource<bool>& cancel, ITarget<ErrorInfo>& errorTarget, double noiseLevel) : AgentBase(dialog->GetWindow(), cancel, errorTarget),
+            m_telemetry(4),
+            m_noiseLevel(noiseLevel)
+        {
+            m_imageDisplaySize = dialog->GetImageSize();
+            m_pipeline = CreatePipeline();
+            const char* stageNames[] = { "Load", "Scale", "Filter", "Display" };
+            for (int i = 0; i < 4; ++i)
+                m_telemetry.set_stage_name(i, stageNames[i]);
+            m_pipeline.set_telemetry(m_telemetry);
+        }
+
+        int GetQueueSize(int queue) const { return static_cast<int>(m_pipeline.unsafe_queue_size(queue)); }
+
+        void run()
+        {
+            m_telemetry.start();
+            m_pipeline.run();
+            TraceTelemetry();
+            done();
+            TRACE("Shutdown complete\n");
+        }
+
+    private:
+        void TraceTelemetry()
+        {
+            pipeline_telemetry_snapshot snapshot = m_telemetry.snapshot();
+            for (size_t i = 0; i < snapshot.stages.size(); ++i)
+            {
+                const pipeline_stage_statistics& stage = snapshot.stages[i];
+                TRACE("%-7s x%d: %5.0f images, service p50 %6.1f p99 %6.1f p99.9 %6.1f ms, wait p50 %6.1f p99 %6.1f ms, queue p99 %d, utilization %4.2f%s\n", 
+                    stage.name.c_str(), static_cast<int>(stage.lanes), static_cast<double>(stage.count), 
+                    1e-6 * stage.service_p50, 1e-6 * stage.service_p99, 1e-6 * stage.service_p999, 1e-6 * stage.wait_p50, 1e-6 * stage.wait_p99, 
+                    static_cast<int>(stage.depth_p99), stage.utilization, (i == snapshot.bottleneck) ? " (bottleneck)" : "");
+            }
+        }
+
+        pipeline CreatePipeline()
+        {
+            vector<wstring> filenames = ListFilesInApplicationDirectory(L"jpg");
+            assert(filenames.size() > 1);
+            size_t next = 0;
+            int sequence = kFirstImage;
+            LARGE_INTEGER offset;
+            QueryPerformanceCounter(&offset);
+
+            // Each ring holds two images. With a parallel stage in the pipeline, at most two images per filter 
+            // thread are in flight at once.
+            const size_t connectionCapacity = 2;
+
+            return pipeline_source<ImageInfoPtr>([this, filenames, next, sequence, offset](ImageInfoPtr& pInfo) mutable -> bool
+                {
+                    while (!IsCancellationPending())
+                    {
+                        pInfo = this->LoadImage(sequence++, filenames[next], offset);
+                        next = (next + 1) % filenames.size();
+                        if (nullptr != pInfo)
+                            return true;
+                    }
+                    return false;
+                }, connectionCapacity)
+                | pipeline_stage([this](ImageInfoPtr pInfo) -> ImageInfoPtr
+                {
+                    this->ScaleImage(pInfo, m_imageDisplaySize);
+                    return pInfo;
+                })
+                | pipeline_stage([this](ImageInfoPtr pInfo) -> ImageInfoPtr
+                {
+                    this->FilterImage(pInfo, m_noiseLevel);
+                    return pInfo;
+                }, pipeline_parallel)
+                | pipeline_sink([this](ImageInfoPtr pInfo)
+                {
+                    this->DisplayImage(pInfo);
+                });
+        }
+    };
+};
@@ -9,37 +9,81 @@
 
 #include "stdafx.h"
 
+#include "image_extras.h"
 #include "AgentBase.h"
-#include "BitmapUtilities.h"
 #include "ImageInfo.h"
 #include "utilities.h"
 
 namespace ImagePipeline
 {
-    using namespace BitmapUtilities;
+    using namespace ::Concurrency::samples;
 
-    ImageInfo::ImageInfo(int sequenceNumber, const wstring& fileName, Bitmap* const originalImage, const LARGE_INTEGER& clockOffset) :
+    namespace
+    {
+        // Building the noise table of a noise_filter takes longer than filtering an image, so the filter for the
+        // last noise level is kept. Filterers that still use a replaced filter hold on to it with their pointer.
+        critical_section g_noiseFilterLock;
+        shared_ptr<const noise_filter> g_pNoiseFilter;
+
+        shared_ptr<const noise_filter> GetNoiseFilter(double noiseAmount)
+        {
+            critical_section::scoped_lock lock(g_noiseFilterLock);
+            if (nullptr == g_pNoiseFilter || g_pNoiseFilter->standard_deviation() != noiseAmount)
+                g_pNoiseFilter = make_shared<noise_filter>(noiseAmount);
+            return g_pNoiseFilter;
+        }
+
+        // Recycles the pixels of the bitmaps the pipelines load and scale, as the headless pipeline does.
+        image_buffer_pool g_bufferPool(AgentBase::GetMaximumImagesInFlight());
+
+        // A 24 bpp bitmap whose pixels come from g_bufferPool and go back to it when the bitmap is deleted.
+        shared_ptr<Bitmap> CreatePooledBitmap(int width, int height)
+        {
+            const int stride = (width * 3 + 3) & ~3;
+            size_t size = static_cast<size_t>(stride) * height;
+            byte* pixels = g_bufferPool.allocate(size);
+            return shared_ptr<Bitmap>(new Bitmap(width, height, stride, PixelFormat24bppRGB, pixels),
+                [pixels, size](Bitmap* pBitmap) { delete pBitmap; g_bufferPool.deallocate(pixels, size); });
+        }
+    };
+
+    ImageInfo::ImageInfo(int sequenceNumber, const wstring& fileName, const shared_ptr<Bitmap>& pImage, const LARGE_INTEGER& clockOffset) :
         m_sequenceNumber(sequenceNumber),
         m_fileName(fileName),
-        m_pBitmap(nullptr),
+        m_pBitmap(pImage),
         m_currentImagePerformance(sequenceNumber)
     {
-        m_pBitmap = shared_ptr<Bitmap>(new Bitmap(originalImage->GetWidth(), originalImage->GetHeight(), PixelFormat24bppRGB));
-        CopyBitmap(originalImage, m_pBitmap.get());
         m_currentImagePerformance.SetClockOffset(clockOffset);
     }
 
-    void ImageInfo::ResizeImage(const SIZE& size)
+    void ImageInfo::ResizeImage(const SIZE& size, image_resampler_cache& resamplers)
     {
         if (nullptr == m_pBitmap.get())
         {
-            m_pBitmap = shared_ptr<Bitmap>(new Bitmap(size.cx, size.cy, PixelFormat24bppRGB));
+            m_pBitmap = CreatePooledBitmap(size.cx, size.cy);
             return;
         }
-        shared_ptr<Bitmap> pNewBitmap = shared_ptr<Bitmap>(new Bitmap(size.cx, size.cy, PixelFormat24bppRGB)); 
-        Graphics graphics(pNewBitmap.get());
-        graphics.DrawImage(m_pBitmap.get(), 0, 0, size.cx, size.cy);
-        m_pBitmap = shared_ptr<Bitmap>(pNewBitmap);
+        shared_ptr<Bitmap> pNewBitmap = CreatePooledBitmap(size.cx, size.cy);
+        UINT width = m_pBitmap->GetWidth();
+        UINT height = m_pBitmap->GetHeight();
+        Rect sourceRect(0, 0, width, height);
+        Rect targetRect(0, 0, size.cx, size.cy);
+        BitmapData sourceData;
+        BitmapData targetData;
+        Status st = m_pBitmap->LockBits(&sourceRect, ImageLockModeRead, PixelFormat24bppRGB, &sourceData);
+        assert(st == Ok);
+        st = pNewBitmap->LockBits(&targetRect, ImageLockModeWrite, PixelFormat24bppRGB, &targetData);
+        assert(st == Ok);
+
+        // Bilinear, like the default interpolation mode of Graphics::DrawImage, straight on the three byte pixels.
+        shared_ptr<const image_resampler> pResampler = resamplers.get(static_cast<int>(width), static_cast<int>(height),
+            size.cx, size.cy, resample_bilinear);
+        pResampler->resample(static_cast<const byte*>(sourceData.Scan0), sourceData.Stride,
+            static_cast<byte*>(targetData.Scan0), targetData.Stride, 3);
+
+        pNewBitmap->UnlockBits(&targetData);
+        m_pBitmap->UnlockBits(&sourceData);
+        m_pBitmap = pNewBitmap;
     }
 
     void ImageInfo::PhaseStart(int phase)
@@ -67,22 +111,34 @@ namespace ImagePipeline
         unique_ptr<Bitmap> temp = unique_ptr<Bitmap>(new Bitmap(filePath.c_str()));
         if (temp->GetWidth() == 0 || temp->GetHeight() == 0)
             AfxThrowFileException(CFileException::invalidFile, 0, filePath.c_str());
-        unique_ptr<Bitmap> img = unique_ptr<Bitmap>(temp->Clone(0, 0, temp->GetWidth(), temp->GetHeight(), PixelFormat24bppRGB));
+
+        // Decode straight into pooled pixels, instead of cloning into a new bitmap and copying that again.
+        shared_ptr<Bitmap> img = CreatePooledBitmap(temp->GetWidth(), temp->GetHeight());
+        Rect rect(0, 0, temp->GetWidth(), temp->GetHeight());
+        BitmapData targetData;
+        Status st = img->LockBits(&rect, ImageLockModeWrite, PixelFormat24bppRGB, &targetData);
+        assert(st == Ok);
+        BitmapData sourceData = targetData;
+        st = temp->LockBits(&rect, ImageLockModeRead | ImageLockModeUserInputBuf, PixelFormat24bppRGB, &sourceData);
+        assert(st == Ok);
+        temp->UnlockBits(&sourceData);
+        img->UnlockBits(&targetData);
+
         size_t i = filePath.find_last_of(L"/\\");
         wstring name = filePath.substr(i + 1);
-        ImageInfoPtr pInfo = ImageInfoPtr(new ImageInfo(sequence, name, img.get(), clockOffset));
+        ImageInfoPtr pInfo = ImageInfoPtr(new ImageInfo(sequence, name, img, clockOffset));
 
         pInfo->PhaseEnd(kLoad, start);
         return pInfo;
     }
 
-    void ScaleImage(ImageInfoPtr pInfo, const SIZE& size)
+    void ScaleImage(ImageInfoPtr pInfo, const SIZE& size, image_resampler_cache& resamplers)
     {
         assert(nullptr != pInfo);
 
         pInfo->PhaseStart(kScale);
 
-        pInfo->ResizeImage(size);
+        pInfo->ResizeImage(size, resamplers);
         Pen pen(Color::Black, 15.0);
         Graphics graphics(pInfo->GetBitmapPtr());
         graphics.DrawRectangle(&pen, 0, 0, size.cx, size.cy);
@@ -90,29 +146,13 @@ namespace ImagePipeline
         pInfo->PhaseEnd(kScale);
     }
 
-    UINT AddPixelNoise(UINT pixel, double noiseAmount)
-    {
-        byte A = pixel;
-        byte R = pixel >> RED_SHIFT;
-        byte G = pixel >> GREEN_SHIFT;
-        byte B = pixel >> BLUE_SHIFT;
-
-        int newR = R + (int)NextGaussianValue(0.0, noiseAmount);
-        int newG = G + (int)NextGaussianValue(0.0, noiseAmount);
-        int newB = B + (int)NextGaussianValue(0.0, noiseAmount);
-
-        R = max(0, min(newR, 255));
-        G = max(0, min(newG, 255));
-        B = max(0, min(newB, 255));
-        return Color::MakeARGB(A, R, G, B);
-    }
-
     void FilterImage(ImageInfoPtr pInfo, double noiseAmount)
     {
         assert(nullptr != pInfo);
 
         pInfo->PhaseStart(kFilter);
 
+        shared_ptr<const noise_filter> pFilter = GetNoiseFilter(noiseAmount);
         Bitmap* bitmap = pInfo->GetBitmapPtr();
         UINT width = bitmap->GetWidth();
         UINT height = bitmap->GetHeight();
@@ -120,27 +160,16 @@ namespace ImagePipeline
         BitmapData bitmapData;
         Status st = bitmap->LockBits(
             &rect,
-            ImageLockModeWrite,
+            ImageLockModeRead | ImageLockModeWrite,
             PixelFormat24bppRGB,
             &bitmapData);
         assert(st == Ok);
 
-        UINT* pixels = (UINT*)bitmapData.Scan0;
-
-        for (UINT y = 0; y < bitmap->GetHeight(); y++)
-        {
-            for (UINT x = 0; x < bitmap->GetWidth(); x++)
-            {
-                UINT index = y * bitmapData.Stride / 4 + x;
-                UINT cur = pixels[index];
-                byte A = cur;
-                byte R = cur >> RED_SHIFT;
-                byte G = cur >> GREEN_SHIFT;
-                byte B = cur >> BLUE_SHIFT;
-
-                pixels[index] = AddPixelNoise(pixels[index], noiseAmount);
-            }
-        }
+        // Each row of three byte pixels gets the noise of its own stream, numbered by image and row.
+        byte* pixels = static_cast<byte*>(bitmapData.Scan0);
+        const unsigned long long stream = static_cast<unsigned long long>(pInfo->GetSequence()) << 32;
+        for (UINT y = 0; y < height; y++)
+            pFilter->filter_row(pixels + y * bitmapData.Stride, static_cast<int>(width), 3, stream + y);
 
         bitmap->UnlockBits(&bitmapData);
 
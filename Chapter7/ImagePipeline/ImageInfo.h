@@ -14,6 +14,7 @@
 #include <tuple>
 #include <gdiplus.h>
 
+#include "image_extras.h"
 #include "PipelinePerformanceData.h"
 #include "utilities.h"
 
@@ -33,7 +34,7 @@ namespace ImagePipeline
         ImagePerformanceData m_currentImagePerformance;
 
     public:
-        ImageInfo(int sequenceNumber, const wstring& fileName, Bitmap* const originalImage, const LARGE_INTEGER& clockOffset);
+        ImageInfo(int sequenceNumber, const wstring& fileName, const shared_ptr<Bitmap>& pImage, const LARGE_INTEGER& clockOffset);
 
         Bitmap* GetBitmapPtr() const { return m_pBitmap.get(); }
 
@@ -43,7 +44,7 @@ namespace ImagePipeline
 
         ImagePerformanceData GetPerformanceData() const { return m_currentImagePerformance; }
 
-        void ResizeImage(const SIZE& size);
+        void ResizeImage(const SIZE& size, image_resampler_cache& resamplers);
 
         void PhaseStart(int phase);
 
@@ -64,7 +65,7 @@ namespace ImagePipeline
 
     void FilterImage(ImageInfoPtr pInfo, double noiseAmount);
 
-    void ScaleImage(ImageInfoPtr pInfo, const SIZE& size);
+    void ScaleImage(ImageInfoPtr pInfo, const SIZE& size, image_resampler_cache& resamplers);
 
     void DisplayImage(ImageInfoPtr pInfo, AgentBase* const agent);
 };
\ No newline at end of file
@@ -19,6 +19,9 @@
 #include "ImageAgentPipelineDataflow.h"
 #include "ImageAgentPipelineControlflow.h"
 #include "ImageAgentPipelineBalanced.h"
+#if defined(SAMPLES_STD_THREADS)
+#include "ImageAgentPipelineTyped.h"
+#endif
 #include "afxdialogex.h"
 
 #ifdef _DEBUG
@@ -114,6 +117,8 @@ void ImagePipelineDlg::OnPaint()
         // The display phase actually ends here. Right before updating the pipeline's performance
         m_currentImagePerformance.SetEndTick(kDisplay);
         m_pipelinePerformance.Update(m_currentImagePerformance);
+        for (int i = kLoaderToScaler; i <= kFiltererToDisplayer; i++)
+            m_pipelinePerformance.UpdateQueueSize(i, GetQueueSize(i));
         UpdateData(false);
     }
     CDialogEx::OnPaint();
@@ -163,6 +168,11 @@ void ImagePipelineDlg::OnBnClickedButtonStart()
     case kBalancedPipeline:
         m_agent = unique_ptr<AgentBase>(static_cast<AgentBase*>(new ImageAgentPipelineBalanced(this, m_cancelMessage, m_errorMessages, noiseLevel, 8)));
         break;
+#if defined(SAMPLES_STD_THREADS)
+    case kTypedPipeline:
+        m_agent = unique_ptr<AgentBase>(static_cast<AgentBase*>(new ImageAgentPipelineTyped(this, m_cancelMessage, m_errorMessages, noiseLevel)));
+        break;
+#endif
     default:
         assert(false);
     }
@@ -198,6 +208,7 @@ void ImagePipelineDlg::StopAgent()
     send(m_cancelMessage, true);
     agent::wait(m_agent.get());
     m_agent = nullptr;
+    m_pipelinePerformance.TraceSummary();
 }
 
 void ImagePipelineDlg::SetButtonState(bool isRunning)
@@ -210,6 +221,12 @@ void ImagePipelineDlg::SetButtonState(bool isRunning)
     GetDlgItem(IDC_RADIO_AGENT1)->EnableWindow(!isRunning && isEnabled);
     GetDlgItem(IDC_RADIO_AGENT2)->EnableWindow(!isRunning && isEnabled);
     GetDlgItem(IDC_RADIO_AGENT3)->EnableWindow(!isRunning && isEnabled);
+#if defined(SAMPLES_STD_THREADS)
+    GetDlgItem(IDC_RADIO_AGENT4)->EnableWindow(!isRunning && isEnabled);
+#else
+    // The typed pipeline needs the C++11 thread support library.
+    GetDlgItem(IDC_RADIO_AGENT4)->EnableWindow(false);
+#endif
 }
 
 void ImagePipelineDlg::ReportError(const ErrorInfo& error)
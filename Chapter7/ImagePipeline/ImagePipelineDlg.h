@@ -50,7 +50,8 @@ private:
         kSequential = 0,
         kPipelineDataFlow = 1,
         kPipelineControlFlow = 2,
-        kBalancedPipeline = 3
+        kBalancedPipeline = 3,
+        kTypedPipeline = 4
     };
 
     unique_ptr<AgentBase> m_agent;
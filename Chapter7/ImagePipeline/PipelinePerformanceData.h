@@ -10,12 +10,20 @@
 #pragma once
 
 #include <vector>
+#include <memory>
+#include <algorithm>
 
 #include "ImagePerformanceData.h"
+#include "telemetry_extras.h"
 
 namespace ImagePipeline
 {
     using namespace ::std;
+    using namespace ::Concurrency::samples;
+
+    // Besides the totals behind the averages shown in the dialog, the phase times, queue times and queue sizes of
+    // every image are kept in histograms, which give percentiles. The slowest images, not the average ones, are
+    // what makes the display stutter. All methods are called on the UI thread.
 
     class PipelinePerformanceData
     {
@@ -26,6 +34,9 @@ namespace ImagePipeline
         LARGE_INTEGER m_clockFrequency;
         vector<LONGLONG> m_totalPhaseTime;
         vector<LONGLONG> m_totalQueueTime;
+        vector<shared_ptr<log_histogram>> m_phaseTimes;
+        vector<shared_ptr<log_histogram>> m_queueTimes;
+        vector<shared_ptr<log_histogram>> m_queueSizes;
 
     public:
         PipelinePerformanceData() :
@@ -37,6 +48,13 @@ namespace ImagePipeline
               QueryPerformanceFrequency(&m_clockFrequency);
               m_totalPhaseTime.resize(4, 0);
               m_totalQueueTime.resize(3, 0);
+              for (int i = 0; i < 4; i++)
+                  m_phaseTimes.push_back(make_shared<log_histogram>());
+              for (int i = 0; i < 3; i++)
+              {
+                  m_queueTimes.push_back(make_shared<log_histogram>());
+                  m_queueSizes.push_back(make_shared<log_histogram>());
+              }
               Reset();
           }
 
@@ -46,6 +64,9 @@ namespace ImagePipeline
               m_currentTime.QuadPart = m_startTime.QuadPart = 0;
               fill(m_totalPhaseTime.begin(), m_totalPhaseTime.end(), 0);
               fill(m_totalQueueTime.begin(), m_totalQueueTime.end(), 0);
+              for_each(m_phaseTimes.begin(), m_phaseTimes.end(), [](shared_ptr<log_histogram>& h) { h->reset(); });
+              for_each(m_queueTimes.begin(), m_queueTimes.end(), [](shared_ptr<log_histogram>& h) { h->reset(); });
+              for_each(m_queueSizes.begin(), m_queueSizes.end(), [](shared_ptr<log_histogram>& h) { h->reset(); });
           }
 
           int GetImageCount() { return m_imageCount; }
@@ -58,6 +79,46 @@ namespace ImagePipeline
 
           double GetTimePerImage() { return 1000.0 * GetElapsedTime() / (double)m_imageCount; }
 
+          // Percentiles are in milliseconds; fraction is 0.5 for the median, 0.99 for the 99th percentile.
+
+          double GetPhaseTimePercentile(int phase, double fraction) { return TicksToMilliseconds(m_phaseTimes[phase]->percentile(fraction)); }
+
+          double GetQueueTimePercentile(int queue, double fraction) { return TicksToMilliseconds(m_queueTimes[queue]->percentile(fraction)); }
+
+          int GetQueueSizePercentile(int queue, double fraction) { return static_cast<int>(m_queueSizes[queue]->percentile(fraction)); }
+
+          // The average number of images in the phase at once: the fraction of the time a serial phase is busy. 
+          // Phases that run on several threads can exceed one.
+
+          double GetPhaseUtilization(int phase) 
+          { 
+              LONGLONG elapsed = m_currentTime.QuadPart - m_startTime.QuadPart;
+              return (elapsed <= 0) ? 0.0 : (double)m_totalPhaseTime[phase] / (double)elapsed;
+          }
+
+          int GetBottleneckPhase()
+          {
+              int bottleneck = kLoad;
+              for (int i = kLoad + 1; i <= kDisplay; i++)
+                  if (m_totalPhaseTime[i] > m_totalPhaseTime[bottleneck])
+                      bottleneck = i;
+              return bottleneck;
+          }
+
+          void TraceSummary()
+          {
+              const char* phaseNames[] = { "Load", "Scale", "Filter", "Display" };
+              TRACE("%d images, %.1f ms per image\n", m_imageCount, GetTimePerImage());
+              for (int i = kLoad; i <= kDisplay; i++)
+                  TRACE("  %-7s: p50 %6.1f ms, p99 %6.1f ms, p99.9 %6.1f ms, utilization %4.2f%s\n", phaseNames[i], 
+                      GetPhaseTimePercentile(i, 0.5), GetPhaseTimePercentile(i, 0.99), GetPhaseTimePercentile(i, 0.999), 
+                      GetPhaseUtilization(i), (i == GetBottleneckPhase()) ? " (bottleneck)" : "");
+              for (int i = kLoaderToScaler; i <= kFiltererToDisplayer; i++)
+                  TRACE("  Queue %d: wait p50 %6.1f ms, p99 %6.1f ms, p99.9 %6.1f ms, size p50 %d, p99 %d\n", i + 1, 
+                      GetQueueTimePercentile(i, 0.5), GetQueueTimePercentile(i, 0.99), GetQueueTimePercentile(i, 0.999), 
+                      GetQueueSizePercentile(i, 0.5), GetQueueSizePercentile(i, 0.99));
+          }
+
           void Start()
           {
               QueryPerformanceCounter(&m_startTime);
@@ -67,11 +128,27 @@ namespace ImagePipeline
           {
               QueryPerformanceCounter(&m_currentTime);
               for (int i = 0; i < 4; i++)
+              {
                   m_totalPhaseTime[i] += data.GetPhaseDuration(i);
+                  m_phaseTimes[i]->record(NonNegative(data.GetPhaseDuration(i)));
+              }
               for (int i = 0; i < 3; i++)
+              {
                   m_totalQueueTime[i] += data.GetQueueDuration(i);
+                  m_queueTimes[i]->record(NonNegative(data.GetQueueDuration(i)));
+              }
               m_imageCount = data.GetSequence();
           }
+
+          void UpdateQueueSize(int queue, int size)
+          {
+              m_queueSizes[queue]->record(NonNegative(size));
+          }
+    private:
+        static unsigned long long NonNegative(LONGLONG ticks) { return (ticks < 0) ? 0 : static_cast<unsigned long long>(ticks); }
+
+        double TicksToMilliseconds(unsigned long long ticks) { return 1000.0 * (double)ticks / (double)m_clockFrequency.QuadPart; }
+
     private:
         // Disable copy constructor and assignment.
         PipelinePerformanceData(const PipelinePerformanceData& rhs);
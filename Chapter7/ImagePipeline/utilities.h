@@ -36,6 +36,4 @@ namespace ImagePipeline
         while (!cancelled);
         return f;
     }
-
-    double NextGaussianValue(double mean, double standardDeviation);
 };
@@ -0,0 +1,174 @@
+//===============================================================================
+// Microsoft patterns & practices
+// Parallel Programming Guide
+//===============================================================================
+// Copyright  Microsoft Corporation.  All rights reserved.
+// This code released under the terms of the
+// Microsoft patterns & practices license (http://parallelpatterns.codeplex.com/license).
+//===============================================================================
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace PipelineBenchmark
+{
+    using namespace ::std;
+
+    enum StageCostKind
+    {
+        kNoCost,
+        kSpinCost,      // busy loop for a number of microseconds, like DoCpuIntensiveOperation
+        kMemoryCost,    // read a number of kilobytes from a buffer that does not fit into the caches
+        kSleepCost      // sleep for a number of microseconds, like a stage that waits for I/O
+    };
+
+    // The work a stage does for each sentence, written as none, spin:US, memory:KB or sleep:US.
+
+    struct StageCost
+    {
+        StageCostKind kind;
+        unsigned int amount;
+
+        StageCost() : kind(kNoCost), amount(0) {}
+
+        StageCost(StageCostKind k, unsigned int a) : kind(k), amount(a) {}
+
+        static bool Parse(const string& text, StageCost& cost)
+        {
+            if (text == "none")
+            {
+                cost = StageCost();
+                return true;
+            }
+
+            const char* names[] = { "spin", "memory", "sleep" };
+            const StageCostKind kinds[] = { kSpinCost, kMemoryCost, kSleepCost };
+            size_t colon = text.find(':');
+            if (colon == string::npos || colon + 1 == text.size())
+                return false;
+            for (int i = 0; i < 3; ++i)
+            {
+                if (text.compare(0, colon, names[i]) == 0)
+                {
+                    // strtoul would accept a sign and negate the amount.
+                    const char* digits = text.c_str() + colon + 1;
+                    if (*digits < '0' || *digits > '9')
+                        return false;
+                    char* end = nullptr;
+                    unsigned long long amount = strtoull(digits, &end, 10);
+                    if (*end != '\0' || amount > UINT_MAX)
+                        return false;
+                    cost = StageCost(kinds[i], static_cast<unsigned int>(amount));
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        string ToString() const
+        {
+            const char* names[] = { "none", "spin", "memory", "sleep" };
+            if (kind == kNoCost)
+                return names[kind];
+            return string(names[kind]) + ":" + to_string(static_cast<unsigned long long>(amount));
+        }
+    };
+
+    // The buffer that memory bound stages read. At 64 MB it is larger than the last level cache of the machines
+    // the benchmark targets, so a stage that reads it streams from memory.
+
+    class MemoryArena
+    {
+    private:
+        vector<unsigned int> m_words;
+
+    public:
+        static const size_t kWords = 16 * 1024 * 1024;
+
+        MemoryArena() : m_words(kWords)
+        {
+            for (size_t i = 0; i < kWords; ++i)
+                m_words[i] = static_cast<unsigned int>(i * 2654435761u);
+        }
+
+        const unsigned int* Words() const { return &m_words[0]; }
+    };
+
+    // Does the work of a StageCost for one sentence and returns a checksum so that the compiler cannot drop a
+    // memory bound stage. Each thread of a stage uses its own copy, which keeps its own position in the arena.
+    // The stages start a quarter of the arena apart, and each copy takes the next lane of its stage when it first
+    // runs and starts a further kLaneOffset words on per lane, so that the lanes of a parallel stage read
+    // different memory rather than the cache lines another lane has just brought in.
+
+    class StageWork
+    {
+    private:
+        // About 0.618 of a quarter of the arena, rounded to whole cache lines, so that the lanes of a stage spread
+        // over the arena without landing on the start of another stage.
+        static const size_t kLaneOffset = 2593344;
+
+        StageCost m_cost;
+        const MemoryArena* m_pArena;
+        size_t m_position;
+        bool m_started;
+        shared_ptr<atomic<size_t>> m_pLanes;
+
+    public:
+        StageWork(const StageCost& cost, const MemoryArena* pArena, size_t stage) :
+            m_cost(cost),
+            m_pArena(pArena),
+            m_position((stage * MemoryArena::kWords / 4) % MemoryArena::kWords),
+            m_started(false),
+            m_pLanes(make_shared<atomic<size_t>>(0))
+        {
+        }
+
+        unsigned int Run()
+        {
+            if (!m_started)
+            {
+                const size_t lane = (*m_pLanes)++;
+                m_position = (m_position + lane * kLaneOffset % MemoryArena::kWords) % MemoryArena::kWords;
+                m_started = true;
+            }
+
+            switch (m_cost.kind)
+            {
+            case kSpinCost:
+                {
+                    chrono::steady_clock::time_point end = chrono::steady_clock::now() + chrono::microseconds(m_cost.amount);
+                    while (chrono::steady_clock::now() < end)
+                    {
+                    }
+                    return 0;
+                }
+            case kMemoryCost:
+                {
+                    const unsigned int* words = m_pArena->Words();
+                    size_t count = static_cast<size_t>(m_cost.amount) * 1024 / sizeof(unsigned int);
+                    unsigned int sum = 0;
+                    for (size_t i = 0; i < count; ++i)
+                    {
+                        sum += words[m_position];
+                        if (++m_position == MemoryArena::kWords)
+                            m_position = 0;
+                    }
+                    return sum;
+                }
+            case kSleepCost:
+                this_thread::sleep_for(chrono::microseconds(m_cost.amount));
+                return 0;
+            default:
+                return 0;
+            }
+        }
+    };
+};
@@ -0,0 +1,455 @@
+//===============================================================================
+// Microsoft patterns & practices
+// Parallel Programming Guide
+//===============================================================================
+// Copyright  Microsoft Corporation.  All rights reserved.
+// This code released under the terms of the
+// Microsoft patterns & practices license (http://parallelpatterns.codeplex.com/license).
+//===============================================================================
+
+// A command line benchmark for the four stage pipeline of the BasicPipeline sample. It runs the stages one
+// after the other on one thread, as SequentialExample does, and then as a typed pipeline for each of a list
+// of pipeline limits, and writes the throughput, the latency percentiles and the speedup over the sequential
+// version of every run as CSV or JSON.
+
+// In place of Stage1AdditionalWork..Stage4AdditionalWork each stage does configurable work for every sentence:
+// it spins, reads memory or sleeps. The benchmark only uses the portable parts of the Utilities folder and does
+// not wait for a key press, so it also builds and runs on Linux, for example with
+//
+//     g++ -std=c++11 -O2 -pthread -I ../../Utilities main.cpp -o PipelineBenchmark
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "pipeline_extras.h"
+#include "sync_extras.h"
+#include "StageCost.h"
+
+using namespace ::std;
+using namespace ::Concurrency::samples;
+using namespace ::PipelineBenchmark;
+
+const int kStageCount = 4;
+const char* g_stageNames[kStageCount] = { "Read phrase", "Correct case", "Create sentences", "Write sentences" };
+
+// The checksums of the memory bound stages end up here, so that the compiler has to keep their reads.
+volatile unsigned int g_checksum = 0;
+
+struct BenchmarkOptions
+{
+    StageCost costs[kStageCount];
+    bool parallel[kStageCount];
+    int sentences;
+    // The most sentences in flight between the first and the last stage, or 0 for no limit but the connections.
+    vector<int> limits;
+    size_t capacity;
+    size_t degree;
+    int runs;
+    bool fusion;
+    bool json;
+    string outputPath;
+
+    // The defaults are the 1/1/1/8 ms of the BasicPipeline stages and the g_sentencePipelineLimit of its governor.
+    BenchmarkOptions() : sentences(200), capacity(32), degree(0), runs(1), fusion(true), json(false)
+    {
+        for (int i = 0; i < kStageCount; ++i)
+        {
+            costs[i] = StageCost(kSpinCost, (i == kStageCount - 1) ? 8000 : 1000);
+            parallel[i] = false;
+        }
+        limits.push_back(10);
+    }
+};
+
+struct Sentence
+{
+    unsigned long long started;
+    unsigned int checksum;
+};
+
+struct RunResult
+{
+    string variant;
+    int limit;
+    int run;
+    double seconds;
+    double throughput;
+    unsigned long long latencyP50;
+    unsigned long long latencyP90;
+    unsigned long long latencyP99;
+    unsigned long long latencyP999;
+    unsigned long long latencyMax;
+    double speedup;
+    pipeline_telemetry_snapshot telemetry;
+};
+
+// Hands each thread of the last stage a latency histogram of its own, as a log_histogram only takes values
+// from one thread at a time, and merges them once the run is over.
+
+class LatencyRecorders
+{
+private:
+    mutex m_lock;
+    vector<unique_ptr<log_histogram>> m_histograms;
+
+public:
+    log_histogram* NewHistogram()
+    {
+        lock_guard<mutex> lock(m_lock);
+        m_histograms.push_back(unique_ptr<log_histogram>(new log_histogram()));
+        return m_histograms.back().get();
+    }
+
+    void MergeInto(log_histogram& latency)
+    {
+        lock_guard<mutex> lock(m_lock);
+        for (size_t i = 0; i < m_histograms.size(); ++i)
+            latency.merge(*m_histograms[i]);
+    }
+};
+
+void SetLatency(RunResult& result, const log_histogram& latency)
+{
+    result.latencyP50 = latency.percentile(0.5);
+    result.latencyP90 = latency.percentile(0.9);
+    result.latencyP99 = latency.percentile(0.99);
+    result.latencyP999 = latency.percentile(0.999);
+    result.latencyMax = latency.max_value();
+}
+
+RunResult RunSequential(const BenchmarkOptions& options, const MemoryArena* pArena, int run)
+{
+    vector<StageWork> work;
+    for (int i = 0; i < kStageCount; ++i)
+        work.push_back(StageWork(options.costs[i], pArena, i));
+    unique_ptr<log_histogram> latency(new log_histogram());
+    unsigned int checksum = 0;
+
+    unsigned long long start = pipeline_telemetry::timestamp();
+    for (int sentence = 0; sentence < options.sentences; ++sentence)
+    {
+        unsigned long long started = pipeline_telemetry::timestamp();
+        for (int i = 0; i < kStageCount; ++i)
+            checksum += work[i].Run();
+        latency->record(pipeline_telemetry::timestamp() - started);
+    }
+    double seconds = 1e-9 * (pipeline_telemetry::timestamp() - start);
+
+    RunResult result;
+    g_checksum += checksum;
+    result.variant = "sequential";
+    result.limit = 0;
+    result.run = run;
+    result.seconds = seconds;
+    result.throughput = options.sentences / seconds;
+    result.speedup = 1.0;
+    SetLatency(result, *latency);
+    return result;
+}
+
+// The pipeline telemetry times each call of the source, so the source only admits sentences, which is where a
+// limited run waits for a slot, and the first stage does the work of reading a phrase. The admission stage is
+// dropped from the snapshot, so that it is neither reported nor taken for the bottleneck.
+pipeline_telemetry_snapshot RemoveAdmissionStage(const pipeline_telemetry_snapshot& snapshot)
+{
+    pipeline_telemetry_snapshot result = snapshot;
+    result.stages.erase(result.stages.begin());
+    result.bottleneck = 0;
+    for (size_t i = 1; i < result.stages.size(); ++i)
+    {
+        if (result.stages[i].utilization > result.stages[result.bottleneck].utilization)
+            result.bottleneck = i;
+    }
+    return result;
+}
+
+RunResult RunPipeline(const BenchmarkOptions& options, const MemoryArena* pArena, int limit, int run)
+{
+    pipeline_stage_mode modes[kStageCount];
+    for (int i = 0; i < kStageCount; ++i)
+        modes[i] = options.parallel[i] ? pipeline_parallel : pipeline_serial_in_order;
+
+    // The source takes a slot for each sentence and the last stage frees it, as with a PipelineGovernor.
+    unique_ptr<counting_semaphore> slots((limit > 0) ? new counting_semaphore(limit) : nullptr);
+    counting_semaphore* pSlots = slots.get();
+    LatencyRecorders recorders;
+    LatencyRecorders* pRecorders = &recorders;
+    atomic<unsigned int> checksum(0);
+    atomic<unsigned int>* pChecksum = &checksum;
+    int produced = 0;
+    const int sentences = options.sentences;
+
+    // Each thread of a stage runs its own copy of the stage function, and so has its own StageWork.
+    StageWork work0(options.costs[0], pArena, 0);
+    StageWork work1(options.costs[1], pArena, 1);
+    StageWork work2(options.costs[2], pArena, 2);
+    StageWork work3(options.costs[3], pArena, 3);
+    log_histogram* pLatency = nullptr;
+
+    pipeline benchmarkPipeline =
+        pipeline_source<Sentence>([&produced, sentences, pSlots](Sentence& sentence) -> bool
+        {
+            if (produced == sentences)
+                return false;
+            ++produced;
+            if (nullptr != pSlots)
+                pSlots->acquire();
+            sentence.started = pipeline_telemetry::timestamp();
+            sentence.checksum = 0;
+            return true;
+        }, options.capacity)
+        | pipeline_stage([work0](Sentence sentence) mutable -> Sentence
+        {
+            sentence.checksum += work0.Run();
+            return sentence;
+        }, modes[0], options.degree)
+        | pipeline_stage([work1](Sentence sentence) mutable -> Sentence
+        {
+            sentence.checksum += work1.Run();
+            return sentence;
+        }, modes[1], options.degree)
+        | pipeline_stage([work2](Sentence sentence) mutable -> Sentence
+        {
+            sentence.checksum += work2.Run();
+            return sentence;
+        }, modes[2], options.degree)
+        | pipeline_sink([work3, pLatency, pRecorders, pSlots, pChecksum](Sentence sentence) mutable
+        {
+            sentence.checksum += work3.Run();
+            if (nullptr == pLatency)
+                pLatency = pRecorders->NewHistogram();
+            pLatency->record(pipeline_telemetry::timestamp() - sentence.started);
+            pChecksum->fetch_add(sentence.checksum, memory_order_relaxed);
+            if (nullptr != pSlots)
+                pSlots->release();
+        }, modes[3], options.degree);
+
+    pipeline_telemetry telemetry(kStageCount + 1);
+    telemetry.set_stage_name(0, "Admit sentence");
+    for (int i = 0; i < kStageCount; ++i)
+        telemetry.set_stage_name(i + 1, g_stageNames[i]);
+    benchmarkPipeline.set_telemetry(telemetry);
+    if (!options.fusion)
+        benchmarkPipeline.set_fusion_threshold(0);
+
+    unsigned long long start = pipeline_telemetry::timestamp();
+    telemetry.start();
+    benchmarkPipeline.run();
+    double seconds = 1e-9 * (pipeline_telemetry::timestamp() - start);
+
+    RunResult result;
+    g_checksum += checksum.load();
+    result.variant = "pipeline";
+    result.limit = limit;
+    result.run = run;
+    result.seconds = seconds;
+    result.throughput = sentences / seconds;
+    result.speedup = 0.0;
+    result.telemetry = RemoveAdmissionStage(telemetry.snapshot());
+    unique_ptr<log_histogram> latency(new log_histogram());
+    recorders.MergeInto(*latency);
+    SetLatency(result, *latency);
+    return result;
+}
+
+void WriteCsv(FILE* out, const BenchmarkOptions& options, const vector<RunResult>& results)
+{
+    fprintf(out, "variant,limit,capacity,run,sentences,seconds,throughput,latency_p50_us,latency_p90_us,latency_p99_us,latency_p999_us,latency_max_us,speedup,bottleneck,bottleneck_utilization\n");
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const RunResult& r = results[i];
+        bool hasTelemetry = !r.telemetry.stages.empty();
+        fprintf(out, "%s,%d,%d,%d,%d,%.6f,%.3f,%.1f,%.1f,%.1f,%.1f,%.1f,%.3f,%s,%.3f\n", r.variant.c_str(), r.limit, static_cast<int>(options.capacity),
+            r.run, options.sentences, r.seconds, r.throughput, 1e-3 * r.latencyP50, 1e-3 * r.latencyP90, 1e-3 * r.latencyP99, 1e-3 * r.latencyP999,
+            1e-3 * r.latencyMax, r.speedup, hasTelemetry ? r.telemetry.stages[r.telemetry.bottleneck].name.c_str() : "",
+            hasTelemetry ? r.telemetry.stages[r.telemetry.bottleneck].utilization : 1.0);
+    }
+}
+
+void WriteJson(FILE* out, const BenchmarkOptions& options, const vector<RunResult>& results)
+{
+    fprintf(out, "{\n  \"sentences\": %d,\n  \"capacity\": %d,\n  \"degree\": %d,\n  \"fusion\": %s,\n  \"stages\": [",
+        options.sentences, static_cast<int>(options.capacity), static_cast<int>(options.degree), options.fusion ? "true" : "false");
+    for (int i = 0; i < kStageCount; ++i)
+    {
+        fprintf(out, "%s\n    { \"name\": \"%s\", \"cost\": \"%s\", \"parallel\": %s }", (i == 0) ? "" : ",", g_stageNames[i],
+            options.costs[i].ToString().c_str(), options.parallel[i] ? "true" : "false");
+    }
+    fprintf(out, "\n  ],\n  \"runs\": [");
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const RunResult& r = results[i];
+        fprintf(out, "%s\n    {\n      \"variant\": \"%s\", \"limit\": %d, \"run\": %d, \"seconds\": %.6f, \"throughput\": %.3f, \"speedup\": %.3f,\n",
+            (i == 0) ? "" : ",", r.variant.c_str(), r.limit, r.run, r.seconds, r.throughput, r.speedup);
+        fprintf(out, "      \"latency_us\": { \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f }",
+            1e-3 * r.latencyP50, 1e-3 * r.latencyP90, 1e-3 * r.latencyP99, 1e-3 * r.latencyP999, 1e-3 * r.latencyMax);
+        if (!r.telemetry.stages.empty())
+        {
+            fprintf(out, ",\n      \"bottleneck\": \"%s\",\n      \"stages\": [", r.telemetry.stages[r.telemetry.bottleneck].name.c_str());
+            for (size_t j = 0; j < r.telemetry.stages.size(); ++j)
+            {
+                const pipeline_stage_statistics& stage = r.telemetry.stages[j];
+                fprintf(out, "%s\n        { \"name\": \"%s\", \"threads\": %d, \"utilization\": %.3f, \"service_p50_us\": %.1f, \"service_p99_us\": %.1f, \"wait_p50_us\": %.1f, \"wait_p99_us\": %.1f, \"queue_p99\": %d }",
+                    (j == 0) ? "" : ",", stage.name.c_str(), static_cast<int>(stage.lanes), stage.utilization, 1e-3 * stage.service_p50,
+                    1e-3 * stage.service_p99, 1e-3 * stage.wait_p50, 1e-3 * stage.wait_p99, static_cast<int>(stage.depth_p99));
+            }
+            fprintf(out, "\n      ]");
+        }
+        fprintf(out, "\n    }");
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+
+void Help()
+{
+    printf("Usage: PipelineBenchmark [options]\n\n");
+    printf("  --stage<N> COST      work stage N (1-4) does for each sentence: none, spin:US, memory:KB or sleep:US\n");
+    printf("                       (default spin:1000 for stages 1-3 and spin:8000 for stage 4)\n");
+    printf("  --parallel N,...     stages 2-4 to run on several threads\n");
+    printf("  --degree N           threads of each parallel stage (default one per hardware thread)\n");
+    printf("  --sentences N        sentences per run (default 200)\n");
+    printf("  --limits N,...       sentences in flight in each pipeline run, 0 for no limit (default 10)\n");
+    printf("  --capacity N         elements each connection between stages holds (default 32)\n");
+    printf("  --runs N             runs of each variant (default 1)\n");
+    printf("  --no-fusion          never run a cheap stage on the thread of the stage before it\n");
+    printf("  --format csv|json    output format (default csv)\n");
+    printf("  --output FILE        write the results to FILE instead of the standard output\n");
+}
+
+bool ParseNumber(const char* text, int minimum, int& value)
+{
+    char* end = nullptr;
+    long number = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || number < minimum)
+        return false;
+    value = static_cast<int>(number);
+    return true;
+}
+
+bool ParseNumbers(const char* text, int minimum, vector<int>& values)
+{
+    values.clear();
+    string list(text);
+    size_t first = 0;
+    while (first <= list.size())
+    {
+        size_t comma = list.find(',', first);
+        if (comma == string::npos)
+            comma = list.size();
+        int value;
+        if (!ParseNumber(list.substr(first, comma - first).c_str(), minimum, value))
+            return false;
+        values.push_back(value);
+        first = comma + 1;
+    }
+    return !values.empty();
+}
+
+bool ParseOptions(int argc, char* argv[], BenchmarkOptions& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        string option = argv[i];
+        if (option == "--no-fusion")
+        {
+            options.fusion = false;
+            continue;
+        }
+        if (i + 1 == argc)
+            return false;
+        const char* value = argv[++i];
+        int number = 0;
+        vector<int> numbers;
+
+        if (option.size() == 8 && option.compare(0, 7, "--stage") == 0 && option[7] >= '1' && option[7] <= '4')
+        {
+            if (!StageCost::Parse(value, options.costs[option[7] - '1']))
+                return false;
+        }
+        else if (option == "--parallel")
+        {
+            if (!ParseNumbers(value, 2, numbers))
+                return false;
+            for (size_t j = 0; j < numbers.size(); ++j)
+            {
+                if (numbers[j] > kStageCount)
+                    return false;
+                options.parallel[numbers[j] - 1] = true;
+            }
+        }
+        else if (option == "--degree" && ParseNumber(value, 0, number))
+            options.degree = number;
+        else if (option == "--sentences" && ParseNumber(value, 1, number))
+            options.sentences = number;
+        else if (option == "--limits" && ParseNumbers(value, 0, numbers))
+            options.limits = numbers;
+        else if (option == "--capacity" && ParseNumber(value, 1, number))
+            options.capacity = number;
+        else if (option == "--runs" && ParseNumber(value, 1, number))
+            options.runs = number;
+        else if (option == "--format" && (strcmp(value, "csv") == 0 || strcmp(value, "json") == 0))
+            options.json = (strcmp(value, "json") == 0);
+        else if (option == "--output")
+            options.outputPath = value;
+        else
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    BenchmarkOptions options;
+    if (!ParseOptions(argc, argv, options))
+    {
+        Help();
+        return 1;
+    }
+
+    unique_ptr<MemoryArena> arena;
+    for (int i = 0; i < kStageCount; ++i)
+    {
+        if (options.costs[i].kind == kMemoryCost && nullptr == arena)
+            arena.reset(new MemoryArena());
+    }
+
+    vector<RunResult> results;
+    double sequentialThroughput = 0.0;
+    for (int run = 0; run < options.runs; ++run)
+    {
+        results.push_back(RunSequential(options, arena.get(), run));
+        sequentialThroughput += results.back().throughput / options.runs;
+    }
+    for (size_t i = 0; i < options.limits.size(); ++i)
+    {
+        for (int run = 0; run < options.runs; ++run)
+        {
+            results.push_back(RunPipeline(options, arena.get(), options.limits[i], run));
+            results.back().speedup = results.back().throughput / sequentialThroughput;
+        }
+    }
+
+    FILE* out = stdout;
+    if (!options.outputPath.empty())
+    {
+        out = fopen(options.outputPath.c_str(), "w");
+        if (nullptr == out)
+        {
+            fprintf(stderr, "Cannot open %s\n", options.outputPath.c_str());
+            return 1;
+        }
+    }
+    if (options.json)
+        WriteJson(out, options, results);
+    else
+        WriteCsv(out, options, results);
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
@@ -11,6 +11,18 @@
 
 #include <agents.h>
 
+#include "concrt_extras.h"
+
+#if defined(SAMPLES_STD_THREADS)
+#include <atomic>
+#include <chrono>
+#include <math.h>
+#include <mutex>
+#include <vector>
+
+#include "sync_extras.h"
+#endif
+
 namespace PipelineUtilities
 {
     using namespace ::Concurrency;
@@ -71,4 +83,230 @@ namespace PipelineUtilities
         PipelineGovernor(const PipelineGovernor&);
         PipelineGovernor const & operator=(PipelineGovernor const&);
     };
+
+#if defined(SAMPLES_STD_THREADS)
+    // Settings for a SemaphorePipelineGovernor that adjusts its capacity while the pipeline runs.
+    //
+    // With a target latency the governor uses additive increase, multiplicative decrease: it adds 
+    // a slot after each measurement window whose end-to-end latency is within the target and cuts 
+    // the capacity by a quarter after each window that exceeds it.
+    //
+    // Without a target latency it aims for maximum throughput using the gradient between the 
+    // lowest latency it has seen and the current latency. While elements do not wait anywhere the 
+    // two are equal and the capacity grows by its square root each window. Once the extra elements 
+    // only queue in front of the slowest stage, latency grows with capacity and the capacity shrinks 
+    // back to what the pipeline can keep busy plus a small queue.
+
+    struct AdaptiveCapacitySettings
+    {
+        int initialCapacity;
+        int minCapacity;
+        int maxCapacity;
+        // Seconds, or 0.0 to maximize throughput.
+        double targetLatency;
+
+        AdaptiveCapacitySettings(int initial, int minimum, int maximum, double target = 0.0) :
+            initialCapacity(initial), minCapacity(minimum), maxCapacity(maximum), targetLatency(target) {}
+    };
+
+    // A change of capacity made by an adaptive SemaphorePipelineGovernor, with the measurements of the 
+    // window that led to it.
+
+    struct PipelineGovernorDecision
+    {
+        double elapsedTime;         // seconds since the governor was created
+        int previousCapacity;
+        int newCapacity;
+        double throughput;          // elements per second
+        double latency;             // seconds, from Little's law: average in-flight elements / throughput
+    };
+
+    // The SemaphorePipelineGovernor class has the interface of PipelineGovernor but 
+    // implements the throttling mechanism as a counting semaphore with one unit per
+    // pipeline slot. The capacity is either fixed or adjusted online, see AdaptiveCapacitySettings.
+    // It needs the C++11 thread support library, see SAMPLES_STD_THREADS.
+    //
+    // The last stage of the pipeline should call FreePipelineSlot() each time it finishes processing 
+    // an element.
+    //
+    // A stage that feeds the pipeline should call WaitForAvailablePipelineSlot() before forwarding
+    // each new element to the next stage of the pipeline. Several stages may do this at the same time.
+    //
+    // The first stage of the pipeline should call WaitForEmptyPipeline() on shutdown before it
+    // reclaims memory for pipeline stages.
+    //
+    // Taking and returning a slot is an atomic operation on a counter; a stage that finds the 
+    // pipeline full spins briefly and then parks on a futex. Parking blocks the thread, so the 
+    // stage oversubscribes its scheduler while it waits and the stages that free slots can still run.
+
+    class SemaphorePipelineGovernor
+    {
+    private:
+        typedef std::chrono::steady_clock clock;
+
+        samples::counting_semaphore m_slots;
+        std::atomic<int> m_capacity;
+
+        // Adaptive mode only.
+        bool m_isAdaptive;
+        AdaptiveCapacitySettings m_settings;
+        // Slots that were removed while their elements were in flight. FreePipelineSlot() keeps 
+        // these instead of returning them.
+        std::atomic<int> m_debt;
+        std::atomic<int> m_inFlight;
+        std::atomic<long> m_windowCompleted;
+        std::atomic<long long> m_windowInFlightSum;
+        std::atomic<bool> m_isDraining;
+        std::mutex m_adjustLock;
+        clock::time_point m_start;
+        clock::time_point m_windowStart;
+        double m_minLatency;
+        std::vector<PipelineGovernorDecision> m_decisions;
+
+    public:
+          SemaphorePipelineGovernor(int capacity) :
+              m_slots(capacity), m_capacity(capacity), m_isAdaptive(false), 
+              m_settings(capacity, capacity, capacity), m_debt(0), m_inFlight(0), m_windowCompleted(0), 
+              m_windowInFlightSum(0), m_isDraining(false), m_minLatency(0.0) {}
+
+          SemaphorePipelineGovernor(const AdaptiveCapacitySettings& settings) :
+              m_slots(settings.initialCapacity), m_capacity(settings.initialCapacity), m_isAdaptive(true), 
+              m_settings(settings), m_debt(0), m_inFlight(0), m_windowCompleted(0), 
+              m_windowInFlightSum(0), m_isDraining(false), m_start(clock::now()), m_windowStart(m_start), 
+              m_minLatency(0.0) {}
+
+          // called by the last stage of pipeline
+          void FreePipelineSlot() 
+          {
+              if (!m_isAdaptive)
+              {
+                  m_slots.release();
+                  return;
+              }
+
+              m_windowInFlightSum += m_inFlight--;
+              long completed = ++m_windowCompleted;
+
+              int debt = m_debt.load();
+              while (debt > 0 && !m_debt.compare_exchange_weak(debt, debt - 1))
+              {
+              }
+              if (debt == 0)
+                  m_slots.release();
+
+              if (completed >= WindowSize() && !m_isDraining)
+                  AdjustCapacity();
+          }
+
+          // called by the stages that feed the pipeline
+          void WaitForAvailablePipelineSlot() 
+          {
+              if (!m_slots.try_acquire())
+              {
+                  scoped_oversubcription_token oversubscribeWhileWaiting;
+                  m_slots.acquire();
+              }
+              if (m_isAdaptive)
+                  ++m_inFlight;
+          }
+
+          // called by the first pipeline stage
+          void WaitForEmptyPipeline() 
+          {
+              // Hold the capacity steady while the pipeline drains. Once every element is out,
+              // every removed slot has been paid back and all m_capacity units are available.
+              m_isDraining = true;
+              m_adjustLock.lock();
+              int capacity = m_capacity;
+              m_adjustLock.unlock();
+
+              if (!m_slots.try_acquire(capacity))
+              {
+                  scoped_oversubcription_token oversubscribeWhileWaiting;
+                  m_slots.acquire(capacity);
+              }
+              m_slots.release(capacity);
+              m_isDraining = false;
+          }   
+
+          // The current number of pipeline slots.
+          int GetCapacity() const
+          {
+              return m_capacity;
+          }
+
+          // The capacity changes made so far, oldest first. Empty unless the governor is adaptive.
+          std::vector<PipelineGovernorDecision> GetDecisions()
+          {
+              std::lock_guard<std::mutex> lock(m_adjustLock);
+              return m_decisions;
+          }
+
+    private:
+          // Capacity is reconsidered after a window of this many completed elements.
+          long WindowSize() const
+          {
+              int capacity = m_capacity;
+              return (capacity > 8) ? capacity : 8;
+          }
+
+          void AdjustCapacity()
+          {
+              std::unique_lock<std::mutex> lock(m_adjustLock, std::try_to_lock);
+              if (!lock.owns_lock() || m_windowCompleted < WindowSize() || m_isDraining)
+                  return;
+
+              clock::time_point now = clock::now();
+              double elapsed = std::chrono::duration<double>(now - m_windowStart).count();
+              long completed = m_windowCompleted.exchange(0);
+              long long inFlightSum = m_windowInFlightSum.exchange(0);
+              m_windowStart = now;
+              if (elapsed <= 0.0 || completed == 0)
+                  return;
+
+              double throughput = completed / elapsed;
+              double latency = (static_cast<double>(inFlightSum) / completed) / throughput;
+
+              // The minimum slowly decays so that a lasting change in stage costs is picked up.
+              m_minLatency = (m_minLatency == 0.0 || latency < m_minLatency) ? latency : m_minLatency * 1.01;
+
+              int capacity = m_capacity;
+              double target;
+              if (m_settings.targetLatency > 0.0)
+                  target = (latency > m_settings.targetLatency) ? capacity * 0.75 : capacity + 1.0;
+              else
+              {
+                  double gradient = m_minLatency / latency;
+                  gradient = (gradient < 0.5) ? 0.5 : gradient;
+                  target = capacity * gradient + sqrt(static_cast<double>(capacity)) + 0.5;
+              }
+
+              int newCapacity = static_cast<int>(target);
+              newCapacity = (newCapacity < m_settings.minCapacity) ? m_settings.minCapacity : newCapacity;
+              newCapacity = (newCapacity > m_settings.maxCapacity) ? m_settings.maxCapacity : newCapacity;
+              if (newCapacity == capacity)
+                  return;
+
+              if (newCapacity > capacity)
+                  m_slots.release(newCapacity - capacity);
+              else
+              {
+                  // Take back free slots first; the rest are kept as elements finish.
+                  int removed = capacity - newCapacity;
+                  while (removed > 0 && m_slots.try_acquire())
+                      --removed;
+                  m_debt += removed;
+              }
+              m_capacity = newCapacity;
+
+              PipelineGovernorDecision decision = 
+                  { std::chrono::duration<double>(now - m_start).count(), capacity, newCapacity, throughput, latency };
+              m_decisions.push_back(decision);
+          }
+
+        // Disable copy constructor and assignment.
+        SemaphorePipelineGovernor(const SemaphorePipelineGovernor&);
+        SemaphorePipelineGovernor const & operator=(SemaphorePipelineGovernor const&);
+    };
+#endif
 };
@@ -10,13 +10,43 @@
 
 #pragma once
 
+// The helpers run on the Concurrency Runtime where it is available. Elsewhere, or when SAMPLES_PORTABLE_RUNTIME
+// is defined, they run on the portable scheduler in portable_scheduler.h.
+#if !defined(_WIN32) && !defined(SAMPLES_PORTABLE_RUNTIME)
+#define SAMPLES_PORTABLE_RUNTIME
+#endif
+
+#if defined(SAMPLES_PORTABLE_RUNTIME)
+#include "portable_scheduler.h"
+#else
 #include <concrtrm.h>
 #include <concrt.h>
+#endif
+
+// sync_extras.h, queue_extras.h, output_extras.h, telemetry_extras.h and pipeline_extras.h use the C++11 thread
+// support library, which Visual C++ has from 2012 on. Samples that still build with Visual C++ 2010 use them only
+// when SAMPLES_STD_THREADS is defined.
+#if !defined(_MSC_VER) || (_MSC_VER >= 1700)
+#define SAMPLES_STD_THREADS
+#endif
+
+// Small functors are stored in task slots taken from the suballocator in memory_extras.h. On the Concurrency Runtime
+// this needs Visual C++ 2015 or later: earlier compilers have no <mutex>, or no thread_local to return the caches of
+// retired worker threads, so every functor is heap allocated as before.
+#if defined(SAMPLES_PORTABLE_RUNTIME) || !defined(_MSC_VER) || (_MSC_VER >= 1900)
+#define SAMPLES_TASK_SLOTS
+#endif
+
+#if defined(SAMPLES_TASK_SLOTS)
+#include <type_traits>
+#include "memory_extras.h"
+#endif
 
 namespace Concurrency
 {
     namespace samples
     {
+#if !defined(SAMPLES_PORTABLE_RUNTIME)
         template<typename T>
         class concrt_suballocator {
         public:
@@ -56,8 +86,58 @@ namespace Concurrency
 
             void destroy( pointer p ) {p->~T();}
         };
+#endif
         namespace details
         {
+#if defined(SAMPLES_PORTABLE_RUNTIME)
+            typedef _Portable_scheduler _Scheduler;
+            typedef _Portable_schedule_group _Schedule_group;
+            typedef _Portable_policy _Policy;
+            typedef _Portable_task_proc _Task_proc_type;
+
+            inline _Policy _Default_policy()
+            {
+                return _Policy();
+            }
+            inline _Scheduler* _Get_current_scheduler()
+            {
+                return _Portable_scheduler::_Get_current();
+            }
+            inline void _Detach_current_scheduler()
+            {
+                _Portable_scheduler::Detach();
+            }
+#else
+            typedef Concurrency::Scheduler _Scheduler;
+            typedef Concurrency::ScheduleGroup _Schedule_group;
+            typedef Concurrency::SchedulerPolicy _Policy;
+            typedef Concurrency::TaskProc _Task_proc_type;
+
+            inline _Policy _Default_policy()
+            {
+                return _Policy(0);
+            }
+            inline _Scheduler* _Get_current_scheduler()
+            {
+                return Concurrency::CurrentScheduler::Get();
+            }
+            inline void _Detach_current_scheduler()
+            {
+                Concurrency::CurrentScheduler::Detach();
+            }
+#endif
+#if defined(SAMPLES_TASK_SLOTS)
+            //functors up to this size are stored inline in a fixed size task slot, one cache line
+            //taken from the scheduling thread's suballocator cache, instead of on the heap
+            const size_t _Task_slot_size = 64;
+
+            template<class Func>
+            struct _Fits_task_slot : std::integral_constant<bool,
+                sizeof(Func) <= _Task_slot_size && std::alignment_of<Func>::value <= 16>
+            {
+            };
+#endif
+
             //a templated static method for scheduling a functor
             //assumes that the functor is heap allocated and should be deleted
             //after execution
@@ -68,22 +148,63 @@ namespace Concurrency
                 (*pFunc)();
                 delete pFunc;
             }
+#if defined(SAMPLES_TASK_SLOTS)
+            //a templated static method for scheduling a functor
+            //assumes that the functor lives in a task slot, the slot is released
+            //to the cache of the thread that ran the task after execution and
+            //flows back to the scheduling threads in batches
+            template<class Func>
+            static void _Slot_task_proc(void* data)
+            {
+                Func* pFunc = (Func*) data;
+                (*pFunc)();
+                pFunc->~Func();
+                _Subfree(data, _Task_slot_size);
+            }
+            template <class SchedulerObject, class Func>
+            void _Schedule_task(SchedulerObject* pScheduler,const Func& fn, std::false_type)
+            {
+                Func* pFn = new Func(fn);
+                pScheduler->ScheduleTask(details::_Task_proc<Func>,(void*)pFn);
+            }
+            template <class SchedulerObject, class Func>
+            void _Schedule_task(SchedulerObject* pScheduler,const Func& fn, std::true_type)
+            {
+                void* pSlot = _Suballoc(_Task_slot_size);
+                try
+                {
+                    new(pSlot) Func(fn);
+                }
+                catch (...)
+                {
+                    _Subfree(pSlot, _Task_slot_size);
+                    throw;
+                }
+                pScheduler->ScheduleTask(details::_Slot_task_proc<Func>,pSlot);
+            }
+            template <class SchedulerObject, class Func>
+            void _Schedule_task(SchedulerObject* pScheduler,const Func& fn)
+            {
+                _Schedule_task(pScheduler,fn,_Fits_task_slot<Func>());
+            }
+#else
             template <class SchedulerObject, class Func>
             void _Schedule_task(SchedulerObject* pScheduler,const Func& fn)
             {
                 Func* pFn = new Func(fn);
                 pScheduler->ScheduleTask(details::_Task_proc<Func>,(void*)pFn);
             }
+#endif
             template <class SchedulerObject>
-            Concurrency::ScheduleGroup* _Create_Schedule_Group(SchedulerObject* sched)
+            _Schedule_group* _Create_Schedule_Group(SchedulerObject* sched)
             {
                 return sched->CreateScheduleGroup();
             }
         }
-        typedef Concurrency::SchedulerPolicy scheduler_policy;
-        typedef Concurrency::TaskProc task_proc;
+        typedef details::_Policy scheduler_policy;
+        typedef details::_Task_proc_type task_proc;
         /// <summary>
-        /// A wrapper around Concurrency::Scheduler that offers 
+        /// A wrapper around Concurrency::Scheduler, or the portable scheduler, that offers 
         /// support for scheduling a task with a functor and release semantics
         /// </summary>
         typedef struct task_scheduler
@@ -92,11 +213,11 @@ namespace Concurrency
             //disable copy constructor
             task_scheduler(const task_scheduler&);
             //a pointer to a scheduler instance
-            Concurrency::Scheduler* pScheduler;
+            details::_Scheduler* pScheduler;
             //disable assignment
             task_scheduler const & operator=(task_scheduler const&);
         public:
-            typedef Concurrency::Scheduler* native_handle_type;
+            typedef details::_Scheduler* native_handle_type;
             const native_handle_type native_handle;
             /// <summary>
             /// Schedules a lightweight task on this scheduler.
@@ -120,13 +241,38 @@ namespace Concurrency
             /// Constructs a new task_scheduler.
             /// </summary>
             /// <param name="policy">Indicates the scheduler policy.</param>
-            task_scheduler(scheduler_policy policy = scheduler_policy(0)):pScheduler(Concurrency::Scheduler::Create(policy)),native_handle(pScheduler)
+            task_scheduler(scheduler_policy policy = details::_Default_policy()):pScheduler(details::_Scheduler::Create(policy)),native_handle(pScheduler)
             {
             }
             operator native_handle_type()
             {
                 return pScheduler;
             }
+            /// <summary>
+            /// Makes this scheduler the current scheduler of the calling thread, so that
+            /// tasks it schedules without naming a scheduler run on this scheduler's workers.
+            /// Each call must be paired with a call to detach on the same thread.
+            /// </summary>
+            void attach()
+            {
+                pScheduler->Attach();
+            }
+            /// <summary>
+            /// Restores the scheduler that was current on the calling thread before the last attach.
+            /// </summary>
+            static void detach()
+            {
+                details::_Detach_current_scheduler();
+            }
+#if defined(SAMPLES_PORTABLE_RUNTIME)
+            /// <summary>
+            /// Returns the per-worker counters of this scheduler.
+            /// </summary>
+            scheduler_statistics statistics() const
+            {
+                return pScheduler->_Statistics();
+            }
+#endif
             ~task_scheduler()
             {
                 //release the scheduler
@@ -140,19 +286,24 @@ namespace Concurrency
         typedef struct schedule_group
         {
         private:
-            Concurrency::ScheduleGroup* pScheduleGroup;
+            details::_Schedule_group* pScheduleGroup;
             //disable copy constructor
             schedule_group(const schedule_group&);
             //disable assignment
             schedule_group const & operator=(schedule_group const&);
         public:
-            typedef Concurrency::ScheduleGroup* native_handle_type;
+            typedef details::_Schedule_group* native_handle_type;
             const native_handle_type native_handle;
 
-            schedule_group():pScheduleGroup(details::_Create_Schedule_Group(Concurrency::CurrentScheduler::Get())),native_handle(pScheduleGroup){}
+            schedule_group():pScheduleGroup(details::_Create_Schedule_Group(details::_Get_current_scheduler())),native_handle(pScheduleGroup){}
             schedule_group(const task_scheduler& scheduler):pScheduleGroup(details::_Create_Schedule_Group(scheduler.native_handle)),native_handle(pScheduleGroup)
             {
             };
+            ~schedule_group()
+            {
+                //release the schedule group, queued tasks still run
+                pScheduleGroup->Release();
+            }
             /// <summary>
             /// Schedules a lightweight task on this schedule group.
             /// </summary>
@@ -175,7 +326,7 @@ namespace Concurrency
         template <class Func>
         void schedule_task(Func&& fn)
         {
-            Concurrency::Scheduler* pScheduler = Concurrency::CurrentScheduler::Get();
+            details::_Scheduler* pScheduler = details::_Get_current_scheduler();
             details::_Schedule_task(pScheduler,fn);
         }
         template <class SchedulingType, class Func>
@@ -183,21 +334,54 @@ namespace Concurrency
         {
             details::_Schedule_task(pScheduler,fn);
         }
+#if defined(SAMPLES_PORTABLE_RUNTIME)
+        /// <summary>
+        /// Returns the per-worker counters of the current scheduler.
+        /// </summary>
+        inline scheduler_statistics current_scheduler_statistics()
+        {
+            return details::_Get_current_scheduler()->_Statistics();
+        }
+#endif
     }
     /// <summary>
     /// An RAII style wrapper around Concurrency::Context::Oversubscribe,
-    /// useful for annotating known blocking calls
+    /// useful for annotating known blocking calls. On the portable scheduler
+    /// a compensation worker runs other tasks while the calling worker is
+    /// blocked, up to the scheduler's compensation limit.
     /// </summary>
+    /// <param name="oversubscribe">Pass false to leave the blocking call
+    /// uncompensated, for example to measure the benefit.</param>
     class scoped_oversubcription_token
     {
+    private:
+        bool m_oversubscribe;
+        //disable copy constructor
+        scoped_oversubcription_token(const scoped_oversubcription_token&);
+        //disable assignment
+        scoped_oversubcription_token const & operator=(scoped_oversubcription_token const&);
     public:
-        scoped_oversubcription_token()
+        explicit scoped_oversubcription_token(bool oversubscribe = true) : m_oversubscribe(oversubscribe)
         {
-            Concurrency::Context::CurrentContext()->Oversubscribe(true);
+            if (m_oversubscribe)
+            {
+#if defined(SAMPLES_PORTABLE_RUNTIME)
+                samples::details::_Portable_scheduler::_Begin_blocking();
+#else
+                Concurrency::Context::CurrentContext()->Oversubscribe(true);
+#endif
+            }
         }
         ~scoped_oversubcription_token()
         {
-            Concurrency::Context::CurrentContext()->Oversubscribe(false);
+            if (m_oversubscribe)
+            {
+#if defined(SAMPLES_PORTABLE_RUNTIME)
+                samples::details::_Portable_scheduler::_End_blocking();
+#else
+                Concurrency::Context::CurrentContext()->Oversubscribe(false);
+#endif
+            }
         }
     };
 }
\ No newline at end of file
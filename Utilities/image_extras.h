@@ -0,0 +1,895 @@
+//--------------------------------------------------------------------------
+//
+//  Copyright (c) Microsoft Corporation.  All rights reserved.
+//
+//  File: image_extras.h
+//
+//  Implementation of a pool of image buffers, a parallel loop over bands
+//  of image rows, a separable image resampler and a table driven
+//  Gaussian noise filter.
+//
+//--------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "concrt_extras.h"
+#include "random_extras.h"
+
+// Without the C++11 thread support library the locks are ConcRT critical sections and the row bands run as a
+// parallel_for.
+#if defined(SAMPLES_STD_THREADS)
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#else
+#include <ppl.h>
+#endif
+
+namespace Concurrency
+{
+namespace samples
+{
+namespace details
+{
+    // Buffer sizes are multiples of this, so that a buffer can be aligned for vector code.
+    const size_t _Buffer_granularity = 64;
+
+    // Row bands are never smaller than this, so that the work of a band outweighs the cost of handing it over.
+    const int _Minimum_band_rows = 16;
+
+#if defined(SAMPLES_STD_THREADS)
+    typedef std::mutex _Image_lock;
+    typedef std::lock_guard<std::mutex> _Image_lock_guard;
+
+    // The rows of one parallel_for_row_bands call. Band i covers rows [_Rows * i / _Band_count,
+    // _Rows * (i + 1) / _Band_count).
+    class _Row_bands
+    {
+    public:
+        _Row_bands(int _Rows, int _Band_count, const std::function<void (int, int)>& _Func) :
+            _M_func(_Func), _M_rows(_Rows), _M_band_count(_Band_count), _M_next_band(0), _M_remaining_bands(_Band_count)
+        {
+        }
+
+        // Works on the next band nobody has taken yet. Returns false if there was none.
+        bool _Run_band()
+        {
+            const int _Band = _M_next_band++;
+            if (_Band >= _M_band_count)
+            {
+                return false;
+            }
+            std::exception_ptr _Error;
+            try
+            {
+                _M_func(_M_rows * _Band / _M_band_count, _M_rows * (_Band + 1) / _M_band_count);
+            }
+            catch (...)
+            {
+                _Error = std::current_exception();
+            }
+
+            std::lock_guard<std::mutex> _Lock(_M_lock);
+            if (_Error != nullptr && _M_error == nullptr)
+            {
+                _M_error = _Error;
+            }
+            if (--_M_remaining_bands == 0)
+            {
+                _M_finished.notify_all();
+            }
+            return true;
+        }
+
+        // Waits for the bands other threads took and rethrows the first exception of any band.
+        void _Wait()
+        {
+            std::unique_lock<std::mutex> _Lock(_M_lock);
+            while (_M_remaining_bands > 0)
+            {
+                _M_finished.wait(_Lock);
+            }
+            if (_M_error != nullptr)
+            {
+                std::rethrow_exception(_M_error);
+            }
+        }
+
+    private:
+        const std::function<void (int, int)> _M_func;
+        const int _M_rows;
+        const int _M_band_count;
+        std::atomic<int> _M_next_band;
+        std::mutex _M_lock;
+        std::condition_variable _M_finished;
+        int _M_remaining_bands;
+        std::exception_ptr _M_error;
+
+        _Row_bands(const _Row_bands&);
+        _Row_bands const & operator=(_Row_bands const&);
+    };
+#else
+    typedef Concurrency::critical_section _Image_lock;
+    typedef Concurrency::critical_section::scoped_lock _Image_lock_guard;
+#endif
+
+    // The source indices and weights of each output row or column of an image_resampler. Output index i starts
+    // at source index _M_first[i] and has _M_pair_count[i] pairs of weights, from _M_pairs[_M_offset[i]] on.
+    // Each pair holds the weight of the even tap in its low 16 bits and that of the odd tap in its high 16 bits.
+    // Taps are padded to an even number with a zero weight, after the last tap or, if that is the last source
+    // index, before the first. Only if the taps cover all of the source is the padding one past the last index,
+    // and _M_padded set.
+    struct _Resample_kernel
+    {
+        std::vector<int> _M_first;
+        std::vector<int> _M_pair_count;
+        std::vector<int> _M_offset;
+        std::vector<int> _M_pairs;
+        int _M_max_pair_count;
+        bool _M_padded;
+
+        _Resample_kernel() : _M_max_pair_count(0), _M_padded(false)
+        {
+        }
+    };
+
+    // The inverse of the standard normal distribution function, with the rational approximation of P. J. Acklam.
+    inline double _Gaussian_inverse(double _Value)
+    {
+        // Lower and upper breakpoints
+        const double _Plow = 0.02425;
+        const double _Phigh = 1.0 - _Plow;
+
+        double _P = (_Phigh < _Value) ? 1.0 - _Value : _Value;
+        double _Sign = (_Phigh < _Value) ? -1.0 : 1.0;
+        double _Q;
+
+        if (_P < _Plow)
+        {
+            // Rational approximation for tail
+            const double _C[] = { -7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00, -2.549732539343734e+00,
+                4.374664141464968e+00, 2.938163982698783e+00 };
+            const double _D[] = { 7.784695709041462e-03, 3.224671290700398e-01, 2.445134137142996e+00, 3.754408661907416e+00 };
+            _Q = std::sqrt(-2 * std::log(_P));
+            return _Sign * (((((_C[0] * _Q + _C[1]) * _Q + _C[2]) * _Q + _C[3]) * _Q + _C[4]) * _Q + _C[5]) /
+                ((((_D[0] * _Q + _D[1]) * _Q + _D[2]) * _Q + _D[3]) * _Q + 1);
+        }
+        else
+        {
+            // Rational approximation for central region
+            const double _A[] = { -3.969683028665376e+01, 2.209460984245205e+02, -2.759285104469687e+02, 1.383577518672690e+02,
+                -3.066479806614716e+01, 2.506628277459239e+00 };
+            const double _B[] = { -5.447609879822406e+01, 1.615858368580409e+02, -1.556989798598866e+02, 6.680131188771972e+01,
+                -1.328068155288572e+01 };
+            _Q = _P - 0.5;
+            double _R = _Q * _Q;
+            return (((((_A[0] * _R + _A[1]) * _R + _A[2]) * _R + _A[3]) * _R + _A[4]) * _R + _A[5]) * _Q /
+                (((((_B[0] * _R + _B[1]) * _R + _B[2]) * _R + _B[3]) * _R + _B[4]) * _R + 1);
+        }
+    }
+} // namespace details
+
+/// <summary>
+///     Recycles the pixel memory of images. Every image in a pipeline allocates several megabytes of pixels that
+///     are freed again when it has been displayed, which the heap hands straight back to the operating system,
+///     so that each image pays for fresh pages. The pool keeps the memory of images that have been freed and
+///     hands it to the next image of the same size class instead. A pipeline that keeps C images in flight then
+///     reuses about C buffers of each size once it has filled up.
+/// </summary>
+/// <remarks>
+///     Sizes are rounded up to one of four classes per power of two, so that images whose sizes differ a little
+///     share buffers at the cost of at most a quarter of the memory. Each class keeps at most a given number of
+///     free buffers, and the rest are freed. All methods may be called from any thread.
+/// </remarks>
+/**/
+class image_buffer_pool
+{
+public:
+    /// <summary>
+    ///     Creates a pool that keeps up to <c>_Maximum_free_buffers</c> free buffers of each size class. Zero
+    ///     turns recycling off, so that every request allocates, which shows what the pool saves.
+    /// </summary>
+    explicit image_buffer_pool(size_t _Maximum_free_buffers) :
+        _M_maximum_free_buffers(_Maximum_free_buffers),
+        _M_allocation_count(0),
+        _M_reuse_count(0),
+        _M_free_buffer_count(0),
+        _M_free_bytes(0)
+    {
+    }
+
+    ~image_buffer_pool()
+    {
+        for (auto _I = _M_free_buffers.begin(); _I != _M_free_buffers.end(); ++_I)
+        {
+            for (size_t _J = 0; _J < _I->second.size(); ++_J)
+            {
+                delete[] _I->second[_J];
+            }
+        }
+    }
+
+    /// <summary>
+    ///     Returns a buffer of at least <c>_Size</c> bytes, and sets <c>_Size</c> to the size of its class, which
+    ///     must be passed to <c>deallocate</c>.
+    /// </summary>
+    unsigned char* allocate(size_t& _Size)
+    {
+        _Size = size_class(_Size);
+        {
+            details::_Image_lock_guard _Lock(_M_lock);
+            auto _I = _M_free_buffers.find(_Size);
+            if (_I != _M_free_buffers.end() && !_I->second.empty())
+            {
+                unsigned char* _Buffer = _I->second.back();
+                _I->second.pop_back();
+                --_M_free_buffer_count;
+                _M_free_bytes -= _Size;
+                ++_M_reuse_count;
+                return _Buffer;
+            }
+            ++_M_allocation_count;
+        }
+        return new unsigned char[_Size];
+    }
+
+    void deallocate(unsigned char* _Buffer, size_t _Size)
+    {
+        {
+            details::_Image_lock_guard _Lock(_M_lock);
+            std::vector<unsigned char*>& _Buffers = _M_free_buffers[_Size];
+            if (_Buffers.size() < _M_maximum_free_buffers)
+            {
+                _Buffers.push_back(_Buffer);
+                ++_M_free_buffer_count;
+                _M_free_bytes += _Size;
+                return;
+            }
+        }
+        delete[] _Buffer;
+    }
+
+    /// <summary>
+    ///     The requests that had to allocate memory.
+    /// </summary>
+    unsigned long long allocation_count() const
+    {
+        details::_Image_lock_guard _Lock(_M_lock);
+        return _M_allocation_count;
+    }
+
+    /// <summary>
+    ///     The requests that got a free buffer.
+    /// </summary>
+    unsigned long long reuse_count() const
+    {
+        details::_Image_lock_guard _Lock(_M_lock);
+        return _M_reuse_count;
+    }
+
+    /// <summary>
+    ///     The free buffers the pool holds on to.
+    /// </summary>
+    size_t free_buffer_count() const
+    {
+        details::_Image_lock_guard _Lock(_M_lock);
+        return _M_free_buffer_count;
+    }
+
+    /// <summary>
+    ///     The total size of the free buffers the pool holds on to.
+    /// </summary>
+    size_t free_bytes() const
+    {
+        details::_Image_lock_guard _Lock(_M_lock);
+        return _M_free_bytes;
+    }
+
+    static size_t size_class(size_t _Size)
+    {
+        _Size = (_Size + details::_Buffer_granularity - 1) & ~(details::_Buffer_granularity - 1);
+        size_t _Power = details::_Buffer_granularity;
+        while (_Power * 2 < _Size)
+        {
+            _Power *= 2;
+        }
+        // _Size is now in (_Power, 2 * _Power], which is split into four classes.
+        const size_t _Step = (_Power >= 4 * details::_Buffer_granularity) ? _Power / 4 : details::_Buffer_granularity;
+        return (_Size + _Step - 1) / _Step * _Step;
+    }
+
+private:
+    const size_t _M_maximum_free_buffers;
+    mutable details::_Image_lock _M_lock;
+    std::map<size_t, std::vector<unsigned char*>> _M_free_buffers;
+    unsigned long long _M_allocation_count;
+    unsigned long long _M_reuse_count;
+    size_t _M_free_buffer_count;
+    size_t _M_free_bytes;
+
+    image_buffer_pool(const image_buffer_pool&);
+    image_buffer_pool const & operator=(image_buffer_pool const&);
+};
+
+/// <summary>
+///     Calls <c>_Func(first, last)</c> for <c>_Band_count</c> ranges of rows that together cover [0, <c>_Rows</c>),
+///     at the same time, and rethrows the first exception of any of them. Fewer bands are used if they would be
+///     smaller than 16 rows. A band count of one calls <c>_Func</c> for all rows on the calling thread.
+/// </summary>
+/// <remarks>
+///     The calling thread works on the bands too, and tasks of the current scheduler help it. A helper that
+///     starts after all bands have been taken returns at once, and the caller only waits for bands that other
+///     threads are working on, so a pipeline stage that runs as a task itself can split an image without waiting
+///     for a free thread. Without the C++11 thread support library the bands run as a ConcRT parallel_for, in
+///     which the calling thread takes part as well.
+/// </remarks>
+/**/
+inline void parallel_for_row_bands(int _Rows, int _Band_count, const std::function<void (int, int)>& _Func)
+{
+    _Band_count = (std::min)(_Band_count, (std::max)(1, _Rows / details::_Minimum_band_rows));
+    if (_Band_count <= 1)
+    {
+        _Func(0, _Rows);
+        return;
+    }
+
+#if defined(SAMPLES_STD_THREADS)
+    // The helpers share ownership of the bands, as they may start after this function has returned.
+    std::shared_ptr<details::_Row_bands> _Bands = std::make_shared<details::_Row_bands>(_Rows, _Band_count, _Func);
+    for (int _I = 1; _I < _Band_count; ++_I)
+    {
+        schedule_task([_Bands]() { while (_Bands->_Run_band()) {} });
+    }
+    while (_Bands->_Run_band()) {}
+    _Bands->_Wait();
+#else
+    Concurrency::parallel_for(0, _Band_count, [_Rows, _Band_count, &_Func](int _Band)
+    {
+        _Func(_Rows * _Band / _Band_count, _Rows * (_Band + 1) / _Band_count);
+    });
+#endif
+}
+
+/// <summary>
+///     How an <c>image_resampler</c> computes an output pixel.
+/// </summary>
+/**/
+enum resample_mode
+{
+    /// <summary>
+    ///     Interpolates the four source pixels around the center of the output pixel, like the default
+    ///     interpolation mode of Graphics::DrawImage.
+    /// </summary>
+    resample_bilinear = 0,
+    /// <summary>
+    ///     Averages the source pixels the output pixel covers, weighted by how much of each it covers. Images that
+    ///     are enlarged are interpolated as with <c>resample_bilinear</c>.
+    /// </summary>
+    resample_area_average
+};
+
+/// <summary>
+///     A separable resampler that works on rows of three or four byte pixels in memory, so that both image
+///     buffers of its own and the bitmaps of a GUI can use it.
+/// </summary>
+/// <remarks>
+///     Each output row is a weighted sum of a few source rows, and each output pixel a weighted sum of a few
+///     source pixels of a row. The source rows and columns and their weights are computed once, as 14 bit fixed
+///     point numbers that add up to exactly one, so an opaque image stays opaque. Both sums take two weights at a
+///     time with _mm_madd_epi16, which multiplies pairs of 16 bit values and adds each pair; the row sums do
+///     sixteen bytes at once and the column sums one pixel, so the order of the two matters. Summing the rows
+///     first suits an area average, which reads every source pixel anyway. Summing the columns of the source rows
+///     first suits bilinear reduction, which uses a fraction of the rows and only reads the pixels it
+///     interpolates.
+/// </remarks>
+/**/
+class image_resampler
+{
+public:
+    image_resampler(int _Source_width, int _Source_height, int _Width, int _Height, resample_mode _Mode) :
+        _M_source_width(_Source_width),
+        _M_source_height(_Source_height),
+        _M_width(_Width),
+        _M_height(_Height)
+    {
+        if (_Source_width < 1 || _Source_height < 1 || _Width < 1 || _Height < 1)
+        {
+            throw std::invalid_argument("image_resampler");
+        }
+        _Create_kernel(_Source_width, _Width, _Mode, _M_columns);
+        _Create_kernel(_Source_height, _Height, _Mode, _M_rows);
+
+        // Count the multiply-adds of either order, taking a column sum of two pixels to cost about twice a row
+        // sum of two pixels.
+        long long _Row_pairs = 0;
+        long long _Column_pairs = 0;
+        long long _Rows_used = 0;
+        int _Next_row = 0;
+        for (int _Y = 0; _Y < _Height; ++_Y)
+        {
+            _Row_pairs += _M_rows._M_pair_count[_Y];
+            const int _End = (std::min)(_M_rows._M_first[_Y] + 2 * _M_rows._M_pair_count[_Y], _Source_height);
+            _Rows_used += (std::max)(0, _End - (std::max)(_M_rows._M_first[_Y], _Next_row));
+            _Next_row = (std::max)(_Next_row, _End);
+        }
+        for (int _X = 0; _X < _Width; ++_X)
+        {
+            _Column_pairs += _M_columns._M_pair_count[_X];
+        }
+        _M_rows_first = _Row_pairs * _Source_width + 2 * _Height * _Column_pairs < 2 * _Rows_used * _Column_pairs + _Row_pairs * _Width;
+    }
+
+    /// <summary>
+    ///     Resamples an image of <c>_Bytes_per_pixel</c>, three or four, byte pixels, splitting the output rows
+    ///     into <c>_Band_count</c> bands. The strides are the distances in bytes between the starts of successive
+    ///     rows. With four byte pixels, the fourth byte is resampled like the others.
+    /// </summary>
+    void resample(const unsigned char* _Source, ptrdiff_t _Source_stride, unsigned char* _Target, ptrdiff_t _Target_stride,
+        int _Bytes_per_pixel, int _Band_count = 1) const
+    {
+        parallel_for_row_bands(_M_height, _Band_count, [&](int _First_row, int _Last_row)
+        {
+            if (_M_rows_first)
+            {
+                _Resample_rows_first(_Source, _Source_stride, _Target, _Target_stride, _Bytes_per_pixel, _First_row, _Last_row);
+            }
+            else
+            {
+                _Resample_columns_first(_Source, _Source_stride, _Target, _Target_stride, _Bytes_per_pixel, _First_row, _Last_row);
+            }
+        });
+    }
+
+private:
+    static const int _Weight_bits = 14;
+
+    int _M_source_width;
+    int _M_source_height;
+    int _M_width;
+    int _M_height;
+    details::_Resample_kernel _M_columns;
+    details::_Resample_kernel _M_rows;
+    bool _M_rows_first;
+
+    static void _Create_kernel(int _Source_size, int _Size, resample_mode _Mode, details::_Resample_kernel& _Kernel)
+    {
+        const double _Scale = static_cast<double>(_Source_size) / _Size;
+        std::vector<double> _Weights;
+        for (int _I = 0; _I < _Size; ++_I)
+        {
+            // The weights of source indices _First, _First + 1 and so on, before clamping to the image.
+            int _First;
+            _Weights.clear();
+            if (_Mode == resample_area_average && _Scale > 1.0)
+            {
+                const double _Start = _I * _Scale;
+                const double _End = (_I + 1) * _Scale;
+                _First = static_cast<int>(_Start);
+                for (int _J = _First; _J < _End; ++_J)
+                {
+                    _Weights.push_back(((std::min)(_End, _J + 1.0) - (std::max)(_Start, static_cast<double>(_J))) / _Scale);
+                }
+            }
+            else
+            {
+                const double _Center = (_I + 0.5) * _Scale - 0.5;
+                _First = static_cast<int>(std::floor(_Center));
+                _Weights.push_back(1.0 - (_Center - _First));
+                _Weights.push_back(_Center - _First);
+            }
+
+            // Taps outside the image count as the nearest pixel of the image.
+            const int _Last = (std::min)(_First + static_cast<int>(_Weights.size()) - 1, _Source_size - 1);
+            const int _Clamped_first = (std::max)(0, (std::min)(_First, _Last));
+            double _Total = 0.0;
+            for (size_t _J = 0; _J < _Weights.size(); ++_J)
+            {
+                _Total += _Weights[_J];
+            }
+            std::vector<double> _Clamped(_Last - _Clamped_first + 1, 0.0);
+            for (int _J = 0; _J < static_cast<int>(_Weights.size()); ++_J)
+            {
+                _Clamped[(std::max)(0, (std::min)(_First + _J, _Last) - _Clamped_first)] += _Weights[_J] / _Total;
+            }
+
+            // Round to fixed point and give the rounding error to the largest weight, so the sum is exact.
+            std::vector<int> _Taps;
+            int _Sum = 0;
+            size_t _Largest = 0;
+            for (size_t _J = 0; _J < _Clamped.size(); ++_J)
+            {
+                _Taps.push_back(static_cast<int>(std::floor(_Clamped[_J] * (1 << _Weight_bits) + 0.5)));
+                _Sum += _Taps[_J];
+                if (_Clamped[_J] > _Clamped[_Largest])
+                {
+                    _Largest = _J;
+                }
+            }
+            _Taps[_Largest] += (1 << _Weight_bits) - _Sum;
+            int _Tap_first = _Clamped_first;
+            if (_Taps.size() % 2 != 0)
+            {
+                if (_Tap_first > 0 && _Tap_first + static_cast<int>(_Taps.size()) == _Source_size)
+                {
+                    _Taps.insert(_Taps.begin(), 0);
+                    --_Tap_first;
+                }
+                else
+                {
+                    _Kernel._M_padded = _Kernel._M_padded || (_Tap_first + static_cast<int>(_Taps.size()) == _Source_size);
+                    _Taps.push_back(0);
+                }
+            }
+
+            _Kernel._M_first.push_back(_Tap_first);
+            _Kernel._M_pair_count.push_back(static_cast<int>(_Taps.size() / 2));
+            _Kernel._M_max_pair_count = (std::max)(_Kernel._M_max_pair_count, _Kernel._M_pair_count.back());
+            _Kernel._M_offset.push_back(static_cast<int>(_Kernel._M_pairs.size()));
+            for (size_t _J = 0; _J < _Taps.size(); _J += 2)
+            {
+                _Kernel._M_pairs.push_back(_Taps[_J] | (_Taps[_J + 1] << 16));
+            }
+        }
+    }
+
+    void _Resample_rows_first(const unsigned char* _Source, ptrdiff_t _Source_stride, unsigned char* _Target, ptrdiff_t _Target_stride,
+        int _Bytes_per_pixel, int _First_row, int _Last_row) const
+    {
+        // The sum of the source rows, with room for the padding pixel of the columns, and the output row.
+        std::vector<unsigned char> _Row((_M_source_width + 1) * _Bytes_per_pixel, 0);
+        std::vector<unsigned char> _Target_row((_Bytes_per_pixel == 4) ? 0 : _M_width * 4);
+        std::vector<const unsigned char*> _Rows(2 * _M_rows._M_max_pair_count);
+
+        for (int _Y = _First_row; _Y < _Last_row; ++_Y)
+        {
+            for (int _I = 0; _I < 2 * _M_rows._M_pair_count[_Y]; ++_I)
+            {
+                _Rows[_I] = _Source + (std::max)(0, (std::min)(_M_rows._M_first[_Y] + _I, _M_source_height - 1)) * _Source_stride;
+            }
+            _Resample_rows(&_Rows[0], &_M_rows._M_pairs[_M_rows._M_offset[_Y]], _M_rows._M_pair_count[_Y], &_Row[0],
+                _M_source_width * _Bytes_per_pixel);
+
+            if (_Bytes_per_pixel == 4)
+            {
+                _Resample_columns(&_Row[0], _Bytes_per_pixel, _Target + _Y * _Target_stride);
+            }
+            else
+            {
+                _Resample_columns(&_Row[0], _Bytes_per_pixel, &_Target_row[0]);
+                _Store_row(&_Target_row[0], _Target + _Y * _Target_stride, _Bytes_per_pixel);
+            }
+        }
+    }
+
+    void _Resample_columns_first(const unsigned char* _Source, ptrdiff_t _Source_stride, unsigned char* _Target, ptrdiff_t _Target_stride,
+        int _Bytes_per_pixel, int _First_row, int _Last_row) const
+    {
+        // The source rows with their columns summed, in four byte pixels. Successive output rows use overlapping
+        // source rows, so the last ones are kept, slot r % _Slot_count holding row r.
+        const int _Row_size = _M_width * 4;
+        const int _Slot_count = 2 * _M_rows._M_max_pair_count;
+        std::vector<unsigned char> _Reduced_rows(_Slot_count * _Row_size);
+        std::vector<int> _Reduced_row_indices(_Slot_count, -1);
+        std::vector<const unsigned char*> _Rows(_Slot_count);
+        std::vector<unsigned char> _Padded_row(_M_columns._M_padded ? (_M_source_width + 1) * _Bytes_per_pixel : 0, 0);
+        std::vector<unsigned char> _Target_row((_Bytes_per_pixel == 4) ? 0 : _Row_size);
+
+        for (int _Y = _First_row; _Y < _Last_row; ++_Y)
+        {
+            for (int _I = 0; _I < 2 * _M_rows._M_pair_count[_Y]; ++_I)
+            {
+                const int _R = (std::max)(0, (std::min)(_M_rows._M_first[_Y] + _I, _M_source_height - 1));
+                const int _Slot = _R % _Slot_count;
+                if (_Reduced_row_indices[_Slot] != _R)
+                {
+                    const unsigned char* _Row = _Source + _R * _Source_stride;
+                    if (_M_columns._M_padded)
+                    {
+                        std::memcpy(&_Padded_row[0], _Row, _M_source_width * _Bytes_per_pixel);
+                        _Row = &_Padded_row[0];
+                    }
+                    _Resample_columns(_Row, _Bytes_per_pixel, &_Reduced_rows[_Slot * _Row_size]);
+                    _Reduced_row_indices[_Slot] = _R;
+                }
+                _Rows[_I] = &_Reduced_rows[_Slot * _Row_size];
+            }
+
+            const int* _Pairs = &_M_rows._M_pairs[_M_rows._M_offset[_Y]];
+            if (_Bytes_per_pixel == 4)
+            {
+                _Resample_rows(&_Rows[0], _Pairs, _M_rows._M_pair_count[_Y], _Target + _Y * _Target_stride, _Row_size);
+            }
+            else
+            {
+                _Resample_rows(&_Rows[0], _Pairs, _M_rows._M_pair_count[_Y], &_Target_row[0], _Row_size);
+                _Store_row(&_Target_row[0], _Target + _Y * _Target_stride, _Bytes_per_pixel);
+            }
+        }
+    }
+
+    void _Store_row(const unsigned char* _Row, unsigned char* _Target, int _Bytes_per_pixel) const
+    {
+        for (int _X = 0; _X < _M_width; ++_X, _Row += 4, _Target += _Bytes_per_pixel)
+        {
+            std::memcpy(_Target, _Row, _Bytes_per_pixel);
+        }
+    }
+
+    static int _Low_weight(int _Pair)
+    {
+        return static_cast<short>(_Pair & 0xFFFF);
+    }
+
+    static int _High_weight(int _Pair)
+    {
+        return _Pair >> 16;
+    }
+
+    // Sums the bytes of _Pair_count pairs of rows, sixteen at a time.
+    static void _Resample_rows(const unsigned char* const* _Rows, const int* _Pairs, int _Pair_count, unsigned char* _Target, int _Size)
+    {
+        int _I = 0;
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+        const __m128i _Zero = _mm_setzero_si128();
+        const __m128i _Half = _mm_set1_epi32(1 << (_Weight_bits - 1));
+        for (; _I + 16 <= _Size; _I += 16)
+        {
+            __m128i _Sum0 = _Half, _Sum1 = _Half, _Sum2 = _Half, _Sum3 = _Half;
+            for (int _P = 0; _P < _Pair_count; ++_P)
+            {
+                const __m128i _Even = _mm_loadu_si128(reinterpret_cast<const __m128i*>(_Rows[2 * _P] + _I));
+                const __m128i _Odd = _mm_loadu_si128(reinterpret_cast<const __m128i*>(_Rows[2 * _P + 1] + _I));
+                const __m128i _Weights = _mm_set1_epi32(_Pairs[_P]);
+                // Interleaving the bytes of the two rows puts each byte of the even row next to the byte of the
+                // odd row it is added to.
+                const __m128i _Low = _mm_unpacklo_epi8(_Even, _Odd);
+                const __m128i _High = _mm_unpackhi_epi8(_Even, _Odd);
+                _Sum0 = _mm_add_epi32(_Sum0, _mm_madd_epi16(_mm_unpacklo_epi8(_Low, _Zero), _Weights));
+                _Sum1 = _mm_add_epi32(_Sum1, _mm_madd_epi16(_mm_unpackhi_epi8(_Low, _Zero), _Weights));
+                _Sum2 = _mm_add_epi32(_Sum2, _mm_madd_epi16(_mm_unpacklo_epi8(_High, _Zero), _Weights));
+                _Sum3 = _mm_add_epi32(_Sum3, _mm_madd_epi16(_mm_unpackhi_epi8(_High, _Zero), _Weights));
+            }
+            const __m128i _Low = _mm_packs_epi32(_mm_srai_epi32(_Sum0, _Weight_bits), _mm_srai_epi32(_Sum1, _Weight_bits));
+            const __m128i _High = _mm_packs_epi32(_mm_srai_epi32(_Sum2, _Weight_bits), _mm_srai_epi32(_Sum3, _Weight_bits));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(_Target + _I), _mm_packus_epi16(_Low, _High));
+        }
+#endif
+        for (; _I < _Size; ++_I)
+        {
+            int _Sum = 1 << (_Weight_bits - 1);
+            for (int _P = 0; _P < _Pair_count; ++_P)
+            {
+                _Sum += _Rows[2 * _P][_I] * _Low_weight(_Pairs[_P]) + _Rows[2 * _P + 1][_I] * _High_weight(_Pairs[_P]);
+            }
+            _Target[_I] = static_cast<unsigned char>((std::min)(_Sum >> _Weight_bits, 255));
+        }
+    }
+
+    // Reduces a source row of three or four byte pixels to a row of _M_width four byte pixels. The fourth byte
+    // of a pixel reduced from three byte pixels is undefined.
+    void _Resample_columns(const unsigned char* _Row, int _Bytes_per_pixel, unsigned char* _Target) const
+    {
+        for (int _X = 0; _X < _M_width; ++_X, _Target += 4)
+        {
+            const unsigned char* _Pixel = _Row + _M_columns._M_first[_X] * _Bytes_per_pixel;
+            const int* _Pairs = &_M_columns._M_pairs[_M_columns._M_offset[_X]];
+            const int _Pair_count = _M_columns._M_pair_count[_X];
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+            const __m128i _Zero = _mm_setzero_si128();
+            __m128i _Sum = _mm_set1_epi32(1 << (_Weight_bits - 1));
+            for (int _P = 0; _P < _Pair_count; ++_P, _Pixel += 2 * _Bytes_per_pixel)
+            {
+                __m128i _Pixels;
+                if (_Bytes_per_pixel == 4)
+                {
+                    _Pixels = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(_Pixel));
+                }
+                else
+                {
+                    int _Even = 0;
+                    int _Odd = 0;
+                    std::memcpy(&_Even, _Pixel, 3);
+                    std::memcpy(&_Odd, _Pixel + 3, 3);
+                    _Pixels = _mm_unpacklo_epi32(_mm_cvtsi32_si128(_Even), _mm_cvtsi32_si128(_Odd));
+                }
+                // The two pixels as 16 bit values, rearranged so that the channels of both are next to each
+                // other.
+                _Pixels = _mm_unpacklo_epi8(_Pixels, _Zero);
+                _Pixels = _mm_unpacklo_epi16(_Pixels, _mm_srli_si128(_Pixels, 8));
+                _Sum = _mm_add_epi32(_Sum, _mm_madd_epi16(_Pixels, _mm_set1_epi32(_Pairs[_P])));
+            }
+            _Sum = _mm_srai_epi32(_Sum, _Weight_bits);
+            _Sum = _mm_packus_epi16(_mm_packs_epi32(_Sum, _Sum), _Zero);
+            const int _Value = _mm_cvtsi128_si32(_Sum);
+            std::memcpy(_Target, &_Value, 4);
+#else
+            int _Sum[4] = { 0, 0, 0, 0 };
+            for (int _P = 0; _P < _Pair_count; ++_P, _Pixel += 2 * _Bytes_per_pixel)
+            {
+                for (int _C = 0; _C < _Bytes_per_pixel; ++_C)
+                {
+                    _Sum[_C] += _Pixel[_C] * _Low_weight(_Pairs[_P]) + _Pixel[_C + _Bytes_per_pixel] * _High_weight(_Pairs[_P]);
+                }
+            }
+            for (int _C = 0; _C < 4; ++_C)
+            {
+                _Target[_C] = static_cast<unsigned char>((std::min)((_Sum[_C] + (1 << (_Weight_bits - 1))) >> _Weight_bits, 255));
+            }
+#endif
+        }
+    }
+};
+
+/// <summary>
+///     Keeps the <c>image_resampler</c> objects a pipeline uses, one for each source size, target size and mode.
+///     Computing the rows and columns and their weights costs about as much as resampling a small image, and a
+///     pipeline scales images of a few sizes to one size.
+/// </summary>
+/// <remarks>
+///     <c>get</c> may be called from any thread.
+/// </remarks>
+/**/
+class image_resampler_cache
+{
+public:
+    image_resampler_cache()
+    {
+    }
+
+    std::shared_ptr<const image_resampler> get(int _Source_width, int _Source_height, int _Width, int _Height, resample_mode _Mode)
+    {
+        const _Key _K(_Source_width, _Source_height, _Width, _Height, _Mode);
+        {
+            details::_Image_lock_guard _Lock(_M_lock);
+            auto _I = _M_resamplers.find(_K);
+            if (_I != _M_resamplers.end())
+            {
+                return _I->second;
+            }
+        }
+        // Threads that miss at the same time each create one, and the first one kept is used from then on.
+        std::shared_ptr<const image_resampler> _Resampler = std::make_shared<image_resampler>(_Source_width, _Source_height, _Width, _Height, _Mode);
+        details::_Image_lock_guard _Lock(_M_lock);
+        return _M_resamplers.insert(std::make_pair(_K, _Resampler)).first->second;
+    }
+
+private:
+    typedef std::tuple<int, int, int, int, int> _Key;
+
+    details::_Image_lock _M_lock;
+    std::map<_Key, std::shared_ptr<const image_resampler>> _M_resamplers;
+
+    image_resampler_cache(const image_resampler_cache&);
+    image_resampler_cache const & operator=(image_resampler_cache const&);
+};
+
+/// <summary>
+///     A Gaussian noise filter that works on one row of three or four byte pixels at a time. The noise is looked
+///     up in a table of the inverse cumulative distribution, computed once for the standard deviation and rounded
+///     to whole intensity steps.
+/// </summary>
+/// <remarks>
+///     The uniform variates come from a <c>philox4x32</c> stream per row, so the noise of a row does not depend
+///     on the thread that filters it, and no state is shared between threads. The noise of a row is split into
+///     amounts to add and to subtract, which are applied sixteen bytes at a time with saturating arithmetic.
+/// </remarks>
+/**/
+class noise_filter
+{
+public:
+    explicit noise_filter(double _Standard_deviation, unsigned long long _Seed = philox4x32::default_seed) :
+        _M_standard_deviation(_Standard_deviation),
+        _M_table(1 << _Table_bits),
+        _M_generator(_Seed)
+    {
+        const double _Count = static_cast<double>(_M_table.size());
+        for (size_t _I = 0; _I < _M_table.size(); ++_I)
+        {
+            int _Noise = static_cast<int>(details::_Gaussian_inverse((_I + 0.5) / _Count) * _Standard_deviation);
+            _Noise = (std::max)(-255, (std::min)(_Noise, 255));
+            _M_table[_I] = static_cast<unsigned short>((_Noise >= 0) ? _Noise : (-_Noise) << 8);
+        }
+    }
+
+    double standard_deviation() const
+    {
+        return _M_standard_deviation;
+    }
+
+    /// <summary>
+    ///     Adds noise to the first three bytes of each pixel of a row. Rows with different stream numbers get
+    ///     independent noise, for example the sequence number of the image in the high and the row number in the
+    ///     low 32 bits.
+    /// </summary>
+    void filter_row(unsigned char* _Row, int _Width, int _Bytes_per_pixel, unsigned long long _Stream) const
+    {
+        philox4x32 _Generator = _M_generator.substream(_Stream);
+        unsigned char _Add[_Chunk_pixels * 4];
+        unsigned char _Subtract[_Chunk_pixels * 4];
+        unsigned int _Random[_Chunk_pixels * 3 / 2];
+
+        for (int _First = 0; _First < _Width; _First += _Chunk_pixels)
+        {
+            const int _Pixels = (std::min)(static_cast<int>(_Chunk_pixels), _Width - _First);
+            // Each 32 bit variate gives two 15 bit table indices, so two pixels take three variates.
+            const int _Channels = 3 * _Pixels;
+            _Generator.generate(_Random, _Random + (_Channels + 1) / 2);
+
+            unsigned char* _A = _Add;
+            unsigned char* _S = _Subtract;
+            for (int _C = 0; _C < _Channels; _C += 3, _A += _Bytes_per_pixel, _S += _Bytes_per_pixel)
+            {
+                _Set_noise(_A[0], _S[0], _Variate(_Random, _C));
+                _Set_noise(_A[1], _S[1], _Variate(_Random, _C + 1));
+                _Set_noise(_A[2], _S[2], _Variate(_Random, _C + 2));
+                if (_Bytes_per_pixel == 4)
+                {
+                    _A[3] = _S[3] = 0;
+                }
+            }
+            _Apply_noise(_Row + _First * _Bytes_per_pixel, _Add, _Subtract, _Pixels * _Bytes_per_pixel);
+        }
+    }
+
+private:
+    // 15 bit uniform variates, the resolution of rand() on Windows. An enum, as static const members that min
+    // binds to a reference would need a definition outside the class.
+    enum
+    {
+        _Table_bits = 15,
+        _Chunk_pixels = 256
+    };
+
+    double _M_standard_deviation;
+    // The low byte of each entry is the amount to add, the high byte the amount to subtract.
+    std::vector<unsigned short> _M_table;
+    philox4x32 _M_generator;
+
+    static unsigned int _Variate(const unsigned int* _Random, int _Index)
+    {
+        return (_Random[_Index >> 1] >> ((_Index & 1) << 4)) & ((1 << _Table_bits) - 1);
+    }
+
+    void _Set_noise(unsigned char& _Add, unsigned char& _Subtract, unsigned int _Uniform) const
+    {
+        const unsigned short _Noise = _M_table[_Uniform];
+        _Add = static_cast<unsigned char>(_Noise);
+        _Subtract = static_cast<unsigned char>(_Noise >> 8);
+    }
+
+    static void _Apply_noise(unsigned char* _Bytes, const unsigned char* _Add, const unsigned char* _Subtract, int _Count)
+    {
+        int _I = 0;
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+        for (; _I + 16 <= _Count; _I += 16)
+        {
+            __m128i _Value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(_Bytes + _I));
+            _Value = _mm_adds_epu8(_Value, _mm_loadu_si128(reinterpret_cast<const __m128i*>(_Add + _I)));
+            _Value = _mm_subs_epu8(_Value, _mm_loadu_si128(reinterpret_cast<const __m128i*>(_Subtract + _I)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(_Bytes + _I), _Value);
+        }
+#endif
+        for (; _I < _Count; ++_I)
+        {
+            int _Value = _Bytes[_I] + _Add[_I] - _Subtract[_I];
+            _Bytes[_I] = static_cast<unsigned char>((std::max)(0, (std::min)(_Value, 255)));
+        }
+    }
+};
+} // namespace samples
+} // namespace Concurrency
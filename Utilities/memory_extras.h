@@ -0,0 +1,468 @@
+//--------------------------------------------------------------------------
+//
+//  Copyright (c) Microsoft Corporation.  All rights reserved.
+//
+//  File: memory_extras.h
+//
+//  Implementation of a portable thread-caching suballocator.
+//
+//--------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstddef>
+#include <new>
+
+#if defined(_MSC_VER) && (_MSC_VER < 1700)
+// <mutex> is not available. The central pools are locked with a Concurrency Runtime critical section.
+#include <concrt.h>
+#define _SUBALLOCATOR_CONCRT_LOCK
+#else
+#include <mutex>
+#endif
+
+#if defined(_MSC_VER) && (_MSC_VER < 1900)
+// thread_local is not available. Thread caches are reached through a __declspec(thread) pointer and are not
+// returned to the central pools when their thread exits. Function-local statics are not initialized thread-safely
+// either, so the heap is published with an interlocked exchange.
+#include <intrin.h>
+#define _SUBALLOCATOR_NO_THREAD_LOCAL
+#endif
+
+namespace Concurrency
+{
+namespace samples
+{
+namespace details
+{
+    const size_t _Cache_line_size = 64;
+
+#if defined(_SUBALLOCATOR_CONCRT_LOCK)
+    typedef Concurrency::critical_section _Pool_lock;
+    typedef Concurrency::critical_section::scoped_lock _Pool_lock_guard;
+#else
+    typedef std::mutex _Pool_lock;
+    typedef std::lock_guard<std::mutex> _Pool_lock_guard;
+#endif
+
+    // Blocks are carved from spans of this size. Spans are aligned to a cache line and are never released.
+    const size_t _Span_size = 64 * 1024;
+
+    // Requests larger than the biggest size class go straight to operator new.
+    const size_t _Size_class_count = 12;
+
+    // Block sizes up to 64 bytes are powers of two, so a block never straddles a cache line. Larger block sizes are
+    // multiples of the cache line size, so every block starts on a line boundary.
+    inline size_t _Class_size(size_t _Class)
+    {
+        static const size_t _Sizes[_Size_class_count] = { 16, 32, 64, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048 };
+        return _Sizes[_Class];
+    }
+
+    // Returns the size class for a request of _Bytes, or _Size_class_count when the request is too large.
+    inline size_t _Size_class_of(size_t _Bytes)
+    {
+        size_t _Class = 0;
+        while (_Class < _Size_class_count && _Class_size(_Class) < _Bytes)
+        {
+            ++_Class;
+        }
+        return _Class;
+    }
+
+    // The number of blocks moved between a thread cache and the central pool at a time. A thread cache holds at most
+    // two batches of a size class before returning one.
+    inline size_t _Batch_count(size_t _Class)
+    {
+        size_t _Count = 8 * 1024 / _Class_size(_Class);
+        return (_Count < 8) ? 8 : (_Count > 64) ? 64 : _Count;
+    }
+
+    // A free block. The first block of a batch in a central pool also links to the next batch.
+    struct _Free_block
+    {
+        _Free_block *_M_next;
+        _Free_block *_M_next_batch;
+    };
+
+    // The central pool for one size class. Thread caches take and return whole batches under the lock, so it is
+    // acquired once per batch rather than once per block.
+    class _Central_pool
+    {
+    public:
+        _Central_pool() : _M_class(0), _M_batches(nullptr), _M_loose(nullptr), _M_loose_count(0), _M_cursor(nullptr), _M_end(nullptr)
+        {
+        }
+
+        void _Initialize(size_t _Class)
+        {
+            _M_class = _Class;
+        }
+
+        // Returns a chain of _Batch_count(_M_class) blocks.
+        _Free_block *_Pop_batch()
+        {
+            _Pool_lock_guard _Lock(_M_lock);
+
+            if (_M_batches != nullptr)
+            {
+                _Free_block *_Batch = _M_batches;
+                _M_batches = _Batch->_M_next_batch;
+                return _Batch;
+            }
+
+            size_t _Count = _Batch_count(_M_class);
+            _Free_block *_Batch = nullptr;
+
+            // Use blocks returned singly by exiting threads first, then carve new ones.
+            while (_Count > 0 && _M_loose != nullptr)
+            {
+                _Free_block *_Block = _M_loose;
+                _M_loose = _Block->_M_next;
+                --_M_loose_count;
+                _Block->_M_next = _Batch;
+                _Batch = _Block;
+                --_Count;
+            }
+
+            size_t _Size = _Class_size(_M_class);
+            while (_Count > 0)
+            {
+                if (_M_cursor == _M_end)
+                {
+                    _New_span();
+                }
+                _Free_block *_Block = reinterpret_cast<_Free_block *>(_M_cursor);
+                _M_cursor += _Size;
+                _Block->_M_next = _Batch;
+                _Batch = _Block;
+                --_Count;
+            }
+            return _Batch;
+        }
+
+        // Takes back a chain of exactly _Batch_count(_M_class) blocks.
+        void _Push_batch(_Free_block *_Batch)
+        {
+            _Pool_lock_guard _Lock(_M_lock);
+            _Batch->_M_next_batch = _M_batches;
+            _M_batches = _Batch;
+        }
+
+        // Takes back a chain of any length, used when a thread cache is flushed.
+        void _Push_loose(_Free_block *_Chain, size_t _Count)
+        {
+            if (_Chain == nullptr)
+            {
+                return;
+            }
+
+            _Free_block *_Last = _Chain;
+            while (_Last->_M_next != nullptr)
+            {
+                _Last = _Last->_M_next;
+            }
+
+            _Pool_lock_guard _Lock(_M_lock);
+            _Last->_M_next = _M_loose;
+            _M_loose = _Chain;
+            _M_loose_count += _Count;
+        }
+
+    private:
+        void _New_span()
+        {
+            char *_Raw = static_cast<char *>(::operator new(_Span_size + _Cache_line_size));
+            size_t _Misalignment = reinterpret_cast<size_t>(_Raw) % _Cache_line_size;
+            char *_Span = _Raw + ((_Misalignment == 0) ? 0 : _Cache_line_size - _Misalignment);
+
+            size_t _Size = _Class_size(_M_class);
+            _M_cursor = _Span;
+            _M_end = _Span + (_Span_size / _Size) * _Size;
+        }
+
+        _Pool_lock _M_lock;
+        size_t _M_class;
+        _Free_block *_M_batches;
+        _Free_block *_M_loose;
+        size_t _M_loose_count;
+        char *_M_cursor;
+        char *_M_end;
+
+        _Central_pool(const _Central_pool&);
+        _Central_pool const & operator=(_Central_pool const&);
+    };
+
+    class _Caching_heap
+    {
+    public:
+        _Caching_heap()
+        {
+            for (size_t _Class = 0; _Class < _Size_class_count; ++_Class)
+            {
+                _M_pools[_Class]._Initialize(_Class);
+            }
+        }
+
+        _Central_pool &_Pool(size_t _Class)
+        {
+            return _M_pools[_Class];
+        }
+
+        // The heap is created on first use and deliberately never destroyed, so that thread caches can still be
+        // flushed into it while the process shuts down.
+        static _Caching_heap &_Get()
+        {
+#if defined(_SUBALLOCATOR_NO_THREAD_LOCAL)
+            static void * volatile _S_heap = nullptr;
+            if (_S_heap == nullptr)
+            {
+                _Caching_heap *_Heap = new _Caching_heap();
+                if (_InterlockedCompareExchangePointer(&_S_heap, _Heap, nullptr) != nullptr)
+                {
+                    delete _Heap;
+                }
+            }
+            return *static_cast<_Caching_heap *>(_S_heap);
+#else
+            static _Caching_heap *_S_heap = new _Caching_heap();
+            return *_S_heap;
+#endif
+        }
+
+    private:
+        _Central_pool _M_pools[_Size_class_count];
+    };
+
+    // The per-thread free lists, one for each size class. Only the owning thread touches them.
+    class _Thread_cache
+    {
+    public:
+        _Thread_cache()
+        {
+            for (size_t _Class = 0; _Class < _Size_class_count; ++_Class)
+            {
+                _M_lists[_Class] = nullptr;
+                _M_counts[_Class] = 0;
+            }
+        }
+
+        ~_Thread_cache()
+        {
+            _Flush();
+        }
+
+        void *_Allocate(size_t _Class)
+        {
+            if (_M_lists[_Class] == nullptr)
+            {
+                _M_lists[_Class] = _Caching_heap::_Get()._Pool(_Class)._Pop_batch();
+                _M_counts[_Class] = _Batch_count(_Class);
+            }
+
+            _Free_block *_Block = _M_lists[_Class];
+            _M_lists[_Class] = _Block->_M_next;
+            --_M_counts[_Class];
+            return _Block;
+        }
+
+        void _Deallocate(void *_Ptr, size_t _Class)
+        {
+            _Free_block *_Block = static_cast<_Free_block *>(_Ptr);
+            _Block->_M_next = _M_lists[_Class];
+            _M_lists[_Class] = _Block;
+
+            size_t _Batch = _Batch_count(_Class);
+            if (++_M_counts[_Class] >= 2 * _Batch)
+            {
+                // Return the most recently freed blocks, keep the rest.
+                _Free_block *_Last = _M_lists[_Class];
+                for (size_t _I = 1; _I < _Batch; ++_I)
+                {
+                    _Last = _Last->_M_next;
+                }
+
+                _Free_block *_Returned = _M_lists[_Class];
+                _M_lists[_Class] = _Last->_M_next;
+                _Last->_M_next = nullptr;
+                _M_counts[_Class] -= _Batch;
+                _Caching_heap::_Get()._Pool(_Class)._Push_batch(_Returned);
+            }
+        }
+
+        // Returns every cached block to the central pools.
+        void _Flush()
+        {
+            for (size_t _Class = 0; _Class < _Size_class_count; ++_Class)
+            {
+                _Caching_heap::_Get()._Pool(_Class)._Push_loose(_M_lists[_Class], _M_counts[_Class]);
+                _M_lists[_Class] = nullptr;
+                _M_counts[_Class] = 0;
+            }
+        }
+
+    private:
+        _Free_block *_M_lists[_Size_class_count];
+        size_t _M_counts[_Size_class_count];
+
+        _Thread_cache(const _Thread_cache&);
+        _Thread_cache const & operator=(_Thread_cache const&);
+    };
+
+#if defined(_SUBALLOCATOR_NO_THREAD_LOCAL)
+    inline _Thread_cache *_Get_thread_cache()
+    {
+        static __declspec(thread) _Thread_cache *_S_cache = nullptr;
+        if (_S_cache == nullptr)
+        {
+            _S_cache = new _Thread_cache();
+        }
+        return _S_cache;
+    }
+#else
+    // Set when the calling thread's cache has been destroyed. The flag has no destructor, so it can still be read
+    // after the main thread's thread_local objects are gone, which happens before static objects are destroyed.
+    inline bool &_Thread_cache_destroyed()
+    {
+        static thread_local bool _S_destroyed = false;
+        return _S_destroyed;
+    }
+
+    class _Thread_local_cache : public _Thread_cache
+    {
+    public:
+        ~_Thread_local_cache()
+        {
+            _Thread_cache_destroyed() = true;
+        }
+    };
+
+    // Returns null once the cache has been destroyed, for example when a static container that uses the
+    // suballocator frees its nodes.
+    inline _Thread_cache *_Get_thread_cache()
+    {
+        if (_Thread_cache_destroyed())
+        {
+            return nullptr;
+        }
+        static thread_local _Thread_local_cache _S_cache;
+        return &_S_cache;
+    }
+#endif
+
+    // Without a thread cache blocks go straight to and from the central pools, a batch at a time for
+    // allocations, of which all blocks but one are returned.
+    inline void *_Allocate_uncached(size_t _Class)
+    {
+        _Central_pool &_Pool = _Caching_heap::_Get()._Pool(_Class);
+        _Free_block *_Block = _Pool._Pop_batch();
+        _Pool._Push_loose(_Block->_M_next, _Batch_count(_Class) - 1);
+        return _Block;
+    }
+
+    inline void _Deallocate_uncached(void *_Ptr, size_t _Class)
+    {
+        _Free_block *_Block = static_cast<_Free_block *>(_Ptr);
+        _Block->_M_next = nullptr;
+        _Caching_heap::_Get()._Pool(_Class)._Push_loose(_Block, 1);
+    }
+
+    // Allocates _Bytes from the calling thread's cache. Blocks must be released with _Subfree and the same size.
+    inline void *_Suballoc(size_t _Bytes)
+    {
+        size_t _Class = _Size_class_of(_Bytes);
+        if (_Class == _Size_class_count)
+        {
+            return ::operator new(_Bytes);
+        }
+        _Thread_cache *_Cache = _Get_thread_cache();
+        return (_Cache != nullptr) ? _Cache->_Allocate(_Class) : _Allocate_uncached(_Class);
+    }
+
+    // Releases a block into the calling thread's cache. It may have been allocated on any thread.
+    inline void _Subfree(void *_Ptr, size_t _Bytes)
+    {
+        if (_Ptr == nullptr)
+        {
+            return;
+        }
+
+        size_t _Class = _Size_class_of(_Bytes);
+        if (_Class == _Size_class_count)
+        {
+            ::operator delete(_Ptr);
+            return;
+        }
+        _Thread_cache *_Cache = _Get_thread_cache();
+        if (_Cache != nullptr)
+        {
+            _Cache->_Deallocate(_Ptr, _Class);
+        }
+        else
+        {
+            _Deallocate_uncached(_Ptr, _Class);
+        }
+    }
+}
+
+/// <summary>
+///     An STL compatible allocator for small objects that does not depend on the Concurrency Runtime. It can be
+///     used in place of <c>concrt_suballocator</c> on any platform.
+/// </summary>
+/// <remarks>
+///     Requests are rounded up to one of twelve size classes between 16 and 2048 bytes. Each thread keeps a free
+///     list per size class and exchanges blocks with a central pool in batches, so most allocations and frees take
+///     no lock. Blocks of 64 bytes or less never straddle a cache line and larger blocks start on one. Larger requests
+///     are passed to <c>operator new</c>.
+///     <para>Memory is never returned to the operating system; the allocator is intended for the node-based containers
+///     and task closures of long running parallel programs, which repeatedly free and reuse blocks of the same sizes.</para>
+/// </remarks>
+/**/
+template<typename T>
+class suballocator {
+public:
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef T value_type;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+    template<typename U> struct rebind {
+        typedef suballocator<U> other;
+    };
+
+    suballocator() throw() {}
+    suballocator( const suballocator& ) throw() {}
+    template<typename U> suballocator(const suballocator<U>&) throw() {}
+
+    pointer address(reference x) const {return &x;}
+    const_pointer address(const_reference x) const {return &x;}
+
+    pointer allocate( size_type n, const void* hint=0 ) {
+        // The "hint" argument is ignored
+        return pointer(details::_Suballoc(n * sizeof(T)));
+    }
+
+    void deallocate( pointer p, size_type n ) {
+        details::_Subfree(p, n * sizeof(T));
+    }
+
+    size_type max_size() const throw() {
+        size_type count = (size_type)(-1) / sizeof (T);
+        return (0 < count ? count : 1);
+    }
+
+    void construct( pointer p, const T& value ) {new(static_cast<void*>(p)) T(value);}
+
+    void destroy( pointer p ) {p->~T();}
+};
+
+// All suballocators share the same heap, so memory allocated by one can be freed by any other.
+template<typename T, typename U>
+inline bool operator==(const suballocator<T>&, const suballocator<U>&) { return true; }
+
+template<typename T, typename U>
+inline bool operator!=(const suballocator<T>&, const suballocator<U>&) { return false; }
+} // namespace samples
+} // namespace Concurrency
@@ -0,0 +1,491 @@
+//--------------------------------------------------------------------------
+//
+//  Copyright (c) Microsoft Corporation.  All rights reserved.
+//
+//  File: output_extras.h
+//
+//  Implementation of a double-buffered output file written by a dedicated
+//  thread.
+//
+//--------------------------------------------------------------------------
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstring>
+#include <cwchar>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace Concurrency
+{
+namespace samples
+{
+namespace details
+{
+    const size_t _Default_output_buffer_size = 1024 * 1024;
+
+    // The most bytes one wide character takes in UTF-8. A UTF-16 surrogate pair takes four bytes for two
+    // characters, every other character at most three.
+    const size_t _Max_utf8_per_wchar = (sizeof(wchar_t) == 2) ? 3 : 4;
+
+    // The file an async_output_file writes to. Only the writer thread calls _Write; the other calls are made
+    // while the writer thread does not run.
+    class _Output_file
+    {
+    public:
+#if defined(_WIN32)
+        explicit _Output_file(const std::wstring& _Path)
+        {
+            _M_handle = CreateFileW(_Path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (_M_handle == INVALID_HANDLE_VALUE)
+            {
+                throw std::runtime_error("async_output_file::async_output_file");
+            }
+        }
+
+        bool _Write(const char *_Data, size_t _Size)
+        {
+            while (_Size > 0)
+            {
+                DWORD _Chunk = (_Size > 0x40000000) ? 0x40000000 : static_cast<DWORD>(_Size);
+                DWORD _Written = 0;
+                if (!WriteFile(_M_handle, _Data, _Chunk, &_Written, nullptr))
+                {
+                    return false;
+                }
+                _Data += _Written;
+                _Size -= _Written;
+            }
+            return true;
+        }
+
+        bool _Sync()
+        {
+            return FlushFileBuffers(_M_handle) != FALSE;
+        }
+
+        bool _Close()
+        {
+            bool _Closed = CloseHandle(_M_handle) != FALSE;
+            _M_handle = INVALID_HANDLE_VALUE;
+            return _Closed;
+        }
+
+        bool _Is_open() const
+        {
+            return _M_handle != INVALID_HANDLE_VALUE;
+        }
+
+    private:
+        HANDLE _M_handle;
+#else
+        // The path is passed to open() in UTF-8.
+        explicit _Output_file(const std::wstring& _Path)
+        {
+            std::string _Narrow;
+            for (size_t _I = 0; _I < _Path.size(); ++_I)
+            {
+                char _Bytes[4];
+                _Narrow.append(_Bytes, _Encode(_Path[_I], _Bytes));
+            }
+            _M_fd = ::open(_Narrow.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (_M_fd < 0)
+            {
+                throw std::runtime_error("async_output_file::async_output_file");
+            }
+        }
+
+        bool _Write(const char *_Data, size_t _Size)
+        {
+            while (_Size > 0)
+            {
+                ssize_t _Written = ::write(_M_fd, _Data, _Size);
+                if (_Written < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    return false;
+                }
+                _Data += _Written;
+                _Size -= static_cast<size_t>(_Written);
+            }
+            return true;
+        }
+
+        bool _Sync()
+        {
+            return ::fsync(_M_fd) == 0;
+        }
+
+        bool _Close()
+        {
+            bool _Closed = ::close(_M_fd) == 0;
+            _M_fd = -1;
+            return _Closed;
+        }
+
+        bool _Is_open() const
+        {
+            return _M_fd >= 0;
+        }
+
+    private:
+        int _M_fd;
+#endif
+
+    public:
+        // Closes the file if async_output_file did not, which is the case when its constructor throws.
+        ~_Output_file()
+        {
+            if (_Is_open())
+            {
+                _Close();
+            }
+        }
+
+        // Writes the UTF-8 encoding of one UTF-32 code point, or of one UTF-16 unit that is not part of a
+        // surrogate pair, to _Bytes and returns its length.
+        static size_t _Encode(unsigned long _Code, char *_Bytes)
+        {
+            if (_Code < 0x80)
+            {
+                _Bytes[0] = static_cast<char>(_Code);
+                return 1;
+            }
+            if (_Code < 0x800)
+            {
+                _Bytes[0] = static_cast<char>(0xC0 | (_Code >> 6));
+                _Bytes[1] = static_cast<char>(0x80 | (_Code & 0x3F));
+                return 2;
+            }
+            if (_Code < 0x10000)
+            {
+                _Bytes[0] = static_cast<char>(0xE0 | (_Code >> 12));
+                _Bytes[1] = static_cast<char>(0x80 | ((_Code >> 6) & 0x3F));
+                _Bytes[2] = static_cast<char>(0x80 | (_Code & 0x3F));
+                return 3;
+            }
+            _Bytes[0] = static_cast<char>(0xF0 | (_Code >> 18));
+            _Bytes[1] = static_cast<char>(0x80 | ((_Code >> 12) & 0x3F));
+            _Bytes[2] = static_cast<char>(0x80 | ((_Code >> 6) & 0x3F));
+            _Bytes[3] = static_cast<char>(0x80 | (_Code & 0x3F));
+            return 4;
+        }
+
+    private:
+        _Output_file(const _Output_file&);
+        _Output_file const & operator=(_Output_file const&);
+    };
+}
+
+/// <summary>
+///     An output file that is written by a thread of its own. Callers format text into one of two large buffers;
+///     when it fills up, the writer thread writes it to the file with a single call while callers go on filling
+///     the other buffer. A caller only waits when it has filled its buffer before the writer has finished
+///     with the previous one.
+/// </summary>
+/// <remarks>
+///     Bytes reach the file in the order in which they were written. Wide text is written in UTF-8, and
+///     <c>end_line</c> writes the line ending of the platform, so a file written with <c>end_line</c> reads
+///     back with the same lines as one written by a <c>wofstream</c> with <c>endl</c>.
+///     <para>Only one thread at a time may call the members of an async_output_file.</para>
+///     <para>A failed write is reported by the next call that hands a buffer to the writer thread, or by
+///     <c>close</c>. The destructor closes the file without waiting for the storage device and ignores errors,
+///     so callers that need to know that their data is safe call <c>close</c>.</para>
+/// </remarks>
+/**/
+class async_output_file
+{
+public:
+    explicit async_output_file(const std::wstring& _Path, size_t _Buffer_size = details::_Default_output_buffer_size) :
+        _M_file(_Path),
+        _M_buffer_size(_Buffer_size),
+        _M_used(0),
+        _M_pending(nullptr),
+        _M_pending_size(0),
+        _M_closing(false),
+        _M_failed(false)
+    {
+        if (_Buffer_size < 64)
+        {
+            throw std::invalid_argument("_Buffer_size");
+        }
+        _M_buffers[0].reset(new char[_Buffer_size]);
+        _M_buffers[1].reset(new char[_Buffer_size]);
+        _M_current = _M_buffers[0].get();
+        _M_writer = std::thread(&async_output_file::_Writer_main, this);
+    }
+
+    ~async_output_file()
+    {
+        if (_M_file._Is_open())
+        {
+            _Close(false);
+        }
+    }
+
+    void write(const char *_Data, size_t _Size)
+    {
+        while (_Size > 0)
+        {
+            _Reserve(1);
+            size_t _Chunk = _M_buffer_size - _M_used;
+            if (_Chunk > _Size)
+            {
+                _Chunk = _Size;
+            }
+            memcpy(_M_current + _M_used, _Data, _Chunk);
+            _M_used += _Chunk;
+            _Data += _Chunk;
+            _Size -= _Chunk;
+        }
+    }
+
+    void write(const std::wstring& _Text)
+    {
+        write(_Text.data(), _Text.size());
+    }
+
+    void write(const wchar_t *_Text)
+    {
+        write(_Text, wcslen(_Text));
+    }
+
+    void write(const wchar_t *_Text, size_t _Length)
+    {
+        // Every pass reserves room for the encoding of a run of characters, so the loop over the characters of
+        // the run checks neither for room nor for the end of the buffer.
+        const size_t _Max_run = (_M_buffer_size / details::_Max_utf8_per_wchar) - 1;
+        while (_Length > 0)
+        {
+            size_t _Run = (_Length < _Max_run) ? _Length : _Max_run;
+            // A surrogate pair that straddles the end of the run is left whole for the next one.
+            if (sizeof(wchar_t) == 2 && _Run < _Length && _Text[_Run - 1] >= 0xD800 && _Text[_Run - 1] < 0xDC00)
+            {
+                --_Run;
+            }
+            _Reserve(_Run * details::_Max_utf8_per_wchar);
+            char *_Out = _M_current + _M_used;
+            for (size_t _I = 0; _I < _Run; ++_I)
+            {
+                unsigned long _Code = static_cast<unsigned long>(_Text[_I]);
+                if (_Code < 0x80)
+                {
+                    *_Out++ = static_cast<char>(_Code);
+                    continue;
+                }
+                if (sizeof(wchar_t) == 2 && _Code >= 0xD800 && _Code < 0xDC00 && _I + 1 < _Run)
+                {
+                    unsigned long _Low = static_cast<unsigned long>(_Text[_I + 1]);
+                    if (_Low >= 0xDC00 && _Low < 0xE000)
+                    {
+                        _Code = 0x10000 + ((_Code - 0xD800) << 10) + (_Low - 0xDC00);
+                        ++_I;
+                    }
+                }
+                _Out += details::_Output_file::_Encode(_Code, _Out);
+            }
+            _M_used = static_cast<size_t>(_Out - _M_current);
+            _Text += _Run;
+            _Length -= _Run;
+        }
+    }
+
+    void write(wchar_t _Ch)
+    {
+        write(&_Ch, 1);
+    }
+
+    void write(char _Ch)
+    {
+        _Reserve(1);
+        _M_current[_M_used++] = _Ch;
+    }
+
+    void write(int _Value)
+    {
+        write(static_cast<long long>(_Value));
+    }
+
+    void write(long long _Value)
+    {
+        char _Digits[24];
+        char *_First = _Digits + sizeof(_Digits);
+        unsigned long long _Magnitude = (_Value < 0) ? (0 - static_cast<unsigned long long>(_Value)) : static_cast<unsigned long long>(_Value);
+        do
+        {
+            *--_First = static_cast<char>('0' + (_Magnitude % 10));
+            _Magnitude /= 10;
+        }
+        while (_Magnitude != 0);
+        if (_Value < 0)
+        {
+            *--_First = '-';
+        }
+        write(_First, static_cast<size_t>(_Digits + sizeof(_Digits) - _First));
+    }
+
+    void end_line()
+    {
+#if defined(_WIN32)
+        write("\r\n", 2);
+#else
+        write('\n');
+#endif
+    }
+
+    /// <summary>
+    ///     Hands what has been written so far to the writer thread without waiting for it to reach the file.
+    /// </summary>
+    /**/
+    void flush()
+    {
+        if (_M_used > 0)
+        {
+            _Hand_over();
+        }
+    }
+
+    /// <summary>
+    ///     Writes what is left in the buffers, waits until the storage device has it unless <paramref name="_Durable"/>
+    ///     is false, and closes the file. Throws <c>std::runtime_error</c> if any write failed.
+    /// </summary>
+    /**/
+    void close(bool _Durable = true)
+    {
+        if (!_M_file._Is_open())
+        {
+            throw std::logic_error("async_output_file::close");
+        }
+        if (!_Close(_Durable))
+        {
+            throw std::runtime_error("async_output_file::close");
+        }
+    }
+
+private:
+    details::_Output_file _M_file;
+    std::unique_ptr<char[]> _M_buffers[2];
+    size_t _M_buffer_size;
+
+    // The buffer callers are filling and how much of it is used.
+    char *_M_current;
+    size_t _M_used;
+
+    // The buffer the writer thread has been given, if any, guarded by _M_lock. The writer clears it once it
+    // has written the buffer, so the caller can hand over the other buffer and reuse this one.
+    std::mutex _M_lock;
+    std::condition_variable _M_changed;
+    const char *_M_pending;
+    size_t _M_pending_size;
+    bool _M_closing;
+    bool _M_failed;
+
+    std::thread _M_writer;
+
+    // Makes sure that _Size bytes fit into the current buffer.
+    void _Reserve(size_t _Size)
+    {
+        if (_M_buffer_size - _M_used < _Size)
+        {
+            _Hand_over();
+        }
+    }
+
+    // Waits until the writer has finished the other buffer, gives it the current one and switches to the other.
+    void _Hand_over()
+    {
+        std::unique_lock<std::mutex> _Lock(_M_lock);
+        while (_M_pending != nullptr)
+        {
+            _M_changed.wait(_Lock);
+        }
+        if (_M_failed)
+        {
+            throw std::runtime_error("async_output_file::write");
+        }
+        _M_pending = _M_current;
+        _M_pending_size = _M_used;
+        _Lock.unlock();
+        _M_changed.notify_all();
+
+        _M_current = (_M_current == _M_buffers[0].get()) ? _M_buffers[1].get() : _M_buffers[0].get();
+        _M_used = 0;
+    }
+
+    void _Writer_main()
+    {
+        std::unique_lock<std::mutex> _Lock(_M_lock);
+        for (;;)
+        {
+            while (_M_pending == nullptr && !_M_closing)
+            {
+                _M_changed.wait(_Lock);
+            }
+            if (_M_pending == nullptr)
+            {
+                return;
+            }
+
+            const char *_Data = _M_pending;
+            size_t _Size = _M_pending_size;
+            bool _Skip = _M_failed;
+            _Lock.unlock();
+
+            // After a failure the rest of the data is dropped, the caller learns of it when it next hands over.
+            bool _Written = _Skip || _M_file._Write(_Data, _Size);
+
+            _Lock.lock();
+            _M_failed = _M_failed || !_Written;
+            _M_pending = nullptr;
+            _M_changed.notify_all();
+        }
+    }
+
+    bool _Close(bool _Durable)
+    {
+        {
+            std::unique_lock<std::mutex> _Lock(_M_lock);
+            while (_M_pending != nullptr)
+            {
+                _M_changed.wait(_Lock);
+            }
+            if (_M_used > 0)
+            {
+                _M_pending = _M_current;
+                _M_pending_size = _M_used;
+                _M_used = 0;
+            }
+            _M_closing = true;
+        }
+        _M_changed.notify_all();
+        _M_writer.join();
+
+        bool _Succeeded = !_M_failed;
+        if (_Durable && _Succeeded)
+        {
+            _Succeeded = _M_file._Sync();
+        }
+        return _M_file._Close() && _Succeeded;
+    }
+
+    async_output_file(const async_output_file&);
+    async_output_file const & operator=(async_output_file const&);
+};
+} // namespace samples
+} // namespace Concurrency
@@ -0,0 +1,1707 @@
+//--------------------------------------------------------------------------
+//
+//  Copyright (c) Microsoft Corporation.  All rights reserved.
+//
+//  File: pipeline_extras.h
+//
+//  Implementation of a typed linear pipeline whose stages are connected by
+//  bounded single-producer, single-consumer rings.
+//
+//--------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "sync_extras.h"
+#include "telemetry_extras.h"
+
+// The rings construct elements with placement new, which MFC's debug definition of new would break.
+#pragma push_macro("new")
+#undef new
+
+namespace Concurrency
+{
+namespace samples
+{
+/// <summary>
+///     How a pipeline stage processes the elements it receives.
+/// </summary>
+/**/
+enum pipeline_stage_mode
+{
+    /// <summary>
+    ///     One thread processes the elements in the order the source produced them.
+    /// </summary>
+    pipeline_serial_in_order,
+    /// <summary>
+    ///     One thread processes the elements in the order they arrive.
+    /// </summary>
+    pipeline_serial_out_of_order,
+    /// <summary>
+    ///     Several threads process elements at the same time, each with its own copy of the stage function.
+    /// </summary>
+    pipeline_parallel
+};
+
+namespace details
+{
+    // The number of elements a connection holds when the source does not say otherwise.
+    const size_t _Default_connection_capacity = 64;
+
+    // How long, in microseconds, a batched element may wait for the rest of its batch by default.
+    const unsigned int _Default_batch_delay = 100;
+
+    // A producer reads the clock to check the delay of its batch once every this many elements.
+    const size_t _Batch_clock_interval = 4;
+
+    // Serial stages that take less than this many microseconds an element run on the thread of the stage before.
+    const unsigned int _Default_fusion_threshold = 1;
+
+    // A fused stage is split off again once it takes this many times the fusion threshold an element.
+    const int _Split_factor = 4;
+
+    // A stage times one element in every _Profile_interval, and decides nothing before _Profile_warmup samples.
+    const size_t _Profile_interval = 16;
+    const size_t _Profile_warmup = 8;
+
+    inline size_t _Default_parallel_degree()
+    {
+        unsigned int _Threads = std::thread::hardware_concurrency();
+        return (_Threads == 0) ? 1 : _Threads;
+    }
+
+    // An element with the sequence number of the source element it came from. Serial in-order stages use the
+    // numbers to restore the source order after parallel stages have mixed it up.
+    template<typename _Ty>
+    struct _Token
+    {
+        _Token() : _M_sequence(0), _M_pushed(0)
+        {
+        }
+
+        template<typename _Arg>
+        _Token(size_t _Sequence, _Arg&& _Value) : _M_sequence(_Sequence), _M_pushed(0), _M_value(std::forward<_Arg>(_Value))
+        {
+        }
+
+        size_t _M_sequence;
+        // When the element was pushed to its current stage, if the pipeline records telemetry.
+        unsigned long long _M_pushed;
+        _Ty _M_value;
+    };
+
+    class _Connection_base
+    {
+    public:
+        virtual ~_Connection_base()
+        {
+        }
+
+        virtual size_t _Unsafe_size() const = 0;
+    };
+
+    // A bounded ring with exactly one producer thread and one consumer thread. Each side keeps a private copy of
+    // the other side's position and only reads the shared one when the copy says the ring is full or empty, so in
+    // steady state the two threads touch each other's cache lines once per lap rather than once per element.
+    // The events are shared with the producer's other rings and the consumer's other rings, so that either side
+    // can wait for any of its rings at once.
+    //
+    // Transfers are batched. The producer writes elements ahead of the tail it has published and publishes them,
+    // with a single notification, once a batch is complete; the consumer frees the slots of everything it has
+    // seen in one go when it has drained them. A batch is complete when it holds _M_batch elements, when the
+    // consumer is waiting, or when the first element has waited longer than the batch delay. The batch size
+    // starts at one and doubles while the consumer has a backlog at least as big as the batch, when holding back
+    // elements costs it nothing, and halves whenever the consumer has run dry.
+    template<typename _Ty>
+    class _Spsc_ring : public _Connection_base
+    {
+    public:
+        _Spsc_ring(size_t _Capacity, size_t _Max_batch, const std::chrono::microseconds& _Max_batch_delay,
+            const std::shared_ptr<_Event_count>& _Not_full, const std::shared_ptr<_Event_count>& _Not_empty) :
+            _M_max_batch_delay(_Max_batch_delay), _M_not_full(_Not_full), _M_not_empty(_Not_empty),
+            _M_tail(0), _M_write(0), _M_published_tail(0), _M_head_cache(0), _M_batch(1),
+            _M_head(0), _M_read(0), _M_published_head(0), _M_tail_cache(0), _M_closed(false)
+        {
+            if (_Capacity == 0)
+            {
+                throw std::invalid_argument("_Capacity");
+            }
+
+            size_t _Size = 1;
+            while (_Size < _Capacity)
+            {
+                _Size <<= 1;
+            }
+            _M_mask = _Size - 1;
+            _M_slots = new _Slot[_Size];
+
+            // Leave room for the producer to fill one batch while the consumer drains another.
+            _M_max_batch = (_Max_batch < 1) ? 1 : (_Max_batch > _Size / 2) ? ((_Size < 2) ? 1 : _Size / 2) : _Max_batch;
+        }
+
+        ~_Spsc_ring()
+        {
+            for (size_t _Pos = _M_read; _Pos != _M_write; ++_Pos)
+            {
+                _Item_at(_Pos)->~_Ty();
+            }
+            delete [] _M_slots;
+        }
+
+        // Called by the producer. Moves from _Item only if there is room.
+        bool _Try_push(_Ty& _Item)
+        {
+            if (_M_write - _M_head_cache > _M_mask)
+            {
+                _M_head_cache = _M_head.load(std::memory_order_acquire);
+                if (_M_write - _M_head_cache > _M_mask)
+                {
+                    return false;
+                }
+            }
+            new (_Item_at(_M_write)) _Ty(std::move(_Item));
+            ++_M_write;
+
+            size_t _Unpublished = _M_write - _M_published_tail;
+            if (_Unpublished >= _M_batch || _M_not_empty->_Has_waiters())
+            {
+                _Publish();
+            }
+            else if (_Unpublished == 1)
+            {
+                _M_batch_start = std::chrono::steady_clock::now();
+            }
+            else if ((_Unpublished % _Batch_clock_interval) == 0 && std::chrono::steady_clock::now() - _M_batch_start >= _M_max_batch_delay)
+            {
+                _Publish();
+            }
+            return true;
+        }
+
+        // Called by the producer: makes every element it has written visible to the consumer.
+        void _Publish()
+        {
+            if (_M_write == _M_published_tail)
+            {
+                return;
+            }
+
+            if (_M_max_batch > 1)
+            {
+                size_t _Backlog = _M_published_tail - _M_head.load(std::memory_order_relaxed);
+                if (_Backlog == 0)
+                {
+                    _M_batch = (_M_batch > 1) ? _M_batch / 2 : 1;
+                }
+                else if (_Backlog >= _M_batch)
+                {
+                    _M_batch = (_M_batch * 2 < _M_max_batch) ? _M_batch * 2 : _M_max_batch;
+                }
+            }
+
+            _M_published_tail = _M_write;
+            _M_tail.store(_M_write, std::memory_order_release);
+            _M_not_empty->_Notify(false);
+        }
+
+        // Called by the consumer.
+        bool _Try_pop(_Ty& _Item)
+        {
+            if (_M_read == _M_tail_cache)
+            {
+                _M_tail_cache = _M_tail.load(std::memory_order_acquire);
+                if (_M_read == _M_tail_cache)
+                {
+                    return false;
+                }
+            }
+            _Ty *_Stored = _Item_at(_M_read);
+            _Item = std::move(*_Stored);
+            _Stored->~_Ty();
+            ++_M_read;
+
+            // Free the slots once the batch that was visible has been drained, or half the ring if that is sooner.
+            if (_M_read == _M_tail_cache || _M_read - _M_published_head > _M_mask / 2)
+            {
+                _M_published_head = _M_read;
+                _M_head.store(_M_read, std::memory_order_release);
+                _M_not_full->_Notify(false);
+            }
+            return true;
+        }
+
+        // Called by the producer after its last push.
+        void _Close()
+        {
+            _Publish();
+            _M_closed.store(true, std::memory_order_release);
+            _M_not_empty->_Notify(true);
+        }
+
+        // Once this returns true, a _Try_pop that fails means the ring is finished.
+        bool _Is_closed() const
+        {
+            return _M_closed.load(std::memory_order_acquire);
+        }
+
+        // The number of elements waiting for the consumer, as the consumer sees them.
+        size_t _Consumer_size() const
+        {
+            return _M_tail.load(std::memory_order_relaxed) - _M_read;
+        }
+
+        // The number of elements the producer has written and the consumer has not freed, for load balancing.
+        size_t _Producer_size() const
+        {
+            return _M_write - _M_head.load(std::memory_order_relaxed);
+        }
+
+        virtual size_t _Unsafe_size() const
+        {
+            size_t _Tail = _M_tail.load(std::memory_order_relaxed);
+            size_t _Head = _M_head.load(std::memory_order_relaxed);
+            return (_Tail > _Head) ? _Tail - _Head : 0;
+        }
+
+    private:
+        typedef typename std::aligned_storage<sizeof(_Ty), std::alignment_of<_Ty>::value>::type _Slot;
+
+        _Ty *_Item_at(size_t _Pos)
+        {
+            return reinterpret_cast<_Ty *>(&_M_slots[_Pos & _M_mask]);
+        }
+
+        // Read-only fields, then the producer's fields, then the consumer's, each group on its own cache line.
+        char _M_padding0[64];
+        _Slot *_M_slots;
+        size_t _M_mask;
+        size_t _M_max_batch;
+        std::chrono::steady_clock::duration _M_max_batch_delay;
+        std::shared_ptr<_Event_count> _M_not_full;
+        std::shared_ptr<_Event_count> _M_not_empty;
+        char _M_padding1[64];
+        std::atomic<size_t> _M_tail;
+        size_t _M_write;
+        size_t _M_published_tail;
+        size_t _M_head_cache;
+        size_t _M_batch;
+        std::chrono::steady_clock::time_point _M_batch_start;
+        char _M_padding2[64];
+        std::atomic<size_t> _M_head;
+        size_t _M_read;
+        size_t _M_published_head;
+        size_t _M_tail_cache;
+        char _M_padding3[64];
+        std::atomic<bool> _M_closed;
+        char _M_padding4[64];
+
+        _Spsc_ring(const _Spsc_ring&);
+        _Spsc_ring const & operator=(_Spsc_ring const&);
+    };
+
+    // All the rings between two stages, one from every thread of the producing stage to every thread of the
+    // consuming stage.
+    class _Connection : public _Connection_base
+    {
+    public:
+        void _Add(const std::shared_ptr<_Connection_base>& _Ring)
+        {
+            _M_rings.push_back(_Ring);
+        }
+
+        virtual size_t _Unsafe_size() const
+        {
+            size_t _Size = 0;
+            for (size_t _I = 0; _I < _M_rings.size(); ++_I)
+            {
+                _Size += _M_rings[_I]->_Unsafe_size();
+            }
+            return _Size;
+        }
+
+    private:
+        std::vector<std::shared_ptr<_Connection_base>> _M_rings;
+    };
+
+    // Limits the number of elements between the stage that numbers them and the stage that retires them. Without
+    // a limit, a serial in-order stage behind a parallel stage could buffer without bound while it waits for one
+    // slow element. Only the numbering stage acquires; any thread may retire.
+    class _Token_window
+    {
+    public:
+        _Token_window() : _M_limit(0), _M_issued(0), _M_retired(0)
+        {
+        }
+
+        void _Set_limit(size_t _Limit)
+        {
+            _M_limit = _Limit;
+        }
+
+        bool _Try_acquire()
+        {
+            if (_M_limit != 0 && _M_issued - _M_retired.load(std::memory_order_acquire) >= _M_limit)
+            {
+                return false;
+            }
+            ++_M_issued;
+            return true;
+        }
+
+        // Returns false if the pipeline was cancelled while waiting.
+        bool _Acquire(const std::atomic<bool>& _Cancelled)
+        {
+            if (_M_limit != 0 && _M_issued - _M_retired.load(std::memory_order_acquire) >= _M_limit)
+            {
+                _Spin_then_wait(_M_retired_event, [this, &_Cancelled]() -> bool
+                {
+                    return _Cancelled.load() || _M_issued - _M_retired.load(std::memory_order_acquire) < _M_limit;
+                });
+                if (_Cancelled.load())
+                {
+                    return false;
+                }
+            }
+            ++_M_issued;
+            return true;
+        }
+
+        void _Retire()
+        {
+            if (_M_limit != 0)
+            {
+                _M_retired.fetch_add(1, std::memory_order_release);
+                _M_retired_event._Notify(false);
+            }
+        }
+
+        void _Wake()
+        {
+            _M_retired_event._Notify(true);
+        }
+
+    private:
+        size_t _M_limit;
+        size_t _M_issued;
+        char _M_padding[64];
+        std::atomic<size_t> _M_retired;
+        _Event_count _M_retired_event;
+    };
+
+    // The stages and connections of one pipeline. Builders add to it; pipeline::run executes it once.
+    class _Pipeline_state
+    {
+    public:
+        _Pipeline_state(size_t _Capacity, size_t _Max_batch, const std::chrono::microseconds& _Max_batch_delay) :
+            _M_capacity(_Capacity), _M_max_batch(_Max_batch), _M_max_batch_delay(_Max_batch_delay),
+            _M_fusion_threshold(std::chrono::microseconds(_Default_fusion_threshold)), _M_stage_count(1), _M_widest_stage(1),
+            _M_reordering(false), _M_telemetry(nullptr), _M_started(false), _M_cancelled(false), _M_fusions(0), _M_splits(0)
+        {
+        }
+
+        size_t _Capacity() const
+        {
+            return _M_capacity;
+        }
+
+        size_t _Max_batch() const
+        {
+            return _M_max_batch;
+        }
+
+        std::chrono::microseconds _Max_batch_delay() const
+        {
+            return _M_max_batch_delay;
+        }
+
+        // Zero turns fusion off. Only set before the pipeline runs.
+        void _Set_fusion_threshold(const std::chrono::steady_clock::duration& _Threshold)
+        {
+            if (_M_started.load())
+            {
+                throw std::logic_error("pipeline::set_fusion_threshold");
+            }
+            _M_fusion_threshold = _Threshold;
+        }
+
+        std::chrono::steady_clock::duration _Fusion_threshold() const
+        {
+            return _M_fusion_threshold;
+        }
+
+        // Only set before the pipeline runs.
+        void _Set_telemetry(pipeline_telemetry *_Telemetry)
+        {
+            if (_M_started.load())
+            {
+                throw std::logic_error("pipeline::set_telemetry");
+            }
+            if (_Telemetry != nullptr && _Telemetry->stage_count() < _M_stage_count)
+            {
+                throw std::invalid_argument("_Telemetry");
+            }
+            _M_telemetry = _Telemetry;
+        }
+
+        pipeline_telemetry *_Telemetry() const
+        {
+            return _M_telemetry;
+        }
+
+        void _Count_fusion()
+        {
+            ++_M_fusions;
+        }
+
+        void _Count_split()
+        {
+            ++_M_splits;
+        }
+
+        size_t _Fusions() const
+        {
+            return _M_fusions.load();
+        }
+
+        size_t _Splits() const
+        {
+            return _M_splits.load();
+        }
+
+        // Each thread of each stage is a lane.
+        void _Add_lane(const std::function<void()>& _Lane)
+        {
+            _M_lanes.push_back(_Lane);
+        }
+
+        void _Add_stage(size_t _Lanes)
+        {
+            ++_M_stage_count;
+            if (_Lanes > _M_widest_stage)
+            {
+                _M_widest_stage = _Lanes;
+            }
+        }
+
+        void _Add_connection(const std::shared_ptr<_Connection_base>& _Connection)
+        {
+            _M_connections.push_back(_Connection);
+        }
+
+        // Events that a cancellation must wake.
+        std::shared_ptr<_Event_count> _New_event()
+        {
+            std::shared_ptr<_Event_count> _Event = std::make_shared<_Event_count>();
+            _M_events.push_back(_Event);
+            return _Event;
+        }
+
+        std::shared_ptr<_Token_window> _New_window()
+        {
+            std::shared_ptr<_Token_window> _Window = std::make_shared<_Token_window>();
+            _M_windows.push_back(_Window);
+            return _Window;
+        }
+
+        void _Set_reordering()
+        {
+            _M_reordering = true;
+        }
+
+        // Called when the sink has been added. Windows are only needed if some stage reorders elements.
+        void _Complete()
+        {
+            if (_M_reordering)
+            {
+                for (size_t _I = 0; _I < _M_windows.size(); ++_I)
+                {
+                    _M_windows[_I]->_Set_limit(_M_capacity * _M_widest_stage);
+                }
+            }
+        }
+
+        // Runs one lane, recording the first exception thrown by any lane and cancelling the others.
+        template<typename _Func>
+        void _Invoke(_Func _Body)
+        {
+            try
+            {
+                _Body();
+            }
+            catch (...)
+            {
+                {
+                    std::lock_guard<std::mutex> _Lock(_M_error_lock);
+                    if (!_M_error)
+                    {
+                        _M_error = std::current_exception();
+                    }
+                }
+                _Cancel();
+            }
+        }
+
+        void _Cancel()
+        {
+            if (!_M_cancelled.exchange(true))
+            {
+                for (size_t _I = 0; _I < _M_events.size(); ++_I)
+                {
+                    _M_events[_I]->_Notify(true);
+                }
+                for (size_t _I = 0; _I < _M_windows.size(); ++_I)
+                {
+                    _M_windows[_I]->_Wake();
+                }
+            }
+        }
+
+        const std::atomic<bool>& _Cancelled() const
+        {
+            return _M_cancelled;
+        }
+
+        bool _Is_cancelled() const
+        {
+            return _M_cancelled.load(std::memory_order_relaxed);
+        }
+
+        void _Run()
+        {
+            if (_M_started.exchange(true))
+            {
+                throw std::logic_error("pipeline::run");
+            }
+
+            // Every lane but the last gets a thread; the last lane of the sink runs on the caller's.
+            std::vector<std::thread> _Threads;
+            _Threads.reserve(_M_lanes.size());
+            _Invoke([this, &_Threads]()
+            {
+                for (size_t _I = 0; _I + 1 < _M_lanes.size(); ++_I)
+                {
+                    _Threads.push_back(std::thread(_M_lanes[_I]));
+                }
+            });
+            if (!_Is_cancelled())
+            {
+                _M_lanes.back()();
+            }
+            for (size_t _I = 0; _I < _Threads.size(); ++_I)
+            {
+                _Threads[_I].join();
+            }
+
+            if (_M_error)
+            {
+                std::rethrow_exception(_M_error);
+            }
+        }
+
+        size_t _Stage_count() const
+        {
+            return _M_stage_count;
+        }
+
+        size_t _Unsafe_size(size_t _Connection) const
+        {
+            return (_Connection < _M_connections.size()) ? _M_connections[_Connection]->_Unsafe_size() : 0;
+        }
+
+    private:
+        size_t _M_capacity;
+        size_t _M_max_batch;
+        std::chrono::microseconds _M_max_batch_delay;
+        std::chrono::steady_clock::duration _M_fusion_threshold;
+        size_t _M_stage_count;
+        size_t _M_widest_stage;
+        bool _M_reordering;
+        pipeline_telemetry *_M_telemetry;
+        std::vector<std::function<void()>> _M_lanes;
+        std::vector<std::shared_ptr<_Connection_base>> _M_connections;
+        std::vector<std::shared_ptr<_Event_count>> _M_events;
+        std::vector<std::shared_ptr<_Token_window>> _M_windows;
+        std::atomic<bool> _M_started;
+        std::atomic<bool> _M_cancelled;
+        std::atomic<size_t> _M_fusions;
+        std::atomic<size_t> _M_splits;
+        std::mutex _M_error_lock;
+        std::exception_ptr _M_error;
+
+        _Pipeline_state(const _Pipeline_state&);
+        _Pipeline_state const & operator=(_Pipeline_state const&);
+    };
+
+    // The output side of a lane, seen from its input side, which must publish pending output before it waits.
+    // While a stage times an element it sets _M_timing, and the output adds the time it spends handing elements
+    // on to _M_excluded, so that waiting for room or running a fused stage does not count as the stage's work.
+    class _Lane_output
+    {
+    public:
+        _Lane_output() : _M_timing(false), _M_excluded(0)
+        {
+        }
+
+        virtual ~_Lane_output()
+        {
+        }
+
+        virtual void _Publish() = 0;
+
+        bool _M_timing;
+        std::chrono::steady_clock::duration _M_excluded;
+    };
+
+    // A connection from the single lane of one stage to the single lane of a serial stage, over which the second
+    // stage can be fused into the first: its stage function is then called on the first stage's thread, straight
+    // from the push, and the ring between them stays empty. The stage times a sample of its elements. When it
+    // is cheap it asks to be fused; the producer stops pushing, the consumer drains the ring, hands over and
+    // parks. When the fused stage turns expensive, whichever thread runs it splits it off again and the
+    // consumer's own thread takes over. Each change of hands is a release and acquire of _M_fusion, so the
+    // stage function and its output are only used by one thread at a time.
+    template<typename _Ty>
+    class _Fusion_link
+    {
+    public:
+        enum _Fusion_state
+        {
+            _Split,
+            _Fuse_requested,
+            _Draining,
+            _Fused
+        };
+
+        _Fusion_link(_Pipeline_state *_State, const std::shared_ptr<_Event_count>& _Changed, const std::shared_ptr<_Event_count>& _Not_empty) :
+            _M_state(_State), _M_changed(_Changed), _M_not_empty(_Not_empty), _M_fusion(_Split), _M_output(nullptr),
+            _M_count(0), _M_samples(0), _M_cost(0)
+        {
+        }
+
+        // Called by the consumer before its first element. _Output is the consumer's output, or null for a sink.
+        void _Set_step(const std::function<bool(_Token<_Ty>&)>& _Step, _Lane_output *_Output)
+        {
+            _M_step = _Step;
+            _M_output = _Output;
+        }
+
+        // Called by whichever thread runs the consumer's stage. Returns false if the stage has to stop.
+        bool _Step(_Token<_Ty>& _Item)
+        {
+            std::chrono::steady_clock::duration _Threshold = _M_state->_Fusion_threshold();
+            if (_Threshold.count() == 0 || ++_M_count % _Profile_interval != 0)
+            {
+                return _M_step(_Item);
+            }
+
+            if (_M_output != nullptr)
+            {
+                _M_output->_M_timing = true;
+                _M_output->_M_excluded = std::chrono::steady_clock::duration(0);
+            }
+            std::chrono::steady_clock::time_point _Start = std::chrono::steady_clock::now();
+            bool _Result = _M_step(_Item);
+            std::chrono::steady_clock::duration _Cost = std::chrono::steady_clock::now() - _Start;
+            if (_M_output != nullptr)
+            {
+                _M_output->_M_timing = false;
+                _Cost -= _M_output->_M_excluded;
+            }
+
+            // An exponential moving average over the last eight or so samples.
+            _M_cost += (_Cost - _M_cost) / 8;
+            if (++_M_samples >= _Profile_warmup)
+            {
+                int _Fusion = _M_fusion.load(std::memory_order_relaxed);
+                if (_Fusion == _Split && _M_cost < _Threshold)
+                {
+                    _M_fusion.store(_Fuse_requested, std::memory_order_release);
+                }
+                else if (_Fusion == _Fused && _M_cost > _Threshold * _Split_factor)
+                {
+                    _Split_off();
+                }
+            }
+            return _Result;
+        }
+
+        // Called by the producer before each push.
+        int _Fusion() const
+        {
+            return _M_fusion.load(std::memory_order_acquire);
+        }
+
+        // Called by the producer once the consumer has asked to be fused and everything pushed so far is
+        // published. Returns false if the pipeline was cancelled before the consumer handed over.
+        bool _Drain()
+        {
+            _M_fusion.store(_Draining, std::memory_order_release);
+            _M_not_empty->_Notify(true);
+            _Spin_then_wait(*_M_changed, [this]() -> bool
+            {
+                return _M_fusion.load(std::memory_order_acquire) == _Fused || _M_state->_Is_cancelled();
+            });
+            return !_M_state->_Is_cancelled();
+        }
+
+        // Called by the producer while fused.
+        void _Publish_output()
+        {
+            if (_M_output != nullptr)
+            {
+                _M_output->_Publish();
+            }
+        }
+
+        // Called by the producer before it closes the ring, even after an exception, so that the consumer's thread
+        // finishes the stage. A drain that was cancelled is abandoned.
+        void _Close()
+        {
+            if (_M_fusion.exchange(_Split, std::memory_order_acq_rel) == _Fused)
+            {
+                _M_state->_Count_split();
+                _M_changed->_Notify(true);
+            }
+        }
+
+        // Called by the consumer when it finds the ring empty. If the producer is waiting for the ring to drain,
+        // hands the stage over and parks until it is split off again. Returns false if there was nothing to do.
+        // The consumer does not leave on cancellation: the producer may still be running the stage, and it
+        // splits the stage off when it closes.
+        bool _Hand_over()
+        {
+            int _Expected = _Draining;
+            if (!_M_fusion.compare_exchange_strong(_Expected, _Fused, std::memory_order_acq_rel))
+            {
+                return false;
+            }
+
+            _M_state->_Count_fusion();
+            _M_changed->_Notify(true);
+            _Spin_then_wait(*_M_changed, [this]() -> bool
+            {
+                return _M_fusion.load(std::memory_order_acquire) != _Fused;
+            });
+            return true;
+        }
+
+    private:
+        void _Split_off()
+        {
+            _M_state->_Count_split();
+            _M_fusion.store(_Split, std::memory_order_release);
+            _M_changed->_Notify(true);
+        }
+
+        _Pipeline_state *_M_state;
+        std::shared_ptr<_Event_count> _M_changed;
+        std::shared_ptr<_Event_count> _M_not_empty;
+        std::atomic<int> _M_fusion;
+        std::function<bool(_Token<_Ty>&)> _M_step;
+        _Lane_output *_M_output;
+        size_t _M_count;
+        size_t _M_samples;
+        std::chrono::steady_clock::duration _M_cost;
+
+        _Fusion_link(const _Fusion_link&);
+        _Fusion_link const & operator=(_Fusion_link const&);
+    };
+
+    // The output side of one lane: its rings to every lane of the next stage.
+    template<typename _Ty>
+    class _Distributor : public _Lane_output
+    {
+    public:
+        typedef _Spsc_ring<_Token<_Ty>> _Ring_type;
+
+        _Distributor(const _Pipeline_state *_State, const std::shared_ptr<_Event_count>& _Not_full) : _M_state(_State), _M_not_full(_Not_full), _M_next(0)
+        {
+        }
+
+        void _Add(const std::shared_ptr<_Ring_type>& _Ring)
+        {
+            _M_rings.push_back(_Ring);
+        }
+
+        void _Set_link(const std::shared_ptr<_Fusion_link<_Ty>>& _Link)
+        {
+            _M_link = _Link;
+        }
+
+        // Pushes _Item, or runs the next stage on it if that stage is fused, waiting while every ring is full.
+        // Returns false if the pipeline was cancelled first.
+        bool _Push(_Token<_Ty>& _Item)
+        {
+            if (!_M_timing)
+            {
+                return _Push_untimed(_Item);
+            }
+            std::chrono::steady_clock::time_point _Start = std::chrono::steady_clock::now();
+            bool _Result = _Push_untimed(_Item);
+            _M_excluded += std::chrono::steady_clock::now() - _Start;
+            return _Result;
+        }
+
+        virtual void _Publish()
+        {
+            for (size_t _I = 0; _I < _M_rings.size(); ++_I)
+            {
+                _M_rings[_I]->_Publish();
+            }
+            if (_M_link && _M_link->_Fusion() == _Fusion_link<_Ty>::_Fused)
+            {
+                _M_link->_Publish_output();
+            }
+        }
+
+        void _Close()
+        {
+            if (_M_link)
+            {
+                _M_link->_Close();
+            }
+            for (size_t _I = 0; _I < _M_rings.size(); ++_I)
+            {
+                _M_rings[_I]->_Close();
+            }
+        }
+
+    private:
+        bool _Push_untimed(_Token<_Ty>& _Item)
+        {
+            if (_M_state->_Is_cancelled())
+            {
+                return false;
+            }
+            if (_M_state->_Telemetry() != nullptr)
+            {
+                _Item._M_pushed = pipeline_telemetry::timestamp();
+            }
+            if (_M_link)
+            {
+                int _Fusion = _M_link->_Fusion();
+                if (_Fusion != _Fusion_link<_Ty>::_Split)
+                {
+                    if (_Fusion != _Fusion_link<_Ty>::_Fused)
+                    {
+                        _Publish();
+                        if (!_M_link->_Drain())
+                        {
+                            return false;
+                        }
+                    }
+                    return _M_link->_Step(_Item);
+                }
+            }
+            if (_Try_push(_Item))
+            {
+                return true;
+            }
+
+            // The consumers may be waiting for elements held back in batches before they can make room.
+            _Publish();
+            bool _Pushed = false;
+            _Spin_then_wait(*_M_not_full, [this, &_Item, &_Pushed]() -> bool
+            {
+                if (_M_state->_Is_cancelled())
+                {
+                    return true;
+                }
+                _Pushed = _Try_push(_Item);
+                return _Pushed;
+            });
+            return _Pushed;
+        }
+
+        // Sends the element to the lane with the shortest queue, so that a lane that is slowed down by expensive
+        // elements gets fewer of them. Ties go round robin so that idle lanes share the work evenly.
+        bool _Try_push(_Token<_Ty>& _Item)
+        {
+            size_t _Count = _M_rings.size();
+            if (_Count == 1)
+            {
+                return _M_rings[0]->_Try_push(_Item);
+            }
+
+            size_t _Best = _M_next;
+            size_t _Best_size = _M_rings[_Best]->_Producer_size();
+            for (size_t _K = 1; _K < _Count && _Best_size != 0; ++_K)
+            {
+                size_t _I = (_M_next + _K) % _Count;
+                size_t _Size = _M_rings[_I]->_Producer_size();
+                if (_Size < _Best_size)
+                {
+                    _Best = _I;
+                    _Best_size = _Size;
+                }
+            }
+            _M_next = (_Best + 1) % _Count;
+
+            for (size_t _K = 0; _K < _Count; ++_K)
+            {
+                if (_M_rings[(_Best + _K) % _Count]->_Try_push(_Item))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        const _Pipeline_state *_M_state;
+        std::vector<std::shared_ptr<_Ring_type>> _M_rings;
+        std::shared_ptr<_Event_count> _M_not_full;
+        std::shared_ptr<_Fusion_link<_Ty>> _M_link;
+        size_t _M_next;
+    };
+
+    // The input side of one lane: its rings from every lane of the previous stage. A collector for a serial
+    // in-order stage whose input may be out of order keeps a reorder buffer, a heap of the elements that arrived
+    // ahead of the next sequence number.
+    template<typename _Ty>
+    class _Collector
+    {
+    public:
+        typedef _Spsc_ring<_Token<_Ty>> _Ring_type;
+
+        _Collector(const _Pipeline_state *_State, size_t _Stage, const std::shared_ptr<_Event_count>& _Not_empty, bool _Reorder) :
+            _M_state(_State), _M_stage(_Stage), _M_not_empty(_Not_empty), _M_output(nullptr), _M_reorder(_Reorder), _M_next_sequence(0), _M_next_ring(0)
+        {
+        }
+
+        void _Add(const std::shared_ptr<_Ring_type>& _Ring)
+        {
+            _M_rings.push_back(_Ring);
+        }
+
+        void _Set_link(const std::shared_ptr<_Fusion_link<_Ty>>& _Link)
+        {
+            _M_link = _Link;
+        }
+
+        // Runs _Step, called as bool _Step_func(_Token<_Ty>&), on every element until the input is finished or
+        // _Step returns false. _Output is the output of the same lane, or null for a sink; it is published
+        // whenever this lane runs out of input.
+        template<typename _Step_func>
+        void _Process(const _Step_func& _Step, _Lane_output *_Output)
+        {
+            pipeline_telemetry *_Telemetry = _M_state->_Telemetry();
+            if (_Telemetry == nullptr)
+            {
+                _Run(_Step, _Output);
+                return;
+            }
+
+            // The service time leaves out the time spent handing elements on, as the fusion profile does. Either
+            // may be timing the element when the other starts.
+            pipeline_telemetry::recorder *_Recorder = &_Telemetry->new_recorder(_M_stage);
+            _Run([this, &_Step, _Output, _Recorder](_Token<_Ty>& _Item) -> bool
+            {
+                bool _Outer_timing = false;
+                std::chrono::steady_clock::duration _Outer_excluded(0);
+                if (_Output != nullptr)
+                {
+                    _Outer_timing = _Output->_M_timing;
+                    _Outer_excluded = _Output->_M_excluded;
+                    _Output->_M_timing = true;
+                    _Output->_M_excluded = std::chrono::steady_clock::duration(0);
+                }
+                size_t _Depth = _Waiting();
+                unsigned long long _Start = pipeline_telemetry::timestamp();
+                bool _Result = _Step(_Item);
+                unsigned long long _Service = pipeline_telemetry::timestamp() - _Start;
+                if (_Output != nullptr)
+                {
+                    unsigned long long _Excluded = std::chrono::duration_cast<std::chrono::nanoseconds>(_Output->_M_excluded).count();
+                    _Service = (_Service > _Excluded) ? _Service - _Excluded : 0;
+                    _Output->_M_timing = _Outer_timing;
+                    _Output->_M_excluded = _Outer_timing ? _Outer_excluded + _Output->_M_excluded : _Outer_excluded;
+                }
+                _Recorder->record(_Service, (_Start > _Item._M_pushed) ? _Start - _Item._M_pushed : 0, _Depth);
+                return _Result;
+            }, _Output);
+        }
+
+        // Called by the thread that runs the stage. Counts the elements in the reorder buffer as waiting too.
+        size_t _Waiting() const
+        {
+            size_t _Count = _M_pending.size();
+            for (size_t _I = 0; _I < _M_rings.size(); ++_I)
+            {
+                _Count += _M_rings[_I]->_Consumer_size();
+            }
+            return _Count;
+        }
+
+    private:
+        template<typename _Step_func>
+        void _Run(const _Step_func& _Step, _Lane_output *_Output)
+        {
+            _M_output = _Output;
+            _Token<_Ty> _Item;
+            if (_M_link)
+            {
+                _M_link->_Set_step(_Step, _Output);
+                while (_Pop(_Item))
+                {
+                    if (!_M_link->_Step(_Item))
+                    {
+                        return;
+                    }
+                }
+            }
+            else
+            {
+                while (_Pop(_Item))
+                {
+                    if (!_Step(_Item))
+                    {
+                        return;
+                    }
+                }
+            }
+        }
+
+        // Pops the next element, waiting while the rings are empty. Returns false once every ring is closed and
+        // empty, or when the pipeline is cancelled.
+        bool _Pop(_Token<_Ty>& _Item)
+        {
+            if (!_M_reorder)
+            {
+                return _Pop_any(_Item);
+            }
+
+            for (;;)
+            {
+                if (!_M_pending.empty() && _M_pending.front()._M_sequence == _M_next_sequence)
+                {
+                    std::pop_heap(_M_pending.begin(), _M_pending.end(), _Later());
+                    _Item = std::move(_M_pending.back());
+                    _M_pending.pop_back();
+                    ++_M_next_sequence;
+                    return true;
+                }
+
+                if (!_Pop_any(_Item))
+                {
+                    return false;
+                }
+                if (_Item._M_sequence == _M_next_sequence)
+                {
+                    ++_M_next_sequence;
+                    return true;
+                }
+                _M_pending.push_back(std::move(_Item));
+                std::push_heap(_M_pending.begin(), _M_pending.end(), _Later());
+            }
+        }
+
+        struct _Later
+        {
+            bool operator()(const _Token<_Ty>& _Left, const _Token<_Ty>& _Right) const
+            {
+                return _Left._M_sequence > _Right._M_sequence;
+            }
+        };
+
+        bool _Pop_any(_Token<_Ty>& _Item)
+        {
+            for (;;)
+            {
+                if (_M_state->_Is_cancelled())
+                {
+                    return false;
+                }
+                if (_Try_pop(_Item))
+                {
+                    return true;
+                }
+                if (_Draining())
+                {
+                    // The producer published everything before it started draining, so the ring is empty now.
+                    if (_Try_pop(_Item))
+                    {
+                        return true;
+                    }
+                    _M_link->_Hand_over();
+                    continue;
+                }
+
+                if (_M_output != nullptr)
+                {
+                    _M_output->_Publish();
+                }
+                bool _Popped = false;
+                bool _Drain = false;
+                _Spin_then_wait(*_M_not_empty, [this, &_Item, &_Popped, &_Drain]() -> bool
+                {
+                    if (_M_state->_Is_cancelled())
+                    {
+                        return true;
+                    }
+                    if (_All_closed())
+                    {
+                        // Each ring's last push happened before its close, so this is the final look.
+                        _Popped = _Try_pop(_Item);
+                        return true;
+                    }
+                    _Popped = _Try_pop(_Item);
+                    _Drain = !_Popped && _Draining();
+                    return _Popped || _Drain;
+                });
+                if (!_Drain)
+                {
+                    return _Popped;
+                }
+            }
+        }
+
+        bool _Draining() const
+        {
+            return _M_link && _M_link->_Fusion() == _Fusion_link<_Ty>::_Draining;
+        }
+
+        // Polls the rings round robin, so that no producing lane is starved.
+        bool _Try_pop(_Token<_Ty>& _Item)
+        {
+            size_t _Count = _M_rings.size();
+            for (size_t _K = 0; _K < _Count; ++_K)
+            {
+                size_t _I = (_M_next_ring + _K) % _Count;
+                if (_M_rings[_I]->_Try_pop(_Item))
+                {
+                    _M_next_ring = (_I + 1) % _Count;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool _All_closed() const
+        {
+            for (size_t _I = 0; _I < _M_rings.size(); ++_I)
+            {
+                if (!_M_rings[_I]->_Is_closed())
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        const _Pipeline_state *_M_state;
+        size_t _M_stage;
+        std::vector<std::shared_ptr<_Ring_type>> _M_rings;
+        std::shared_ptr<_Event_count> _M_not_empty;
+        _Lane_output *_M_output;
+        std::shared_ptr<_Fusion_link<_Ty>> _M_link;
+        bool _M_reorder;
+        size_t _M_next_sequence;
+        size_t _M_next_ring;
+        std::vector<_Token<_Ty>> _M_pending;
+    };
+
+    template<typename _Func>
+    struct _Map_stage
+    {
+        _Map_stage(const _Func& _F, pipeline_stage_mode _Mode, size_t _Degree) : _M_func(_F), _M_mode(_Mode), _M_degree(_Degree)
+        {
+        }
+
+        _Func _M_func;
+        pipeline_stage_mode _M_mode;
+        size_t _M_degree;
+    };
+
+    template<typename _Out, typename _Func>
+    struct _Flat_stage
+    {
+        _Flat_stage(const _Func& _F, pipeline_stage_mode _Mode) : _M_func(_F), _M_mode(_Mode)
+        {
+        }
+
+        _Func _M_func;
+        pipeline_stage_mode _M_mode;
+    };
+
+    template<typename _Func>
+    struct _Sink_stage
+    {
+        _Sink_stage(const _Func& _F, pipeline_stage_mode _Mode, size_t _Degree) : _M_func(_F), _M_mode(_Mode), _M_degree(_Degree)
+        {
+        }
+
+        _Func _M_func;
+        pipeline_stage_mode _M_mode;
+        size_t _M_degree;
+    };
+
+    inline size_t _Lanes_for(pipeline_stage_mode _Mode, size_t _Degree)
+    {
+        if (_Mode != pipeline_parallel)
+        {
+            return 1;
+        }
+        return (_Degree == 0) ? _Default_parallel_degree() : _Degree;
+    }
+}
+
+/// <summary>
+///     The output of a pipeline stage, passed to flat stages so that they can emit any number of elements for
+///     each element they receive.
+/// </summary>
+/**/
+template<typename _Ty>
+class pipeline_output
+{
+public:
+    pipeline_output(details::_Distributor<_Ty>& _Distributor, details::_Token_window& _Window, const details::_Pipeline_state *_State) :
+        _M_distributor(_Distributor), _M_window(_Window), _M_state(_State), _M_next_sequence(0)
+    {
+    }
+
+    /// <summary>
+    ///     Passes an element to the next stage, waiting while its input is full.
+    /// </summary>
+    /// <returns>
+    ///     <c>false</c> if the pipeline has been cancelled, in which case the stage should return.
+    /// </returns>
+    bool push(_Ty&& _Item)
+    {
+        if (!_M_window._Try_acquire())
+        {
+            // The elements that would be retired may be held back in a batch.
+            _M_distributor._Publish();
+            std::chrono::steady_clock::time_point _Start = std::chrono::steady_clock::now();
+            bool _Acquired = _M_window._Acquire(_M_state->_Cancelled());
+            if (_M_distributor._M_timing)
+            {
+                _M_distributor._M_excluded += std::chrono::steady_clock::now() - _Start;
+            }
+            if (!_Acquired)
+            {
+                return false;
+            }
+        }
+        details::_Token<_Ty> _Numbered(_M_next_sequence++, std::move(_Item));
+        return _M_distributor._Push(_Numbered);
+    }
+
+    bool push(const _Ty& _Item)
+    {
+        _Ty _Copy(_Item);
+        return push(std::move(_Copy));
+    }
+
+private:
+    details::_Distributor<_Ty>& _M_distributor;
+    details::_Token_window& _M_window;
+    const details::_Pipeline_state *_M_state;
+    size_t _M_next_sequence;
+
+    pipeline_output(const pipeline_output&);
+    pipeline_output const & operator=(pipeline_output const&);
+};
+
+/// <summary>
+///     A complete pipeline, from a source to a sink, built with <c>operator|</c>.
+/// </summary>
+/// <remarks>
+///     <c>run</c> starts one thread for every stage except the sink, and as many threads as a parallel stage
+///     asks for. It runs the sink on the calling thread and returns when every stage has finished. The pipeline
+///     ends when the source returns <c>false</c>: each stage drains its input and closes its output in turn, so no
+///     sentinel value travels down the pipeline. If a stage throws, the remaining stages are cancelled and
+///     <c>run</c> rethrows the first exception. A pipeline can be run only once. Copies of a pipeline share its
+///     state.
+///     <para>A serial stage whose input comes from a single thread times a sample of its elements. While it takes
+///     less than the fusion threshold an element, it is fused into the stage before it: its function is called
+///     on that stage's thread, straight after the element is produced, and its own thread waits. This saves the
+///     hand-over between threads that would otherwise cost more than the stage's work. If the fused stage later
+///     takes more than four times the threshold, it is split off onto its own thread again.</para>
+/// </remarks>
+/**/
+class pipeline
+{
+public:
+    pipeline()
+    {
+    }
+
+    explicit pipeline(const std::shared_ptr<details::_Pipeline_state>& _State) : _M_state(_State)
+    {
+    }
+
+    void run()
+    {
+        if (!_M_state)
+        {
+            throw std::logic_error("pipeline::run");
+        }
+        _M_state->_Run();
+    }
+
+    /// <summary>
+    ///     Stops every stage as soon as it next pushes or pops. Elements still in the connections are discarded.
+    /// </summary>
+    void cancel()
+    {
+        if (_M_state)
+        {
+            _M_state->_Cancel();
+        }
+    }
+
+    bool is_cancelled() const
+    {
+        return _M_state && _M_state->_Is_cancelled();
+    }
+
+    size_t stage_count() const
+    {
+        return _M_state ? _M_state->_Stage_count() : 0;
+    }
+
+    /// <summary>
+    ///     Sets the time per element below which a serial stage is fused into the stage before it, or turns fusion
+    ///     off when <c>_Microseconds</c> is zero. The default is one microsecond. Call before <c>run</c>.
+    /// </summary>
+    void set_fusion_threshold(unsigned int _Microseconds)
+    {
+        if (_M_state)
+        {
+            _M_state->_Set_fusion_threshold(std::chrono::microseconds(_Microseconds));
+        }
+    }
+
+    /// <summary>
+    ///     Records the service time, queue wait and queue depth of every element of every stage into
+    ///     <c>_Telemetry</c>, which must have at least <c>stage_count</c> stages and outlive the run. Stage zero is
+    ///     the source. Call before <c>run</c>.
+    /// </summary>
+    void set_telemetry(pipeline_telemetry& _Telemetry)
+    {
+        if (_M_state)
+        {
+            _M_state->_Set_telemetry(&_Telemetry);
+        }
+    }
+
+    /// <summary>
+    ///     Returns the number of times a stage has been fused into the stage before it.
+    /// </summary>
+    size_t fusion_count() const
+    {
+        return _M_state ? _M_state->_Fusions() : 0;
+    }
+
+    /// <summary>
+    ///     Returns the number of times a fused stage has been split off again, including at the end of the run.
+    /// </summary>
+    size_t split_count() const
+    {
+        return _M_state ? _M_state->_Splits() : 0;
+    }
+
+    /// <summary>
+    ///     Returns the number of elements waiting in the connection after stage <c>_Connection</c>. The value is
+    ///     only a snapshot while the pipeline runs.
+    /// </summary>
+    size_t unsafe_queue_size(size_t _Connection) const
+    {
+        return _M_state ? _M_state->_Unsafe_size(_Connection) : 0;
+    }
+
+private:
+    std::shared_ptr<details::_Pipeline_state> _M_state;
+};
+
+/// <summary>
+///     A pipeline under construction whose last stage produces elements of type <c>_Ty</c>. Appending a stage with
+///     <c>operator|</c> consumes the builder; appending a sink completes the pipeline.
+/// </summary>
+/// <remarks>
+///     Elements are moved from stage to stage, so they may be move only. Every thread of a stage has a bounded ring
+///     to every thread of the next stage, each of the capacity given to <c>pipeline_source</c>. A stage that gets
+///     ahead of its successor waits until there is room, which bounds the memory the pipeline uses. A serial stage
+///     function is only called by one thread at a time, so it may keep state between elements, but fusion may move
+///     it from one thread to another, so it should not rely on thread local state; each thread of a parallel stage
+///     has its own copy of the function. Element types must be default constructible.
+///     <para>Elements are numbered by the source. A serial in-order stage receives them in that order even when an
+///     earlier parallel stage finished them out of order; the elements that arrive early wait in a reorder buffer.
+///     A parallel stage sends each element to the thread with the fewest elements waiting. Flat stages are serial
+///     and number the elements they emit afresh.</para>
+/// </remarks>
+/**/
+template<typename _Ty>
+class pipeline_builder
+{
+public:
+    typedef _Ty value_type;
+    typedef std::function<void(details::_Distributor<_Ty>&)> _Body_type;
+
+    pipeline_builder(const std::shared_ptr<details::_Pipeline_state>& _State, const std::vector<_Body_type>& _Bodies, const std::shared_ptr<details::_Token_window>& _Window, bool _Ordered) :
+        _M_state(_State), _M_bodies(_Bodies), _M_window(_Window), _M_ordered(_Ordered)
+    {
+    }
+
+    template<typename _Func>
+    pipeline_builder<typename std::decay<decltype(std::declval<_Func&>()(std::declval<_Ty>()))>::type> operator|(const details::_Map_stage<_Func>& _Stage) const
+    {
+        typedef typename std::decay<decltype(std::declval<_Func&>()(std::declval<_Ty>()))>::type _Result;
+
+        std::vector<std::shared_ptr<details::_Collector<_Ty>>> _Inputs = _Connect(_Stage._M_mode, details::_Lanes_for(_Stage._M_mode, _Stage._M_degree));
+        std::vector<typename pipeline_builder<_Result>::_Body_type> _Bodies;
+        for (size_t _I = 0; _I < _Inputs.size(); ++_I)
+        {
+            std::shared_ptr<details::_Collector<_Ty>> _Input = _Inputs[_I];
+            _Func _F = _Stage._M_func;
+            _Bodies.push_back([_Input, _F](details::_Distributor<_Result>& _Out) mutable
+            {
+                _Input->_Process([&_F, &_Out](details::_Token<_Ty>& _Item) -> bool
+                {
+                    details::_Token<_Result> _Transformed(_Item._M_sequence, _F(std::move(_Item._M_value)));
+                    return _Out._Push(_Transformed);
+                }, &_Out);
+            });
+        }
+        return pipeline_builder<_Result>(_M_state, _Bodies, _M_window, _Ordered_after(_Stage._M_mode, _Inputs.size()));
+    }
+
+    template<typename _Out, typename _Func>
+    pipeline_builder<_Out> operator|(const details::_Flat_stage<_Out, _Func>& _Stage) const
+    {
+        if (_Stage._M_mode == pipeline_parallel)
+        {
+            throw std::invalid_argument("_Mode");
+        }
+
+        std::shared_ptr<details::_Collector<_Ty>> _Input = _Connect(_Stage._M_mode, 1)[0];
+        std::shared_ptr<details::_Token_window> _In_window = _M_window;
+        std::shared_ptr<details::_Token_window> _Out_window = _M_state->_New_window();
+        _Func _F = _Stage._M_func;
+        details::_Pipeline_state *_State = _M_state.get();
+        std::vector<typename pipeline_builder<_Out>::_Body_type> _Bodies;
+        _Bodies.push_back([_Input, _In_window, _Out_window, _F, _State](details::_Distributor<_Out>& _Distributor) mutable
+        {
+            pipeline_output<_Out> _Output(_Distributor, *_Out_window, _State);
+            _Input->_Process([&_F, &_Output, &_In_window, _State](details::_Token<_Ty>& _Item) -> bool
+            {
+                _F(std::move(_Item._M_value), _Output);
+                _In_window->_Retire();
+                return !_State->_Is_cancelled();
+            }, &_Distributor);
+        });
+        return pipeline_builder<_Out>(_M_state, _Bodies, _Out_window, true);
+    }
+
+    template<typename _Func>
+    pipeline operator|(const details::_Sink_stage<_Func>& _Stage) const
+    {
+        std::vector<std::shared_ptr<details::_Collector<_Ty>>> _Inputs = _Connect(_Stage._M_mode, details::_Lanes_for(_Stage._M_mode, _Stage._M_degree));
+        std::shared_ptr<details::_Token_window> _Window = _M_window;
+        details::_Pipeline_state *_State = _M_state.get();
+        for (size_t _I = 0; _I < _Inputs.size(); ++_I)
+        {
+            std::shared_ptr<details::_Collector<_Ty>> _Input = _Inputs[_I];
+            _Func _F = _Stage._M_func;
+            _M_state->_Add_lane([_Input, _Window, _F, _State]() mutable
+            {
+                _State->_Invoke([&_Input, &_Window, &_F]()
+                {
+                    _Input->_Process([&_F, &_Window](details::_Token<_Ty>& _Item) -> bool
+                    {
+                        _F(std::move(_Item._M_value));
+                        _Window->_Retire();
+                        return true;
+                    }, nullptr);
+                });
+            });
+        }
+        _M_state->_Complete();
+        return pipeline(_M_state);
+    }
+
+private:
+    // Adds the lanes that produce this builder's elements to the pipeline, with a ring from each of them to each
+    // of the _Lanes lanes of the next stage, and returns the collectors for the next stage to read.
+    std::vector<std::shared_ptr<details::_Collector<_Ty>>> _Connect(pipeline_stage_mode _Mode, size_t _Lanes) const
+    {
+        typedef details::_Spsc_ring<details::_Token<_Ty>> _Ring_type;
+
+        bool _Reorder = (_Mode == pipeline_serial_in_order) && !(_M_ordered && _M_bodies.size() == 1);
+        if (_Reorder)
+        {
+            _M_state->_Set_reordering();
+        }
+        _M_state->_Add_stage(_Lanes);
+
+        std::vector<std::shared_ptr<details::_Collector<_Ty>>> _Collectors;
+        std::vector<std::shared_ptr<details::_Event_count>> _Not_empty;
+        for (size_t _J = 0; _J < _Lanes; ++_J)
+        {
+            _Not_empty.push_back(_M_state->_New_event());
+            _Collectors.push_back(std::make_shared<details::_Collector<_Ty>>(_M_state.get(), _M_state->_Stage_count() - 1, _Not_empty[_J], _Reorder));
+        }
+
+        std::shared_ptr<details::_Connection> _Connection = std::make_shared<details::_Connection>();
+        _M_state->_Add_connection(_Connection);
+        details::_Pipeline_state *_State = _M_state.get();
+        for (size_t _I = 0; _I < _M_bodies.size(); ++_I)
+        {
+            std::shared_ptr<details::_Event_count> _Not_full = _M_state->_New_event();
+            std::shared_ptr<details::_Distributor<_Ty>> _Distributor = std::make_shared<details::_Distributor<_Ty>>(_State, _Not_full);
+            for (size_t _J = 0; _J < _Lanes; ++_J)
+            {
+                std::shared_ptr<_Ring_type> _Ring = std::make_shared<_Ring_type>(_M_state->_Capacity(), _M_state->_Max_batch(), _M_state->_Max_batch_delay(), _Not_full, _Not_empty[_J]);
+                _Distributor->_Add(_Ring);
+                _Collectors[_J]->_Add(_Ring);
+                _Connection->_Add(_Ring);
+            }
+
+            // A serial stage with a single lane before it can be fused into that lane.
+            if (_M_bodies.size() == 1 && _Lanes == 1 && _Mode != pipeline_parallel && !_Reorder)
+            {
+                std::shared_ptr<details::_Fusion_link<_Ty>> _Link = std::make_shared<details::_Fusion_link<_Ty>>(_State, _M_state->_New_event(), _Not_empty[0]);
+                _Distributor->_Set_link(_Link);
+                _Collectors[0]->_Set_link(_Link);
+            }
+
+            _Body_type _Body = _M_bodies[_I];
+            _M_state->_Add_lane([_Distributor, _Body, _State]()
+            {
+                _State->_Invoke([&_Distributor, &_Body]()
+                {
+                    _Body(*_Distributor);
+                });
+                _Distributor->_Close();
+            });
+        }
+        return _Collectors;
+    }
+
+    // Whether the single lane of the next stage emits elements in sequence order.
+    bool _Ordered_after(pipeline_stage_mode _Mode, size_t _Lanes) const
+    {
+        if (_Lanes != 1)
+        {
+            return false;
+        }
+        return (_Mode == pipeline_serial_in_order) || (_M_ordered && _M_bodies.size() == 1);
+    }
+
+    std::shared_ptr<details::_Pipeline_state> _M_state;
+    std::vector<_Body_type> _M_bodies;
+    std::shared_ptr<details::_Token_window> _M_window;
+    bool _M_ordered;
+};
+
+/// <summary>
+///     Starts a pipeline with a source of elements of type <c>_Ty</c>. The source is called as
+///     <c>bool _Func(_Ty&amp;)</c>; it stores the next element and returns <c>true</c>, or returns <c>false</c>
+///     at the end of the stream.
+/// </summary>
+/// <param name="_Capacity">
+///     The number of elements each ring of the pipeline can hold.
+/// </param>
+/// <param name="_Max_batch">
+///     The largest number of elements a stage hands to the next in one batch, at most half of <c>_Capacity</c>.
+///     One, the default, hands over each element on its own.
+/// </param>
+/// <param name="_Max_batch_delay">
+///     How long the first element of an incomplete batch may be held back, in microseconds.
+/// </param>
+/// <remarks>
+///     With batching, a stage makes the elements it has produced visible to the next stage, and wakes it, once per
+///     batch instead of once per element, and the next stage frees their slots once per batch. The size of the
+///     batches adapts: it grows while the next stage has a backlog, shrinks when the next stage runs dry, and a
+///     batch is handed over straight away when the next stage is waiting for it. The delay is checked when the
+///     stage produces its next element, so a source or flat stage that blocks for longer than the delay should
+///     not use batching.
+/// </remarks>
+/**/
+template<typename _Ty, typename _Func>
+pipeline_builder<_Ty> pipeline_source(const _Func& _F, size_t _Capacity = details::_Default_connection_capacity, size_t _Max_batch = 1,
+    unsigned int _Max_batch_delay = details::_Default_batch_delay)
+{
+    std::shared_ptr<details::_Pipeline_state> _State = std::make_shared<details::_Pipeline_state>(_Capacity, _Max_batch, std::chrono::microseconds(_Max_batch_delay));
+    std::shared_ptr<details::_Token_window> _Window = _State->_New_window();
+    details::_Pipeline_state *_Raw_state = _State.get();
+    _Func _Source = _F;
+
+    std::vector<typename pipeline_builder<_Ty>::_Body_type> _Bodies;
+    _Bodies.push_back([_Source, _Window, _Raw_state](details::_Distributor<_Ty>& _Distributor) mutable
+    {
+        pipeline_output<_Ty> _Out(_Distributor, *_Window, _Raw_state);
+        pipeline_telemetry *_Telemetry = _Raw_state->_Telemetry();
+        pipeline_telemetry::recorder *_Recorder = (_Telemetry != nullptr) ? &_Telemetry->new_recorder(0) : nullptr;
+        for (;;)
+        {
+            _Ty _Item;
+            unsigned long long _Start = (_Recorder != nullptr) ? pipeline_telemetry::timestamp() : 0;
+            if (!_Source(_Item))
+            {
+                return;
+            }
+            if (_Recorder != nullptr)
+            {
+                _Recorder->record_service(pipeline_telemetry::timestamp() - _Start);
+            }
+            if (!_Out.push(std::move(_Item)))
+            {
+                return;
+            }
+        }
+    });
+    return pipeline_builder<_Ty>(_State, _Bodies, _Window, true);
+}
+
+/// <summary>
+///     A stage that transforms each element, called as <c>_Result _Func(_Ty)</c>.
+/// </summary>
+/// <param name="_Mode">
+///     Whether the stage is serial in order, serial out of order or parallel.
+/// </param>
+/// <param name="_Degree">
+///     The number of threads of a parallel stage, or zero for one per hardware thread.
+/// </param>
+/**/
+template<typename _Func>
+details::_Map_stage<_Func> pipeline_stage(const _Func& _F, pipeline_stage_mode _Mode = pipeline_serial_in_order, size_t _Degree = 0)
+{
+    return details::_Map_stage<_Func>(_F, _Mode, _Degree);
+}
+
+/// <summary>
+///     A stage that emits zero or more elements of type <c>_Out</c> for each element, called as
+///     <c>void _Func(_Ty, pipeline_output&lt;_Out&gt;&amp;)</c>. Flat stages are serial.
+/// </summary>
+/**/
+template<typename _Out, typename _Func>
+details::_Flat_stage<_Out, _Func> pipeline_flat_stage(const _Func& _F, pipeline_stage_mode _Mode = pipeline_serial_in_order)
+{
+    return details::_Flat_stage<_Out, _Func>(_F, _Mode);
+}
+
+/// <summary>
+///     The last stage of a pipeline, called as <c>void _Func(_Ty)</c>.
+/// </summary>
+/**/
+template<typename _Func>
+details::_Sink_stage<_Func> pipeline_sink(const _Func& _F, pipeline_stage_mode _Mode = pipeline_serial_in_order, size_t _Degree = 0)
+{
+    return details::_Sink_stage<_Func>(_F, _Mode, _Degree);
+}
+} // namespace samples
+} // namespace Concurrency
+
+#pragma pop_macro("new")
@@ -0,0 +1,889 @@
+//--------------------------------------------------------------------------
+//
+//  Copyright (c) Microsoft Corporation.  All rights reserved.
+//
+//  File: portable_scheduler.h
+//
+//  Implementation of a portable work-stealing scheduler used by concrt_extras.h
+//  where the Concurrency Runtime is not available.
+//
+//--------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#if defined(_MSC_VER) && (_MSC_VER < 1900)
+#define _PORTABLE_THREAD_LOCAL __declspec(thread)
+#else
+#define _PORTABLE_THREAD_LOCAL thread_local
+#endif
+
+namespace Concurrency
+{
+namespace samples
+{
+/// <summary>
+///     The counters kept by one worker of a portable scheduler since the scheduler was created.
+/// </summary>
+/**/
+struct worker_statistics
+{
+    unsigned int worker;
+    // True for a worker that only runs while another worker is blocked.
+    bool compensation;
+    unsigned long long tasks_executed;
+    // Searches of the other workers' deques that found a task, and searches that found none.
+    unsigned long long steals;
+    unsigned long long failed_steals;
+    // Time spent waiting for tasks to be scheduled.
+    unsigned long long idle_microseconds;
+    // Time tasks on this worker spent blocked in a region marked with scoped_oversubcription_token.
+    unsigned long long compensated_microseconds;
+    // The most tasks queued in this worker's deque at once.
+    size_t max_deque_depth;
+};
+
+/// <summary>
+///     A snapshot of the counters of every worker of a portable scheduler that has been started.
+/// </summary>
+/// <remarks>
+///     Counters are collected unless <c>SAMPLES_NO_SCHEDULER_STATISTICS</c> is defined, in which case they read
+///     as zero. Each worker updates only its own counters and a snapshot reads them without stopping the workers,
+///     so the values of different workers may be a few tasks apart.
+/// </remarks>
+/**/
+struct scheduler_statistics
+{
+    std::vector<worker_statistics> workers;
+    // The most tasks queued at once by threads that are not workers of the scheduler.
+    size_t max_injected_depth;
+
+    scheduler_statistics() : max_injected_depth(0)
+    {
+    }
+
+    /// <summary>
+    ///     Returns the snapshot as a JSON object.
+    /// </summary>
+    std::string to_json() const
+    {
+        std::ostringstream _Out;
+        _Out << "{\"max_injected_depth\":" << max_injected_depth << ",\"workers\":[";
+        for (size_t _I = 0; _I < workers.size(); ++_I)
+        {
+            const worker_statistics &_W = workers[_I];
+            _Out << ((_I == 0) ? "" : ",")
+                << "{\"worker\":" << _W.worker
+                << ",\"compensation\":" << (_W.compensation ? "true" : "false")
+                << ",\"tasks_executed\":" << _W.tasks_executed
+                << ",\"steals\":" << _W.steals
+                << ",\"failed_steals\":" << _W.failed_steals
+                << ",\"idle_microseconds\":" << _W.idle_microseconds
+                << ",\"compensated_microseconds\":" << _W.compensated_microseconds
+                << ",\"max_deque_depth\":" << _W.max_deque_depth << "}";
+        }
+        _Out << "]}";
+        return _Out.str();
+    }
+};
+
+namespace details
+{
+    typedef void (*_Portable_task_proc)(void *);
+
+    struct _Portable_task
+    {
+        _Portable_task_proc _M_proc;
+        void *_M_data;
+    };
+
+    // The subset of Concurrency::SchedulerPolicy understood by the portable scheduler, plus the processors its
+    // workers may run on. A value of zero selects the default.
+    struct _Portable_policy
+    {
+        // The number of workers started with the scheduler. More are started, up to the maximum, while tasks are
+        // waiting and no worker is idle. By default all workers are started up front.
+        unsigned int _M_min_concurrency;
+
+        // The number of workers, by default one per processor in the affinity set or one per hardware thread.
+        unsigned int _M_max_concurrency;
+
+        // The most compensation workers that may be running at the same time, by default the same as the maximum
+        // number of workers.
+        unsigned int _M_max_compensation;
+
+        // The processors all workers are restricted to, or empty for no restriction.
+        std::vector<unsigned int> _M_processors;
+
+        _Portable_policy() : _M_min_concurrency(0), _M_max_concurrency(0), _M_max_compensation(0)
+        {
+        }
+
+        void SetConcurrencyLimits(unsigned int _Min_concurrency, unsigned int _Max_concurrency)
+        {
+            if (_Max_concurrency != 0 && _Min_concurrency > _Max_concurrency)
+            {
+                throw std::invalid_argument("_Min_concurrency");
+            }
+            _M_min_concurrency = _Min_concurrency;
+            _M_max_concurrency = _Max_concurrency;
+        }
+
+        void SetCompensationLimit(unsigned int _Max_compensation)
+        {
+            _M_max_compensation = _Max_compensation;
+        }
+
+        void SetProcessorAffinity(const std::vector<unsigned int>& _Processors)
+        {
+            _M_processors = _Processors;
+        }
+    };
+
+    // Restricts the calling thread to the given processors. Does nothing if the set is empty or the platform has no
+    // way to do it; processors beyond the first 64 are ignored on Windows.
+    inline void _Set_current_thread_affinity(const std::vector<unsigned int>& _Processors)
+    {
+        if (_Processors.empty())
+        {
+            return;
+        }
+#if defined(_WIN32)
+        DWORD_PTR _Mask = 0;
+        for (size_t _I = 0; _I < _Processors.size(); ++_I)
+        {
+            if (_Processors[_I] < sizeof(DWORD_PTR) * 8)
+            {
+                _Mask |= static_cast<DWORD_PTR>(1) << _Processors[_I];
+            }
+        }
+        if (_Mask != 0)
+        {
+            SetThreadAffinityMask(GetCurrentThread(), _Mask);
+        }
+#elif defined(__linux__)
+        cpu_set_t _Set;
+        CPU_ZERO(&_Set);
+        for (size_t _I = 0; _I < _Processors.size(); ++_I)
+        {
+            if (_Processors[_I] < CPU_SETSIZE)
+            {
+                CPU_SET(_Processors[_I], &_Set);
+            }
+        }
+        pthread_setaffinity_np(pthread_self(), sizeof(_Set), &_Set);
+#endif
+    }
+
+    // The counters of one worker. Only the worker itself writes them, so they are updated with plain loads and
+    // stores instead of interlocked operations.
+    class _Portable_counters
+    {
+    public:
+#if !defined(SAMPLES_NO_SCHEDULER_STATISTICS)
+        _Portable_counters() : _M_tasks(0), _M_steals(0), _M_failed_steals(0), _M_idle(0), _M_compensated(0), _M_max_depth(0)
+        {
+        }
+
+        static unsigned long long _Now()
+        {
+            return static_cast<unsigned long long>(std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+        }
+
+        void _Task_executed()
+        {
+            _Add(_M_tasks, 1);
+        }
+
+        void _Steal(bool _Succeeded)
+        {
+            _Add(_Succeeded ? _M_steals : _M_failed_steals, 1);
+        }
+
+        void _Idle_since(unsigned long long _Start)
+        {
+            _Add(_M_idle, _Now() - _Start);
+        }
+
+        void _Compensated_since(unsigned long long _Start)
+        {
+            _Add(_M_compensated, _Now() - _Start);
+        }
+
+        void _Deque_depth(size_t _Depth)
+        {
+            if (_Depth > _M_max_depth.load(std::memory_order_relaxed))
+            {
+                _M_max_depth.store(_Depth, std::memory_order_relaxed);
+            }
+        }
+
+        void _Read(worker_statistics &_Statistics) const
+        {
+            _Statistics.tasks_executed = _M_tasks.load(std::memory_order_relaxed);
+            _Statistics.steals = _M_steals.load(std::memory_order_relaxed);
+            _Statistics.failed_steals = _M_failed_steals.load(std::memory_order_relaxed);
+            _Statistics.idle_microseconds = _M_idle.load(std::memory_order_relaxed);
+            _Statistics.compensated_microseconds = _M_compensated.load(std::memory_order_relaxed);
+            _Statistics.max_deque_depth = _M_max_depth.load(std::memory_order_relaxed);
+        }
+
+    private:
+        static void _Add(std::atomic<unsigned long long> &_Counter, unsigned long long _Value)
+        {
+            _Counter.store(_Counter.load(std::memory_order_relaxed) + _Value, std::memory_order_relaxed);
+        }
+
+        std::atomic<unsigned long long> _M_tasks;
+        std::atomic<unsigned long long> _M_steals;
+        std::atomic<unsigned long long> _M_failed_steals;
+        std::atomic<unsigned long long> _M_idle;
+        std::atomic<unsigned long long> _M_compensated;
+        std::atomic<size_t> _M_max_depth;
+#else
+        static unsigned long long _Now() { return 0; }
+        void _Task_executed() {}
+        void _Steal(bool) {}
+        void _Idle_since(unsigned long long) {}
+        void _Compensated_since(unsigned long long) {}
+        void _Deque_depth(size_t) {}
+
+        void _Read(worker_statistics &_Statistics) const
+        {
+            _Statistics.tasks_executed = _Statistics.steals = _Statistics.failed_steals = 0;
+            _Statistics.idle_microseconds = _Statistics.compensated_microseconds = 0;
+            _Statistics.max_deque_depth = 0;
+        }
+#endif
+    };
+
+    class _Portable_scheduler;
+
+    // A worker thread with its own deque of tasks. The owner pushes and pops at the back, thieves take from the front.
+    struct _Portable_worker
+    {
+        _Portable_scheduler *_M_scheduler;
+        size_t _M_index;
+        bool _M_is_compensation;
+        std::thread _M_thread;
+
+        std::mutex _M_lock;
+        std::deque<_Portable_task> _M_tasks;
+
+        // Set once the thread has been started, after which the slot can be stolen from.
+        std::atomic<bool> _M_started;
+
+        // Compensation workers only: true while the worker is running tasks rather than parked. Guarded by the
+        // scheduler's thread lock.
+        bool _M_active;
+        std::condition_variable _M_resume;
+
+        // The nesting depth of blocking regions entered by tasks running on this worker.
+        int _M_blocking_depth;
+
+        // State of the xorshift generator used to pick steal victims.
+        unsigned int _M_victim_seed;
+
+        // When the outermost blocking region was entered.
+        unsigned long long _M_blocking_start;
+
+        // Keeps the counters off the cache line of the deque lock, which thieves write.
+        char _M_padding[64];
+        _Portable_counters _M_counters;
+
+        _Portable_worker(_Portable_scheduler *_Scheduler, size_t _Index, bool _Is_compensation) :
+            _M_scheduler(_Scheduler), _M_index(_Index), _M_is_compensation(_Is_compensation), _M_started(false),
+            _M_active(false), _M_blocking_depth(0), _M_victim_seed(static_cast<unsigned int>(_Index) * 2654435761U + 1),
+            _M_blocking_start(0)
+        {
+        }
+    };
+
+    // The worker the calling thread belongs to, if any.
+    inline _Portable_worker *&_Current_portable_worker()
+    {
+        static _PORTABLE_THREAD_LOCAL _Portable_worker *_S_worker = nullptr;
+        return _S_worker;
+    }
+
+    struct _Portable_attach_frame;
+
+    // The schedulers attached to the calling thread, innermost first.
+    inline _Portable_attach_frame *&_Current_portable_attach_frame()
+    {
+        static _PORTABLE_THREAD_LOCAL _Portable_attach_frame *_S_frame = nullptr;
+        return _S_frame;
+    }
+
+    struct _Portable_attach_frame
+    {
+        _Portable_scheduler *_M_scheduler;
+        _Portable_attach_frame *_M_previous;
+    };
+
+    class _Portable_schedule_group;
+
+    // A pool of worker threads with per-worker deques and random work stealing. It mirrors the subset of
+    // Concurrency::Scheduler used by the wrappers in concrt_extras.h. Each instance has its own workers, so work
+    // on one scheduler never waits behind work on another, and the policy can bound the number of workers and
+    // restrict them to a set of processors.
+    //
+    // Tasks that block in a region marked with scoped_oversubcription_token are compensated for: the scheduler
+    // wakes or starts a compensation worker for each blocked worker, up to the policy's cap, and retires it once
+    // the region ends so that the number of running workers returns to the number of cores.
+    class _Portable_scheduler
+    {
+    public:
+        static _Portable_scheduler *Create(const _Portable_policy &_Policy)
+        {
+            return new _Portable_scheduler(_Policy);
+        }
+
+        void Reference()
+        {
+            ++_M_references;
+        }
+
+        // Releases a reference. When the last reference is released the workers finish the remaining tasks and exit.
+        void Release()
+        {
+            if (--_M_references == 0)
+            {
+                _Shutdown();
+            }
+        }
+
+        void ScheduleTask(_Portable_task_proc _Proc, void *_Data)
+        {
+            _Portable_task _Task = { _Proc, _Data };
+
+            _Portable_worker *_Worker = _Current_portable_worker();
+            if (_Worker != nullptr && _Worker->_M_scheduler == this)
+            {
+                std::lock_guard<std::mutex> _Lock(_Worker->_M_lock);
+                _Worker->_M_tasks.push_back(_Task);
+                _Worker->_M_counters._Deque_depth(_Worker->_M_tasks.size());
+            }
+            else
+            {
+                std::lock_guard<std::mutex> _Lock(_M_injection_lock);
+                _M_injected.push_back(_Task);
+                if (_M_injected.size() > _M_max_injected_depth)
+                {
+                    _M_max_injected_depth = _M_injected.size();
+                }
+            }
+
+            ++_M_pending;
+            if (_M_idle.load() > 0)
+            {
+                std::lock_guard<std::mutex> _Lock(_M_idle_lock);
+                _M_work_available.notify_one();
+            }
+            else if (_M_started_workers.load() < _M_worker_count)
+            {
+                _Add_worker();
+            }
+        }
+
+        _Portable_schedule_group *CreateScheduleGroup();
+
+        unsigned int GetNumberOfVirtualProcessors() const
+        {
+            return _M_worker_count;
+        }
+
+        const std::vector<unsigned int>& _Processors() const
+        {
+            return _M_processors;
+        }
+
+        scheduler_statistics _Statistics()
+        {
+            scheduler_statistics _Result;
+            for (size_t _I = 0; _I < _M_workers.size(); ++_I)
+            {
+                _Portable_worker *_Worker = _M_workers[_I].get();
+                if (_Worker->_M_started)
+                {
+                    worker_statistics _Statistics;
+                    _Statistics.worker = static_cast<unsigned int>(_Worker->_M_index);
+                    _Statistics.compensation = _Worker->_M_is_compensation;
+                    _Worker->_M_counters._Read(_Statistics);
+                    _Result.workers.push_back(_Statistics);
+                }
+            }
+
+            std::lock_guard<std::mutex> _Lock(_M_injection_lock);
+            _Result.max_injected_depth = _M_max_injected_depth;
+            return _Result;
+        }
+
+        // Makes this scheduler the current scheduler of the calling thread until the matching Detach.
+        void Attach()
+        {
+            Reference();
+            _Portable_attach_frame *_Frame = new _Portable_attach_frame;
+            _Frame->_M_scheduler = this;
+            _Frame->_M_previous = _Current_portable_attach_frame();
+            _Current_portable_attach_frame() = _Frame;
+        }
+
+        static void Detach()
+        {
+            _Portable_attach_frame *_Frame = _Current_portable_attach_frame();
+            if (_Frame != nullptr)
+            {
+                _Current_portable_attach_frame() = _Frame->_M_previous;
+                _Portable_scheduler *_Scheduler = _Frame->_M_scheduler;
+                delete _Frame;
+                _Scheduler->Release();
+            }
+        }
+
+        // Returns the scheduler of the calling worker, else the innermost attached scheduler, else the default
+        // scheduler, which is created on first use and lives until the process exits.
+        static _Portable_scheduler *_Get_current()
+        {
+            _Portable_worker *_Worker = _Current_portable_worker();
+            if (_Worker != nullptr)
+            {
+                return _Worker->_M_scheduler;
+            }
+
+            _Portable_attach_frame *_Frame = _Current_portable_attach_frame();
+            if (_Frame != nullptr)
+            {
+                return _Frame->_M_scheduler;
+            }
+
+            static _Portable_scheduler *_S_default = Create(_Portable_policy());
+            return _S_default;
+        }
+
+        // Called when a task on the calling thread is about to block. Nested regions are counted once.
+        static void _Begin_blocking()
+        {
+            _Portable_worker *_Worker = _Current_portable_worker();
+            if (_Worker == nullptr || _Worker->_M_blocking_depth++ > 0)
+            {
+                return;
+            }
+
+            _Worker->_M_blocking_start = _Portable_counters::_Now();
+            _Portable_scheduler *_Scheduler = _Worker->_M_scheduler;
+            ++_Scheduler->_M_blocked;
+            _Scheduler->_Compensate();
+        }
+
+        static void _End_blocking()
+        {
+            _Portable_worker *_Worker = _Current_portable_worker();
+            if (_Worker == nullptr || --_Worker->_M_blocking_depth > 0)
+            {
+                return;
+            }
+
+            _Worker->_M_counters._Compensated_since(_Worker->_M_blocking_start);
+            _Portable_scheduler *_Scheduler = _Worker->_M_scheduler;
+            --_Scheduler->_M_blocked;
+
+            // Idle compensation workers re-check whether they are still needed.
+            std::lock_guard<std::mutex> _Lock(_Scheduler->_M_idle_lock);
+            _Scheduler->_M_work_available.notify_all();
+        }
+
+    private:
+        explicit _Portable_scheduler(const _Portable_policy &_Policy) :
+            _M_references(1), _M_processors(_Policy._M_processors), _M_started_workers(0), _M_closing(false), _M_max_injected_depth(0), _M_pending(0),
+            _M_idle(0), _M_shutdown(false), _M_blocked(0), _M_active_compensation(0), _M_shutdown_parked(false)
+        {
+            unsigned int _Hardware = std::thread::hardware_concurrency();
+            unsigned int _Default = !_M_processors.empty() ? static_cast<unsigned int>(_M_processors.size()) : ((_Hardware != 0) ? _Hardware : 1);
+            _M_worker_count = (_Policy._M_max_concurrency != 0) ? _Policy._M_max_concurrency : _Default;
+            _M_max_compensation = (_Policy._M_max_compensation != 0) ? _Policy._M_max_compensation : _M_worker_count;
+            unsigned int _Initial = (_Policy._M_min_concurrency != 0 && _Policy._M_min_concurrency < _M_worker_count) ? _Policy._M_min_concurrency : _M_worker_count;
+
+            // All slots are created up front so that thieves can walk the array without locking it.
+            for (size_t _I = 0; _I < _M_worker_count + _M_max_compensation; ++_I)
+            {
+                _M_workers.push_back(std::unique_ptr<_Portable_worker>(new _Portable_worker(this, _I, _I >= _M_worker_count)));
+            }
+
+            std::lock_guard<std::mutex> _Lock(_M_thread_lock);
+            for (size_t _I = 0; _I < _Initial; ++_I)
+            {
+                _Start(_M_workers[_I].get());
+            }
+            _M_started_workers = _Initial;
+        }
+
+        // Called with _M_thread_lock held.
+        void _Start(_Portable_worker *_Worker)
+        {
+            _Worker->_M_thread = std::thread(&_Portable_scheduler::_Worker_main, this, _Worker);
+            _Worker->_M_started = true;
+        }
+
+        // Starts another regular worker if the scheduler is below its maximum concurrency.
+        void _Add_worker()
+        {
+            std::lock_guard<std::mutex> _Lock(_M_thread_lock);
+            unsigned int _Started = _M_started_workers.load();
+            if (_M_closing || _Started >= _M_worker_count)
+            {
+                return;
+            }
+            _Start(_M_workers[_Started].get());
+            _M_started_workers = _Started + 1;
+        }
+
+        void _Worker_main(_Portable_worker *_Worker)
+        {
+            _Current_portable_worker() = _Worker;
+            _Set_current_thread_affinity(_M_processors);
+
+            for (;;)
+            {
+                if (_Worker->_M_is_compensation && _Try_retire())
+                {
+                    if (!_Park(_Worker))
+                    {
+                        break;
+                    }
+                    continue;
+                }
+
+                _Portable_task _Task;
+                if (_Take_task(_Worker, _Task))
+                {
+                    _Task._M_proc(_Task._M_data);
+                    _Worker->_M_counters._Task_executed();
+                }
+                else if (!_Wait_for_work(_Worker))
+                {
+                    break;
+                }
+            }
+
+            _Current_portable_worker() = nullptr;
+        }
+
+        // Pops from the back of the worker's own deque, then takes injected tasks, then steals from the front of the
+        // deque of a randomly chosen victim.
+        bool _Take_task(_Portable_worker *_Worker, _Portable_task &_Task)
+        {
+            {
+                std::lock_guard<std::mutex> _Lock(_Worker->_M_lock);
+                if (!_Worker->_M_tasks.empty())
+                {
+                    _Task = _Worker->_M_tasks.back();
+                    _Worker->_M_tasks.pop_back();
+                    --_M_pending;
+                    return true;
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> _Lock(_M_injection_lock);
+                if (!_M_injected.empty())
+                {
+                    _Task = _M_injected.front();
+                    _M_injected.pop_front();
+                    --_M_pending;
+                    return true;
+                }
+            }
+
+            size_t _Count = _M_workers.size();
+            unsigned int &_Seed = _Worker->_M_victim_seed;
+            _Seed ^= _Seed << 13;
+            _Seed ^= _Seed >> 17;
+            _Seed ^= _Seed << 5;
+
+            for (size_t _I = 0, _Victim = _Seed % _Count; _I < _Count; ++_I, _Victim = (_Victim + 1 == _Count) ? 0 : _Victim + 1)
+            {
+                _Portable_worker *_Other = _M_workers[_Victim].get();
+                if (_Other == _Worker || !_Other->_M_started)
+                {
+                    continue;
+                }
+
+                std::lock_guard<std::mutex> _Lock(_Other->_M_lock);
+                if (!_Other->_M_tasks.empty())
+                {
+                    _Task = _Other->_M_tasks.front();
+                    _Other->_M_tasks.pop_front();
+                    --_M_pending;
+                    _Worker->_M_counters._Steal(true);
+                    return true;
+                }
+            }
+            _Worker->_M_counters._Steal(false);
+            return false;
+        }
+
+        // Sleeps until a task is scheduled. Returns false when the scheduler has shut down and no tasks remain.
+        bool _Wait_for_work(_Portable_worker *_Worker)
+        {
+            unsigned long long _Start = _Portable_counters::_Now();
+            std::unique_lock<std::mutex> _Lock(_M_idle_lock);
+            ++_M_idle;
+            while (_M_pending.load() == 0 && !_M_shutdown && !(_Worker->_M_is_compensation && _Is_over_compensated()))
+            {
+                _M_work_available.wait(_Lock);
+            }
+            --_M_idle;
+            _Worker->_M_counters._Idle_since(_Start);
+            return !(_M_shutdown && _M_pending.load() == 0);
+        }
+
+        // Starts or wakes compensation workers until every blocked worker is compensated for or the cap is reached.
+        void _Compensate()
+        {
+            for (;;)
+            {
+                unsigned int _Active = _M_active_compensation.load();
+                if (_Active >= _M_blocked.load() || _Active >= _M_max_compensation)
+                {
+                    return;
+                }
+
+                if (_M_active_compensation.compare_exchange_weak(_Active, _Active + 1))
+                {
+                    _Activate_compensation_worker();
+                }
+            }
+        }
+
+        void _Activate_compensation_worker()
+        {
+            std::lock_guard<std::mutex> _Lock(_M_thread_lock);
+            if (_M_shutdown_parked)
+            {
+                --_M_active_compensation;
+                return;
+            }
+
+            // Prefer a parked thread to starting a new one.
+            _Portable_worker *_Unstarted = nullptr;
+            for (size_t _I = _M_worker_count; _I < _M_workers.size(); ++_I)
+            {
+                _Portable_worker *_Worker = _M_workers[_I].get();
+                if (!_Worker->_M_started)
+                {
+                    if (_Unstarted == nullptr)
+                    {
+                        _Unstarted = _Worker;
+                    }
+                }
+                else if (!_Worker->_M_active)
+                {
+                    _Worker->_M_active = true;
+                    _Worker->_M_resume.notify_one();
+                    return;
+                }
+            }
+
+            // The number of active compensation workers never exceeds the number of slots, so one is free.
+            _Unstarted->_M_active = true;
+            _Start(_Unstarted);
+        }
+
+        bool _Is_over_compensated() const
+        {
+            return _M_active_compensation.load() > _M_blocked.load();
+        }
+
+        // Called by a compensation worker between tasks. Returns true if it should stop running tasks.
+        bool _Try_retire()
+        {
+            unsigned int _Active = _M_active_compensation.load();
+            while (_Active > _M_blocked.load())
+            {
+                if (_M_active_compensation.compare_exchange_weak(_Active, _Active - 1))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Parks a retired compensation worker until it is needed again. Returns false if the scheduler shut down.
+        bool _Park(_Portable_worker *_Worker)
+        {
+            {
+                // Tasks left in the deque can still be stolen, make sure someone is awake to do it.
+                std::lock_guard<std::mutex> _Lock(_Worker->_M_lock);
+                if (!_Worker->_M_tasks.empty())
+                {
+                    std::lock_guard<std::mutex> _Idle_lock(_M_idle_lock);
+                    _M_work_available.notify_one();
+                }
+            }
+
+            std::unique_lock<std::mutex> _Lock(_M_thread_lock);
+            _Worker->_M_active = false;
+            while (!_Worker->_M_active && !_M_shutdown_parked)
+            {
+                _Worker->_M_resume.wait(_Lock);
+            }
+            return _Worker->_M_active;
+        }
+
+        void _Shutdown()
+        {
+            // The last reference may be released by a task running on one of our own workers, which cannot join
+            // itself. Hand the shutdown to another thread in that case.
+            _Portable_worker *_Worker = _Current_portable_worker();
+            if (_Worker != nullptr && _Worker->_M_scheduler == this)
+            {
+                std::thread(&_Portable_scheduler::_Shutdown_and_delete, this).detach();
+            }
+            else
+            {
+                _Shutdown_and_delete();
+            }
+        }
+
+        void _Shutdown_and_delete()
+        {
+            // No more regular workers are started from here on.
+            unsigned int _Started;
+            {
+                std::lock_guard<std::mutex> _Lock(_M_thread_lock);
+                _M_closing = true;
+                _Started = _M_started_workers.load();
+            }
+
+            {
+                std::lock_guard<std::mutex> _Lock(_M_idle_lock);
+                _M_shutdown = true;
+                _M_work_available.notify_all();
+            }
+
+            // Workers exit once no tasks remain. Parked compensation workers are released after that, since running
+            // tasks may still block and need them.
+            for (size_t _I = 0; _I < _Started; ++_I)
+            {
+                _M_workers[_I]->_M_thread.join();
+            }
+
+            {
+                std::lock_guard<std::mutex> _Lock(_M_thread_lock);
+                _M_shutdown_parked = true;
+                for (size_t _I = _M_worker_count; _I < _M_workers.size(); ++_I)
+                {
+                    _M_workers[_I]->_M_resume.notify_one();
+                }
+            }
+
+            for (size_t _I = _M_worker_count; _I < _M_workers.size(); ++_I)
+            {
+                if (_M_workers[_I]->_M_started)
+                {
+                    _M_workers[_I]->_M_thread.join();
+                }
+            }
+
+            delete this;
+        }
+
+        std::atomic<long> _M_references;
+
+        unsigned int _M_worker_count;
+        unsigned int _M_max_compensation;
+        std::vector<unsigned int> _M_processors;
+        std::vector<std::unique_ptr<_Portable_worker>> _M_workers;
+
+        // Guards starting threads and parking compensation workers.
+        std::mutex _M_thread_lock;
+        std::atomic<unsigned int> _M_started_workers;
+        bool _M_closing;
+
+        // Tasks scheduled from threads that are not workers of this scheduler.
+        std::mutex _M_injection_lock;
+        std::deque<_Portable_task> _M_injected;
+        size_t _M_max_injected_depth;
+
+        // The number of tasks that have been scheduled but not yet taken by a worker.
+        std::atomic<long> _M_pending;
+
+        // Idle workers wait on _M_work_available. _M_idle is incremented under _M_idle_lock before _M_pending is
+        // checked, and ScheduleTask increments _M_pending before it reads _M_idle, so a wake up cannot be lost.
+        std::mutex _M_idle_lock;
+        std::condition_variable _M_work_available;
+        std::atomic<long> _M_idle;
+        bool _M_shutdown;
+
+        // The number of workers blocked in a blocking region, and the number of compensation workers running.
+        std::atomic<unsigned int> _M_blocked;
+        std::atomic<unsigned int> _M_active_compensation;
+        bool _M_shutdown_parked;
+
+        _Portable_scheduler(const _Portable_scheduler&);
+        _Portable_scheduler const & operator=(_Portable_scheduler const&);
+    };
+
+    // Groups do not change where tasks run in the portable scheduler. They keep the scheduler alive while they exist.
+    class _Portable_schedule_group
+    {
+    public:
+        explicit _Portable_schedule_group(_Portable_scheduler *_Scheduler) : _M_scheduler(_Scheduler), _M_references(1)
+        {
+            _M_scheduler->Reference();
+        }
+
+        void ScheduleTask(_Portable_task_proc _Proc, void *_Data)
+        {
+            _M_scheduler->ScheduleTask(_Proc, _Data);
+        }
+
+        void Reference()
+        {
+            ++_M_references;
+        }
+
+        void Release()
+        {
+            if (--_M_references == 0)
+            {
+                _M_scheduler->Release();
+                delete this;
+            }
+        }
+
+    private:
+        _Portable_scheduler *_M_scheduler;
+        std::atomic<long> _M_references;
+
+        _Portable_schedule_group(const _Portable_schedule_group&);
+        _Portable_schedule_group const & operator=(_Portable_schedule_group const&);
+    };
+
+    inline _Portable_schedule_group *_Portable_scheduler::CreateScheduleGroup()
+    {
+        return new _Portable_schedule_group(this);
+    }
+}
+} // namespace samples
+} // namespace Concurrency
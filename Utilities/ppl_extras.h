@@ -13,7 +13,11 @@
 #include <ppl.h>
 #include <numeric>
 #include <vector>
+#if defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
 #include "concrt_extras.h"
+#include "random_extras.h"
 namespace Concurrency
 {
 namespace samples
@@ -1514,6 +1518,642 @@ inline void parallel_merge(ran_it first1, ran_it last1, ran_it first2, ran_it la
     tasks.run_and_wait([&](){parallel_merge(mid1, last1, m2, last2, out_right );});
 }
 
+namespace details
+{
+    // The number of buckets used by parallel_shuffle. It depends only on the size of the range and never on the number 
+    // of cores, so that a seeded shuffle produces the same permutation on every machine.
+    inline size_t _Shuffle_bucket_count(size_t _Size)
+    {
+        size_t _Buckets = 1;
+        while (_Buckets < 1024 && _Buckets * 4096 < _Size)
+        {
+            _Buckets <<= 1;
+        }
+        return _Buckets;
+    }
+
+    // Serial Fisher-Yates shuffle driven by a single engine.
+    template<typename _Random_iterator, typename _Engine>
+    inline void _Fisher_yates_shuffle(_Random_iterator _Begin, size_t _Size, _Engine &_Eng)
+    {
+        for (size_t _I = _Size; _I > 1; --_I)
+        {
+            size_t _J = _Random_index(_Eng, _I);
+            if (_J != _I - 1)
+            {
+                std::swap(_Begin[_I - 1], _Begin[_J]);
+            }
+        }
+    }
+}
+
+/// <summary>
+///     This template function is semantically equivalent to <c>std::generate</c>, except that the elements are generated
+///     in parallel from a counter-based random engine such as <c>philox4x32</c>.
+/// </summary>
+/// <typeparam name="_Random_iterator">
+///     The iterator type of the output range, it requires the iterator category to be random_iterator.
+/// </typeparam>
+/// <typeparam name="_Engine">
+///     The engine type. It must provide <c>substream(unsigned long long)</c> returning an independent engine.
+/// </typeparam>
+/// <typeparam name="_Function">
+///     The generator functor type.
+/// </typeparam>
+/// <param name="_Begin">
+///     The position of the first element to be generated.
+/// </param>
+/// <param name="_End">
+///     The position of the first element not to be generated.
+/// </param>
+/// <param name="_Eng">
+///     The seeded engine that all of the element streams are derived from.
+/// </param>
+/// <param name="_Func">
+///     A functor <c>T (_Engine&amp;)</c> which returns a new element, drawing as many random values as it needs.
+/// </param>
+/// <remarks>
+///     The element at position <c>i</c> is produced by <c>_Func(_Eng.substream(i))</c>. Because every element draws from
+///     its own stream the result is bit-for-bit identical to the serial loop, whatever the number of threads and however 
+///     the range is divided into chunks.
+/// </remarks>
+/**/
+template<typename _Random_iterator, typename _Engine, typename _Function>
+inline void parallel_generate(const _Random_iterator &_Begin, const _Random_iterator &_End, const _Engine &_Eng, const _Function &_Func)
+{
+    typedef typename std::iterator_traits<_Random_iterator>::difference_type _Index_type;
+
+    _Index_type _Size = _End - _Begin;
+    parallel_for(_Index_type(0), _Size, [&_Begin, &_Eng, &_Func](_Index_type _I)
+    {
+        _Engine _Local = _Eng.substream(static_cast<unsigned long long>(_I));
+        _Begin[_I] = _Func(_Local);
+    });
+}
+
+/// <summary>
+///     This template function is semantically equivalent to <c>std::shuffle</c>, except that the range is permuted in 
+///     parallel using a counter-based random engine such as <c>philox4x32</c>.
+/// </summary>
+/// <typeparam name="_Random_iterator">
+///     The iterator type of the input range, it requires the iterator category to be random_iterator.
+/// </typeparam>
+/// <typeparam name="_Engine">
+///     The engine type. It must provide <c>substream(unsigned long long)</c> and a constant time <c>discard</c>.
+/// </typeparam>
+/// <param name="_Begin">
+///     The position of the first element to be shuffled.
+/// </param>
+/// <param name="_End">
+///     The position of the first element not to be shuffled.
+/// </param>
+/// <param name="_Eng">
+///     The seeded engine that all of the random choices are derived from.
+/// </param>
+/// <remarks>
+///     Every element is sent to one of up to 1024 buckets chosen uniformly at random, the buckets are concatenated in 
+///     order and then each bucket is shuffled with Fisher-Yates. Random assignment to buckets followed by a uniform 
+///     permutation of every bucket gives a uniform permutation of the whole range.
+///     <para>Bucket choices are taken from stream 0 of <c>_Eng</c>, at the position given by the element index, and bucket
+///     <c>b</c> is shuffled from stream <c>b + 1</c>. No random choice depends on how the range was divided among threads,
+///     so the permutation for a given seed does not change with the number of cores.</para>
+///     <para><c>n * sizeof(T)</c> bytes of additional space are required and the element type must be default
+///     constructible.</para>
+/// </remarks>
+/**/
+template<typename _Random_iterator, typename _Engine>
+inline void parallel_shuffle(const _Random_iterator &_Begin, const _Random_iterator &_End, const _Engine &_Eng)
+{
+    typedef typename std::iterator_traits<_Random_iterator>::value_type _Value_type;
+
+    size_t _Size = _End - _Begin;
+    size_t _Buckets = details::_Shuffle_bucket_count(_Size);
+
+    if (_Buckets == 1)
+    {
+        // Too small to be worth scattering. This is the same permutation as a single bucket.
+        _Engine _Local = _Eng.substream(1);
+        details::_Fisher_yates_shuffle(_Begin, _Size, _Local);
+        return;
+    }
+
+    // Bucket numbers are the top bits of a 32 bit random value.
+    unsigned int _Shift = 32;
+    for (size_t _B = _Buckets; _B > 1; _B >>= 1)
+    {
+        --_Shift;
+    }
+
+    // The chunking only affects how the work is shared out, not the result.
+    size_t _Chunk_num = Concurrency::CurrentScheduler::Get()->GetNumberOfVirtualProcessors() * 4;
+    size_t _Chunk_size = (_Size + _Chunk_num - 1) / _Chunk_num;
+    _Chunk_num = (_Size + _Chunk_size - 1) / _Chunk_size;
+
+    // Count the number of elements each chunk sends to each bucket.
+    std::vector<size_t> _Offsets(_Chunk_num * _Buckets, 0);
+    parallel_for(size_t(0), _Chunk_num, [&](size_t _Chunk)
+    {
+        size_t _First = _Chunk * _Chunk_size;
+        size_t _Last = min(_First + _Chunk_size, _Size);
+        size_t* _Row = &_Offsets[_Chunk * _Buckets];
+
+        _Engine _Choice = _Eng.substream(0);
+        _Choice.discard(_First);
+        for (size_t _I = _First; _I < _Last; ++_I)
+        {
+            ++_Row[_Choice() >> _Shift];
+        }
+    });
+
+    // Turn the counts into the position at which each chunk starts writing into each bucket. Elements keep their 
+    // relative order within a bucket, so the layout is the same for any chunking.
+    std::vector<size_t> _Bucket_begin(_Buckets + 1);
+    size_t _Sum = 0;
+    for (size_t _B = 0; _B < _Buckets; ++_B)
+    {
+        _Bucket_begin[_B] = _Sum;
+        for (size_t _Chunk = 0; _Chunk < _Chunk_num; ++_Chunk)
+        {
+            size_t _Count = _Offsets[_Chunk * _Buckets + _B];
+            _Offsets[_Chunk * _Buckets + _B] = _Sum;
+            _Sum += _Count;
+        }
+    }
+    _Bucket_begin[_Buckets] = _Size;
+
+    // Scatter the elements into their buckets, replaying the same bucket choices as the counting pass.
+    std::vector<_Value_type> _Buffer(_Size);
+    parallel_for(size_t(0), _Chunk_num, [&](size_t _Chunk)
+    {
+        size_t _First = _Chunk * _Chunk_size;
+        size_t _Last = min(_First + _Chunk_size, _Size);
+        size_t* _Row = &_Offsets[_Chunk * _Buckets];
+
+        _Engine _Choice = _Eng.substream(0);
+        _Choice.discard(_First);
+        for (size_t _I = _First; _I < _Last; ++_I)
+        {
+            _Buffer[_Row[_Choice() >> _Shift]++] = std::move(_Begin[_I]);
+        }
+    });
+
+    // Shuffle each bucket on its own stream and move it back into place.
+    parallel_for(size_t(0), _Buckets, [&](size_t _B)
+    {
+        size_t _First = _Bucket_begin[_B];
+        size_t _Count = _Bucket_begin[_B + 1] - _First;
+
+        _Engine _Local = _Eng.substream(_B + 1);
+        details::_Fisher_yates_shuffle(_Buffer.begin() + _First, _Count, _Local);
+        std::move(_Buffer.begin() + _First, _Buffer.begin() + _First + _Count, _Begin + _First);
+    });
+}
+
+namespace details
+{
+    // Buffers smaller than this are initialized serially; spreading them over the workers costs more than it saves.
+    const size_t _Parallel_init_min_bytes = 1024 * 1024;
+
+    // The granularity at which the operating system places memory on NUMA nodes.
+    const size_t _Numa_page_size = 4096;
+
+    // Returns true when the machine has more than one NUMA node (or processor package).
+    inline bool _Is_numa_system()
+    {
+        return Concurrency::GetProcessorNodeCount() > 1;
+    }
+
+    // Calls _Func(_Chunk, _First, _Last) in parallel for each of _Chunk_num contiguous chunks of [0, _Size). The chunks are laid out 
+    // the same way as the segments used by _Parallel_integer_radix_sort.
+    template<typename _Function>
+    inline void _Parallel_for_chunks(size_t _Size, size_t _Chunk_num, const _Function &_Func)
+    {
+        size_t _Step = _Size / _Chunk_num;
+        size_t _Remain = _Size % _Chunk_num;
+
+        Concurrency::parallel_for(static_cast<size_t>(0), _Chunk_num, [&](size_t _Chunk)
+        {
+            size_t _First = _Chunk * _Step + ((_Chunk < _Remain) ? _Chunk : _Remain);
+            size_t _Last = _First + _Step + ((_Chunk < _Remain) ? 1 : 0);
+            _Func(_Chunk, _First, _Last);
+        });
+    }
+
+    // Writes to every page in [_First, _Last) so that the pages are committed on the NUMA node of the calling thread.
+    inline void _Touch_pages(void *_First, void *_Last)
+    {
+        volatile char *_Page = static_cast<char *>(_First);
+        volatile char *_End = static_cast<char *>(_Last);
+        if (_Page == _End)
+        {
+            return;
+        }
+
+        for (; _Page < _End; _Page += _Numa_page_size)
+        {
+            *_Page = 0;
+        }
+        *(_End - 1) = 0;
+    }
+}
+
+/// <summary>
+///     This template function is semantically equivalent to <c>std::uninitialized_fill</c>, except that the elements are 
+///     constructed in parallel.
+/// </summary>
+/// <typeparam name="_Random_iterator">
+///     The iterator type of the uninitialized range, it requires the iterator category to be random_iterator.
+/// </typeparam>
+/// <typeparam name="_Type">
+///     The type of the value to be copied.
+/// </typeparam>
+/// <param name="_Begin">
+///     The position of the first element to be constructed.
+/// </param>
+/// <param name="_End">
+///     The position of the first element not to be constructed.
+/// </param>
+/// <param name="_Value">
+///     The value to copy into every element.
+/// </param>
+/// <remarks>
+///     The range is divided into one contiguous chunk per virtual processor. Besides being faster, this places the pages of 
+///     a freshly allocated range on the NUMA nodes of the workers that constructed them, so a later <c>parallel_for</c> over 
+///     the same range mostly accesses local memory.
+///     <para>If a constructor throws, the elements already constructed are destroyed and the exception is rethrown.</para>
+/// </remarks>
+/**/
+template<typename _Random_iterator, typename _Type>
+inline void parallel_uninitialized_fill(const _Random_iterator &_Begin, const _Random_iterator &_End, const _Type &_Value)
+{
+    typedef typename std::iterator_traits<_Random_iterator>::value_type _Value_type;
+
+    size_t _Size = _End - _Begin;
+    size_t _Core_num = Concurrency::CurrentScheduler::Get()->GetNumberOfVirtualProcessors();
+
+    if (_Size * sizeof(_Value_type) < details::_Parallel_init_min_bytes || _Core_num < 2)
+    {
+        std::uninitialized_fill(_Begin, _End, _Value);
+        return;
+    }
+
+    size_t _Chunk_num = (std::min)(_Core_num, _Size);
+    std::vector<char> _Is_constructed(_Chunk_num, 0);
+    try
+    {
+        details::_Parallel_for_chunks(_Size, _Chunk_num, [&](size_t _Chunk, size_t _First, size_t _Last)
+        {
+            std::uninitialized_fill(_Begin + _First, _Begin + _Last, _Value);
+            _Is_constructed[_Chunk] = 1;
+        });
+    }
+    catch (...)
+    {
+        // std::uninitialized_fill has already cleaned up the chunk that threw, and chunks that were canceled before they started 
+        // constructed nothing. Destroy the chunks that completed.
+        size_t _Step = _Size / _Chunk_num;
+        size_t _Remain = _Size % _Chunk_num;
+        for (size_t _Chunk = 0; _Chunk < _Chunk_num; ++_Chunk)
+        {
+            if (_Is_constructed[_Chunk])
+            {
+                size_t _First = _Chunk * _Step + ((_Chunk < _Remain) ? _Chunk : _Remain);
+                size_t _Last = _First + _Step + ((_Chunk < _Remain) ? 1 : 0);
+                for (size_t _I = _First; _I < _Last; ++_I)
+                {
+                    (&*(_Begin + _I))->~_Value_type();
+                }
+            }
+        }
+        throw;
+    }
+}
+
+namespace details
+{
+    // Ranges larger than this are written with non-temporal stores. They are assumed not to be read again soon, and 
+    // would otherwise evict everything else from the last level cache on their way to memory.
+    const size_t _Streaming_store_min_bytes = 8 * 1024 * 1024;
+
+    // Iterators whose elements are laid out contiguously in memory and can be written through a pointer.
+    template<typename _Iterator>
+    struct _Is_contiguous_iterator
+    {
+        static const bool value = false;
+    };
+
+    template<typename _Type>
+    struct _Is_contiguous_iterator<_Type *>
+    {
+        static const bool value = true;
+    };
+
+    template<typename _Myvec>
+    struct _Is_contiguous_iterator<std::_Vector_iterator<_Myvec>>
+    {
+        static const bool value = true;
+    };
+
+    // Writes elements [_Base, _Base + _Count) of a sequence to _Dest. The sequence is produced by _Produce(_Out, _Offset, _N) 
+    // which writes elements [_Offset, _Offset + _N) to _Out. Whole 16 byte aligned blocks are produced into a small buffer that
+    // stays in the L1 cache and then streamed to _Dest, bypassing the cache; the unaligned head and tail are written directly.
+    // _Dest must be aligned to sizeof(_Type), which must divide 16.
+    template<typename _Type, typename _Producer>
+    inline void _Streaming_store(_Type *_Dest, size_t _Base, size_t _Count, const _Producer &_Produce)
+    {
+        size_t _Head = ((16 - reinterpret_cast<size_t>(_Dest) % 16) % 16) / sizeof(_Type);
+        if (_Head > _Count)
+        {
+            _Head = _Count;
+        }
+
+        _Produce(_Dest, _Base, _Head);
+        size_t _Offset = _Head;
+
+#if defined(_M_IX86) || defined(_M_X64)
+        const size_t _Block_bytes = 1024;
+        const size_t _Block_count = _Block_bytes / sizeof(_Type);
+        __declspec(align(16)) char _Block[_Block_bytes];
+
+        while (_Count - _Offset >= _Block_count)
+        {
+            _Produce(reinterpret_cast<_Type *>(_Block), _Base + _Offset, _Block_count);
+
+            const __m128i *_In = reinterpret_cast<const __m128i *>(_Block);
+            __m128i *_Out = reinterpret_cast<__m128i *>(_Dest + _Offset);
+            for (size_t _I = 0; _I < _Block_bytes / sizeof(__m128i); ++_I)
+            {
+                _mm_stream_si128(_Out + _I, _mm_load_si128(_In + _I));
+            }
+            _Offset += _Block_count;
+        }
+
+        // Streaming stores are weakly ordered, make them visible before the task completes.
+        _mm_sfence();
+#endif
+
+        _Produce(_Dest + _Offset, _Base + _Offset, _Count - _Offset);
+    }
+
+    // Writes the chunk [_First, _Last) of the output range. This overload is used when the output cannot be streamed.
+    template<typename _Random_iterator, typename _Producer>
+    inline void _Store_chunk(const _Random_iterator &_Begin, size_t _First, size_t _Last, const _Producer &_Produce, bool, std::false_type)
+    {
+        _Produce(_Begin + _First, _First, _Last - _First);
+    }
+
+    template<typename _Random_iterator, typename _Producer>
+    inline void _Store_chunk(const _Random_iterator &_Begin, size_t _First, size_t _Last, const _Producer &_Produce, bool _Is_large, std::true_type)
+    {
+        typedef typename std::iterator_traits<_Random_iterator>::value_type _Value_type;
+
+        _Value_type *_Dest = &*(_Begin + _First);
+        if (_Is_large && reinterpret_cast<size_t>(_Dest) % sizeof(_Value_type) == 0)
+        {
+            _Streaming_store(_Dest, _First, _Last - _First, _Produce);
+        }
+        else
+        {
+            _Produce(_Begin + _First, _First, _Last - _First);
+        }
+    }
+
+    // Writes the output range [_Begin, _Begin + _Size) in one chunk per virtual processor. Large ranges of trivially assignable 
+    // elements in contiguous memory are written with streaming stores.
+    template<typename _Random_iterator, typename _Producer>
+    inline void _Parallel_store(const _Random_iterator &_Begin, size_t _Size, const _Producer &_Produce)
+    {
+        typedef typename std::iterator_traits<_Random_iterator>::value_type _Value_type;
+        typedef std::integral_constant<bool, _Is_contiguous_iterator<_Random_iterator>::value 
+            && std::has_trivial_assign<_Value_type>::value && (16 % sizeof(_Value_type) == 0)> _Can_stream;
+
+        size_t _Core_num = Concurrency::CurrentScheduler::Get()->GetNumberOfVirtualProcessors();
+
+        if (_Size * sizeof(_Value_type) < _Parallel_init_min_bytes || _Core_num < 2)
+        {
+            _Produce(_Begin, 0, _Size);
+            return;
+        }
+
+        bool _Is_large = _Size * sizeof(_Value_type) >= _Streaming_store_min_bytes;
+        _Parallel_for_chunks(_Size, (std::min)(_Core_num, _Size), [&](size_t, size_t _First, size_t _Last)
+        {
+            _Store_chunk(_Begin, _First, _Last, _Produce, _Is_large, _Can_stream());
+        });
+    }
+
+    // Producers for _Parallel_store. Plain loops are used rather than the STL algorithms to avoid the checked iterator 
+    // warnings on pointers.
+    template<typename _Type>
+    struct _Fill_producer
+    {
+        const _Type &_M_value;
+
+        _Fill_producer(const _Type &_Value) : _M_value(_Value) {}
+
+        template<typename _Output_iterator>
+        void operator()(_Output_iterator _Out, size_t, size_t _Count) const
+        {
+            for (size_t _I = 0; _I < _Count; ++_I)
+            {
+                _Out[_I] = _M_value;
+            }
+        }
+
+    private:
+        _Fill_producer const & operator=(_Fill_producer const&);
+    };
+
+    template<typename _Input_iterator>
+    struct _Copy_producer
+    {
+        _Input_iterator _M_source;
+
+        _Copy_producer(const _Input_iterator &_Source) : _M_source(_Source) {}
+
+        template<typename _Output_iterator>
+        void operator()(_Output_iterator _Out, size_t _Offset, size_t _Count) const
+        {
+            for (size_t _I = 0; _I < _Count; ++_I)
+            {
+                _Out[_I] = _M_source[_Offset + _I];
+            }
+        }
+    };
+
+    template<typename _Input_iterator>
+    struct _Move_producer
+    {
+        _Input_iterator _M_source;
+
+        _Move_producer(const _Input_iterator &_Source) : _M_source(_Source) {}
+
+        template<typename _Output_iterator>
+        void operator()(_Output_iterator _Out, size_t _Offset, size_t _Count) const
+        {
+            for (size_t _I = 0; _I < _Count; ++_I)
+            {
+                _Out[_I] = std::move(_M_source[_Offset + _I]);
+            }
+        }
+    };
+
+    template<typename _Type>
+    struct _Iota_producer
+    {
+        _Type _M_value;
+
+        _Iota_producer(const _Type &_Value) : _M_value(_Value) {}
+
+        template<typename _Output_iterator>
+        void operator()(_Output_iterator _Out, size_t _Offset, size_t _Count) const
+        {
+            if (_Count == 0)
+            {
+                return;
+            }
+
+            _Type _Current = static_cast<_Type>(_M_value + _Offset);
+            for (size_t _I = 0; _I < _Count; ++_I)
+            {
+                _Out[_I] = _Current;
+                ++_Current;
+            }
+        }
+    };
+}
+
+/// <summary>
+///     This template function is semantically equivalent to <c>std::fill</c>, except that the range is filled in parallel.
+/// </summary>
+/// <typeparam name="_Random_iterator">
+///     The iterator type of the range, it requires the iterator category to be random_iterator.
+/// </typeparam>
+/// <typeparam name="_Type">
+///     The type of the value to be assigned.
+/// </typeparam>
+/// <param name="_Begin">
+///     The position of the first element to be assigned.
+/// </param>
+/// <param name="_End">
+///     The position of the first element not to be assigned.
+/// </param>
+/// <param name="_Value">
+///     The value to assign to every element.
+/// </param>
+/// <remarks>
+///     The range is divided into one contiguous chunk per virtual processor. When the range is larger than the last level cache,
+///     is stored contiguously (a pointer or a <c>std::vector</c> iterator) and holds trivially assignable elements, the 
+///     elements are written with non-temporal stores so that the fill does not evict data that is in use.
+///     <para>Because each chunk is written by one worker, filling a newly allocated buffer this way also places its pages on the
+///     NUMA nodes of the workers that will later process it with <c>parallel_for</c>.</para>
+/// </remarks>
+/**/
+template<typename _Random_iterator, typename _Type>
+inline void parallel_fill(const _Random_iterator &_Begin, const _Random_iterator &_End, const _Type &_Value)
+{
+    details::_Parallel_store(_Begin, _End - _Begin, details::_Fill_producer<_Type>(_Value));
+}
+
+/// <summary>
+///     This template function is semantically equivalent to <c>std::copy</c>, except that the elements are copied in parallel.
+/// </summary>
+/// <typeparam name="_Input_iterator">
+///     The iterator type of the source range, it requires the iterator category to be random_iterator.
+/// </typeparam>
+/// <typeparam name="_Output_iterator">
+///     The iterator type of the destination range, it requires the iterator category to be random_iterator.
+/// </typeparam>
+/// <param name="_Begin">
+///     The position of the first element to be copied.
+/// </param>
+/// <param name="_End">
+///     The position of the first element not to be copied.
+/// </param>
+/// <param name="_Dest">
+///     The position of the first element of the destination range.
+/// </param>
+/// <returns>
+///     The position one past the last element written.
+/// </returns>
+/// <remarks>
+///     The source and destination ranges must not overlap. Large destinations are written with non-temporal stores under the same
+///     conditions as <c>parallel_fill</c>.
+/// </remarks>
+/**/
+template<typename _Input_iterator, typename _Output_iterator>
+inline _Output_iterator parallel_copy(const _Input_iterator &_Begin, const _Input_iterator &_End, const _Output_iterator &_Dest)
+{
+    size_t _Size = _End - _Begin;
+    details::_Parallel_store(_Dest, _Size, details::_Copy_producer<_Input_iterator>(_Begin));
+    return _Dest + _Size;
+}
+
+/// <summary>
+///     This template function is semantically equivalent to the range version of <c>std::move</c>, except that the elements are 
+///     moved in parallel.
+/// </summary>
+/// <typeparam name="_Input_iterator">
+///     The iterator type of the source range, it requires the iterator category to be random_iterator.
+/// </typeparam>
+/// <typeparam name="_Output_iterator">
+///     The iterator type of the destination range, it requires the iterator category to be random_iterator.
+/// </typeparam>
+/// <param name="_Begin">
+///     The position of the first element to be moved.
+/// </param>
+/// <param name="_End">
+///     The position of the first element not to be moved.
+/// </param>
+/// <param name="_Dest">
+///     The position of the first element of the destination range.
+/// </param>
+/// <returns>
+///     The position one past the last element written.
+/// </returns>
+/// <remarks>
+///     The source and destination ranges must not overlap. Large destinations are written with non-temporal stores under the same
+///     conditions as <c>parallel_fill</c>.
+/// </remarks>
+/**/
+template<typename _Input_iterator, typename _Output_iterator>
+inline _Output_iterator parallel_move(const _Input_iterator &_Begin, const _Input_iterator &_End, const _Output_iterator &_Dest)
+{
+    size_t _Size = _End - _Begin;
+    details::_Parallel_store(_Dest, _Size, details::_Move_producer<_Input_iterator>(_Begin));
+    return _Dest + _Size;
+}
+
+/// <summary>
+///     This template function fills a range with sequentially increasing values, starting with <c>_Value</c>, in parallel. It is 
+///     semantically equivalent to <c>std::iota</c>.
+/// </summary>
+/// <typeparam name="_Random_iterator">
+///     The iterator type of the range, it requires the iterator category to be random_iterator.
+/// </typeparam>
+/// <typeparam name="_Type">
+///     The type of the values. Each chunk computes its first value as <c>_Value + offset</c>, so the type must support addition
+///     of an unsigned integer, as arithmetic types, pointers and random access iterators do.
+/// </typeparam>
+/// <param name="_Begin">
+///     The position of the first element to be assigned.
+/// </param>
+/// <param name="_End">
+///     The position of the first element not to be assigned.
+/// </param>
+/// <param name="_Value">
+///     The value to assign to the first element.
+/// </param>
+/// <remarks>
+///     Large ranges are written with non-temporal stores under the same conditions as <c>parallel_fill</c>.
+/// </remarks>
+/**/
+template<typename _Random_iterator, typename _Type>
+inline void parallel_iota(const _Random_iterator &_Begin, const _Random_iterator &_End, const _Type &_Value)
+{
+    details::_Parallel_store(_Begin, _End - _Begin, details::_Iota_producer<_Type>(_Value));
+}
+
 #pragma push_macro("_MAX_NUM_TASKS_PER_CORE")
 #pragma push_macro("_FINE_GRAIN_CHUNK_SIZE")
 #pragma push_macro("_SORT_MAX_RECURSION_DEPTH")
@@ -2159,12 +2799,39 @@ inline bool _Parallel_buffered_sort_impl(const _Random_iterator &_Begin, size_t
 #pragma warning (push)
 #pragma warning (disable: 4127)
 
-// Allocate and construct a buffer
+// Allocate and construct a buffer. 
+//
+// The algorithm using the buffer will work on it in _Chunk_num contiguous chunks, one chunk per task. On a NUMA machine 
+// a large buffer is first touched in parallel using the same chunks, so that the pages of each chunk are placed on the 
+// node of a worker rather than all on the node of the calling thread. On a single node machine, or when _Chunk_num is 1,
+// the buffer is prepared serially as before.
 template<typename _Allocator>
-inline typename _Allocator::pointer _Construct_buffer(size_t _N, _Allocator &_Alloc)
+inline typename _Allocator::pointer _Construct_buffer(size_t _N, _Allocator &_Alloc, size_t _Chunk_num = 1)
 {
     typename _Allocator::pointer _P = _Alloc.allocate(_N);
 
+    if (_Chunk_num > 1 && _N >= _Chunk_num && _N * sizeof(typename _Allocator::value_type) >= details::_Parallel_init_min_bytes 
+        && details::_Is_numa_system())
+    {
+        details::_Parallel_for_chunks(_N, _Chunk_num, [&](size_t, size_t _First, size_t _Last)
+        {
+            if (std::has_trivial_default_constructor<typename _Allocator::value_type>::value)
+            {
+                details::_Touch_pages(_P + _First, _P + _Last);
+            }
+            else
+            {
+                for (size_t _I = _First; _I < _Last; _I++)
+                {
+                    _Allocator::value_type _T;
+                    _Alloc.construct(_P + _I, std::forward<_Allocator::value_type>(_T));
+                }
+            }
+        });
+
+        return _P;
+    }
+
     // If the objects being sorted have trivial default constructors, they do not need to be 
     // constructed here. This can benefit performance.
     if (!std::has_trivial_default_constructor<typename _Allocator::value_type>::value)
@@ -2205,11 +2872,11 @@ template<typename _Allocator>
 class _AllocatedBufferHolder
 {
 public:
-    _AllocatedBufferHolder(size_t _Size, _Allocator _Alloc)
+    _AllocatedBufferHolder(size_t _Size, _Allocator _Alloc, size_t _Chunk_num = 1)
     {
         _M_size = _Size;
         _M_alloc = _Alloc;
-        _M_buffer = _Construct_buffer(_Size, _Alloc);
+        _M_buffer = _Construct_buffer(_Size, _Alloc, _Chunk_num);
     }
 
     ~_AllocatedBufferHolder()
@@ -2522,9 +3189,18 @@ inline void parallel_buffered_sort(const _Random_iterator &_Begin, const _Random
         return std::sort(_Begin, _End, _Func);
     }
     const static size_t CORE_NUM_MASK = 0x55555555;
+    size_t _Div_num = _Core_num & CORE_NUM_MASK | _Core_num << 1 & CORE_NUM_MASK;
+
+    // The buffer is halved until the division number reaches one, so the chunks sorted by each task number the 
+    // highest bit of _Div_num. Construct the buffer with the same chunks.
+    size_t _Leaf_num = 1;
+    while (_Leaf_num <= _Div_num / 2)
+    {
+        _Leaf_num <<= 1;
+    }
 
     _Allocator _Alloc;
-    _AllocatedBufferHolder<_Allocator> _Holder(_Size, _Alloc);
+    _AllocatedBufferHolder<_Allocator> _Holder(_Size, _Alloc, _Leaf_num);
 
     // This buffered sort algorithm will divide chunks and apply parallel quicksort on each chunk. In the end, it will 
     // apply parallel merge to these sorted chunks.
@@ -2561,7 +3237,7 @@ inline void parallel_buffered_sort(const _Random_iterator &_Begin, const _Random
     // mask bin(... 0101 0101 0101) We don't care about the other bits on the aligned result except the highest bit, since they 
     // will be ignored in the function.
     _Parallel_buffered_sort_impl(_Begin, _Size, stdext::make_unchecked_array_iterator(_Holder._Get_buffer()), 
-        _Func, _Core_num & CORE_NUM_MASK | _Core_num << 1 & CORE_NUM_MASK, _Chunk_size);
+        _Func, static_cast<int>(_Div_num), _Chunk_size);
 }
 
 #pragma warning(push)
@@ -2817,8 +3493,10 @@ inline void parallel_radixsort(const _Random_iterator &_Begin, const _Random_ite
         return;
     }
 
+    // The first pass of the radix sort scans one segment of the input per virtual processor, construct the buffer
+    // with the same segments.
     _Allocator _Alloc;
-    _AllocatedBufferHolder<_Allocator> _Holder(_Size, _Alloc);
+    _AllocatedBufferHolder<_Allocator> _Holder(_Size, _Alloc, Concurrency::CurrentScheduler::Get()->GetNumberOfVirtualProcessors());
 
     _Parallel_integer_sort_asc(_Begin, _Size, stdext::make_unchecked_array_iterator(_Holder._Get_buffer()), _Proj_func, _Chunk_size);
 }
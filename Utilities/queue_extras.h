@@ -0,0 +1,322 @@
+//--------------------------------------------------------------------------
+//
+//  Copyright (c) Microsoft Corporation.  All rights reserved.
+//
+//  File: queue_extras.h
+//
+//  Implementation of a portable bounded multi-producer, multi-consumer queue.
+//
+//--------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include "sync_extras.h"
+
+namespace Concurrency
+{
+namespace samples
+{
+/// <summary>
+///     A bounded first in, first out queue that any number of threads can push to and pop from at the same time
+///     without taking a lock. It is the array based queue of Dmitry Vyukov: every slot of a ring buffer carries a
+///     sequence number that tells producers and consumers whether the slot is free or full in the current lap.
+/// </summary>
+/// <remarks>
+///     <c>try_push</c> and <c>try_pop</c> never block; they fail when the queue is full or empty. <c>push</c>
+///     and <c>pop</c> spin briefly and then park the calling thread on a futex (WaitOnAddress on Windows 8 and
+///     later) until the other side makes progress. Producers and consumers only make a system call to wake a
+///     thread when one is actually parked.
+///     <para>The capacity is rounded up to a power of two. Elements may be move only.</para>
+///     <para>Batch operations move a run of elements with one wake up of parked threads at the end. Elements of
+///     a batch are still claimed one slot at a time, so other threads' elements can be interleaved with them.</para>
+/// </remarks>
+/**/
+template<typename _Ty>
+class bounded_queue
+{
+public:
+    typedef _Ty value_type;
+    typedef size_t size_type;
+
+    explicit bounded_queue(size_type _Capacity)
+    {
+        if (_Capacity == 0)
+        {
+            throw std::invalid_argument("_Capacity");
+        }
+
+        size_type _Size = 1;
+        while (_Size < _Capacity)
+        {
+            _Size <<= 1;
+        }
+
+        _M_mask = _Size - 1;
+        _M_cells = static_cast<_Cell *>(::operator new(_Size * sizeof(_Cell)));
+        for (size_type _I = 0; _I < _Size; ++_I)
+        {
+            new (&_M_cells[_I]) _Cell(_I);
+        }
+        _M_enqueue_pos.store(0, std::memory_order_relaxed);
+        _M_dequeue_pos.store(0, std::memory_order_relaxed);
+    }
+
+    ~bounded_queue()
+    {
+        size_type _Last = _M_enqueue_pos.load(std::memory_order_relaxed);
+        for (size_type _Pos = _M_dequeue_pos.load(std::memory_order_relaxed); _Pos != _Last; ++_Pos)
+        {
+            _M_cells[_Pos & _M_mask]._Item()->~_Ty();
+        }
+
+        for (size_type _I = 0; _I <= _M_mask; ++_I)
+        {
+            _M_cells[_I].~_Cell();
+        }
+        ::operator delete(_M_cells);
+    }
+
+    size_type capacity() const
+    {
+        return _M_mask + 1;
+    }
+
+    /// <summary>
+    ///     Returns the number of elements in the queue. The value is only a snapshot while other threads use
+    ///     the queue.
+    /// </summary>
+    size_type unsafe_size() const
+    {
+        size_type _Enqueued = _M_enqueue_pos.load(std::memory_order_relaxed);
+        size_type _Dequeued = _M_dequeue_pos.load(std::memory_order_relaxed);
+        return (_Enqueued > _Dequeued) ? _Enqueued - _Dequeued : 0;
+    }
+
+    bool empty() const
+    {
+        return unsafe_size() == 0;
+    }
+
+    bool try_push(const _Ty& _Item)
+    {
+        if (!_Try_push(_Item))
+        {
+            return false;
+        }
+        _M_not_empty._Notify(false);
+        return true;
+    }
+
+    bool try_push(_Ty&& _Item)
+    {
+        if (!_Try_push(std::move(_Item)))
+        {
+            return false;
+        }
+        _M_not_empty._Notify(false);
+        return true;
+    }
+
+    bool try_pop(_Ty& _Item)
+    {
+        if (!_Try_pop(_Item))
+        {
+            return false;
+        }
+        _M_not_full._Notify(false);
+        return true;
+    }
+
+    /// <summary>
+    ///     Pushes an element, waiting while the queue is full.
+    /// </summary>
+    void push(const _Ty& _Item)
+    {
+        details::_Spin_then_wait(_M_not_full, [this, &_Item]() { return _Try_push(_Item); });
+        _M_not_empty._Notify(false);
+    }
+
+    void push(_Ty&& _Item)
+    {
+        details::_Spin_then_wait(_M_not_full, [this, &_Item]() { return _Try_push(std::move(_Item)); });
+        _M_not_empty._Notify(false);
+    }
+
+    /// <summary>
+    ///     Pops an element, waiting while the queue is empty.
+    /// </summary>
+    void pop(_Ty& _Item)
+    {
+        details::_Spin_then_wait(_M_not_empty, [this, &_Item]() { return _Try_pop(_Item); });
+        _M_not_full._Notify(false);
+    }
+
+    /// <summary>
+    ///     Pushes elements from <c>[_First, _Last)</c> until the range is exhausted or the queue is full.
+    /// </summary>
+    /// <returns>An iterator to the first element that was not pushed.</returns>
+    template<typename _Input_iterator>
+    _Input_iterator try_push_batch(_Input_iterator _First, _Input_iterator _Last)
+    {
+        size_type _Count = 0;
+        for (; _First != _Last && _Try_push(*_First); ++_First)
+        {
+            ++_Count;
+        }
+        if (_Count != 0)
+        {
+            _M_not_empty._Notify(_Count > 1);
+        }
+        return _First;
+    }
+
+    /// <summary>
+    ///     Pops up to <c>_Max_count</c> elements into <c>_Out</c> without waiting.
+    /// </summary>
+    /// <returns>The number of elements popped.</returns>
+    /// <remarks>
+    ///     <c>_Ty</c> must be default constructible.
+    /// </remarks>
+    template<typename _Output_iterator>
+    size_type try_pop_batch(_Output_iterator _Out, size_type _Max_count)
+    {
+        size_type _Count = 0;
+        _Ty _Item;
+        while (_Count < _Max_count && _Try_pop(_Item))
+        {
+            *_Out = std::move(_Item);
+            ++_Out;
+            ++_Count;
+        }
+        if (_Count != 0)
+        {
+            _M_not_full._Notify(_Count > 1);
+        }
+        return _Count;
+    }
+
+    /// <summary>
+    ///     Pops between one and <c>_Max_count</c> elements into <c>_Out</c>, waiting while the queue is empty.
+    /// </summary>
+    /// <returns>The number of elements popped, which is zero only when <c>_Max_count</c> is zero.</returns>
+    /// <remarks>
+    ///     <c>_Ty</c> must be default constructible.
+    /// </remarks>
+    template<typename _Output_iterator>
+    size_type pop_batch(_Output_iterator _Out, size_type _Max_count)
+    {
+        if (_Max_count == 0)
+        {
+            return 0;
+        }
+        _Ty _Item;
+        pop(_Item);
+        *_Out = std::move(_Item);
+        ++_Out;
+        return 1 + try_pop_batch(_Out, _Max_count - 1);
+    }
+
+private:
+    struct _Cell
+    {
+        std::atomic<size_type> _M_sequence;
+        typename std::aligned_storage<sizeof(_Ty), std::alignment_of<_Ty>::value>::type _M_storage;
+
+        explicit _Cell(size_type _Sequence)
+        {
+            _M_sequence.store(_Sequence, std::memory_order_relaxed);
+        }
+
+        _Ty *_Item()
+        {
+            return reinterpret_cast<_Ty *>(&_M_storage);
+        }
+    };
+
+    // A slot at position _Pos is free for the producer of lap _Pos / capacity when its sequence is _Pos, and
+    // holds an element for the consumer of that lap when its sequence is _Pos + 1.
+    template<typename _Arg>
+    bool _Try_push(_Arg&& _Item)
+    {
+        size_type _Pos = _M_enqueue_pos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            _Cell &_Slot = _M_cells[_Pos & _M_mask];
+            size_type _Sequence = _Slot._M_sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t _Diff = static_cast<std::ptrdiff_t>(_Sequence - _Pos);
+            if (_Diff == 0)
+            {
+                if (_M_enqueue_pos.compare_exchange_weak(_Pos, _Pos + 1, std::memory_order_relaxed))
+                {
+                    new (_Slot._Item()) _Ty(std::forward<_Arg>(_Item));
+                    _Slot._M_sequence.store(_Pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (_Diff < 0)
+            {
+                // The slot still holds the element of the previous lap: the queue is full.
+                return false;
+            }
+            else
+            {
+                _Pos = _M_enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool _Try_pop(_Ty& _Item)
+    {
+        size_type _Pos = _M_dequeue_pos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            _Cell &_Slot = _M_cells[_Pos & _M_mask];
+            size_type _Sequence = _Slot._M_sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t _Diff = static_cast<std::ptrdiff_t>(_Sequence - (_Pos + 1));
+            if (_Diff == 0)
+            {
+                if (_M_dequeue_pos.compare_exchange_weak(_Pos, _Pos + 1, std::memory_order_relaxed))
+                {
+                    _Ty *_Stored = _Slot._Item();
+                    _Item = std::move(*_Stored);
+                    _Stored->~_Ty();
+                    _Slot._M_sequence.store(_Pos + _M_mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (_Diff < 0)
+            {
+                // The slot has not been filled in this lap: the queue is empty.
+                return false;
+            }
+            else
+            {
+                _Pos = _M_dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // The positions are on separate cache lines from each other and from the read-mostly fields, so that
+    // producers and consumers do not invalidate each other's lines.
+    char _M_padding0[64];
+    _Cell *_M_cells;
+    size_type _M_mask;
+    char _M_padding1[64];
+    std::atomic<size_type> _M_enqueue_pos;
+    char _M_padding2[64];
+    std::atomic<size_type> _M_dequeue_pos;
+    char _M_padding3[64];
+    details::_Event_count _M_not_full;
+    details::_Event_count _M_not_empty;
+
+    bounded_queue(const bounded_queue&);
+    bounded_queue const & operator=(bounded_queue const&);
+};
+} // namespace samples
+} // namespace Concurrency
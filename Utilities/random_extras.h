@@ -0,0 +1,309 @@
+//--------------------------------------------------------------------------
+//
+//  Copyright (c) Microsoft Corporation.  All rights reserved.
+//
+//  File: random_extras.h
+//
+//  Implementation of counter-based random number engines.
+//
+//--------------------------------------------------------------------------
+
+#pragma once
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace Concurrency
+{
+namespace samples
+{
+/// <summary>
+///     A counter-based random number engine implementing the Philox4x32-10 generator of Salmon et al,
+///     "Parallel Random Numbers: As Easy as 1, 2, 3". Each output block is a pure function of a 64 bit key
+///     (the seed), a 64 bit stream number and a 64 bit block counter, so any position in any stream can be
+///     reached in constant time.
+/// </summary>
+/// <remarks>
+///     The engine satisfies the requirements of a uniform random number generator and can be used with the
+///     distributions in the &lt;random&gt; header.
+///     <para>Because there is no sequential state, parallel algorithms can give each element, chunk or task its
+///     own stream with <c>substream</c> or jump ahead with <c>discard</c> and still produce exactly the same
+///     values as a serial run, independent of the number of threads taking part.</para>
+/// </remarks>
+/**/
+class philox4x32
+{
+public:
+    typedef unsigned int result_type;
+
+    static const unsigned long long default_seed = 20111101ULL;
+
+    explicit philox4x32(unsigned long long _Seed = default_seed, unsigned long long _Stream = 0)
+    {
+        seed(_Seed, _Stream);
+    }
+
+    /// <summary>
+    ///     Rekeys the engine and rewinds it to the start of the given stream.
+    /// </summary>
+    void seed(unsigned long long _Seed = default_seed, unsigned long long _Stream = 0)
+    {
+        _M_key[0] = static_cast<unsigned int>(_Seed);
+        _M_key[1] = static_cast<unsigned int>(_Seed >> 32);
+        _M_stream = _Stream;
+        _M_counter = 0;
+        _M_index = _Block_size;
+    }
+
+    /// <summary>
+    ///     Returns an engine with the same key positioned at the start of stream <c>_Stream</c>. Streams
+    ///     with different numbers never overlap.
+    /// </summary>
+    philox4x32 substream(unsigned long long _Stream) const
+    {
+        philox4x32 _Result(*this);
+        _Result._M_stream = _Stream;
+        _Result._M_counter = 0;
+        _Result._M_index = _Block_size;
+        return _Result;
+    }
+
+    /// <summary>
+    ///     Advances the engine by <c>_Count</c> values in constant time.
+    /// </summary>
+    void discard(unsigned long long _Count)
+    {
+        unsigned long long _Position = position() + _Count;
+        _M_counter = _Position / _Block_size;
+        _M_index = static_cast<unsigned int>(_Position % _Block_size);
+        if (_M_index != 0)
+        {
+            _Generate_block(_M_counter++);
+        }
+        else
+        {
+            _M_index = _Block_size;
+        }
+    }
+
+    /// <summary>
+    ///     Returns the number of values already drawn from the current stream.
+    /// </summary>
+    unsigned long long position() const
+    {
+        return (_M_index == _Block_size) ? _M_counter * _Block_size : (_M_counter - 1) * _Block_size + _M_index;
+    }
+
+    unsigned long long stream() const { return _M_stream; }
+
+    result_type operator()()
+    {
+        if (_M_index == _Block_size)
+        {
+            _Generate_block(_M_counter++);
+            _M_index = 0;
+        }
+        return _M_output[_M_index++];
+    }
+
+    /// <summary>
+    ///     Stores the next <c>_Last - _First</c> values of the stream in <c>[_First, _Last)</c>, the same values
+    ///     as that many calls of the engine, without checking for the end of a block for every value. With
+    ///     SSE2 four blocks are computed at once.
+    /// </summary>
+    void generate(result_type* _First, result_type* _Last)
+    {
+        while (_First != _Last && _M_index != _Block_size)
+        {
+            *_First++ = _M_output[_M_index++];
+        }
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+        while (static_cast<size_t>(_Last - _First) >= 4 * _Block_size)
+        {
+            _Generate_four_blocks(_M_counter, _First);
+            _M_counter += 4;
+            _First += 4 * _Block_size;
+        }
+#endif
+        while (static_cast<size_t>(_Last - _First) >= _Block_size)
+        {
+            _Generate_block(_M_counter++);
+            _First[0] = _M_output[0];
+            _First[1] = _M_output[1];
+            _First[2] = _M_output[2];
+            _First[3] = _M_output[3];
+            _First += _Block_size;
+        }
+        if (_First != _Last)
+        {
+            _Generate_block(_M_counter++);
+            _M_index = 0;
+            while (_First != _Last)
+            {
+                *_First++ = _M_output[_M_index++];
+            }
+        }
+    }
+
+    static result_type (min)() { return 0; }
+
+    static result_type (max)() { return 0xFFFFFFFFU; }
+
+    bool operator==(const philox4x32& _Other) const
+    {
+        return _M_key[0] == _Other._M_key[0] && _M_key[1] == _Other._M_key[1] &&
+            _M_stream == _Other._M_stream && position() == _Other.position();
+    }
+
+    bool operator!=(const philox4x32& _Other) const { return !(*this == _Other); }
+
+private:
+    static const unsigned int _Block_size = 4;
+    static const unsigned int _Rounds = 10;
+
+    // Compute one block of four outputs for block number _Block of the current stream.
+    void _Generate_block(unsigned long long _Block)
+    {
+        unsigned int _Ctr[4] =
+        {
+            static_cast<unsigned int>(_Block), static_cast<unsigned int>(_Block >> 32),
+            static_cast<unsigned int>(_M_stream), static_cast<unsigned int>(_M_stream >> 32)
+        };
+        unsigned int _Key[2] = { _M_key[0], _M_key[1] };
+
+        for (unsigned int _R = 0; _R < _Rounds; ++_R)
+        {
+            if (_R > 0)
+            {
+                _Key[0] += 0x9E3779B9U;
+                _Key[1] += 0xBB67AE85U;
+            }
+
+            unsigned long long _Product0 = 0xD2511F53ULL * _Ctr[0];
+            unsigned long long _Product1 = 0xCD9E8D57ULL * _Ctr[2];
+
+            unsigned int _Hi0 = static_cast<unsigned int>(_Product0 >> 32);
+            unsigned int _Lo0 = static_cast<unsigned int>(_Product0);
+            unsigned int _Hi1 = static_cast<unsigned int>(_Product1 >> 32);
+            unsigned int _Lo1 = static_cast<unsigned int>(_Product1);
+
+            _Ctr[0] = _Hi1 ^ _Ctr[1] ^ _Key[0];
+            _Ctr[1] = _Lo1;
+            _Ctr[2] = _Hi0 ^ _Ctr[3] ^ _Key[1];
+            _Ctr[3] = _Lo0;
+        }
+
+        _M_output[0] = _Ctr[0];
+        _M_output[1] = _Ctr[1];
+        _M_output[2] = _Ctr[2];
+        _M_output[3] = _Ctr[3];
+    }
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+    // Returns the low and the high 32 bits of the products of the four lanes of _Value with _Multiplier.
+    static void _Multiply_four(__m128i _Value, __m128i _Multiplier, __m128i& _Low, __m128i& _High)
+    {
+        // _mm_mul_epu32 multiplies lanes 0 and 2; the shifted copy brings lanes 1 and 3 into their place.
+        __m128i _Even = _mm_shuffle_epi32(_mm_mul_epu32(_Value, _Multiplier), _MM_SHUFFLE(3, 1, 2, 0));
+        __m128i _Odd = _mm_shuffle_epi32(_mm_mul_epu32(_mm_srli_epi64(_Value, 32), _Multiplier), _MM_SHUFFLE(3, 1, 2, 0));
+        _Low = _mm_unpacklo_epi32(_Even, _Odd);
+        _High = _mm_unpackhi_epi32(_Even, _Odd);
+    }
+
+    // Compute blocks _Block to _Block + 3 of the current stream, one block in each lane, into _Dest.
+    void _Generate_four_blocks(unsigned long long _Block, result_type* _Dest) const
+    {
+        __m128i _Ctr0 = _mm_setr_epi32(static_cast<int>(_Block), static_cast<int>(_Block + 1),
+            static_cast<int>(_Block + 2), static_cast<int>(_Block + 3));
+        __m128i _Ctr1 = _mm_setr_epi32(static_cast<int>(_Block >> 32), static_cast<int>((_Block + 1) >> 32),
+            static_cast<int>((_Block + 2) >> 32), static_cast<int>((_Block + 3) >> 32));
+        __m128i _Ctr2 = _mm_set1_epi32(static_cast<int>(_M_stream));
+        __m128i _Ctr3 = _mm_set1_epi32(static_cast<int>(_M_stream >> 32));
+        const __m128i _Multiplier0 = _mm_set1_epi32(static_cast<int>(0xD2511F53U));
+        const __m128i _Multiplier1 = _mm_set1_epi32(static_cast<int>(0xCD9E8D57U));
+        unsigned int _Key[2] = { _M_key[0], _M_key[1] };
+
+        for (unsigned int _R = 0; _R < _Rounds; ++_R)
+        {
+            if (_R > 0)
+            {
+                _Key[0] += 0x9E3779B9U;
+                _Key[1] += 0xBB67AE85U;
+            }
+
+            __m128i _Lo0, _Hi0, _Lo1, _Hi1;
+            _Multiply_four(_Ctr0, _Multiplier0, _Lo0, _Hi0);
+            _Multiply_four(_Ctr2, _Multiplier1, _Lo1, _Hi1);
+
+            _Ctr0 = _mm_xor_si128(_mm_xor_si128(_Hi1, _Ctr1), _mm_set1_epi32(static_cast<int>(_Key[0])));
+            _Ctr1 = _Lo1;
+            _Ctr2 = _mm_xor_si128(_mm_xor_si128(_Hi0, _Ctr3), _mm_set1_epi32(static_cast<int>(_Key[1])));
+            _Ctr3 = _Lo0;
+        }
+
+        // Transpose, so that each block's four words are stored together.
+        __m128i _T0 = _mm_unpacklo_epi32(_Ctr0, _Ctr1);
+        __m128i _T1 = _mm_unpacklo_epi32(_Ctr2, _Ctr3);
+        __m128i _T2 = _mm_unpackhi_epi32(_Ctr0, _Ctr1);
+        __m128i _T3 = _mm_unpackhi_epi32(_Ctr2, _Ctr3);
+        __m128i* _Out = reinterpret_cast<__m128i*>(_Dest);
+        _mm_storeu_si128(_Out, _mm_unpacklo_epi64(_T0, _T1));
+        _mm_storeu_si128(_Out + 1, _mm_unpackhi_epi64(_T0, _T1));
+        _mm_storeu_si128(_Out + 2, _mm_unpacklo_epi64(_T2, _T3));
+        _mm_storeu_si128(_Out + 3, _mm_unpackhi_epi64(_T2, _T3));
+    }
+#endif
+
+    unsigned int _M_key[2];
+    unsigned long long _M_stream;
+    // Number of the next block to generate.
+    unsigned long long _M_counter;
+    unsigned int _M_output[_Block_size];
+    // Index of the next unused value in _M_output, _Block_size when the buffer is exhausted.
+    unsigned int _M_index;
+};
+
+namespace details
+{
+    // Returns an unbiased value in [0, _Bound) using Lemire's multiply and reject method.
+    template<typename _Engine>
+    inline unsigned int _Random_bounded(_Engine& _Eng, unsigned int _Bound)
+    {
+        unsigned long long _Product = static_cast<unsigned long long>(_Eng()) * _Bound;
+        unsigned int _Low = static_cast<unsigned int>(_Product);
+        if (_Low < _Bound)
+        {
+            unsigned int _Threshold = (0U - _Bound) % _Bound;
+            while (_Low < _Threshold)
+            {
+                _Product = static_cast<unsigned long long>(_Eng()) * _Bound;
+                _Low = static_cast<unsigned int>(_Product);
+            }
+        }
+        return static_cast<unsigned int>(_Product >> 32);
+    }
+
+    // Returns an unbiased value in [0, _Bound) for bounds that may exceed 32 bits.
+    template<typename _Engine>
+    inline size_t _Random_index(_Engine& _Eng, size_t _Bound)
+    {
+        if (_Bound <= 0xFFFFFFFFU)
+        {
+            return _Random_bounded(_Eng, static_cast<unsigned int>(_Bound));
+        }
+
+        // Rare case, only reachable on 64 bit platforms: rejection sample from a 64 bit value.
+        unsigned long long _Range = static_cast<unsigned long long>(_Bound);
+        unsigned long long _Limit = (0ULL - _Range) % _Range;
+        unsigned long long _Value;
+        do
+        {
+            _Value = (static_cast<unsigned long long>(_Eng()) << 32) | _Eng();
+        }
+        while (_Value < _Limit);
+        return static_cast<size_t>(_Value % _Range);
+    }
+}
+} // namespace samples
+} // namespace Concurrency
@@ -0,0 +1,252 @@
+//--------------------------------------------------------------------------
+//
+//  Copyright (c) Microsoft Corporation.  All rights reserved.
+//
+//  File: sync_extras.h
+//
+//  Implementation of address-based waiting and of a counting semaphore
+//  built on it.
+//
+//--------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define _SYNC_FUTEX
+#elif defined(_WIN32) && defined(_WIN32_WINNT) && (_WIN32_WINNT >= 0x0602)
+#include <windows.h>
+#pragma comment(lib, "Synchronization.lib")
+#define _SYNC_WAIT_ON_ADDRESS
+#endif
+
+namespace Concurrency
+{
+namespace samples
+{
+namespace details
+{
+    // A 32 bit word that threads can wait on until its value changes, a futex on Linux and WaitOnAddress on
+    // Windows 8 and later. Elsewhere waiters sleep on one of a fixed set of condition variables chosen by address.
+    typedef std::atomic<unsigned int> _Wait_word;
+
+#if !defined(_SYNC_FUTEX) && !defined(_SYNC_WAIT_ON_ADDRESS)
+    struct _Wait_bucket
+    {
+        std::mutex _M_lock;
+        std::condition_variable _M_changed;
+    };
+
+    inline _Wait_bucket &_Wait_bucket_for(const volatile void *_Address)
+    {
+        static _Wait_bucket _S_buckets[64];
+        return _S_buckets[(reinterpret_cast<size_t>(_Address) / sizeof(_Wait_word)) % 64];
+    }
+#endif
+
+    // Blocks while _Word holds _Expected. May return spuriously, callers re-check their condition.
+    inline void _Wait_on_address(_Wait_word &_Word, unsigned int _Expected)
+    {
+#if defined(_SYNC_FUTEX)
+        syscall(SYS_futex, reinterpret_cast<unsigned int *>(&_Word), FUTEX_WAIT_PRIVATE, _Expected, nullptr, nullptr, 0);
+#elif defined(_SYNC_WAIT_ON_ADDRESS)
+        WaitOnAddress(&_Word, &_Expected, sizeof(_Expected), INFINITE);
+#else
+        _Wait_bucket &_Bucket = _Wait_bucket_for(&_Word);
+        std::unique_lock<std::mutex> _Lock(_Bucket._M_lock);
+        if (_Word.load() == _Expected)
+        {
+            _Bucket._M_changed.wait(_Lock);
+        }
+#endif
+    }
+
+    // Wakes one thread, or all threads, waiting on _Word. Call after changing its value.
+    inline void _Wake_by_address(_Wait_word &_Word, bool _All)
+    {
+#if defined(_SYNC_FUTEX)
+        syscall(SYS_futex, reinterpret_cast<unsigned int *>(&_Word), FUTEX_WAKE_PRIVATE, _All ? 0x7FFFFFFF : 1, nullptr, nullptr, 0);
+#elif defined(_SYNC_WAIT_ON_ADDRESS)
+        if (_All)
+        {
+            WakeByAddressAll(&_Word);
+        }
+        else
+        {
+            WakeByAddressSingle(&_Word);
+        }
+#else
+        // Taking the lock orders the wake after a waiter that saw the old value has started waiting. Waiters on
+        // other words may share the bucket, so all are woken.
+        (void) _All;
+        _Wait_bucket &_Bucket = _Wait_bucket_for(&_Word);
+        std::lock_guard<std::mutex> _Lock(_Bucket._M_lock);
+        _Bucket._M_changed.notify_all();
+#endif
+    }
+
+    // The number of times a waiter polls before it parks.
+    const int _Spin_count = 100;
+
+    // An event count: lets threads wait for a condition that other threads make true without a lock around the
+    // condition. A waiter takes a key, re-checks the condition and waits only if the key is still current; a
+    // notifier changes the condition and then calls _Notify, which only makes a system call if someone waits.
+    class _Event_count
+    {
+    public:
+        _Event_count() : _M_epoch(0), _M_waiters(0)
+        {
+        }
+
+        unsigned int _Prepare_wait()
+        {
+            ++_M_waiters;
+            // Orders the increment before the caller's re-check of the condition.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            return _M_epoch.load();
+        }
+
+        void _Cancel_wait()
+        {
+            --_M_waiters;
+        }
+
+        void _Wait(unsigned int _Key)
+        {
+            while (_M_epoch.load() == _Key)
+            {
+                _Wait_on_address(_M_epoch, _Key);
+            }
+            --_M_waiters;
+        }
+
+        // A hint for callers that can defer a notification while nobody waits. Without the fence of _Notify it may
+        // miss a waiter that has only just arrived.
+        bool _Has_waiters() const
+        {
+            return _M_waiters.load(std::memory_order_relaxed) != 0;
+        }
+
+        void _Notify(bool _All)
+        {
+            // Orders the caller's change to the condition before the read of the waiter count.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (_M_waiters.load() != 0)
+            {
+                ++_M_epoch;
+                _Wake_by_address(_M_epoch, _All);
+            }
+        }
+
+    private:
+        _Wait_word _M_epoch;
+        std::atomic<int> _M_waiters;
+
+        _Event_count(const _Event_count&);
+        _Event_count const & operator=(_Event_count const&);
+    };
+
+    // Spins on _Try, then parks on _Event until _Try succeeds.
+    template<typename _Try_func>
+    inline void _Spin_then_wait(_Event_count &_Event, _Try_func _Try)
+    {
+        for (int _I = 0; _I < _Spin_count; ++_I)
+        {
+            if (_Try())
+            {
+                return;
+            }
+            if (_I > _Spin_count / 2)
+            {
+                std::this_thread::yield();
+            }
+        }
+
+        for (;;)
+        {
+            unsigned int _Key = _Event._Prepare_wait();
+            if (_Try())
+            {
+                _Event._Cancel_wait();
+                return;
+            }
+            _Event._Wait(_Key);
+            if (_Try())
+            {
+                return;
+            }
+        }
+    }
+}
+
+/// <summary>
+///     A counting semaphore built on an atomic counter. Acquiring a unit that is available is a single
+///     compare-and-swap; a thread that has to wait spins briefly and then parks on a futex (WaitOnAddress on
+///     Windows 8 and later).
+/// </summary>
+/// <remarks>
+///     <c>acquire</c> and <c>release</c> take a count, and a multi-unit acquire takes all of its units at once,
+///     so callers waiting for different counts cannot starve each other by holding part of what they need.
+/// </remarks>
+/**/
+class counting_semaphore
+{
+public:
+    explicit counting_semaphore(int _Initial_count = 0) : _M_count(_Initial_count)
+    {
+    }
+
+    bool try_acquire(int _Units = 1)
+    {
+        int _Count = _M_count.load(std::memory_order_relaxed);
+        while (_Count >= _Units)
+        {
+            if (_M_count.compare_exchange_weak(_Count, _Count - _Units, std::memory_order_acquire))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void acquire(int _Units = 1)
+    {
+        if (!try_acquire(_Units))
+        {
+            details::_Spin_then_wait(_M_available, [this, _Units]() { return try_acquire(_Units); });
+        }
+    }
+
+    void release(int _Units = 1)
+    {
+        _M_count.fetch_add(_Units, std::memory_order_release);
+        // Waiters may want different counts, so all of them re-check.
+        _M_available._Notify(true);
+    }
+
+    /// <summary>
+    ///     Returns the number of available units. The value is only a snapshot while other threads use
+    ///     the semaphore.
+    /// </summary>
+    int unsafe_count() const
+    {
+        return _M_count.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<int> _M_count;
+    details::_Event_count _M_available;
+
+    counting_semaphore(const counting_semaphore&);
+    counting_semaphore const & operator=(counting_semaphore const&);
+};
+} // namespace samples
+} // namespace Concurrency
@@ -0,0 +1,463 @@
+//--------------------------------------------------------------------------
+//
+//  Copyright (c) Microsoft Corporation.  All rights reserved.
+//
+//  File: telemetry_extras.h
+//
+//  Implementation of log-bucketed histograms and of per-stage pipeline
+//  telemetry recorded into per-thread buffers.
+//
+//--------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(_MSC_VER) && (_MSC_VER < 1700)
+// <atomic> and <chrono> are not available. The counters of a log_histogram are plain integers, so it may only be
+// used on one thread, and pipeline_telemetry is left out.
+#define _TELEMETRY_NO_ATOMIC
+#else
+#include <atomic>
+#include <chrono>
+#endif
+
+namespace Concurrency
+{
+namespace samples
+{
+namespace details
+{
+    // Values below _Sub_bucket_count get a bucket each. Above that, every power of two is split into
+    // _Sub_bucket_count buckets, so a bucket is never wider than a sixteenth of the values in it.
+    const int _Sub_bucket_bits = 4;
+    const size_t _Sub_bucket_count = size_t(1) << _Sub_bucket_bits;
+    const size_t _Bucket_count = (64 - _Sub_bucket_bits + 1) * _Sub_bucket_count;
+
+    inline int _Floor_log2(unsigned long long _Value)
+    {
+#if defined(_MSC_VER) && defined(_M_X64)
+        unsigned long _Index;
+        _BitScanReverse64(&_Index, _Value);
+        return static_cast<int>(_Index);
+#elif defined(__GNUC__)
+        return 63 - __builtin_clzll(_Value);
+#else
+        int _Log = 0;
+        while (_Value >>= 1)
+        {
+            ++_Log;
+        }
+        return _Log;
+#endif
+    }
+
+    inline size_t _Bucket_of(unsigned long long _Value)
+    {
+        if (_Value < _Sub_bucket_count)
+        {
+            return static_cast<size_t>(_Value);
+        }
+        int _Shift = _Floor_log2(_Value) - _Sub_bucket_bits;
+        return (_Shift + 1) * _Sub_bucket_count + static_cast<size_t>((_Value >> _Shift) - _Sub_bucket_count);
+    }
+
+    // The highest value that falls into _Bucket.
+    inline unsigned long long _Bucket_high(size_t _Bucket)
+    {
+        if (_Bucket < _Sub_bucket_count)
+        {
+            return _Bucket;
+        }
+        int _Shift = static_cast<int>(_Bucket / _Sub_bucket_count) - 1;
+        unsigned long long _Low = static_cast<unsigned long long>(_Bucket % _Sub_bucket_count + _Sub_bucket_count) << _Shift;
+        return _Low + ((1ULL << _Shift) - 1);
+    }
+
+#if defined(_TELEMETRY_NO_ATOMIC)
+    typedef unsigned long long _Histogram_counter;
+
+    inline unsigned long long _Load_relaxed(const _Histogram_counter& _Counter)
+    {
+        return _Counter;
+    }
+
+    inline void _Store_relaxed(_Histogram_counter& _Counter, unsigned long long _Value)
+    {
+        _Counter = _Value;
+    }
+#else
+    typedef std::atomic<unsigned long long> _Histogram_counter;
+
+    inline unsigned long long _Load_relaxed(const _Histogram_counter& _Counter)
+    {
+        return _Counter.load(std::memory_order_relaxed);
+    }
+
+    inline void _Store_relaxed(_Histogram_counter& _Counter, unsigned long long _Value)
+    {
+        _Counter.store(_Value, std::memory_order_relaxed);
+    }
+#endif
+
+    // Only one thread writes a counter, so it is updated with a plain load and store, which other threads can
+    // read at any time, rather than with a locked read-modify-write.
+    inline void _Add_relaxed(_Histogram_counter& _Counter, unsigned long long _Value)
+    {
+        _Store_relaxed(_Counter, _Load_relaxed(_Counter) + _Value);
+    }
+}
+
+/// <summary>
+///     A histogram of non-negative integers, such as durations in nanoseconds or queue lengths, in the style of
+///     an HDR histogram: small values are counted exactly and larger ones in logarithmic buckets with a relative
+///     error of at most 1/16, over the full 64 bit range in a fixed 8K of counters.
+/// </summary>
+/// <remarks>
+///     Only one thread at a time may <c>record</c>, but any number of threads can read or <c>merge</c> the
+///     histogram while it does. Recording is wait free and uses no locked instructions. A reader sees each
+///     counter either before or after a concurrent update, so a snapshot can be off by the values recorded
+///     while it was taken. With Visual C++ 2010, which has no <c>std::atomic</c>, the histogram may only be
+///     used on one thread.
+/// </remarks>
+/**/
+class log_histogram
+{
+public:
+    log_histogram()
+    {
+        reset();
+    }
+
+    void record(unsigned long long _Value)
+    {
+        details::_Add_relaxed(_M_counts[details::_Bucket_of(_Value)], 1);
+        details::_Add_relaxed(_M_count, 1);
+        details::_Add_relaxed(_M_sum, _Value);
+        if (_Value > details::_Load_relaxed(_M_max))
+        {
+            details::_Store_relaxed(_M_max, _Value);
+        }
+    }
+
+    /// <summary>
+    ///     Adds the counts of <c>_Other</c> to this histogram. The calling thread must be the only one recording
+    ///     into this histogram.
+    /// </summary>
+    void merge(const log_histogram& _Other)
+    {
+        for (size_t _I = 0; _I < details::_Bucket_count; ++_I)
+        {
+            unsigned long long _Count = details::_Load_relaxed(_Other._M_counts[_I]);
+            if (_Count != 0)
+            {
+                details::_Add_relaxed(_M_counts[_I], _Count);
+            }
+        }
+        details::_Add_relaxed(_M_count, details::_Load_relaxed(_Other._M_count));
+        details::_Add_relaxed(_M_sum, details::_Load_relaxed(_Other._M_sum));
+        unsigned long long _Max = details::_Load_relaxed(_Other._M_max);
+        if (_Max > details::_Load_relaxed(_M_max))
+        {
+            details::_Store_relaxed(_M_max, _Max);
+        }
+    }
+
+    /// <summary>
+    ///     Clears the histogram. Not safe while another thread records.
+    /// </summary>
+    void reset()
+    {
+        for (size_t _I = 0; _I < details::_Bucket_count; ++_I)
+        {
+            details::_Store_relaxed(_M_counts[_I], 0);
+        }
+        details::_Store_relaxed(_M_count, 0);
+        details::_Store_relaxed(_M_sum, 0);
+        details::_Store_relaxed(_M_max, 0);
+    }
+
+    unsigned long long count() const
+    {
+        return details::_Load_relaxed(_M_count);
+    }
+
+    unsigned long long sum() const
+    {
+        return details::_Load_relaxed(_M_sum);
+    }
+
+    unsigned long long max_value() const
+    {
+        return details::_Load_relaxed(_M_max);
+    }
+
+    double mean() const
+    {
+        unsigned long long _Count = count();
+        return (_Count == 0) ? 0.0 : static_cast<double>(sum()) / _Count;
+    }
+
+    /// <summary>
+    ///     Returns a value that at least the fraction <c>_Fraction</c> of the recorded values are no greater than,
+    ///     to within the width of its bucket. For example 0.99 gives the 99th percentile.
+    /// </summary>
+    unsigned long long percentile(double _Fraction) const
+    {
+        unsigned long long _Count = count();
+        if (_Count == 0)
+        {
+            return 0;
+        }
+
+        unsigned long long _Rank = static_cast<unsigned long long>(_Fraction * _Count + 0.5);
+        _Rank = (_Rank < 1) ? 1 : (_Rank > _Count) ? _Count : _Rank;
+        unsigned long long _Seen = 0;
+        for (size_t _I = 0; _I < details::_Bucket_count; ++_I)
+        {
+            _Seen += details::_Load_relaxed(_M_counts[_I]);
+            if (_Seen >= _Rank)
+            {
+                unsigned long long _High = details::_Bucket_high(_I);
+                unsigned long long _Max = max_value();
+                return (_High < _Max) ? _High : _Max;
+            }
+        }
+        return max_value();
+    }
+
+private:
+    details::_Histogram_counter _M_counts[details::_Bucket_count];
+    details::_Histogram_counter _M_count;
+    details::_Histogram_counter _M_sum;
+    details::_Histogram_counter _M_max;
+
+    log_histogram(const log_histogram&);
+    log_histogram const & operator=(log_histogram const&);
+};
+
+#if !defined(_TELEMETRY_NO_ATOMIC)
+/// <summary>
+///     The statistics of one pipeline stage in a <c>pipeline_telemetry_snapshot</c>. Times are in nanoseconds.
+/// </summary>
+/**/
+struct pipeline_stage_statistics
+{
+    std::string name;
+    size_t lanes;
+    unsigned long long count;
+    double utilization;
+    double mean_service;
+    unsigned long long service_p50;
+    unsigned long long service_p99;
+    unsigned long long service_p999;
+    unsigned long long wait_p50;
+    unsigned long long wait_p99;
+    unsigned long long wait_p999;
+    unsigned long long depth_p50;
+    unsigned long long depth_p99;
+    unsigned long long depth_max;
+};
+
+/// <summary>
+///     The merged statistics of every stage of a pipeline. The bottleneck is the stage with the highest
+///     utilization.
+/// </summary>
+/**/
+struct pipeline_telemetry_snapshot
+{
+    double elapsed;
+    std::vector<pipeline_stage_statistics> stages;
+    size_t bottleneck;
+};
+
+/// <summary>
+///     Records, for each stage of a pipeline, how long the stage takes to process an element (the service time),
+///     how long elements wait in the stage's input before it picks them up, and how many elements are waiting
+///     when it does, in <c>log_histogram</c>s. A snapshot gives the 50th, 99th and 99.9th percentiles of each and
+///     the utilization of each stage, the fraction of the time since <c>start</c> its threads spent on service.
+/// </summary>
+/// <remarks>
+///     Each thread of a stage records into its own <c>recorder</c>, which it gets once with <c>new_recorder</c>
+///     and keeps; a recorder may pass from thread to thread as long as only one records at a time. Getting a
+///     recorder and recording are lock free, and <c>snapshot</c> merges the recorders of each stage while they
+///     are in use. Recorders live as long as the telemetry.
+/// </remarks>
+/**/
+class pipeline_telemetry
+{
+public:
+    class recorder
+    {
+    public:
+        void record(unsigned long long _Service, unsigned long long _Wait, size_t _Depth)
+        {
+            _M_service.record(_Service);
+            _M_wait.record(_Wait);
+            _M_depth.record(_Depth);
+        }
+
+        // For stages that have no input, such as the source.
+        void record_service(unsigned long long _Service)
+        {
+            _M_service.record(_Service);
+        }
+
+    private:
+        friend class pipeline_telemetry;
+
+        recorder() : _M_next(nullptr)
+        {
+        }
+
+        log_histogram _M_service;
+        log_histogram _M_wait;
+        log_histogram _M_depth;
+        recorder *_M_next;
+    };
+
+    explicit pipeline_telemetry(size_t _Stage_count)
+    {
+        for (size_t _I = 0; _I < _Stage_count; ++_I)
+        {
+            _M_stages.push_back(std::unique_ptr<_Stage_data>(new _Stage_data()));
+        }
+        start();
+    }
+
+    ~pipeline_telemetry()
+    {
+        for (size_t _I = 0; _I < _M_stages.size(); ++_I)
+        {
+            recorder *_Recorder = _M_stages[_I]->_M_recorders.load();
+            while (_Recorder != nullptr)
+            {
+                recorder *_Next = _Recorder->_M_next;
+                delete _Recorder;
+                _Recorder = _Next;
+            }
+        }
+    }
+
+    size_t stage_count() const
+    {
+        return _M_stages.size();
+    }
+
+    /// <summary>
+    ///     Names a stage in snapshots. Call before the pipeline runs.
+    /// </summary>
+    void set_stage_name(size_t _Stage, const std::string& _Name)
+    {
+        _M_stages.at(_Stage)->_M_name = _Name;
+    }
+
+    /// <summary>
+    ///     Returns a new recorder for one thread of stage <c>_Stage</c>.
+    /// </summary>
+    recorder& new_recorder(size_t _Stage)
+    {
+        _Stage_data& _Target = *_M_stages.at(_Stage);
+        recorder *_Recorder = new recorder();
+        recorder *_Head = _Target._M_recorders.load(std::memory_order_relaxed);
+        do
+        {
+            _Recorder->_M_next = _Head;
+        }
+        while (!_Target._M_recorders.compare_exchange_weak(_Head, _Recorder, std::memory_order_release, std::memory_order_relaxed));
+        return *_Recorder;
+    }
+
+    /// <summary>
+    ///     Restarts the clock that utilization is measured against.
+    /// </summary>
+    void start()
+    {
+        _M_start.store(timestamp(), std::memory_order_relaxed);
+    }
+
+    pipeline_telemetry_snapshot snapshot() const
+    {
+        pipeline_telemetry_snapshot _Snapshot;
+        unsigned long long _Elapsed = timestamp() - _M_start.load(std::memory_order_relaxed);
+        _Snapshot.elapsed = 1e-9 * _Elapsed;
+        _Snapshot.bottleneck = 0;
+
+        // The merged histograms are large, so they live on the heap.
+        std::unique_ptr<log_histogram> _Service(new log_histogram());
+        std::unique_ptr<log_histogram> _Wait(new log_histogram());
+        std::unique_ptr<log_histogram> _Depth(new log_histogram());
+        for (size_t _I = 0; _I < _M_stages.size(); ++_I)
+        {
+            _Service->reset();
+            _Wait->reset();
+            _Depth->reset();
+            pipeline_stage_statistics _Statistics;
+            _Statistics.name = _M_stages[_I]->_M_name;
+            _Statistics.lanes = 0;
+            for (const recorder *_Recorder = _M_stages[_I]->_M_recorders.load(std::memory_order_acquire); _Recorder != nullptr; _Recorder = _Recorder->_M_next)
+            {
+                _Service->merge(_Recorder->_M_service);
+                _Wait->merge(_Recorder->_M_wait);
+                _Depth->merge(_Recorder->_M_depth);
+                ++_Statistics.lanes;
+            }
+
+            _Statistics.count = _Service->count();
+            _Statistics.utilization = (_Elapsed == 0 || _Statistics.lanes == 0) ? 0.0 : static_cast<double>(_Service->sum()) / (static_cast<double>(_Elapsed) * _Statistics.lanes);
+            _Statistics.mean_service = _Service->mean();
+            _Statistics.service_p50 = _Service->percentile(0.5);
+            _Statistics.service_p99 = _Service->percentile(0.99);
+            _Statistics.service_p999 = _Service->percentile(0.999);
+            _Statistics.wait_p50 = _Wait->percentile(0.5);
+            _Statistics.wait_p99 = _Wait->percentile(0.99);
+            _Statistics.wait_p999 = _Wait->percentile(0.999);
+            _Statistics.depth_p50 = _Depth->percentile(0.5);
+            _Statistics.depth_p99 = _Depth->percentile(0.99);
+            _Statistics.depth_max = _Depth->max_value();
+
+            _Snapshot.stages.push_back(_Statistics);
+            if (_Statistics.utilization > _Snapshot.stages[_Snapshot.bottleneck].utilization)
+            {
+                _Snapshot.bottleneck = _I;
+            }
+        }
+        return _Snapshot;
+    }
+
+    /// <summary>
+    ///     The clock that telemetry is recorded with, in nanoseconds.
+    /// </summary>
+    static unsigned long long timestamp()
+    {
+        return static_cast<unsigned long long>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+private:
+    struct _Stage_data
+    {
+        _Stage_data() : _M_recorders(nullptr)
+        {
+        }
+
+        std::string _M_name;
+        std::atomic<recorder *> _M_recorders;
+    };
+
+    std::vector<std::unique_ptr<_Stage_data>> _M_stages;
+    std::atomic<unsigned long long> _M_start;
+
+    pipeline_telemetry(const pipeline_telemetry&);
+    pipeline_telemetry const & operator=(pipeline_telemetry const&);
+};
+#endif
+} // namespace samples
+} // namespace Concurrency